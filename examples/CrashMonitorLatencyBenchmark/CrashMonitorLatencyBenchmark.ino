@@ -0,0 +1,152 @@
+#include <Arduino.h>
+#include "ArduinoCrashMonitor.h"
+
+using namespace Watchdog;
+
+// Measures the time from a hang starting to the sketch running again with the
+// report stored, for each watchdog timeout. The sketch hangs on purpose and
+// resets itself once per timeout, then prints the results. Timer1 is used as
+// a stopwatch (1024 prescaler, 64us per tick at 16MHz) and the measurements
+// are kept in .noinit RAM so they survive the resets. Rebuild with different
+// build flags (ie. CRASH_MONITOR_TRACE_ENTRIES or CRASH_MONITOR_STACK_BYTES)
+// or storage to compare configurations. The crash handler chain
+// (CRASH_MONITOR_MAX_HANDLERS) also uses Timer1, so leave it disabled here.
+
+#define BENCH_MAGIC 0xBE4C
+
+// The hangs are stored (and cleared at the end) at the end of the EEPROM
+// rather than the default base address (500), so the board's real crash log
+// survives. Anything else stored there (ie. a heatmap) will be overwritten.
+#define BENCH_ENTRIES 8
+#define BENCH_STORE_SIZE (sizeof(CCrashMonitorHeader) + (BENCH_ENTRIES * sizeof(CCrashReport)) + \
+  (CRASH_MONITOR_TRACE_ENTRIES * sizeof(CTraceEntry)))
+#define BENCH_ADDRESS ((int)(E2END + 1 - BENCH_STORE_SIZE))
+
+static const CrashMonitor::ETimeout timeouts[] = {
+  CrashMonitor::Timeout_15ms,
+  CrashMonitor::Timeout_30ms,
+  CrashMonitor::Timeout_60ms,
+  CrashMonitor::Timeout_120ms,
+  CrashMonitor::Timeout_250ms,
+  CrashMonitor::Timeout_500ms,
+  CrashMonitor::Timeout_1s,
+  CrashMonitor::Timeout_2s
+};
+
+static const uint16_t timeoutMillis[] = { 15, 30, 60, 120, 250, 500, 1000, 2000 };
+
+#define TIMEOUT_COUNT (sizeof(timeouts) / sizeof(timeouts[0]))
+
+struct Result {
+  uint16_t detect;     // Ticks from the hang to the watchdog interrupt.
+  uint16_t captured;   // Ticks from the hang to the report being stored.
+  uint16_t lastAlive;  // Last tick seen before the second stage reset.
+  unsigned long bootToBegin;  // Microseconds from init() to begin().
+};
+
+struct BenchState {
+  uint16_t magic;
+  uint8_t step;
+  bool running;
+  Result results[TIMEOUT_COUNT];
+};
+
+static BenchState state __attribute__((section(".noinit")));
+
+unsigned long ticksToMicros(uint16_t ticks) {
+  return ((unsigned long)ticks * 1024UL) / (F_CPU / 1000000UL);
+}
+
+void onFailSafe() {
+  state.results[state.step].detect = TCNT1;
+}
+
+void onCrash() {
+  state.results[state.step].captured = TCNT1;
+
+  // Keep stamping the time until the second stage watchdog resets the MCU.
+  volatile uint16_t *lastAlive = &state.results[state.step].lastAlive;
+  while (true) {
+    *lastAlive = TCNT1;
+  }
+}
+
+void printMillis(unsigned long us) {
+  Serial.print(us / 1000);
+  Serial.print('.');
+  Serial.print((us % 1000) / 100);
+  Serial.print('\t');
+}
+
+void printResults() {
+  Serial.println(F("timeout\tdetect (ms)\tcapture (ms)\tsecond stage (ms)\tboot-to-begin (us)\ttotal (ms)"));
+  for (uint8_t i = 0; i < TIMEOUT_COUNT; ++i) {
+    const Result &result = state.results[i];
+    Serial.print(timeoutMillis[i]);
+    Serial.print(F("ms\t"));
+    printMillis(ticksToMicros(result.detect));
+    if (result.captured == 0) {
+      // The hardware reset beat the report to storage.
+      Serial.print(F("lost\t-\t"));
+    }
+    else {
+      printMillis(ticksToMicros(result.captured - result.detect));
+      printMillis(ticksToMicros(result.lastAlive - result.captured));
+    }
+    Serial.print(result.bootToBegin);
+    Serial.print('\t');
+    unsigned long total = ticksToMicros(result.captured ? result.lastAlive : result.detect) + result.bootToBegin;
+    printMillis(total);
+    Serial.println();
+  }
+}
+
+void setup() {
+  unsigned long bootToBegin = micros();
+  CrashMonitor::begin(BENCH_ADDRESS, BENCH_ENTRIES);
+
+  Serial.begin(9600);
+  while (!Serial) {
+    delay(10);
+  }
+
+  if ((state.magic != BENCH_MAGIC) || (!state.running)) {
+    // Fresh start.
+    memset(&state, 0, sizeof(state));
+    state.magic = BENCH_MAGIC;
+    state.running = true;
+    Serial.println(F("Starting hang-to-recovery benchmark ..."));
+  }
+  else {
+    // We just recovered from the hang for the current step.
+    state.results[state.step].bootToBegin = bootToBegin;
+    ++state.step;
+    if (state.step >= TIMEOUT_COUNT) {
+      state.running = false;
+      printResults();
+      CrashMonitor::clear();
+      return;
+    }
+  }
+
+  Serial.print(F("Hanging with a "));
+  Serial.print(timeoutMillis[state.step]);
+  Serial.println(F("ms timeout ..."));
+  Serial.flush();
+
+  CrashMonitor::setFailSafeHandler(onFailSafe);
+  CrashMonitor::setUserCrashHandler(onCrash);
+  CrashMonitor::enableWatchdog(timeouts[state.step]);
+
+  // Timer1 as a free running stopwatch.
+  TCCR1A = 0;
+  TCCR1B = _BV(CS12) | _BV(CS10);
+  CrashMonitor::iAmAlive();
+  TCNT1 = 0;
+  while (true) {
+    ;
+  }
+}
+
+void loop() {
+}
@@ -0,0 +1,133 @@
+#include <Arduino.h>
+#include "ArduinoCrashMonitor.h"
+#include "SdRawStorage.h"
+
+using namespace Watchdog;
+
+// The number of report slots to benchmark with.
+#define MAX_ENTRIES 10
+
+// The bytes the crash monitor uses: the header, the reports and the saved
+// trace (if enabled).
+#define STORE_SIZE (sizeof(CCrashMonitorHeader) + (MAX_ENTRIES * sizeof(CCrashReport)) + \
+  (CRASH_MONITOR_TRACE_ENTRIES * sizeof(CTraceEntry)))
+
+// WARNING: The benchmark clears the report store of each backend it runs. The
+// EEPROM backend uses the area at the end of the EEPROM instead of the default
+// base address (500) so the board's real crash log survives, but anything else
+// stored there (ie. a heatmap) will be overwritten.
+#define EEPROM_BENCH_ADDRESS (E2END + 1 - STORE_SIZE)
+
+// Define the chip select pin to also benchmark the SD card backend. The blocks
+// starting at SD_FIRST_BLOCK will be overwritten.
+// #define SD_CS_PIN 4
+#define SD_FIRST_BLOCK 100000UL
+
+// A RAM backed store. This has no write latency, so it shows the cost of the
+// crash monitor logic itself.
+static uint8_t ramStore[STORE_SIZE];
+
+void ramRead(int address, void *pData, uint8_t uSize) {
+  memcpy(pData, &ramStore[address], uSize);
+}
+
+void ramWrite(int address, const void *pData, uint8_t uSize) {
+  memcpy(&ramStore[address], pData, uSize);
+}
+
+// Counts what dump() prints without sending it anywhere.
+class NullPrint : public Print {
+public:
+  unsigned long count = 0;
+  size_t write(uint8_t) {
+    ++count;
+    return 1;
+  }
+};
+
+struct Backend {
+  const __FlashStringHelper *name;
+  READFUNC onRead;
+  WRITEFUNC onWrite;
+  int baseAddress;
+};
+
+void runBenchmark(const Backend &backend) {
+  CrashMonitor::setStorage(backend.onRead, backend.onWrite);
+  CrashMonitor::begin(backend.baseAddress, MAX_ENTRIES);
+  CrashMonitor::clear();
+
+  // Persisting a report is what happens in the watchdog interrupt.
+  unsigned long persistWorst = 0;
+  unsigned long persistTotal = 0;
+  for (uint8_t i = 0; i < MAX_ENTRIES; ++i) {
+    unsigned long start = micros();
+    CrashMonitor::record(ReportType_User, 0x1000 + i, i);
+    unsigned long elapsed = micros() - start;
+    persistTotal += elapsed;
+    if (elapsed > persistWorst) {
+      persistWorst = elapsed;
+    }
+  }
+
+  NullPrint sink;
+  unsigned long start = micros();
+  CrashMonitor::dump(sink);
+  unsigned long dumpTime = micros() - start;
+
+  start = micros();
+  CrashMonitor::clear();
+  unsigned long clearTime = micros() - start;
+
+  Serial.print(backend.name);
+  Serial.print('\t');
+  Serial.print(persistTotal / MAX_ENTRIES);
+  Serial.print('\t');
+  Serial.print(persistWorst);
+  Serial.print('\t');
+  Serial.print((sink.count * 1000000UL) / (dumpTime ? dumpTime : 1));
+  Serial.print('\t');
+  Serial.println(clearTime);
+}
+
+void setup() {
+  Serial.begin(9600);
+  while (!Serial) {
+    delay(10);
+  }
+
+  Backend backends[] = {
+    { F("RAM"), ramRead, ramWrite, 0 },
+    { F("EEPROM"), NULL, NULL, (int)EEPROM_BENCH_ADDRESS },
+  #ifdef SD_CS_PIN
+    { F("SD"), SdRawStorage::read, SdRawStorage::write, 0 },
+  #endif
+    // A FRAM or NOR flash driver goes here, as READFUNC and WRITEFUNC. The
+    // host CrashStorageBench tool simulates both, with their wear.
+  };
+
+#ifdef SD_CS_PIN
+  if (!SdRawStorage::begin(SD_CS_PIN, SD_FIRST_BLOCK, 64)) {
+    Serial.println(F("SD card init failed."));
+  }
+#endif
+
+  Serial.print(F("Record size: "));
+  Serial.print(sizeof(CCrashReport));
+  Serial.print(F(" bytes, entries: "));
+  Serial.println(MAX_ENTRIES);
+
+  Serial.println();
+
+  Serial.println(F("backend\tpersist avg (us)\tpersist max (us)\tdump (B/s)\tclear (us)"));
+  for (uint8_t i = 0; i < sizeof(backends) / sizeof(backends[0]); ++i) {
+    runBenchmark(backends[i]);
+  }
+
+  // Leave the EEPROM backend selected at the default address for normal use.
+  CrashMonitor::setStorage(NULL, NULL);
+  CrashMonitor::begin();
+}
+
+void loop() {
+}
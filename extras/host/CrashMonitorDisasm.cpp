@@ -0,0 +1,425 @@
+/**
+ * CrashMonitorDisasm.cpp
+ * Version 1.4
+ * Author
+ *  Cyrus Brunner
+ *
+ * An AVR disassembler and hang classifier.
+ */
+
+#include "CrashMonitorDisasm.h"
+#include "CrashMonitorHost.h"
+#include <stdio.h>
+#include <string.h>
+
+// Operand formats.
+enum EOperands
+{
+  Operands_None,
+  Operands_RdRr,
+  Operands_RdImmediate,
+  Operands_Rd,
+  Operands_Branch,
+  Operands_Relative,
+  Operands_Absolute,
+  Operands_Lds,
+  Operands_Sts,
+  Operands_In,
+  Operands_Out,
+  Operands_IoBit,
+  Operands_RegisterBit,
+  Operands_Word,
+  Operands_Movw,
+  Operands_Muls,
+  Operands_Fmul,
+  Operands_Load,
+  Operands_Store,
+  Operands_LoadDisplaced,
+  Operands_StoreDisplaced,
+  Operands_Sreg
+};
+
+struct COpcode
+{
+  uint16_t uMask;
+  uint16_t uValue;
+  const char *pName;
+  uint8_t uOperands;
+  uint8_t uFlow;
+  // The pointer register for loads and stores (ie. "X+").
+  const char *pPointer;
+};
+
+// Most specific masks first.
+static const COpcode aOpcodes[] = {
+  { 0xffff, 0x0000, "nop", Operands_None, CM_FLOW_NONE, NULL },
+  { 0xffff, 0x9508, "ret", Operands_None, CM_FLOW_RETURN, NULL },
+  { 0xffff, 0x9518, "reti", Operands_None, CM_FLOW_RETURN, NULL },
+  { 0xffff, 0x9588, "sleep", Operands_None, CM_FLOW_NONE, NULL },
+  { 0xffff, 0x9598, "break", Operands_None, CM_FLOW_NONE, NULL },
+  { 0xffff, 0x95a8, "wdr", Operands_None, CM_FLOW_NONE, NULL },
+  { 0xffff, 0x95c8, "lpm", Operands_None, CM_FLOW_NONE, NULL },
+  { 0xffff, 0x95d8, "elpm", Operands_None, CM_FLOW_NONE, NULL },
+  { 0xffff, 0x95e8, "spm", Operands_None, CM_FLOW_NONE, NULL },
+  { 0xffff, 0x9409, "ijmp", Operands_None, CM_FLOW_INDIRECT_JUMP, NULL },
+  { 0xffff, 0x9419, "eijmp", Operands_None, CM_FLOW_INDIRECT_JUMP, NULL },
+  { 0xffff, 0x9509, "icall", Operands_None, CM_FLOW_INDIRECT_CALL, NULL },
+  { 0xffff, 0x9519, "eicall", Operands_None, CM_FLOW_INDIRECT_CALL, NULL },
+  { 0xff8f, 0x9408, "bset", Operands_Sreg, CM_FLOW_NONE, NULL },
+  { 0xff8f, 0x9488, "bclr", Operands_Sreg, CM_FLOW_NONE, NULL },
+  { 0xfe0f, 0x9400, "com", Operands_Rd, CM_FLOW_NONE, NULL },
+  { 0xfe0f, 0x9401, "neg", Operands_Rd, CM_FLOW_NONE, NULL },
+  { 0xfe0f, 0x9402, "swap", Operands_Rd, CM_FLOW_NONE, NULL },
+  { 0xfe0f, 0x9403, "inc", Operands_Rd, CM_FLOW_NONE, NULL },
+  { 0xfe0f, 0x9405, "asr", Operands_Rd, CM_FLOW_NONE, NULL },
+  { 0xfe0f, 0x9406, "lsr", Operands_Rd, CM_FLOW_NONE, NULL },
+  { 0xfe0f, 0x9407, "ror", Operands_Rd, CM_FLOW_NONE, NULL },
+  { 0xfe0f, 0x940a, "dec", Operands_Rd, CM_FLOW_NONE, NULL },
+  { 0xfe0f, 0x920f, "push", Operands_Rd, CM_FLOW_NONE, NULL },
+  { 0xfe0f, 0x900f, "pop", Operands_Rd, CM_FLOW_NONE, NULL },
+  { 0xfe0f, 0x9000, "lds", Operands_Lds, CM_FLOW_NONE, NULL },
+  { 0xfe0f, 0x9200, "sts", Operands_Sts, CM_FLOW_NONE, NULL },
+  { 0xfe0f, 0x900c, "ld", Operands_Load, CM_FLOW_NONE, "X" },
+  { 0xfe0f, 0x900d, "ld", Operands_Load, CM_FLOW_NONE, "X+" },
+  { 0xfe0f, 0x900e, "ld", Operands_Load, CM_FLOW_NONE, "-X" },
+  { 0xfe0f, 0x9009, "ld", Operands_Load, CM_FLOW_NONE, "Y+" },
+  { 0xfe0f, 0x900a, "ld", Operands_Load, CM_FLOW_NONE, "-Y" },
+  { 0xfe0f, 0x9001, "ld", Operands_Load, CM_FLOW_NONE, "Z+" },
+  { 0xfe0f, 0x9002, "ld", Operands_Load, CM_FLOW_NONE, "-Z" },
+  { 0xfe0f, 0x9004, "lpm", Operands_Load, CM_FLOW_NONE, "Z" },
+  { 0xfe0f, 0x9005, "lpm", Operands_Load, CM_FLOW_NONE, "Z+" },
+  { 0xfe0f, 0x9006, "elpm", Operands_Load, CM_FLOW_NONE, "Z" },
+  { 0xfe0f, 0x9007, "elpm", Operands_Load, CM_FLOW_NONE, "Z+" },
+  { 0xfe0f, 0x920c, "st", Operands_Store, CM_FLOW_NONE, "X" },
+  { 0xfe0f, 0x920d, "st", Operands_Store, CM_FLOW_NONE, "X+" },
+  { 0xfe0f, 0x920e, "st", Operands_Store, CM_FLOW_NONE, "-X" },
+  { 0xfe0f, 0x9209, "st", Operands_Store, CM_FLOW_NONE, "Y+" },
+  { 0xfe0f, 0x920a, "st", Operands_Store, CM_FLOW_NONE, "-Y" },
+  { 0xfe0f, 0x9201, "st", Operands_Store, CM_FLOW_NONE, "Z+" },
+  { 0xfe0f, 0x9202, "st", Operands_Store, CM_FLOW_NONE, "-Z" },
+  { 0xfe0e, 0x940c, "jmp", Operands_Absolute, CM_FLOW_JUMP, NULL },
+  { 0xfe0e, 0x940e, "call", Operands_Absolute, CM_FLOW_CALL, NULL },
+  { 0xff88, 0x0300, "mulsu", Operands_Fmul, CM_FLOW_NONE, NULL },
+  { 0xff88, 0x0308, "fmul", Operands_Fmul, CM_FLOW_NONE, NULL },
+  { 0xff88, 0x0380, "fmuls", Operands_Fmul, CM_FLOW_NONE, NULL },
+  { 0xff88, 0x0388, "fmulsu", Operands_Fmul, CM_FLOW_NONE, NULL },
+  { 0xff00, 0x0100, "movw", Operands_Movw, CM_FLOW_NONE, NULL },
+  { 0xff00, 0x0200, "muls", Operands_Muls, CM_FLOW_NONE, NULL },
+  { 0xff00, 0x9600, "adiw", Operands_Word, CM_FLOW_NONE, NULL },
+  { 0xff00, 0x9700, "sbiw", Operands_Word, CM_FLOW_NONE, NULL },
+  { 0xff00, 0x9800, "cbi", Operands_IoBit, CM_FLOW_NONE, NULL },
+  { 0xff00, 0x9900, "sbic", Operands_IoBit, CM_FLOW_SKIP, NULL },
+  { 0xff00, 0x9a00, "sbi", Operands_IoBit, CM_FLOW_NONE, NULL },
+  { 0xff00, 0x9b00, "sbis", Operands_IoBit, CM_FLOW_SKIP, NULL },
+  { 0xfe08, 0xf800, "bld", Operands_RegisterBit, CM_FLOW_NONE, NULL },
+  { 0xfe08, 0xfa00, "bst", Operands_RegisterBit, CM_FLOW_NONE, NULL },
+  { 0xfe08, 0xfc00, "sbrc", Operands_RegisterBit, CM_FLOW_SKIP, NULL },
+  { 0xfe08, 0xfe00, "sbrs", Operands_RegisterBit, CM_FLOW_SKIP, NULL },
+  { 0xfc00, 0x0400, "cpc", Operands_RdRr, CM_FLOW_NONE, NULL },
+  { 0xfc00, 0x0800, "sbc", Operands_RdRr, CM_FLOW_NONE, NULL },
+  { 0xfc00, 0x0c00, "add", Operands_RdRr, CM_FLOW_NONE, NULL },
+  { 0xfc00, 0x1000, "cpse", Operands_RdRr, CM_FLOW_SKIP, NULL },
+  { 0xfc00, 0x1400, "cp", Operands_RdRr, CM_FLOW_NONE, NULL },
+  { 0xfc00, 0x1800, "sub", Operands_RdRr, CM_FLOW_NONE, NULL },
+  { 0xfc00, 0x1c00, "adc", Operands_RdRr, CM_FLOW_NONE, NULL },
+  { 0xfc00, 0x2000, "and", Operands_RdRr, CM_FLOW_NONE, NULL },
+  { 0xfc00, 0x2400, "eor", Operands_RdRr, CM_FLOW_NONE, NULL },
+  { 0xfc00, 0x2800, "or", Operands_RdRr, CM_FLOW_NONE, NULL },
+  { 0xfc00, 0x2c00, "mov", Operands_RdRr, CM_FLOW_NONE, NULL },
+  { 0xfc00, 0x9c00, "mul", Operands_RdRr, CM_FLOW_NONE, NULL },
+  { 0xfc00, 0xf000, "brbs", Operands_Branch, CM_FLOW_BRANCH, NULL },
+  { 0xfc00, 0xf400, "brbc", Operands_Branch, CM_FLOW_BRANCH, NULL },
+  { 0xf800, 0xb000, "in", Operands_In, CM_FLOW_NONE, NULL },
+  { 0xf800, 0xb800, "out", Operands_Out, CM_FLOW_NONE, NULL },
+  { 0xd208, 0x8000, "ldd", Operands_LoadDisplaced, CM_FLOW_NONE, "Z" },
+  { 0xd208, 0x8008, "ldd", Operands_LoadDisplaced, CM_FLOW_NONE, "Y" },
+  { 0xd208, 0x8200, "std", Operands_StoreDisplaced, CM_FLOW_NONE, "Z" },
+  { 0xd208, 0x8208, "std", Operands_StoreDisplaced, CM_FLOW_NONE, "Y" },
+  { 0xf000, 0x3000, "cpi", Operands_RdImmediate, CM_FLOW_NONE, NULL },
+  { 0xf000, 0x4000, "sbci", Operands_RdImmediate, CM_FLOW_NONE, NULL },
+  { 0xf000, 0x5000, "subi", Operands_RdImmediate, CM_FLOW_NONE, NULL },
+  { 0xf000, 0x6000, "ori", Operands_RdImmediate, CM_FLOW_NONE, NULL },
+  { 0xf000, 0x7000, "andi", Operands_RdImmediate, CM_FLOW_NONE, NULL },
+  { 0xf000, 0xe000, "ldi", Operands_RdImmediate, CM_FLOW_NONE, NULL },
+  { 0xf000, 0xc000, "rjmp", Operands_Relative, CM_FLOW_JUMP, NULL },
+  { 0xf000, 0xd000, "rcall", Operands_Relative, CM_FLOW_CALL, NULL }
+};
+
+// The names avr-objdump uses for brbs/brbc and bset/bclr, by SREG bit.
+static const char *apBranchSet[] = { "brcs", "breq", "brmi", "brvs", "brlt", "brhs", "brts", "brie" };
+static const char *apBranchClear[] = { "brcc", "brne", "brpl", "brvc", "brge", "brhc", "brtc", "brid" };
+static const char *apFlagSet[] = { "sec", "sez", "sen", "sev", "ses", "seh", "set", "sei" };
+static const char *apFlagClear[] = { "clc", "clz", "cln", "clv", "cls", "clh", "clt", "cli" };
+
+static const CMTarget aTargets[] = {
+  { "atmega328p", 0x4d, 0xbc, 0x100, 0x8ff },
+  { "atmega32u4", 0x4d, 0xbc, 0x100, 0xaff },
+  { "atmega644p", 0x4d, 0xbc, 0x100, 0x10ff },
+  { "atmega1284p", 0x4d, 0xbc, 0x100, 0x40ff },
+  { "atmega1280", 0x4d, 0xbc, 0x200, 0x21ff },
+  { "atmega2560", 0x4d, 0xbc, 0x200, 0x21ff }
+};
+
+static inline uint8_t getRd(uint16_t uOpcode) {
+  return (uint8_t)((uOpcode >> 4) & 0x1f);
+}
+
+static inline uint8_t getRr(uint16_t uOpcode) {
+  return (uint8_t)((uOpcode & 0x0f) | ((uOpcode >> 5) & 0x10));
+}
+
+static void formatRelative(char *pText, size_t size, const char *pName, int32_t nOffset, uint32_t ulTarget) {
+  snprintf(pText, size, "%s .%s%ld ; 0x%lx", pName, (nOffset < 0) ? "-" : "+",
+           (long)((nOffset < 0) ? -nOffset : nOffset), (unsigned long)ulTarget);
+}
+
+int cmDisassemble(const CMElf *pElf, uint32_t ulByteAddress, struct CMInstruction *pInstruction) {
+  uint16_t uOpcode;
+  if (cmElfReadWord(pElf, ulByteAddress, &uOpcode) != CM_OK) {
+    return CM_ERR_ARGUMENT;
+  }
+
+  memset(pInstruction, 0, sizeof(*pInstruction));
+  pInstruction->ulAddress = ulByteAddress;
+  pInstruction->uWords = 1;
+  pInstruction->auOpcode[0] = uOpcode;
+
+  const COpcode *pOpcode = NULL;
+  for (size_t index = 0; index < sizeof(aOpcodes) / sizeof(aOpcodes[0]); ++index) {
+    if ((uOpcode & aOpcodes[index].uMask) == aOpcodes[index].uValue) {
+      pOpcode = &aOpcodes[index];
+      break;
+    }
+  }
+
+  char *pText = pInstruction->acText;
+  size_t size = sizeof(pInstruction->acText);
+  if (pOpcode == NULL) {
+    snprintf(pText, size, ".word 0x%04x", uOpcode);
+    return CM_OK;
+  }
+
+  pInstruction->uFlow = pOpcode->uFlow;
+  if ((pOpcode->uOperands == Operands_Absolute) || (pOpcode->uOperands == Operands_Lds) ||
+      (pOpcode->uOperands == Operands_Sts)) {
+    // Two word instructions. A missing second word still decodes the first.
+    pInstruction->uWords = 2;
+    cmElfReadWord(pElf, ulByteAddress + 2, &pInstruction->auOpcode[1]);
+  }
+  uint16_t uSecond = pInstruction->auOpcode[1];
+  const char *pName = pOpcode->pName;
+  switch (pOpcode->uOperands) {
+    case Operands_None:
+      snprintf(pText, size, "%s", pName);
+      break;
+    case Operands_RdRr:
+      snprintf(pText, size, "%s r%u, r%u", pName, getRd(uOpcode), getRr(uOpcode));
+      break;
+    case Operands_RdImmediate:
+      snprintf(pText, size, "%s r%u, 0x%02X", pName, 16 + ((uOpcode >> 4) & 0x0f),
+               ((uOpcode >> 4) & 0xf0) | (uOpcode & 0x0f));
+      break;
+    case Operands_Rd:
+      snprintf(pText, size, "%s r%u", pName, getRd(uOpcode));
+      break;
+    case Operands_Branch: {
+      int32_t nOffset = (int32_t)((uOpcode >> 3) & 0x7f);
+      if (nOffset & 0x40) {
+        nOffset -= 0x80;
+      }
+      pInstruction->ulTarget = ulByteAddress + 2 + (nOffset * 2);
+      const char **ppNames = (pOpcode->uValue == 0xf000) ? apBranchSet : apBranchClear;
+      formatRelative(pText, size, ppNames[uOpcode & 7], nOffset * 2, pInstruction->ulTarget);
+      break;
+    }
+    case Operands_Relative: {
+      int32_t nOffset = (int32_t)(uOpcode & 0x0fff);
+      if (nOffset & 0x800) {
+        nOffset -= 0x1000;
+      }
+      pInstruction->ulTarget = ulByteAddress + 2 + (nOffset * 2);
+      formatRelative(pText, size, pName, nOffset * 2, pInstruction->ulTarget);
+      break;
+    }
+    case Operands_Absolute:
+      pInstruction->ulTarget = (((uint32_t)((uOpcode >> 3) & 0x3e) | (uOpcode & 1)) << 17) | ((uint32_t)uSecond << 1);
+      snprintf(pText, size, "%s 0x%lx", pName, (unsigned long)pInstruction->ulTarget);
+      break;
+    case Operands_Lds:
+      snprintf(pText, size, "%s r%u, 0x%04X", pName, getRd(uOpcode), uSecond);
+      break;
+    case Operands_Sts:
+      snprintf(pText, size, "%s 0x%04X, r%u", pName, uSecond, getRd(uOpcode));
+      break;
+    case Operands_In:
+      snprintf(pText, size, "%s r%u, 0x%02x", pName, getRd(uOpcode), ((uOpcode >> 5) & 0x30) | (uOpcode & 0x0f));
+      break;
+    case Operands_Out:
+      snprintf(pText, size, "%s 0x%02x, r%u", pName, ((uOpcode >> 5) & 0x30) | (uOpcode & 0x0f), getRd(uOpcode));
+      break;
+    case Operands_IoBit:
+      snprintf(pText, size, "%s 0x%02x, %u", pName, (uOpcode >> 3) & 0x1f, uOpcode & 7);
+      break;
+    case Operands_RegisterBit:
+      snprintf(pText, size, "%s r%u, %u", pName, getRd(uOpcode), uOpcode & 7);
+      break;
+    case Operands_Word:
+      snprintf(pText, size, "%s r%u, 0x%02X", pName, 24 + (((uOpcode >> 4) & 3) * 2),
+               ((uOpcode >> 2) & 0x30) | (uOpcode & 0x0f));
+      break;
+    case Operands_Movw:
+      snprintf(pText, size, "%s r%u, r%u", pName, ((uOpcode >> 4) & 0x0f) * 2, (uOpcode & 0x0f) * 2);
+      break;
+    case Operands_Muls:
+      snprintf(pText, size, "%s r%u, r%u", pName, 16 + ((uOpcode >> 4) & 0x0f), 16 + (uOpcode & 0x0f));
+      break;
+    case Operands_Fmul:
+      snprintf(pText, size, "%s r%u, r%u", pName, 16 + ((uOpcode >> 4) & 7), 16 + (uOpcode & 7));
+      break;
+    case Operands_Load:
+      snprintf(pText, size, "%s r%u, %s", pName, getRd(uOpcode), pOpcode->pPointer);
+      break;
+    case Operands_Store:
+      snprintf(pText, size, "%s %s, r%u", pName, pOpcode->pPointer, getRd(uOpcode));
+      break;
+    case Operands_LoadDisplaced:
+    case Operands_StoreDisplaced: {
+      uint8_t uDisplacement = (uint8_t)(((uOpcode >> 8) & 0x20) | ((uOpcode >> 7) & 0x18) | (uOpcode & 7));
+      bool bLoad = (pOpcode->uOperands == Operands_LoadDisplaced);
+      if (uDisplacement == 0) {
+        // ld Rd,Y and ld Rd,Z are ldd with no displacement.
+        if (bLoad) {
+          snprintf(pText, size, "ld r%u, %s", getRd(uOpcode), pOpcode->pPointer);
+        }
+        else {
+          snprintf(pText, size, "st %s, r%u", pOpcode->pPointer, getRd(uOpcode));
+        }
+      }
+      else if (bLoad) {
+        snprintf(pText, size, "%s r%u, %s+%u", pName, getRd(uOpcode), pOpcode->pPointer, uDisplacement);
+      }
+      else {
+        snprintf(pText, size, "%s %s+%u, r%u", pName, pOpcode->pPointer, uDisplacement, getRd(uOpcode));
+      }
+      break;
+    }
+    case Operands_Sreg: {
+      const char **ppNames = (pOpcode->uValue == 0x9408) ? apFlagSet : apFlagClear;
+      snprintf(pText, size, "%s", ppNames[(uOpcode >> 4) & 7]);
+      break;
+    }
+  }
+  return CM_OK;
+}
+
+const char *cmClassifyHang(const CMElf *pElf, const struct CMTarget *pTarget, uint32_t ulByteAddress) {
+  // The same checks as CrashMonitor::classifyHang(), so the host and the
+  // device agree.
+  uint16_t uOpcode;
+  if (cmElfReadWord(pElf, ulByteAddress, &uOpcode) != CM_OK) {
+    return NULL;
+  }
+  if (uOpcode == 0xcfff) {
+    // rjmp .-2
+    return "spin";
+  }
+
+  // Look for a short backwards rjmp or conditional branch at or just after the
+  // crash address that jumps back to (or before) it.
+  uint32_t ulLoopStart = 0;
+  uint32_t ulLoopEnd = 0;
+  for (uint8_t uWord = 0; uWord < 4; ++uWord) {
+    uint32_t ulAddress = ulByteAddress + (uWord * 2);
+    if (cmElfReadWord(pElf, ulAddress, &uOpcode) != CM_OK) {
+      break;
+    }
+
+    int32_t nOffset = 0;
+    if (((uOpcode & 0xf000) == 0xc000) && (uOpcode & 0x0800)) {
+      // rjmp .-k
+      nOffset = (int32_t)(uOpcode & 0x0fff) - 0x1000;
+    }
+    else if ((((uOpcode & 0xf800) == 0xf000) || ((uOpcode & 0xf800) == 0xf400)) && (uOpcode & 0x0200)) {
+      // brbs/brbc s,.-k
+      nOffset = (int32_t)((uOpcode >> 3) & 0x7f) - 0x80;
+    }
+
+    if (nOffset < 0) {
+      uint32_t ulTarget = ulAddress + 2 + (nOffset * 2);
+      if ((ulTarget <= ulByteAddress) && (ulAddress - ulTarget <= 16)) {
+        ulLoopStart = ulTarget;
+        ulLoopEnd = ulAddress;
+        break;
+      }
+    }
+  }
+
+  if (ulLoopEnd == 0) {
+    return NULL;
+  }
+
+  for (uint32_t ulAddress = ulLoopStart; ulAddress < ulLoopEnd; ulAddress += 2) {
+    if (cmElfReadWord(pElf, ulAddress, &uOpcode) != CM_OK) {
+      return NULL;
+    }
+    if ((uOpcode & 0xfd00) == 0x9900) {
+      // sbic/sbis A,b
+      return "io-poll";
+    }
+
+    if ((uOpcode & 0xf800) == 0xb000) {
+      // in Rd,A (I/O addresses are data addresses - 0x20)
+      uint8_t uIoAddress = (uint8_t)(((uOpcode >> 5) & 0x30) | (uOpcode & 0x0f));
+      if (uIoAddress + 0x20 == pTarget->uSpsr) {
+        return "spi-poll";
+      }
+      return "io-poll";
+    }
+
+    if ((uOpcode & 0xfe0f) == 0x9000) {
+      // lds Rd,k (two words)
+      ulAddress += 2;
+      uint16_t uDataAddress;
+      if (cmElfReadWord(pElf, ulAddress, &uDataAddress) != CM_OK) {
+        return NULL;
+      }
+      if (uDataAddress == pTarget->uTwcr) {
+        return "twi-poll";
+      }
+      if (uDataAddress == pTarget->uSpsr) {
+        return "spi-poll";
+      }
+      if (uDataAddress >= pTarget->uRamStart) {
+        return "volatile-wait";
+      }
+      return "io-poll";
+    }
+  }
+
+  return "loop";
+}
+
+const struct CMTarget *cmFindTarget(const char *pName, uint32_t ulArch) {
+  if (pName == NULL) {
+    // avr5 (ie. the 328), avr51 (the 1280 and 1284) and avr6 (the 2560).
+    if (ulArch == 5) {
+      pName = "atmega328p";
+    }
+    else if (ulArch == 51) {
+      pName = "atmega1280";
+    }
+    else if (ulArch == 6) {
+      pName = "atmega2560";
+    }
+    else {
+      return NULL;
+    }
+  }
+
+  for (size_t index = 0; index < sizeof(aTargets) / sizeof(aTargets[0]); ++index) {
+    if (strcmp(aTargets[index].pName, pName) == 0) {
+      return &aTargets[index];
+    }
+  }
+  return NULL;
+}
@@ -0,0 +1,122 @@
+/**
+ * CrashMonitorDisasm.h
+ * Version 1.4
+ * Author
+ *  Cyrus Brunner
+ *
+ * An AVR disassembler for showing the code around a crash address, and the
+ * same hang classification dump() does on the device, run against the ELF of
+ * the build the report came from.
+ */
+
+#ifndef CrashMonitorDisasm_h
+#define CrashMonitorDisasm_h
+
+#include <stdint.h>
+#include "CrashMonitorElf.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief How an instruction changes the flow of control.
+ */
+enum ECMFlow
+{
+  CM_FLOW_NONE = 0,
+  CM_FLOW_CALL = 1,
+  CM_FLOW_JUMP = 2,
+  CM_FLOW_BRANCH = 3,
+  CM_FLOW_SKIP = 4,
+  CM_FLOW_RETURN = 5,
+  CM_FLOW_INDIRECT_CALL = 6,
+  CM_FLOW_INDIRECT_JUMP = 7
+};
+
+/**
+ * @brief A decoded instruction.
+ */
+struct CMInstruction
+{
+  /**
+   * @brief The byte address.
+   */
+  uint32_t ulAddress;
+
+  /**
+   * @brief The size in words (1 or 2).
+   */
+  uint8_t uWords;
+
+  /**
+   * @brief The opcode words.
+   */
+  uint16_t auOpcode[2];
+
+  /**
+   * @brief The flow of control (see ECMFlow).
+   */
+  uint8_t uFlow;
+
+  /**
+   * @brief The byte address a call, jump or branch goes to.
+   */
+  uint32_t ulTarget;
+
+  /**
+   * @brief The instruction in avr-objdump syntax (ie. "rjmp .-2").
+   */
+  char acText[40];
+};
+
+/**
+ * @brief The I/O registers hang classification looks for, and where RAM
+ * starts and ends (RAMEND). All are data space addresses.
+ */
+struct CMTarget
+{
+  const char *pName;
+  uint16_t uSpsr;
+  uint16_t uTwcr;
+  uint16_t uRamStart;
+  uint16_t uRamEnd;
+};
+
+/**
+ * @brief Decodes the instruction at an address.
+ * @param  pElf          The firmware.
+ * @param  ulByteAddress The byte address.
+ * @param  pInstruction  Receives the instruction. Unknown opcodes are shown as
+ *                       ".word 0x....".
+ * @return               CM_OK or CM_ERR_ARGUMENT if the address is not in
+ *                       the firmware.
+ */
+int cmDisassemble(const CMElf *pElf, uint32_t ulByteAddress, struct CMInstruction *pInstruction);
+
+/**
+ * @brief Classifies the code at a crash address the same way dump() does
+ * (spin, io-poll, spi-poll, twi-poll, volatile-wait or loop).
+ * @param  pElf          The firmware.
+ * @param  pTarget       The MCU.
+ * @param  ulByteAddress The crash byte address.
+ * @return               The classification, or NULL if it is not a short
+ *                       loop.
+ */
+const char *cmClassifyHang(const CMElf *pElf, const struct CMTarget *pTarget, uint32_t ulByteAddress);
+
+/**
+ * @brief Looks up an MCU by name (ie. "atmega328p"), or by the architecture
+ * in the ELF flags if pName is NULL.
+ * @param  pName  The MCU name, or NULL.
+ * @param  ulArch The architecture (cmElfFlags() & 0x7f) used when pName is
+ *                NULL.
+ * @return        The MCU, or NULL if it is not known.
+ */
+const struct CMTarget *cmFindTarget(const char *pName, uint32_t ulArch);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
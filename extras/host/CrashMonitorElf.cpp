@@ -0,0 +1,285 @@
+/**
+ * CrashMonitorElf.cpp
+ * Version 1.4
+ * Author
+ *  Cyrus Brunner
+ *
+ * A minimal reader for the 32-bit little-endian ELF files avr-gcc produces.
+ */
+
+#include "CrashMonitorElf.h"
+#include "CrashMonitorHost.h"
+#include <string.h>
+#include <algorithm>
+#include <new>
+#include <vector>
+
+// ELF32 offsets and constants (<elf.h> is not available everywhere).
+#define EHDR_SIZE 52
+#define SHDR_SIZE 40
+#define SYM_SIZE 16
+#define SHT_SYMTAB 2
+#define SHT_NOBITS 8
+#define SHF_ALLOC 0x2
+#define DATA_ADDRESS 0x800000
+
+struct CMElf
+{
+  struct CMMappedFile file;
+  const uint8_t *puData;
+  size_t size;
+  uint32_t ulFlags;
+  std::vector<CMElfSection> sections;
+  std::vector<CMElfSymbol> symbols;
+};
+
+static inline uint16_t readLe16(const uint8_t *puData) {
+  return (uint16_t)(puData[0] | (puData[1] << 8));
+}
+
+static inline uint32_t readLe32(const uint8_t *puData) {
+  return (uint32_t)puData[0] | ((uint32_t)puData[1] << 8) |
+    ((uint32_t)puData[2] << 16) | ((uint32_t)puData[3] << 24);
+}
+
+// Gets a NUL terminated string from a string table, or NULL if it runs off
+// the end.
+static const char *getString(const CMElfSection &table, uint32_t ulOffset) {
+  if (ulOffset >= table.ulSize) {
+    return NULL;
+  }
+  const char *pString = (const char *)table.puData + ulOffset;
+  if (memchr(pString, 0, table.ulSize - ulOffset) == NULL) {
+    return NULL;
+  }
+  return pString;
+}
+
+static bool isBefore(const CMElfSymbol &a, const CMElfSymbol &b) {
+  if (a.ulAddress != b.ulAddress) {
+    return a.ulAddress < b.ulAddress;
+  }
+  // Functions last, so a search for the last symbol at an address finds the
+  // function rather than a label.
+  return a.uType < b.uType;
+}
+
+static int parseImage(CMElf *pElf) {
+  const uint8_t *puData = pElf->puData;
+  size_t size = pElf->size;
+  if (size < EHDR_SIZE) {
+    return CM_ERR_TRUNCATED;
+  }
+  if ((memcmp(puData, "\x7f" "ELF", 4) != 0) || (puData[4] != 1) || (puData[5] != 1)) {
+    // Not ELFCLASS32 / ELFDATA2LSB.
+    return CM_ERR_FORMAT;
+  }
+
+  pElf->ulFlags = readLe32(puData + 36);
+  uint32_t ulShOff = readLe32(puData + 32);
+  uint16_t uShEntSize = readLe16(puData + 46);
+  uint16_t uShNum = readLe16(puData + 48);
+  uint16_t uShStrNdx = readLe16(puData + 50);
+  if ((uShNum == 0) || (uShEntSize < SHDR_SIZE) || (uShStrNdx >= uShNum)) {
+    return CM_ERR_FORMAT;
+  }
+  if ((ulShOff > size) || ((size - ulShOff) / uShEntSize < uShNum)) {
+    return CM_ERR_TRUNCATED;
+  }
+
+  std::vector<uint32_t> types(uShNum);
+  std::vector<uint32_t> names(uShNum);
+  std::vector<uint32_t> links(uShNum);
+  pElf->sections.resize(uShNum);
+  for (uint16_t uSection = 0; uSection < uShNum; ++uSection) {
+    const uint8_t *puHeader = puData + ulShOff + ((size_t)uSection * uShEntSize);
+    CMElfSection &section = pElf->sections[uSection];
+    names[uSection] = readLe32(puHeader);
+    types[uSection] = readLe32(puHeader + 4);
+    section.ulFlags = readLe32(puHeader + 8);
+    section.ulAddress = readLe32(puHeader + 12);
+    uint32_t ulOffset = readLe32(puHeader + 16);
+    section.ulSize = readLe32(puHeader + 20);
+    links[uSection] = readLe32(puHeader + 24);
+    section.pName = "";
+    section.puData = NULL;
+    if (types[uSection] != SHT_NOBITS) {
+      // Everything but .bss and .noinit has data in the file.
+      if ((ulOffset > size) || (section.ulSize > size - ulOffset)) {
+        return CM_ERR_TRUNCATED;
+      }
+      section.puData = puData + ulOffset;
+    }
+    else {
+      section.ulSize = 0;
+    }
+  }
+
+  for (uint16_t uSection = 0; uSection < uShNum; ++uSection) {
+    const char *pName = getString(pElf->sections[uShStrNdx], names[uSection]);
+    if (pName != NULL) {
+      pElf->sections[uSection].pName = pName;
+    }
+  }
+
+  for (uint16_t uSection = 0; uSection < uShNum; ++uSection) {
+    if ((types[uSection] != SHT_SYMTAB) || (links[uSection] >= uShNum)) {
+      continue;
+    }
+
+    const CMElfSection &symbols = pElf->sections[uSection];
+    const CMElfSection &strings = pElf->sections[links[uSection]];
+    for (uint32_t ulOffset = SYM_SIZE; ulOffset + SYM_SIZE <= symbols.ulSize; ulOffset += SYM_SIZE) {
+      const uint8_t *puSymbol = symbols.puData + ulOffset;
+      uint8_t uType = puSymbol[12] & 0x0f;
+      uint16_t uShndx = readLe16(puSymbol + 14);
+      const char *pName = getString(strings, readLe32(puSymbol));
+      if ((uType > CM_SYMBOL_FUNC) || (uShndx == 0) || (uShndx >= uShNum) || (pName == NULL) ||
+          (pName[0] == '\0')) {
+        continue;
+      }
+
+      CMElfSymbol symbol;
+      symbol.pName = pName;
+      symbol.ulAddress = readLe32(puSymbol + 4);
+      symbol.ulSize = readLe32(puSymbol + 8);
+      symbol.uType = uType;
+      pElf->symbols.push_back(symbol);
+    }
+  }
+  std::stable_sort(pElf->symbols.begin(), pElf->symbols.end(), isBefore);
+  return CM_OK;
+}
+
+int cmElfParse(const uint8_t *puData, size_t size, CMElf **ppElf) {
+  *ppElf = NULL;
+  CMElf *pElf = new (std::nothrow) CMElf;
+  if (pElf == NULL) {
+    return CM_ERR_MEMORY;
+  }
+
+  pElf->file.puData = NULL;
+  pElf->file.size = 0;
+  pElf->puData = puData;
+  pElf->size = size;
+  pElf->ulFlags = 0;
+  int result;
+  try {
+    result = parseImage(pElf);
+  }
+  catch (const std::bad_alloc &) {
+    result = CM_ERR_MEMORY;
+  }
+  if (result != CM_OK) {
+    delete pElf;
+    return result;
+  }
+  *ppElf = pElf;
+  return CM_OK;
+}
+
+int cmElfOpen(const char *pPath, CMElf **ppElf) {
+  struct CMMappedFile file;
+  int result = cmMapFile(pPath, &file);
+  if (result != CM_OK) {
+    *ppElf = NULL;
+    return result;
+  }
+
+  result = cmElfParse(file.puData, file.size, ppElf);
+  if (result != CM_OK) {
+    cmUnmapFile(&file);
+    return result;
+  }
+  (*ppElf)->file = file;
+  return CM_OK;
+}
+
+void cmElfFree(CMElf *pElf) {
+  if (pElf != NULL) {
+    cmUnmapFile(&pElf->file);
+    delete pElf;
+  }
+}
+
+uint32_t cmElfFlags(const CMElf *pElf) {
+  return pElf->ulFlags;
+}
+
+int cmElfFindSection(const CMElf *pElf, const char *pName, struct CMElfSection *pSection) {
+  for (size_t index = 0; index < pElf->sections.size(); ++index) {
+    if (strcmp(pElf->sections[index].pName, pName) == 0) {
+      *pSection = pElf->sections[index];
+      return CM_OK;
+    }
+  }
+  return CM_ERR_ARGUMENT;
+}
+
+int cmElfReadWord(const CMElf *pElf, uint32_t ulByteAddress, uint16_t *puWord) {
+  for (size_t index = 0; index < pElf->sections.size(); ++index) {
+    const CMElfSection &section = pElf->sections[index];
+    if ((section.puData == NULL) || !(section.ulFlags & SHF_ALLOC) || (section.ulAddress >= DATA_ADDRESS)) {
+      continue;
+    }
+    if ((ulByteAddress >= section.ulAddress) && (ulByteAddress - section.ulAddress + 2 <= section.ulSize)) {
+      *puWord = readLe16(section.puData + (ulByteAddress - section.ulAddress));
+      return CM_OK;
+    }
+  }
+  return CM_ERR_ARGUMENT;
+}
+
+size_t cmElfSymbolCount(const CMElf *pElf) {
+  return pElf->symbols.size();
+}
+
+int cmElfGetSymbol(const CMElf *pElf, size_t index, struct CMElfSymbol *pSymbol) {
+  if (index >= pElf->symbols.size()) {
+    return CM_ERR_ARGUMENT;
+  }
+  *pSymbol = pElf->symbols[index];
+  return CM_OK;
+}
+
+int cmElfFindCode(const CMElf *pElf, uint32_t ulByteAddress, struct CMElfSymbol *pSymbol) {
+  // A function whose size covers the address wins, otherwise the last code
+  // symbol at or below it.
+  const CMElfSymbol *pCovering = NULL;
+  const CMElfSymbol *pLast = NULL;
+  for (size_t index = 0; index < pElf->symbols.size(); ++index) {
+    const CMElfSymbol &symbol = pElf->symbols[index];
+    if (symbol.ulAddress > ulByteAddress) {
+      break;
+    }
+    if ((symbol.uType == CM_SYMBOL_OBJECT) || (symbol.ulAddress >= DATA_ADDRESS)) {
+      continue;
+    }
+
+    pLast = &symbol;
+    if ((symbol.uType == CM_SYMBOL_FUNC) && (ulByteAddress - symbol.ulAddress < symbol.ulSize)) {
+      pCovering = &symbol;
+    }
+  }
+
+  if (pCovering != NULL) {
+    *pSymbol = *pCovering;
+  }
+  else if (pLast != NULL) {
+    *pSymbol = *pLast;
+  }
+  else {
+    return CM_ERR_ARGUMENT;
+  }
+  return CM_OK;
+}
+
+int cmElfFindSymbol(const CMElf *pElf, const char *pName, struct CMElfSymbol *pSymbol) {
+  for (size_t index = 0; index < pElf->symbols.size(); ++index) {
+    if (strcmp(pElf->symbols[index].pName, pName) == 0) {
+      *pSymbol = pElf->symbols[index];
+      return CM_OK;
+    }
+  }
+  return CM_ERR_ARGUMENT;
+}
@@ -0,0 +1,170 @@
+/**
+ * CrashMonitorElf.h
+ * Version 1.4
+ * Author
+ *  Cyrus Brunner
+ *
+ * A minimal reader for the 32-bit little-endian ELF files avr-gcc produces,
+ * for looking up the code, symbols and debug sections of the firmware a
+ * report came from. The file is parsed in place; nothing is copied.
+ */
+
+#ifndef CrashMonitorElf_h
+#define CrashMonitorElf_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief A firmware image (opaque).
+ */
+typedef struct CMElf CMElf;
+
+/**
+ * @brief The symbol types that are kept (the same values as STT_*).
+ */
+enum ECMSymbolType
+{
+  CM_SYMBOL_NOTYPE = 0,
+  CM_SYMBOL_OBJECT = 1,
+  CM_SYMBOL_FUNC = 2
+};
+
+/**
+ * @brief A symbol.
+ */
+struct CMElfSymbol
+{
+  /**
+   * @brief The name (points into the image).
+   */
+  const char *pName;
+
+  /**
+   * @brief The address. For code this is a byte address in flash, for data
+   * avr-gcc adds 0x800000.
+   */
+  uint32_t ulAddress;
+
+  /**
+   * @brief The size in bytes (0 if unknown).
+   */
+  uint32_t ulSize;
+
+  /**
+   * @brief The type (see ECMSymbolType).
+   */
+  uint8_t uType;
+};
+
+/**
+ * @brief A section.
+ */
+struct CMElfSection
+{
+  const char *pName;
+  const uint8_t *puData;
+  uint32_t ulAddress;
+  uint32_t ulSize;
+  uint32_t ulFlags;
+};
+
+/**
+ * @brief Parses an image that is already in memory. The memory must stay
+ * valid until the image is freed.
+ * @param  puData The image.
+ * @param  size   The size of the image.
+ * @param  ppElf  Receives the image.
+ * @return        CM_OK, CM_ERR_FORMAT (not a 32-bit little-endian ELF),
+ *                CM_ERR_TRUNCATED or CM_ERR_MEMORY.
+ */
+int cmElfParse(const uint8_t *puData, size_t size, CMElf **ppElf);
+
+/**
+ * @brief Maps and parses a file.
+ * @param  pPath The path.
+ * @param  ppElf Receives the image.
+ * @return       CM_OK, CM_ERR_IO or a cmElfParse() error.
+ */
+int cmElfOpen(const char *pPath, CMElf **ppElf);
+
+/**
+ * @brief Frees an image (and unmaps it if it was opened from a file).
+ * @param pElf The image (may be NULL).
+ */
+void cmElfFree(CMElf *pElf);
+
+/**
+ * @brief Gets the processor specific flags. For AVR, the low 7 bits are the
+ * architecture (ie. 5 for the 328, 6 for the Mega 2560).
+ * @param  pElf The image.
+ * @return      e_flags.
+ */
+uint32_t cmElfFlags(const CMElf *pElf);
+
+/**
+ * @brief Finds a section by name.
+ * @param  pElf     The image.
+ * @param  pName    The name (ie. ".debug_frame").
+ * @param  pSection Receives the section.
+ * @return          CM_OK or CM_ERR_ARGUMENT if there is no such section.
+ */
+int cmElfFindSection(const CMElf *pElf, const char *pName, struct CMElfSection *pSection);
+
+/**
+ * @brief Reads a program word from flash (any allocated section below the
+ * data address space, ie. .text).
+ * @param  pElf          The image.
+ * @param  ulByteAddress The byte address (must be even).
+ * @param  puWord        Receives the word.
+ * @return               CM_OK or CM_ERR_ARGUMENT if the address is not in
+ *                       the image.
+ */
+int cmElfReadWord(const CMElf *pElf, uint32_t ulByteAddress, uint16_t *puWord);
+
+/**
+ * @brief Gets the number of symbols kept (functions, objects and untyped
+ * labels), sorted by address.
+ * @param  pElf The image.
+ * @return      The number of symbols.
+ */
+size_t cmElfSymbolCount(const CMElf *pElf);
+
+/**
+ * @brief Gets a symbol.
+ * @param  pElf    The image.
+ * @param  index   The index (in address order).
+ * @param  pSymbol Receives the symbol.
+ * @return         CM_OK or CM_ERR_ARGUMENT.
+ */
+int cmElfGetSymbol(const CMElf *pElf, size_t index, struct CMElfSymbol *pSymbol);
+
+/**
+ * @brief Finds the code symbol (function or label) an address is in: the one
+ * with the highest address at or below it, preferring functions whose size
+ * covers it.
+ * @param  pElf          The image.
+ * @param  ulByteAddress The byte address in flash.
+ * @param  pSymbol       Receives the symbol.
+ * @return               CM_OK or CM_ERR_ARGUMENT if there is none.
+ */
+int cmElfFindCode(const CMElf *pElf, uint32_t ulByteAddress, struct CMElfSymbol *pSymbol);
+
+/**
+ * @brief Finds a symbol by name.
+ * @param  pElf    The image.
+ * @param  pName   The name.
+ * @param  pSymbol Receives the symbol.
+ * @return         CM_OK or CM_ERR_ARGUMENT if there is none.
+ */
+int cmElfFindSymbol(const CMElf *pElf, const char *pName, struct CMElfSymbol *pSymbol);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,282 @@
+/**
+ * CrashMonitorFleet.cpp
+ * Version 1.4
+ * Author
+ *  Cyrus Brunner
+ *
+ * A simulated fleet of devices, for load testing host tooling.
+ */
+
+#include "CrashMonitorFleet.h"
+#include <stdio.h>
+#include <string.h>
+
+#define MS_PER_HOUR 3600000UL
+
+// The longest dump() line cmFormatReport() writes without a stack snapshot.
+#define MAX_LINE_SIZE 160
+
+// "Device: N", "Crash Monitor", the underline and the header counts.
+#define MAX_TEXT_HEADER_SIZE 96
+
+// About 1 in 100 reports is flash or memory corruption instead of a hang.
+#define CORRUPTION_PERCENT 1
+
+namespace
+{
+  struct CHangSite
+  {
+    uint32_t ulWordAddress;
+    uint8_t uType;
+    uint8_t uWeight;
+  };
+
+  struct CBuildModel
+  {
+    CMFleetBuild build;
+    const CHangSite *pSites;
+    uint8_t uSiteCount;
+
+    // The mean hours between crashes, and whether the build paints the stack
+    // (so its reports have stack-low).
+    uint8_t uMeanHours;
+    bool bPaint;
+  };
+
+  const CHangSite aBuild101Sites[] = {
+    { 0x03ae, CM_TYPE_WATCHDOG, 50 }, { 0x0512, CM_TYPE_WATCHDOG, 25 }, { 0x07c0, CM_TYPE_WATCHDOG, 15 },
+    { 0x0a44, CM_TYPE_STALL, 10 }
+  };
+
+  const CHangSite aBuild102Sites[] = {
+    { 0x03b2, CM_TYPE_WATCHDOG, 30 }, { 0x0530, CM_TYPE_WATCHDOG, 30 }, { 0x07d8, CM_TYPE_WATCHDOG, 5 },
+    { 0x0b10, CM_TYPE_STALL, 35 }
+  };
+
+  // The newest build hangs twice as often, a fifth of the time at a new site.
+  const CHangSite aBuild103Sites[] = {
+    { 0x03b2, CM_TYPE_WATCHDOG, 30 }, { 0x0530, CM_TYPE_WATCHDOG, 30 }, { 0x0b10, CM_TYPE_STALL, 20 },
+    { 0x0c20, CM_TYPE_USER, 20 }
+  };
+
+  const CBuildModel aBuilds[] = {
+    { { 101, 45 }, aBuild101Sites, sizeof(aBuild101Sites) / sizeof(aBuild101Sites[0]), 48, false },
+    { { 102, 40 }, aBuild102Sites, sizeof(aBuild102Sites) / sizeof(aBuild102Sites[0]), 48, false },
+    { { 103, 15 }, aBuild103Sites, sizeof(aBuild103Sites) / sizeof(aBuild103Sites[0]), 24, true }
+  };
+
+  const size_t BUILD_COUNT = sizeof(aBuilds) / sizeof(aBuilds[0]);
+
+  // SplitMix64: small, fast, and good enough to seed each device on its own.
+  struct CRandom
+  {
+    uint64_t ullState;
+
+    uint64_t next() {
+      uint64_t z = (ullState += 0x9e3779b97f4a7c15ULL);
+      z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+      z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+      return z ^ (z >> 31);
+    }
+
+    // 0 to limit - 1 (the modulo bias is irrelevant here).
+    uint32_t below(uint32_t ulLimit) {
+      return (uint32_t)(next() % ulLimit);
+    }
+  };
+
+  bool validConfig(const CMFleetConfig *pConfig) {
+    return (pConfig != NULL) && (pConfig->uMaxEntries != 0) && ((pConfig->uPcSize == 2) || (pConfig->uPcSize == 3)) &&
+      (pConfig->uFormat <= CM_FLEET_BINARY);
+  }
+
+  uint8_t recordSize(const CMFleetConfig *pConfig) {
+    return (uint8_t)(pConfig->uPcSize + CM_RECORD_FIXED_SIZE);
+  }
+
+  size_t storeSize(const CMFleetConfig *pConfig) {
+    return CM_HEADER_SIZE + ((size_t)pConfig->uMaxEntries * recordSize(pConfig));
+  }
+
+  const CBuildModel &pickBuild(CRandom &random) {
+    uint32_t ulPick = random.below(100);
+    for (size_t index = 0; index < BUILD_COUNT - 1; ++index) {
+      if (ulPick < aBuilds[index].build.uShare) {
+        return aBuilds[index];
+      }
+      ulPick -= aBuilds[index].build.uShare;
+    }
+    return aBuilds[BUILD_COUNT - 1];
+  }
+
+  const CHangSite &pickSite(const CBuildModel &model, CRandom &random) {
+    uint32_t ulTotal = 0;
+    for (uint8_t uSite = 0; uSite < model.uSiteCount; ++uSite) {
+      ulTotal += model.pSites[uSite].uWeight;
+    }
+    uint32_t ulPick = random.below(ulTotal);
+    for (uint8_t uSite = 0; uSite < model.uSiteCount - 1; ++uSite) {
+      if (ulPick < model.pSites[uSite].uWeight) {
+        return model.pSites[uSite];
+      }
+      ulPick -= model.pSites[uSite].uWeight;
+    }
+    return model.pSites[model.uSiteCount - 1];
+  }
+
+  void makeReport(const CMFleetConfig *pConfig, const CBuildModel &model, CRandom &random, CMReport &report) {
+    uint16_t uRamEnd = (pConfig->uPcSize == 3) ? 0x21ff : 0x8ff;
+    memset(&report, 0, sizeof(report));
+    report.uBuild = model.build.uBuild;
+    // Each report is from its own boot, so uptimes are independent.
+    report.ulUptime = 1000 + random.below(model.uMeanHours * 2 * MS_PER_HOUR);
+
+    uint32_t ulKind = random.below(100);
+    if (ulKind < CORRUPTION_PERCENT) {
+      // The length checked in words, then the CRC found and the one expected.
+      report.uType = CM_TYPE_FLASH_CORRUPT;
+      report.ulAddress = 0x3800;
+      report.ulData = (random.below(0x10000) << 16) | 0x5a3c;
+      return;
+    }
+    if (ulKind < 2 * CORRUPTION_PERCENT) {
+      report.uType = CM_TYPE_MEMORY_CORRUPT;
+      report.ulAddress = 0x100 + (random.below(16) * 2);
+      report.ulData = random.below(0x100);
+      return;
+    }
+
+    const CHangSite &site = pickSite(model, random);
+    report.uType = site.uType;
+    report.ulAddress = site.ulWordAddress;
+    report.ulData = random.below(0x10000);
+    report.uStackPointer = (uint16_t)(uRamEnd - 16 - random.below(256));
+    if (model.bPaint) {
+      report.uStackLow = (uint16_t)(report.uStackPointer - random.below(128));
+    }
+  }
+
+  // CrashMonitor::loadHeader(): start over if the header is not ours.
+  void loadHeader(const CMFleetConfig *pConfig, const uint8_t *puStore, uint8_t auHeader[CM_HEADER_SIZE]) {
+    memcpy(auHeader, puStore, CM_HEADER_SIZE);
+    if ((auHeader[2] != CM_REPORT_LAYOUT_VERSION) || (auHeader[3] != recordSize(pConfig))) {
+      auHeader[0] = 0;
+      auHeader[1] = 0;
+      auHeader[2] = CM_REPORT_LAYOUT_VERSION;
+      auHeader[3] = recordSize(pConfig);
+    }
+    else if (auHeader[0] > pConfig->uMaxEntries) {
+      auHeader[0] = pConfig->uMaxEntries;
+    }
+    if (auHeader[1] >= pConfig->uMaxEntries) {
+      auHeader[1] = 0;
+    }
+  }
+
+  // CrashMonitor::storeReport().
+  void storeReport(const CMFleetConfig *pConfig, uint8_t *puStore, const CMReport &report) {
+    uint8_t auHeader[CM_HEADER_SIZE];
+    loadHeader(pConfig, puStore, auHeader);
+    cmEncodeRecord(&report, pConfig->uPcSize, puStore + CM_HEADER_SIZE + ((size_t)auHeader[1] * recordSize(pConfig)));
+    if (++auHeader[1] >= pConfig->uMaxEntries) {
+      auHeader[1] = 0;
+    }
+    else {
+      ++auHeader[0];
+    }
+    memcpy(puStore, auHeader, CM_HEADER_SIZE);
+  }
+
+  void fillStore(const CMFleetConfig *pConfig, uint32_t ulDevice, uint8_t *puStore) {
+    CRandom random = { ((uint64_t)pConfig->ulSeed << 32) ^ ulDevice };
+    random.next();
+    const CBuildModel &model = pickBuild(random);
+
+    // Most devices have a few crashes, some have wrapped their store.
+    memset(puStore, 0xff, storeSize(pConfig));
+    uint32_t ulCrashes = random.below(2 * pConfig->uMaxEntries + 1);
+    CMReport report;
+    for (uint32_t ulCrash = 0; ulCrash < ulCrashes; ++ulCrash) {
+      makeReport(pConfig, model, random, report);
+      storeReport(pConfig, puStore, report);
+    }
+  }
+
+  void writeLe32(uint8_t *puData, uint32_t ulValue) {
+    for (uint8_t uByte = 0; uByte < 4; ++uByte) {
+      puData[uByte] = (uint8_t)(ulValue >> (uByte * 8));
+    }
+  }
+}
+
+void cmFleetDefaults(struct CMFleetConfig *pConfig) {
+  pConfig->ulSeed = 1;
+  pConfig->uMaxEntries = 10;
+  pConfig->uPcSize = 2;
+  pConfig->uFormat = CM_FLEET_TEXT;
+}
+
+size_t cmFleetBuilds(const struct CMFleetBuild **ppBuilds) {
+  static CMFleetBuild aFleetBuilds[BUILD_COUNT];
+  for (size_t index = 0; index < BUILD_COUNT; ++index) {
+    aFleetBuilds[index] = aBuilds[index].build;
+  }
+  *ppBuilds = aFleetBuilds;
+  return BUILD_COUNT;
+}
+
+size_t cmFleetMaxDumpSize(const struct CMFleetConfig *pConfig) {
+  if (pConfig->uFormat == CM_FLEET_BINARY) {
+    return 4 + CM_DESCRIPTOR_SIZE + storeSize(pConfig);
+  }
+  return MAX_TEXT_HEADER_SIZE + ((size_t)pConfig->uMaxEntries * MAX_LINE_SIZE);
+}
+
+long cmFleetStore(const struct CMFleetConfig *pConfig, uint32_t ulDevice, uint8_t *puStore, size_t size) {
+  if (!validConfig(pConfig) || (size < storeSize(pConfig))) {
+    return CM_ERR_ARGUMENT;
+  }
+  fillStore(pConfig, ulDevice, puStore);
+  return (long)storeSize(pConfig);
+}
+
+long cmFleetDump(const struct CMFleetConfig *pConfig, uint32_t ulDevice, uint8_t *puBuffer, size_t size) {
+  if (!validConfig(pConfig) || (size < cmFleetMaxDumpSize(pConfig))) {
+    return CM_ERR_ARGUMENT;
+  }
+
+  uint8_t auStore[CM_HEADER_SIZE + (255 * (3 + CM_RECORD_FIXED_SIZE))];
+  fillStore(pConfig, ulDevice, auStore);
+  uint8_t auHeader[CM_HEADER_SIZE];
+  loadHeader(pConfig, auStore, auHeader);
+  uint8_t uRecordSize = recordSize(pConfig);
+  const uint8_t *puRecords = auStore + CM_HEADER_SIZE;
+
+  if (pConfig->uFormat == CM_FLEET_BINARY) {
+    // dumpBinary(): the descriptor, the header as loaded, then the saved
+    // records as stored.
+    writeLe32(puBuffer, ulDevice);
+    const uint8_t auDescriptor[CM_DESCRIPTOR_SIZE] = { 'C', 'M', CM_BINARY_FORMAT_VERSION, uRecordSize };
+    memcpy(puBuffer + 4, auDescriptor, CM_DESCRIPTOR_SIZE);
+    memcpy(puBuffer + 4 + CM_DESCRIPTOR_SIZE, auHeader, CM_HEADER_SIZE);
+    size_t recordBytes = (size_t)auHeader[0] * uRecordSize;
+    memcpy(puBuffer + 4 + CM_DESCRIPTOR_SIZE + CM_HEADER_SIZE, puRecords, recordBytes);
+    return (long)(4 + CM_DESCRIPTOR_SIZE + CM_HEADER_SIZE + recordBytes);
+  }
+
+  // dump(), with println()'s line endings. The insn and hang fields are left
+  // out, as a device does for reports from other builds.
+  char *pText = (char *)puBuffer;
+  int length = snprintf(pText, size,
+                        "Device: %lu\r\nCrash Monitor\r\n-------------\r\nSaved reports: %u\r\nNext report: %u\r\n",
+                        (unsigned long)ulDevice, auHeader[0], auHeader[1]);
+  CMReport report;
+  for (uint8_t uSlot = 0; uSlot < auHeader[0]; ++uSlot) {
+    cmDecodeRecord(puRecords + ((size_t)uSlot * uRecordSize), uRecordSize, pConfig->uPcSize, &report);
+    report.uSlot = uSlot;
+    length += cmFormatReport(&report, pText + length, size - length);
+    pText[length++] = '\r';
+    pText[length++] = '\n';
+  }
+  return length;
+}
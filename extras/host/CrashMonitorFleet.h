@@ -0,0 +1,132 @@
+/**
+ * CrashMonitorFleet.h
+ * Version 1.4
+ * Author
+ *  Cyrus Brunner
+ *
+ * A simulated fleet of devices, for load testing host tooling. Each virtual
+ * device runs one of a few firmware builds, each with its own distribution of
+ * hang sites, and stores its crashes in an emulated EEPROM the same way
+ * CrashMonitor::record() does (so the slots wrap, and the header counts them,
+ * exactly as on a device). Its dumps come out in the dump() or dumpBinary()
+ * format.
+ *
+ * Everything about a device (its build, its crashes, their uptimes) comes
+ * from its own random number generator, seeded from the fleet seed and the
+ * device number. Devices can be generated in any order, from any number of
+ * threads, and the output is the same for the same seed.
+ */
+
+#ifndef CrashMonitorFleet_h
+#define CrashMonitorFleet_h
+
+#include <stddef.h>
+#include <stdint.h>
+#include "CrashMonitorHost.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief The dump formats.
+ */
+enum ECMFleetFormat
+{
+  /**
+   * @brief dump() text, preceded by a "Device: N" line.
+   */
+  CM_FLEET_TEXT = 0,
+
+  /**
+   * @brief dumpBinary() output, preceded by the device number (4 bytes,
+   * little-endian), as read by cmParseBinaryStream().
+   */
+  CM_FLEET_BINARY = 1
+};
+
+/**
+ * @brief What to simulate.
+ */
+struct CMFleetConfig
+{
+  uint32_t ulSeed;
+
+  /**
+   * @brief The number of report slots of each device (maxEntries, 1-255).
+   */
+  uint8_t uMaxEntries;
+
+  /**
+   * @brief The program counter size (2, or 3 on the Mega).
+   */
+  uint8_t uPcSize;
+
+  /**
+   * @brief See ECMFleetFormat.
+   */
+  uint8_t uFormat;
+};
+
+/**
+ * @brief A firmware build run by the fleet.
+ */
+struct CMFleetBuild
+{
+  uint16_t uBuild;
+
+  /**
+   * @brief The share of the fleet running it, in percent.
+   */
+  uint8_t uShare;
+};
+
+/**
+ * @brief Sets a configuration to the defaults (seed 1, 10 slots, a 2 byte
+ * program counter and text).
+ * @param pConfig The configuration.
+ */
+void cmFleetDefaults(struct CMFleetConfig *pConfig);
+
+/**
+ * @brief Gets the builds the fleet runs.
+ * @param  ppBuilds Receives the builds.
+ * @return          The number of builds.
+ */
+size_t cmFleetBuilds(const struct CMFleetBuild **ppBuilds);
+
+/**
+ * @brief Gets the most a device's dump can take, to size buffers with.
+ * @param  pConfig The configuration.
+ * @return         The size in bytes.
+ */
+size_t cmFleetMaxDumpSize(const struct CMFleetConfig *pConfig);
+
+/**
+ * @brief Fills the emulated EEPROM of a device: the report header, then
+ * uMaxEntries slots, with the unwritten ones left 0xff.
+ * @param  pConfig The configuration.
+ * @param  ulDevice The device.
+ * @param  puStore  Receives CM_HEADER_SIZE + uMaxEntries records.
+ * @param  size     The size of the buffer.
+ * @return          The number of bytes written, or CM_ERR_ARGUMENT if the
+ *                  configuration is invalid or the buffer is too small.
+ */
+long cmFleetStore(const struct CMFleetConfig *pConfig, uint32_t ulDevice, uint8_t *puStore, size_t size);
+
+/**
+ * @brief Writes the dump of a device.
+ * @param  pConfig  The configuration.
+ * @param  ulDevice The device.
+ * @param  puBuffer Receives the dump (text is not null terminated).
+ * @param  size     The size of the buffer (cmFleetMaxDumpSize() is enough).
+ * @return          The number of bytes written, or CM_ERR_ARGUMENT if the
+ *                  configuration is invalid or the buffer is too small.
+ */
+long cmFleetDump(const struct CMFleetConfig *pConfig, uint32_t ulDevice, uint8_t *puBuffer, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,710 @@
+/**
+ * CrashMonitorHost.cpp
+ * Version 1.4
+ * Author
+ *  Cyrus Brunner
+ *
+ * Host (PC) library for reading crash reports collected from a fleet.
+ */
+
+#include "CrashMonitorHost.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <new>
+#include <vector>
+
+struct CMTable
+{
+  std::vector<uint32_t> address;
+  std::vector<uint32_t> data;
+  std::vector<uint8_t> type;
+  std::vector<uint16_t> stackPointer;
+  std::vector<uint8_t> region;
+  std::vector<uint16_t> build;
+  std::vector<uint32_t> uptime;
+  std::vector<uint16_t> stackLow;
+  std::vector<uint16_t> irqLatencyUs;
+  std::vector<uint8_t> slot;
+  std::vector<uint32_t> device;
+  std::vector<uint8_t> stack;
+  uint8_t uStackBytes;
+};
+
+static inline uint16_t readLe16(const uint8_t *puData) {
+  return (uint16_t)(puData[0] | (puData[1] << 8));
+}
+
+static inline uint32_t readLe32(const uint8_t *puData) {
+  return (uint32_t)puData[0] | ((uint32_t)puData[1] << 8) |
+    ((uint32_t)puData[2] << 16) | ((uint32_t)puData[3] << 24);
+}
+
+static inline void writeLe16(uint8_t *puData, uint16_t uValue) {
+  puData[0] = (uint8_t)uValue;
+  puData[1] = (uint8_t)(uValue >> 8);
+}
+
+static inline void writeLe32(uint8_t *puData, uint32_t ulValue) {
+  writeLe16(puData, (uint16_t)ulValue);
+  writeLe16(puData + 2, (uint16_t)(ulValue >> 16));
+}
+
+// Drops the rows from count on, so a parse that fails half way through a dump
+// leaves the table as it was.
+static void truncateTable(CMTable *pTable, size_t count) {
+  pTable->address.resize(count);
+  pTable->data.resize(count);
+  pTable->type.resize(count);
+  pTable->stackPointer.resize(count);
+  pTable->region.resize(count);
+  pTable->build.resize(count);
+  pTable->uptime.resize(count);
+  pTable->stackLow.resize(count);
+  pTable->irqLatencyUs.resize(count);
+  pTable->slot.resize(count);
+  pTable->device.resize(count);
+  pTable->stack.resize(count * pTable->uStackBytes);
+}
+
+static void widenStack(CMTable *pTable, uint8_t uStackBytes) {
+  size_t count = pTable->address.size();
+  std::vector<uint8_t> stack(count * uStackBytes, 0);
+  for (size_t row = 0; row < count; ++row) {
+    memcpy(&stack[row * uStackBytes], &pTable->stack[row * pTable->uStackBytes], pTable->uStackBytes);
+  }
+  pTable->stack.swap(stack);
+  pTable->uStackBytes = uStackBytes;
+}
+
+CMTable *cmTableCreate(void) {
+  CMTable *pTable = new (std::nothrow) CMTable;
+  if (pTable != NULL) {
+    pTable->uStackBytes = 0;
+  }
+  return pTable;
+}
+
+void cmTableFree(CMTable *pTable) {
+  delete pTable;
+}
+
+void cmTableClear(CMTable *pTable) {
+  truncateTable(pTable, 0);
+  pTable->uStackBytes = 0;
+}
+
+size_t cmTableCount(const CMTable *pTable) {
+  return pTable->address.size();
+}
+
+void cmTableColumns(const CMTable *pTable, struct CMColumns *pColumns) {
+  pColumns->count = pTable->address.size();
+  pColumns->pulAddress = pTable->address.data();
+  pColumns->pulData = pTable->data.data();
+  pColumns->puType = pTable->type.data();
+  pColumns->puStackPointer = pTable->stackPointer.data();
+  pColumns->puRegion = pTable->region.data();
+  pColumns->puBuild = pTable->build.data();
+  pColumns->pulUptime = pTable->uptime.data();
+  pColumns->puStackLow = pTable->stackLow.data();
+  pColumns->puIrqLatencyUs = pTable->irqLatencyUs.data();
+  pColumns->puSlot = pTable->slot.data();
+  pColumns->pulDevice = pTable->device.data();
+  pColumns->puStack = pTable->stack.data();
+  pColumns->uStackBytes = pTable->uStackBytes;
+}
+
+int cmTableAppend(CMTable *pTable, const struct CMReport *pReport) {
+  if (pReport->uStackBytes > CM_MAX_STACK_BYTES) {
+    return CM_ERR_ARGUMENT;
+  }
+
+  size_t count = pTable->address.size();
+  try {
+    if (pReport->uStackBytes > pTable->uStackBytes) {
+      widenStack(pTable, pReport->uStackBytes);
+    }
+    pTable->address.push_back(pReport->ulAddress);
+    pTable->data.push_back(pReport->ulData);
+    pTable->type.push_back(pReport->uType);
+    pTable->stackPointer.push_back(pReport->uStackPointer);
+    pTable->region.push_back(pReport->uRegion);
+    pTable->build.push_back(pReport->uBuild);
+    pTable->uptime.push_back(pReport->ulUptime);
+    pTable->stackLow.push_back(pReport->uStackLow);
+    pTable->irqLatencyUs.push_back(pReport->uIrqLatencyUs);
+    pTable->slot.push_back(pReport->uSlot);
+    pTable->device.push_back(pReport->ulDevice);
+    pTable->stack.insert(pTable->stack.end(), pReport->auStack, pReport->auStack + pReport->uStackBytes);
+    pTable->stack.resize(pTable->address.size() * pTable->uStackBytes, 0);
+  }
+  catch (const std::bad_alloc &) {
+    truncateTable(pTable, count);
+    return CM_ERR_MEMORY;
+  }
+  return CM_OK;
+}
+
+int cmTableGet(const CMTable *pTable, size_t row, struct CMReport *pReport) {
+  if (row >= pTable->address.size()) {
+    return CM_ERR_ARGUMENT;
+  }
+
+  pReport->ulAddress = pTable->address[row];
+  pReport->ulData = pTable->data[row];
+  pReport->uType = pTable->type[row];
+  pReport->uStackPointer = pTable->stackPointer[row];
+  pReport->uRegion = pTable->region[row];
+  pReport->uBuild = pTable->build[row];
+  pReport->ulUptime = pTable->uptime[row];
+  pReport->uStackLow = pTable->stackLow[row];
+  pReport->uIrqLatencyUs = pTable->irqLatencyUs[row];
+  pReport->uSlot = pTable->slot[row];
+  pReport->ulDevice = pTable->device[row];
+  pReport->uStackBytes = pTable->uStackBytes;
+  memset(pReport->auStack, 0, sizeof(pReport->auStack));
+  if (pTable->uStackBytes > 0) {
+    memcpy(pReport->auStack, &pTable->stack[row * pTable->uStackBytes], pTable->uStackBytes);
+  }
+  return CM_OK;
+}
+
+int cmDecodeRecord(const uint8_t *puRecord, uint8_t uRecordSize, uint8_t uPcSize, struct CMReport *pReport) {
+  if (((uPcSize != 2) && (uPcSize != 3)) || (uRecordSize < uPcSize + CM_RECORD_FIXED_SIZE) ||
+      (uRecordSize - uPcSize - CM_RECORD_FIXED_SIZE > CM_MAX_STACK_BYTES)) {
+    return CM_ERR_LAYOUT;
+  }
+
+  // The address is big-endian, as the CPU pushed it. Everything else is
+  // little-endian.
+  pReport->ulAddress = 0;
+  for (uint8_t uByte = 0; uByte < uPcSize; ++uByte) {
+    pReport->ulAddress = (pReport->ulAddress << 8) | puRecord[uByte];
+  }
+  const uint8_t *puField = puRecord + uPcSize;
+  pReport->ulData = readLe32(puField);
+  pReport->uType = puField[4];
+  pReport->uStackPointer = readLe16(puField + 5);
+  pReport->uRegion = puField[7];
+  pReport->uBuild = readLe16(puField + 8);
+  pReport->ulUptime = readLe32(puField + 10);
+  pReport->uStackLow = readLe16(puField + 14);
+  pReport->uIrqLatencyUs = readLe16(puField + 16);
+  pReport->uStackBytes = (uint8_t)(uRecordSize - uPcSize - CM_RECORD_FIXED_SIZE);
+  memset(pReport->auStack, 0, sizeof(pReport->auStack));
+  memcpy(pReport->auStack, puField + CM_RECORD_FIXED_SIZE, pReport->uStackBytes);
+  return CM_OK;
+}
+
+uint8_t cmEncodeRecord(const struct CMReport *pReport, uint8_t uPcSize, uint8_t *puRecord) {
+  uint32_t ulAddress = pReport->ulAddress;
+  for (int8_t nByte = (int8_t)(uPcSize - 1); nByte >= 0; --nByte) {
+    puRecord[nByte] = (uint8_t)ulAddress;
+    ulAddress >>= 8;
+  }
+  uint8_t *puField = puRecord + uPcSize;
+  writeLe32(puField, pReport->ulData);
+  puField[4] = pReport->uType;
+  writeLe16(puField + 5, pReport->uStackPointer);
+  puField[7] = pReport->uRegion;
+  writeLe16(puField + 8, pReport->uBuild);
+  writeLe32(puField + 10, pReport->ulUptime);
+  writeLe16(puField + 14, pReport->uStackLow);
+  writeLe16(puField + 16, pReport->uIrqLatencyUs);
+  memcpy(puField + CM_RECORD_FIXED_SIZE, pReport->auStack, pReport->uStackBytes);
+  return (uint8_t)(uPcSize + CM_RECORD_FIXED_SIZE + pReport->uStackBytes);
+}
+
+// Appends the records that follow a report header. puHeader is the 4 byte
+// CCrashMonitorHeader and puRecords the first record.
+static long appendRecords(CMTable *pTable, const uint8_t *puHeader, const uint8_t *puRecords, size_t size,
+                          uint8_t uPcSize, uint32_t ulDevice) {
+  uint8_t uSaved = puHeader[0];
+  uint8_t uRecordSize = puHeader[3];
+  if (puHeader[2] != CM_REPORT_LAYOUT_VERSION) {
+    return CM_ERR_LAYOUT;
+  }
+  if ((size_t)uSaved * uRecordSize > size) {
+    return CM_ERR_TRUNCATED;
+  }
+
+  size_t count = cmTableCount(pTable);
+  CMReport report;
+  for (uint8_t uSlot = 0; uSlot < uSaved; ++uSlot) {
+    int result = cmDecodeRecord(puRecords + ((size_t)uSlot * uRecordSize), uRecordSize, uPcSize, &report);
+    if (result == CM_OK) {
+      report.uSlot = uSlot;
+      report.ulDevice = ulDevice;
+      result = cmTableAppend(pTable, &report);
+    }
+    if (result != CM_OK) {
+      truncateTable(pTable, count);
+      return result;
+    }
+  }
+  return uSaved;
+}
+
+long cmParseBinary(CMTable *pTable, const uint8_t *puData, size_t size, uint8_t uPcSize, uint32_t ulDevice, size_t *pUsed) {
+  if (size < CM_DESCRIPTOR_SIZE + CM_HEADER_SIZE) {
+    return CM_ERR_TRUNCATED;
+  }
+  if ((puData[0] != 'C') || (puData[1] != 'M')) {
+    return CM_ERR_FORMAT;
+  }
+  if (puData[2] != CM_BINARY_FORMAT_VERSION) {
+    return CM_ERR_VERSION;
+  }
+
+  const uint8_t *puHeader = puData + CM_DESCRIPTOR_SIZE;
+  if (puHeader[3] != puData[3]) {
+    return CM_ERR_LAYOUT;
+  }
+
+  long result = appendRecords(pTable, puHeader, puHeader + CM_HEADER_SIZE,
+                              size - CM_DESCRIPTOR_SIZE - CM_HEADER_SIZE, uPcSize, ulDevice);
+  if ((result >= 0) && (pUsed != NULL)) {
+    *pUsed = CM_DESCRIPTOR_SIZE + CM_HEADER_SIZE + ((size_t)puHeader[0] * puHeader[3]);
+  }
+  return result;
+}
+
+long cmParseBinaryStream(CMTable *pTable, const uint8_t *puData, size_t size, uint8_t uPcSize) {
+  size_t count = cmTableCount(pTable);
+  size_t offset = 0;
+  while (offset < size) {
+    if (size - offset < 4) {
+      truncateTable(pTable, count);
+      return CM_ERR_TRUNCATED;
+    }
+
+    size_t used = 0;
+    long result = cmParseBinary(pTable, puData + offset + 4, size - offset - 4, uPcSize,
+                                readLe32(puData + offset), &used);
+    if (result < 0) {
+      truncateTable(pTable, count);
+      return result;
+    }
+    offset += 4 + used;
+  }
+  return (long)(cmTableCount(pTable) - count);
+}
+
+long cmParseEeprom(CMTable *pTable, const uint8_t *puData, size_t size, size_t base, uint8_t uPcSize, uint32_t ulDevice) {
+  if ((base > size) || (size - base < CM_HEADER_SIZE)) {
+    return CM_ERR_TRUNCATED;
+  }
+
+  const uint8_t *puHeader = puData + base;
+  return appendRecords(pTable, puHeader, puHeader + CM_HEADER_SIZE, size - base - CM_HEADER_SIZE, uPcSize, ulDevice);
+}
+
+long cmParseFile(CMTable *pTable, const char *pPath, uint8_t uPcSize, long base) {
+  struct CMMappedFile file;
+  int result = cmMapFile(pPath, &file);
+  if (result != CM_OK) {
+    return result;
+  }
+
+  long added;
+  if (base >= 0) {
+    added = cmParseEeprom(pTable, file.puData, file.size, (size_t)base, uPcSize, CM_NO_DEVICE);
+  }
+  else if ((file.size >= 2) && (file.puData[0] == 'C') && (file.puData[1] == 'M')) {
+    added = cmParseBinary(pTable, file.puData, file.size, uPcSize, CM_NO_DEVICE, NULL);
+  }
+  else if ((file.size >= 6) && (file.puData[4] == 'C') && (file.puData[5] == 'M')) {
+    added = cmParseBinaryStream(pTable, file.puData, file.size, uPcSize);
+  }
+  else {
+    added = cmParseText(pTable, (const char *)file.puData, file.size);
+  }
+  cmUnmapFile(&file);
+  return added;
+}
+
+int cmPacketReaderInit(struct CMPacketReader *pReader, uint8_t uRecordSize, uint8_t uPcSize, uint32_t ulDevice) {
+  if (((uPcSize != 2) && (uPcSize != 3)) || (uRecordSize < uPcSize + CM_RECORD_FIXED_SIZE) ||
+      (uRecordSize > sizeof(pReader->auRecord))) {
+    return CM_ERR_ARGUMENT;
+  }
+
+  memset(pReader, 0, sizeof(*pReader));
+  pReader->uPcSize = uPcSize;
+  pReader->uRecordSize = uRecordSize;
+  pReader->ulDevice = ulDevice;
+  return CM_OK;
+}
+
+long cmParsePacket(struct CMPacketReader *pReader, CMTable *pTable, const uint8_t *puData, size_t size) {
+  long added = 0;
+  size_t offset = 0;
+  while (size - offset >= 3) {
+    uint8_t uSlot = puData[offset];
+    uint8_t uOffset = puData[offset + 1];
+    offset += 2;
+    if (uOffset >= pReader->uRecordSize) {
+      return CM_ERR_FORMAT;
+    }
+
+    // Each entry runs to the end of its record or the end of the packet.
+    size_t length = pReader->uRecordSize - uOffset;
+    if (length > size - offset) {
+      length = size - offset;
+    }
+
+    if (uOffset == 0) {
+      pReader->uSlot = uSlot;
+      pReader->uFill = 0;
+    }
+    else if ((uSlot != pReader->uSlot) || (uOffset != pReader->uFill)) {
+      // Not the continuation of the record in progress. Drop it.
+      pReader->uFill = 0;
+      offset += length;
+      continue;
+    }
+
+    memcpy(pReader->auRecord + uOffset, puData + offset, length);
+    pReader->uFill = (uint8_t)(uOffset + length);
+    offset += length;
+    if (pReader->uFill == pReader->uRecordSize) {
+      CMReport report;
+      int result = cmDecodeRecord(pReader->auRecord, pReader->uRecordSize, pReader->uPcSize, &report);
+      if (result == CM_OK) {
+        report.uSlot = uSlot;
+        report.ulDevice = pReader->ulDevice;
+        result = cmTableAppend(pTable, &report);
+      }
+      if (result != CM_OK) {
+        return result;
+      }
+      pReader->uFill = 0;
+      ++added;
+    }
+  }
+  return (offset == size) ? added : (long)CM_ERR_FORMAT;
+}
+
+// A cursor over one line of text. The input is not NUL terminated (it may be
+// a mapped file), so everything is bounded by pEnd.
+struct CTextCursor
+{
+  const char *p;
+  const char *pEnd;
+};
+
+static bool skipText(CTextCursor &cursor, const char *pText) {
+  size_t length = strlen(pText);
+  if ((size_t)(cursor.pEnd - cursor.p) < length || (memcmp(cursor.p, pText, length) != 0)) {
+    return false;
+  }
+  cursor.p += length;
+  return true;
+}
+
+static bool readNumber(CTextCursor &cursor, uint32_t &ulValue) {
+  uint32_t ulBase = 10;
+  if (skipText(cursor, "0x")) {
+    ulBase = 16;
+  }
+
+  const char *pStart = cursor.p;
+  ulValue = 0;
+  while (cursor.p < cursor.pEnd) {
+    char c = *cursor.p;
+    uint32_t ulDigit;
+    if ((c >= '0') && (c <= '9')) {
+      ulDigit = (uint32_t)(c - '0');
+    }
+    else if ((ulBase == 16) && (c >= 'A') && (c <= 'F')) {
+      ulDigit = (uint32_t)(c - 'A' + 10);
+    }
+    else if ((ulBase == 16) && (c >= 'a') && (c <= 'f')) {
+      ulDigit = (uint32_t)(c - 'a' + 10);
+    }
+    else {
+      break;
+    }
+    ulValue = (ulValue * ulBase) + ulDigit;
+    ++cursor.p;
+  }
+  return cursor.p != pStart;
+}
+
+static int hexDigit(char c) {
+  if ((c >= '0') && (c <= '9')) {
+    return c - '0';
+  }
+  if ((c >= 'A') && (c <= 'F')) {
+    return c - 'A' + 10;
+  }
+  if ((c >= 'a') && (c <= 'f')) {
+    return c - 'a' + 10;
+  }
+  return -1;
+}
+
+// Parses the fields after "word-address=0x..". Returns false if the line is
+// not a complete report (ie. it was cut off).
+static bool parseWatchdogFields(CTextCursor &cursor, CMReport &report) {
+  uint32_t ulValue;
+  bool bBuild = false;
+  bool bUptime = false;
+  while (cursor.p < cursor.pEnd) {
+    if (!skipText(cursor, ", ") && !skipText(cursor, ": ")) {
+      return false;
+    }
+
+    if (skipText(cursor, "stall")) {
+      report.uType = CM_TYPE_STALL;
+    }
+    else if (skipText(cursor, "user")) {
+      report.uType = CM_TYPE_USER;
+    }
+    else if (skipText(cursor, "byte-address=") || skipText(cursor, "insn=")) {
+      // Derived from other fields (or the firmware).
+      if (!readNumber(cursor, ulValue)) {
+        return false;
+      }
+    }
+    else if (skipText(cursor, "hang=")) {
+      while ((cursor.p < cursor.pEnd) && (*cursor.p != ',')) {
+        ++cursor.p;
+      }
+    }
+    else if (skipText(cursor, "stack=")) {
+      report.uStackBytes = 0;
+      while ((cursor.pEnd - cursor.p >= 2) && (hexDigit(cursor.p[0]) >= 0) && (hexDigit(cursor.p[1]) >= 0)) {
+        if (report.uStackBytes >= CM_MAX_STACK_BYTES) {
+          return false;
+        }
+        report.auStack[report.uStackBytes++] = (uint8_t)((hexDigit(cursor.p[0]) << 4) | hexDigit(cursor.p[1]));
+        cursor.p += 2;
+      }
+    }
+    else {
+      uint32_t *pulField = NULL;
+      if (skipText(cursor, "data=")) {
+        pulField = &report.ulData;
+      }
+      else if (skipText(cursor, "uptime=")) {
+        pulField = &report.ulUptime;
+        bUptime = true;
+      }
+      if (pulField != NULL) {
+        if (!readNumber(cursor, *pulField)) {
+          return false;
+        }
+        continue;
+      }
+
+      bool bKnown = true;
+      uint8_t uWidth = 16;
+      uint16_t *puField = NULL;
+      uint8_t *puByte = NULL;
+      if (skipText(cursor, "sp=")) {
+        puField = &report.uStackPointer;
+      }
+      else if (skipText(cursor, "stack-low=")) {
+        puField = &report.uStackLow;
+      }
+      else if (skipText(cursor, "irq-latency=")) {
+        puField = &report.uIrqLatencyUs;
+      }
+      else if (skipText(cursor, "build=")) {
+        puField = &report.uBuild;
+        bBuild = true;
+      }
+      else if (skipText(cursor, "region=")) {
+        puByte = &report.uRegion;
+        uWidth = 8;
+      }
+      else {
+        bKnown = false;
+      }
+      if (!bKnown || !readNumber(cursor, ulValue) || (ulValue >> uWidth) != 0) {
+        return false;
+      }
+      if (puField != NULL) {
+        *puField = (uint16_t)ulValue;
+      }
+      else {
+        *puByte = (uint8_t)ulValue;
+      }
+    }
+  }
+  return bBuild && bUptime;
+}
+
+// Parses one line. Returns true if it was a report.
+static bool parseLine(CTextCursor cursor, CMReport &report, uint32_t &ulDevice) {
+  uint32_t ulValue;
+  if (skipText(cursor, "Device: ")) {
+    if (readNumber(cursor, ulValue) && (cursor.p == cursor.pEnd)) {
+      ulDevice = ulValue;
+    }
+    return false;
+  }
+
+  uint32_t ulSlot;
+  if (!readNumber(cursor, ulSlot) || (ulSlot > 0xff) || !skipText(cursor, ": ")) {
+    return false;
+  }
+
+  memset(&report, 0, sizeof(report));
+  report.uSlot = (uint8_t)ulSlot;
+  report.ulDevice = ulDevice;
+  if (skipText(cursor, "memory-corrupt address=")) {
+    report.uType = CM_TYPE_MEMORY_CORRUPT;
+    return readNumber(cursor, report.ulAddress) && skipText(cursor, ", value=") &&
+      readNumber(cursor, report.ulData) && (cursor.p == cursor.pEnd);
+  }
+
+  if (skipText(cursor, "flash-corrupt length=")) {
+    uint32_t ulCrc;
+    uint32_t ulExpected;
+    report.uType = CM_TYPE_FLASH_CORRUPT;
+    if (!readNumber(cursor, ulValue) || !skipText(cursor, ", crc=") || !readNumber(cursor, ulCrc) ||
+        !skipText(cursor, ", expected=") || !readNumber(cursor, ulExpected) || (cursor.p != cursor.pEnd)) {
+      return false;
+    }
+    report.ulAddress = ulValue / 2;
+    report.ulData = (ulCrc << 16) | (ulExpected & 0xffff);
+    return true;
+  }
+
+  report.uType = CM_TYPE_WATCHDOG;
+  return skipText(cursor, "word-address=") && readNumber(cursor, report.ulAddress) &&
+    parseWatchdogFields(cursor, report);
+}
+
+long cmParseText(CMTable *pTable, const char *pText, size_t size) {
+  size_t count = cmTableCount(pTable);
+  uint32_t ulDevice = CM_NO_DEVICE;
+  const char *pEnd = pText + size;
+  const char *pLine = pText;
+  while (pLine < pEnd) {
+    const char *pNext = (const char *)memchr(pLine, '\n', (size_t)(pEnd - pLine));
+    if (pNext == NULL) {
+      pNext = pEnd;
+    }
+
+    CTextCursor cursor = { pLine, pNext };
+    if ((cursor.pEnd > cursor.p) && (cursor.pEnd[-1] == '\r')) {
+      --cursor.pEnd;
+    }
+
+    CMReport report;
+    if (parseLine(cursor, report, ulDevice)) {
+      int result = cmTableAppend(pTable, &report);
+      if (result != CM_OK) {
+        truncateTable(pTable, count);
+        return result;
+      }
+    }
+    pLine = pNext + 1;
+  }
+  return (long)(cmTableCount(pTable) - count);
+}
+
+int cmFormatReport(const struct CMReport *pReport, char *pBuffer, size_t size) {
+  if (pReport->uType == CM_TYPE_MEMORY_CORRUPT) {
+    return snprintf(pBuffer, size, "%u: memory-corrupt address=0x%lX, value=0x%lX", pReport->uSlot,
+                    (unsigned long)pReport->ulAddress, (unsigned long)pReport->ulData);
+  }
+  if (pReport->uType == CM_TYPE_FLASH_CORRUPT) {
+    return snprintf(pBuffer, size, "%u: flash-corrupt length=0x%lX, crc=0x%lX, expected=0x%lX", pReport->uSlot,
+                    (unsigned long)pReport->ulAddress * 2, (unsigned long)(pReport->ulData >> 16),
+                    (unsigned long)(pReport->ulData & 0xffff));
+  }
+
+  // Formatted piece by piece, the same way dump() prints it.
+  char acLine[128 + (CM_MAX_STACK_BYTES * 2)];
+  int length = snprintf(acLine, sizeof(acLine), "%u: word-address=0x%lX: byte-address=0x%lX, data=0x%lX",
+                        pReport->uSlot, (unsigned long)pReport->ulAddress, (unsigned long)pReport->ulAddress * 2,
+                        (unsigned long)pReport->ulData);
+  if (pReport->uType == CM_TYPE_STALL) {
+    length += snprintf(acLine + length, sizeof(acLine) - length, ", stall");
+  }
+  else if (pReport->uType == CM_TYPE_USER) {
+    length += snprintf(acLine + length, sizeof(acLine) - length, ", user");
+  }
+  length += snprintf(acLine + length, sizeof(acLine) - length, ", sp=0x%X", pReport->uStackPointer);
+  if (pReport->uStackLow != 0) {
+    length += snprintf(acLine + length, sizeof(acLine) - length, ", stack-low=0x%X", pReport->uStackLow);
+  }
+  if (pReport->uIrqLatencyUs != 0) {
+    length += snprintf(acLine + length, sizeof(acLine) - length, ", irq-latency=%u", pReport->uIrqLatencyUs);
+  }
+  if (pReport->uRegion != 0) {
+    length += snprintf(acLine + length, sizeof(acLine) - length, ", region=%u", pReport->uRegion);
+  }
+  length += snprintf(acLine + length, sizeof(acLine) - length, ", build=%u, uptime=%lu", pReport->uBuild,
+                     (unsigned long)pReport->ulUptime);
+  if (pReport->uStackBytes > 0) {
+    length += snprintf(acLine + length, sizeof(acLine) - length, ", stack=");
+    for (uint8_t uByte = 0; uByte < pReport->uStackBytes; ++uByte) {
+      length += snprintf(acLine + length, sizeof(acLine) - length, "%02X", pReport->auStack[uByte]);
+    }
+  }
+  return snprintf(pBuffer, size, "%s", acLine);
+}
+
+const char *cmResultText(long result) {
+  switch (result) {
+    case CM_ERR_ARGUMENT:
+      return "invalid argument";
+    case CM_ERR_FORMAT:
+      return "not a crash monitor dump";
+    case CM_ERR_VERSION:
+      return "unsupported format version";
+    case CM_ERR_LAYOUT:
+      return "report layout mismatch";
+    case CM_ERR_TRUNCATED:
+      return "truncated input";
+    case CM_ERR_IO:
+      return "I/O error";
+    case CM_ERR_MEMORY:
+      return "out of memory";
+  }
+  return (result >= 0) ? "ok" : "unknown error";
+}
+
+int cmMapFile(const char *pPath, struct CMMappedFile *pFile) {
+  pFile->puData = NULL;
+  pFile->size = 0;
+  int fd = open(pPath, O_RDONLY);
+  if (fd < 0) {
+    return CM_ERR_IO;
+  }
+
+  struct stat status;
+  if (fstat(fd, &status) != 0) {
+    close(fd);
+    return CM_ERR_IO;
+  }
+
+  if (status.st_size > 0) {
+    void *pData = mmap(NULL, (size_t)status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (pData == MAP_FAILED) {
+      close(fd);
+      return CM_ERR_IO;
+    }
+    pFile->puData = (const uint8_t *)pData;
+    pFile->size = (size_t)status.st_size;
+  }
+  close(fd);
+  return CM_OK;
+}
+
+void cmUnmapFile(struct CMMappedFile *pFile) {
+  if (pFile->puData != NULL) {
+    munmap((void *)pFile->puData, pFile->size);
+  }
+  pFile->puData = NULL;
+  pFile->size = 0;
+}
@@ -0,0 +1,383 @@
+/**
+ * CrashMonitorHost.h
+ * Version 1.4
+ * Author
+ *  Cyrus Brunner
+ *
+ * Host (PC) library for reading crash reports collected from a fleet. Text
+ * dumps (dump()), binary dumps (dumpBinary()), serialize() packets and raw
+ * EEPROM images are all parsed into the same columnar table: one array per
+ * CCrashReport field, so a tool that only looks at the build ID and uptime
+ * never touches the rest. The input is parsed in place (ie. straight out of a
+ * memory mapped file, see cmMapFile()) without copying it first.
+ *
+ * This has a C ABI so it can be linked from C, C++ or anything with a C FFI.
+ * Build it with "make host", which produces extras/build/libcrashmonitor.a.
+ */
+
+#ifndef CrashMonitorHost_h
+#define CrashMonitorHost_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Result codes. Everything that can fail returns one of these (or a
+ * count, which is never negative).
+ */
+enum ECMResult
+{
+  CM_OK = 0,
+  CM_ERR_ARGUMENT = -1,
+  CM_ERR_FORMAT = -2,
+  CM_ERR_VERSION = -3,
+  CM_ERR_LAYOUT = -4,
+  CM_ERR_TRUNCATED = -5,
+  CM_ERR_IO = -6,
+  CM_ERR_MEMORY = -7
+};
+
+/**
+ * @brief The report types (the same values as EReportType).
+ */
+enum ECMReportType
+{
+  CM_TYPE_WATCHDOG = 0,
+  CM_TYPE_FLASH_CORRUPT = 1,
+  CM_TYPE_STALL = 2,
+  CM_TYPE_USER = 3,
+  CM_TYPE_MEMORY_CORRUPT = 4
+};
+
+/**
+ * @brief Constants of the on-device formats.
+ */
+enum ECMFormat
+{
+  CM_BINARY_FORMAT_VERSION = 2,
+  CM_REPORT_LAYOUT_VERSION = 1,
+  CM_HEADER_SIZE = 4,
+  CM_DESCRIPTOR_SIZE = 4,
+  CM_RECORD_FIXED_SIZE = 18,
+  CM_MAX_STACK_BYTES = 64
+};
+
+/**
+ * @brief The device ID of reports that were not tagged with one.
+ */
+#define CM_NO_DEVICE 0xffffffffUL
+
+/**
+ * @brief A single report, decoded. Used to append rows and to read one back.
+ */
+struct CMReport
+{
+  /**
+   * @brief The word address (for flash corruption reports, the length checked
+   * in words, and for memory corruption reports, the watched address).
+   */
+  uint32_t ulAddress;
+
+  /**
+   * @brief User data (see CCrashReport::uData).
+   */
+  uint32_t ulData;
+
+  /**
+   * @brief The report type (see ECMReportType).
+   */
+  uint8_t uType;
+
+  /**
+   * @brief The stack pointer of the interrupted code.
+   */
+  uint16_t uStackPointer;
+
+  /**
+   * @brief The extended timeout region ID (0 = none).
+   */
+  uint8_t uRegion;
+
+  /**
+   * @brief The firmware build ID.
+   */
+  uint16_t uBuild;
+
+  /**
+   * @brief The uptime in milliseconds.
+   */
+  uint32_t ulUptime;
+
+  /**
+   * @brief The stack high-water mark (0 = not painted).
+   */
+  uint16_t uStackLow;
+
+  /**
+   * @brief The worst interrupt latency in microseconds (0 = off).
+   */
+  uint16_t uIrqLatencyUs;
+
+  /**
+   * @brief The report slot the report was read from.
+   */
+  uint8_t uSlot;
+
+  /**
+   * @brief The device the report came from, or CM_NO_DEVICE.
+   */
+  uint32_t ulDevice;
+
+  /**
+   * @brief The number of valid bytes in auStack.
+   */
+  uint8_t uStackBytes;
+
+  /**
+   * @brief The stack snapshot, lowest address (sp + 1) first.
+   */
+  uint8_t auStack[CM_MAX_STACK_BYTES];
+};
+
+/**
+ * @brief The columns of a table. Each pointer addresses count values (the
+ * stack column count * uStackBytes bytes, one row after another). The pointers
+ * stay valid until the table is changed or freed.
+ */
+struct CMColumns
+{
+  size_t count;
+  const uint32_t *pulAddress;
+  const uint32_t *pulData;
+  const uint8_t *puType;
+  const uint16_t *puStackPointer;
+  const uint8_t *puRegion;
+  const uint16_t *puBuild;
+  const uint32_t *pulUptime;
+  const uint16_t *puStackLow;
+  const uint16_t *puIrqLatencyUs;
+  const uint8_t *puSlot;
+  const uint32_t *pulDevice;
+  const uint8_t *puStack;
+  uint8_t uStackBytes;
+};
+
+/**
+ * @brief A table of reports (opaque).
+ */
+typedef struct CMTable CMTable;
+
+/**
+ * @brief A read-only memory mapped file.
+ */
+struct CMMappedFile
+{
+  const uint8_t *puData;
+  size_t size;
+};
+
+/**
+ * @brief Reassembles the records split across serialize() packets.
+ */
+struct CMPacketReader
+{
+  uint8_t uPcSize;
+  uint8_t uRecordSize;
+  uint8_t uSlot;
+  uint8_t uFill;
+  uint32_t ulDevice;
+  uint8_t auRecord[CM_RECORD_FIXED_SIZE + 3 + CM_MAX_STACK_BYTES];
+};
+
+/**
+ * @brief Creates an empty table.
+ * @return The table, or NULL if out of memory.
+ */
+CMTable *cmTableCreate(void);
+
+/**
+ * @brief Frees a table.
+ * @param pTable The table (may be NULL).
+ */
+void cmTableFree(CMTable *pTable);
+
+/**
+ * @brief Removes all the rows from a table.
+ * @param pTable The table.
+ */
+void cmTableClear(CMTable *pTable);
+
+/**
+ * @brief Gets the number of rows.
+ * @param  pTable The table.
+ * @return        The number of rows.
+ */
+size_t cmTableCount(const CMTable *pTable);
+
+/**
+ * @brief Gets the columns of a table.
+ * @param pTable   The table.
+ * @param pColumns Receives the columns.
+ */
+void cmTableColumns(const CMTable *pTable, struct CMColumns *pColumns);
+
+/**
+ * @brief Appends a row. The stack column is as wide as the widest snapshot
+ * appended so far; shorter ones are padded with 0.
+ * @param  pTable  The table.
+ * @param  pReport The report.
+ * @return         CM_OK, CM_ERR_ARGUMENT if the snapshot is too big or
+ *                 CM_ERR_MEMORY.
+ */
+int cmTableAppend(CMTable *pTable, const struct CMReport *pReport);
+
+/**
+ * @brief Reads one row back.
+ * @param  pTable  The table.
+ * @param  row     The row.
+ * @param  pReport Receives the report.
+ * @return         CM_OK or CM_ERR_ARGUMENT if the row does not exist.
+ */
+int cmTableGet(const CMTable *pTable, size_t row, struct CMReport *pReport);
+
+/**
+ * @brief Decodes one stored record (the CCrashReport bytes as stored).
+ * @param  puRecord    The record.
+ * @param  uRecordSize The record size (uPcSize + 18 + stack bytes).
+ * @param  uPcSize     The program counter size (2, or 3 on the Mega).
+ * @param  pReport     Receives the report. The slot and device are not set.
+ * @return             CM_OK or CM_ERR_LAYOUT if the sizes don't add up.
+ */
+int cmDecodeRecord(const uint8_t *puRecord, uint8_t uRecordSize, uint8_t uPcSize, struct CMReport *pReport);
+
+/**
+ * @brief Encodes a report as a stored record (the inverse of
+ * cmDecodeRecord()).
+ * @param  pReport     The report.
+ * @param  uPcSize     The program counter size.
+ * @param  puRecord    Receives uPcSize + 18 + pReport->uStackBytes bytes.
+ * @return             The record size.
+ */
+uint8_t cmEncodeRecord(const struct CMReport *pReport, uint8_t uPcSize, uint8_t *puRecord);
+
+/**
+ * @brief Parses one binary dump (dumpBinary()).
+ * @param  pTable   The table to append to.
+ * @param  puData   The dump.
+ * @param  size     The size of the dump.
+ * @param  uPcSize  The program counter size of the device.
+ * @param  ulDevice The device ID to tag the rows with (or CM_NO_DEVICE).
+ * @param  pUsed    Receives the number of bytes the dump took (may be NULL).
+ * @return          The number of reports added, or an error.
+ */
+long cmParseBinary(CMTable *pTable, const uint8_t *puData, size_t size, uint8_t uPcSize, uint32_t ulDevice, size_t *pUsed);
+
+/**
+ * @brief Parses a stream of binary dumps, each preceded by the device ID
+ * (4 bytes, little-endian), as written by CrashFleet.
+ * @param  pTable  The table to append to.
+ * @param  puData  The stream.
+ * @param  size    The size of the stream.
+ * @param  uPcSize The program counter size of the devices.
+ * @return         The number of reports added, or an error.
+ */
+long cmParseBinaryStream(CMTable *pTable, const uint8_t *puData, size_t size, uint8_t uPcSize);
+
+/**
+ * @brief Parses text dumps (dump()). Lines that are not part of a dump (ie.
+ * other serial output) are skipped. A "Device: N" line tags the reports that
+ * follow it with device N.
+ * @param  pTable The table to append to.
+ * @param  pText  The text.
+ * @param  size   The size of the text.
+ * @return        The number of reports added, or an error.
+ */
+long cmParseText(CMTable *pTable, const char *pText, size_t size);
+
+/**
+ * @brief Parses a raw EEPROM image (ie. read back with avrdude).
+ * @param  pTable   The table to append to.
+ * @param  puData   The image.
+ * @param  size     The size of the image.
+ * @param  base     The base address passed to CrashMonitor::begin().
+ * @param  uPcSize  The program counter size of the device.
+ * @param  ulDevice The device ID to tag the rows with (or CM_NO_DEVICE).
+ * @return          The number of reports added, or an error. CM_ERR_LAYOUT
+ *                  means the header was not written by this version (the
+ *                  device discards these reports too).
+ */
+long cmParseEeprom(CMTable *pTable, const uint8_t *puData, size_t size, size_t base, uint8_t uPcSize, uint32_t ulDevice);
+
+/**
+ * @brief Parses a file, working out what it holds: an EEPROM image if base is
+ * not negative, otherwise a binary dump, a stream of binary dumps or text.
+ * @param  pTable  The table to append to.
+ * @param  pPath   The path.
+ * @param  uPcSize The program counter size of the devices.
+ * @param  base    The base address of an EEPROM image, or -1.
+ * @return         The number of reports added, or an error.
+ */
+long cmParseFile(CMTable *pTable, const char *pPath, uint8_t uPcSize, long base);
+
+/**
+ * @brief Starts reassembling serialize() packets.
+ * @param pReader     The reader.
+ * @param uRecordSize sizeof(CCrashReport) on the device.
+ * @param uPcSize     The program counter size of the device.
+ * @param ulDevice    The device ID to tag the rows with (or CM_NO_DEVICE).
+ * @return            CM_OK or CM_ERR_ARGUMENT.
+ */
+int cmPacketReaderInit(struct CMPacketReader *pReader, uint8_t uRecordSize, uint8_t uPcSize, uint32_t ulDevice);
+
+/**
+ * @brief Parses one serialize() packet. Records split across packets are
+ * added once their last fragment arrives; a fragment that doesn't continue
+ * the record in progress (ie. a lost packet) drops that record.
+ * @param  pReader The reader.
+ * @param  pTable  The table to append to.
+ * @param  puData  The packet.
+ * @param  size    The size of the packet.
+ * @return         The number of reports added, or an error.
+ */
+long cmParsePacket(struct CMPacketReader *pReader, CMTable *pTable, const uint8_t *puData, size_t size);
+
+/**
+ * @brief Formats a report as a dump() line, without the insn and hang fields
+ * (which need the firmware) and without the line ending.
+ * @param  pReport The report.
+ * @param  pBuffer The buffer.
+ * @param  size    The size of the buffer.
+ * @return         The length of the line (as snprintf()).
+ */
+int cmFormatReport(const struct CMReport *pReport, char *pBuffer, size_t size);
+
+/**
+ * @brief Describes a result code.
+ * @param  result The result code.
+ * @return        The description (ie. "truncated input").
+ */
+const char *cmResultText(long result);
+
+/**
+ * @brief Maps a file read-only.
+ * @param  pPath The path.
+ * @param  pFile Receives the mapping.
+ * @return       CM_OK or CM_ERR_IO.
+ */
+int cmMapFile(const char *pPath, struct CMMappedFile *pFile);
+
+/**
+ * @brief Unmaps a file.
+ * @param pFile The mapping.
+ */
+void cmUnmapFile(struct CMMappedFile *pFile);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
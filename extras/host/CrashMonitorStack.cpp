@@ -0,0 +1,446 @@
+/**
+ * CrashMonitorStack.cpp
+ * Version 1.4
+ * Author
+ *  Cyrus Brunner
+ *
+ * Static worst case stack depth from -fstack-usage and the ELF call graph.
+ */
+
+#include "CrashMonitorStack.h"
+#include <cxxabi.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <map>
+#include <new>
+#include <string>
+#include <vector>
+
+#define DATA_SPACE 0x800000
+
+namespace
+{
+  struct CCall
+  {
+    size_t callee;
+
+    // A call pushes the return address. A jump to another function (a tail
+    // call) doesn't.
+    bool bPush;
+  };
+
+  struct CNode
+  {
+    std::string name;
+    uint32_t ulAddress;
+    uint32_t ulSize;
+    uint32_t ulFrame;
+    uint8_t uBaseFlags;
+    std::vector<CCall> calls;
+
+    uint32_t ulDepth;
+    uint8_t uFlags;
+    size_t worstCallee;
+    uint8_t uState;
+  };
+
+  struct CUsage
+  {
+    std::string key;
+    uint32_t ulFrame;
+    bool bDynamic;
+  };
+
+  bool isBefore(const CNode &node, uint32_t ulAddress) {
+    return node.ulAddress + node.ulSize <= ulAddress;
+  }
+
+  std::string demangle(const char *pName) {
+    std::string name(pName);
+    if (strncmp(pName, "_Z", 2) == 0) {
+      int status;
+      char *pDemangled = abi::__cxa_demangle(pName, NULL, NULL, &status);
+      if (pDemangled != NULL) {
+        if (status == 0) {
+          name = pDemangled;
+        }
+        free(pDemangled);
+      }
+    }
+    return name;
+  }
+
+  // The name as it's demangled from the ELF. The .su name of a C++ function
+  // also has the return type ("void Foo::bar(int)"), which is dropped.
+  std::string usageKey(const std::string &name) {
+    size_t parameters = name.find('(');
+    if (parameters == std::string::npos) {
+      return name;
+    }
+
+    int depth = 0;
+    for (size_t index = parameters; index-- > 0;) {
+      char c = name[index];
+      if (c == '>') {
+        ++depth;
+      }
+      else if (c == '<') {
+        --depth;
+      }
+      else if ((c == ' ') && (depth == 0)) {
+        return name.substr(index + 1);
+      }
+    }
+    return name;
+  }
+
+  const char *skipDigits(const char *p, const char *pEnd) {
+    const char *pStart = p;
+    while ((p < pEnd) && (*p >= '0') && (*p <= '9')) {
+      ++p;
+    }
+    return (p == pStart) ? NULL : p;
+  }
+
+  // "file:line:column:name<TAB>size<TAB>qualifier". The file may have colons
+  // (ie. "C:\..."), and so may the name, so the name starts after the first
+  // ":line:" or ":line:column:".
+  bool parseUsageLine(const char *pLine, const char *pEnd, CUsage &usage) {
+    const char *pTab = (const char *)memchr(pLine, '\t', pEnd - pLine);
+    if (pTab == NULL) {
+      return false;
+    }
+
+    const char *pName = NULL;
+    for (const char *p = pLine; (p < pTab) && (pName == NULL); ++p) {
+      if (*p != ':') {
+        continue;
+      }
+      const char *pAfter = skipDigits(p + 1, pTab);
+      if ((pAfter == NULL) || (pAfter >= pTab) || (*pAfter != ':')) {
+        continue;
+      }
+      pName = pAfter + 1;
+      const char *pColumn = skipDigits(pName, pTab);
+      if ((pColumn != NULL) && (pColumn < pTab) && (*pColumn == ':')) {
+        pName = pColumn + 1;
+      }
+    }
+    if ((pName == NULL) || (pName == pTab)) {
+      return false;
+    }
+
+    const char *pSize = pTab + 1;
+    const char *pSizeEnd = skipDigits(pSize, pEnd);
+    if ((pSizeEnd == NULL) || (pSizeEnd >= pEnd) || (*pSizeEnd != '\t')) {
+      return false;
+    }
+
+    std::string qualifier(pSizeEnd + 1, pEnd);
+    usage.key = usageKey(std::string(pName, pTab));
+    usage.ulFrame = (uint32_t)strtoul(std::string(pSize, pSizeEnd).c_str(), NULL, 10);
+    // "static", "dynamic" or "dynamic,bounded".
+    usage.bDynamic = (qualifier.compare(0, 7, "dynamic") == 0) && (qualifier.find("bounded") == std::string::npos);
+    return true;
+  }
+}
+
+struct CMStackGraph
+{
+  uint8_t uPcSize;
+  std::vector<CNode> nodes;
+  std::map<std::string, std::vector<size_t> > byName;
+
+  size_t find(uint32_t ulAddress) const {
+    std::vector<CNode>::const_iterator node = std::lower_bound(nodes.begin(), nodes.end(), ulAddress, isBefore);
+    if ((node == nodes.end()) || (ulAddress < node->ulAddress)) {
+      return CM_STACK_NONE;
+    }
+    return node - nodes.begin();
+  }
+
+  void visit(size_t index) {
+    CNode &node = nodes[index];
+    node.uState = 1;
+    node.ulDepth = node.ulFrame;
+    node.worstCallee = CM_STACK_NONE;
+    uint8_t uFlags = 0;
+    for (size_t call = 0; call < node.calls.size(); ++call) {
+      CNode &callee = nodes[node.calls[call].callee];
+      if (callee.uState == 1) {
+        // A cycle: the callee is further up this path.
+        callee.uFlags |= CM_STACK_RECURSIVE;
+        uFlags |= CM_STACK_RECURSIVE;
+        continue;
+      }
+      if (callee.uState == 0) {
+        visit(node.calls[call].callee);
+      }
+      uFlags |= callee.uFlags;
+      uint32_t ulDepth = node.ulFrame + callee.ulDepth + (node.calls[call].bPush ? uPcSize : 0);
+      if ((node.worstCallee == CM_STACK_NONE) || (ulDepth > node.ulDepth)) {
+        node.ulDepth = ulDepth;
+        node.worstCallee = node.calls[call].callee;
+      }
+    }
+    node.uFlags |= uFlags;
+    node.uState = 2;
+  }
+
+  void compute() {
+    for (size_t index = 0; index < nodes.size(); ++index) {
+      nodes[index].uFlags = nodes[index].uBaseFlags;
+      nodes[index].uState = 0;
+    }
+    for (size_t index = 0; index < nodes.size(); ++index) {
+      if (nodes[index].uState == 0) {
+        visit(index);
+      }
+    }
+  }
+};
+
+namespace
+{
+  void addCalls(const CMElf *pElf, CMStackGraph &graph, size_t index) {
+    CNode &node = graph.nodes[index];
+    uint32_t ulEnd = node.ulAddress + node.ulSize;
+    CMInstruction instruction;
+    for (uint32_t ulAddress = node.ulAddress;
+         (ulAddress < ulEnd) && (cmDisassemble(pElf, ulAddress, &instruction) == CM_OK);
+         ulAddress += instruction.uWords * 2) {
+      bool bCall = (instruction.uFlow == CM_FLOW_CALL);
+      if (instruction.uFlow == CM_FLOW_INDIRECT_CALL) {
+        node.uBaseFlags |= CM_STACK_INDIRECT;
+        continue;
+      }
+      // ijmp is left out: it's how switch tables (__tablejump2__) jump
+      // within a function.
+      if (!bCall && ((instruction.uFlow != CM_FLOW_JUMP) ||
+                     ((instruction.ulTarget >= node.ulAddress) && (instruction.ulTarget < ulEnd)))) {
+        continue;
+      }
+
+      size_t callee = graph.find(instruction.ulTarget);
+      if (callee == CM_STACK_NONE) {
+        node.uBaseFlags |= CM_STACK_UNKNOWN_CALL;
+        continue;
+      }
+      CCall call = { callee, bCall };
+      node.calls.push_back(call);
+    }
+  }
+
+  int build(const CMElf *pElf, CMStackGraph &graph) {
+    CMElfSymbol symbol;
+    for (size_t index = 0; cmElfGetSymbol(pElf, index, &symbol) == CM_OK; ++index) {
+      // Sorted by address, so aliases (ie. the C1 and C2 constructors) are
+      // next to each other.
+      if ((symbol.uType != CM_SYMBOL_FUNC) || (symbol.ulSize == 0) || (symbol.ulAddress >= DATA_SPACE) ||
+          (!graph.nodes.empty() && (graph.nodes.back().ulAddress + graph.nodes.back().ulSize > symbol.ulAddress))) {
+        continue;
+      }
+      CNode node;
+      node.name = demangle(symbol.pName);
+      node.ulAddress = symbol.ulAddress;
+      node.ulSize = symbol.ulSize;
+      node.ulFrame = 0;
+      node.uBaseFlags = CM_STACK_NO_USAGE;
+      graph.nodes.push_back(node);
+      graph.byName[node.name].push_back(graph.nodes.size() - 1);
+    }
+
+    for (size_t index = 0; index < graph.nodes.size(); ++index) {
+      addCalls(pElf, graph, index);
+    }
+    graph.compute();
+    return CM_OK;
+  }
+}
+
+int cmStackGraphBuild(const CMElf *pElf, uint8_t uPcSize, CMStackGraph **ppGraph) {
+  *ppGraph = NULL;
+  if ((uPcSize != 2) && (uPcSize != 3)) {
+    return CM_ERR_ARGUMENT;
+  }
+
+  CMStackGraph *pGraph = new (std::nothrow) CMStackGraph;
+  if (pGraph == NULL) {
+    return CM_ERR_MEMORY;
+  }
+  pGraph->uPcSize = uPcSize;
+  try {
+    build(pElf, *pGraph);
+  }
+  catch (const std::bad_alloc &) {
+    delete pGraph;
+    return CM_ERR_MEMORY;
+  }
+  *ppGraph = pGraph;
+  return CM_OK;
+}
+
+long cmStackGraphAddUsage(CMStackGraph *pGraph, const char *pText, size_t size) {
+  try {
+    // Parsed first, so a bad file changes nothing.
+    std::vector<CUsage> usages;
+    const char *pEnd = pText + size;
+    for (const char *pLine = pText; pLine < pEnd;) {
+      const char *pLineEnd = (const char *)memchr(pLine, '\n', pEnd - pLine);
+      const char *pNext = (pLineEnd == NULL) ? pEnd : pLineEnd + 1;
+      if (pLineEnd == NULL) {
+        pLineEnd = pEnd;
+      }
+      if ((pLineEnd > pLine) && (pLineEnd[-1] == '\r')) {
+        --pLineEnd;
+      }
+      if (pLineEnd > pLine) {
+        CUsage usage;
+        if (!parseUsageLine(pLine, pLineEnd, usage)) {
+          return CM_ERR_FORMAT;
+        }
+        usages.push_back(usage);
+      }
+      pLine = pNext;
+    }
+
+    long matched = 0;
+    for (size_t index = 0; index < usages.size(); ++index) {
+      std::map<std::string, std::vector<size_t> >::const_iterator nodes = pGraph->byName.find(usages[index].key);
+      if (nodes == pGraph->byName.end()) {
+        // An extern "C" function (ie. main or an ISR) in a C++ file has a
+        // parameter list in the .su file but not in the ELF.
+        nodes = pGraph->byName.find(usages[index].key.substr(0, usages[index].key.find('(')));
+      }
+      if (nodes == pGraph->byName.end()) {
+        continue;
+      }
+      ++matched;
+      // Static functions of the same name in different files can't be told
+      // apart, so each gets the biggest frame.
+      for (size_t node = 0; node < nodes->second.size(); ++node) {
+        CNode &function = pGraph->nodes[nodes->second[node]];
+        function.uBaseFlags &= ~CM_STACK_NO_USAGE;
+        function.ulFrame = std::max(function.ulFrame, usages[index].ulFrame);
+        if (usages[index].bDynamic) {
+          function.uBaseFlags |= CM_STACK_DYNAMIC;
+        }
+      }
+    }
+    pGraph->compute();
+    return matched;
+  }
+  catch (const std::bad_alloc &) {
+    return CM_ERR_MEMORY;
+  }
+}
+
+void cmStackGraphFree(CMStackGraph *pGraph) {
+  delete pGraph;
+}
+
+size_t cmStackGraphCount(const CMStackGraph *pGraph) {
+  return pGraph->nodes.size();
+}
+
+int cmStackGraphGet(const CMStackGraph *pGraph, size_t index, struct CMStackFunction *pFunction) {
+  if (index >= pGraph->nodes.size()) {
+    return CM_ERR_ARGUMENT;
+  }
+  const CNode &node = pGraph->nodes[index];
+  pFunction->pName = node.name.c_str();
+  pFunction->ulAddress = node.ulAddress;
+  pFunction->ulSize = node.ulSize;
+  pFunction->ulFrame = node.ulFrame;
+  pFunction->ulDepth = node.ulDepth;
+  pFunction->uFlags = node.uFlags;
+  pFunction->worstCallee = node.worstCallee;
+  return CM_OK;
+}
+
+int cmStackGraphFind(const CMStackGraph *pGraph, uint32_t ulByteAddress, size_t *pIndex) {
+  *pIndex = pGraph->find(ulByteAddress);
+  return (*pIndex == CM_STACK_NONE) ? CM_ERR_ARGUMENT : CM_OK;
+}
+
+int cmStackSummarize(const CMStackGraph *pGraph, const CMElf *pElf, const struct CMTarget *pTarget,
+                     struct CMStackSummary *pSummary) {
+  CMElfSymbol symbol;
+  if ((cmElfFindSymbol(pElf, "_end", &symbol) != CM_OK) && (cmElfFindSymbol(pElf, "__heap_start", &symbol) != CM_OK)) {
+    return CM_ERR_ARGUMENT;
+  }
+
+  memset(pSummary, 0, sizeof(*pSummary));
+  pSummary->uRamEnd = pTarget->uRamEnd;
+  pSummary->uDataEnd = (uint16_t)(symbol.ulAddress - DATA_SPACE);
+  pSummary->ulBudget = (pSummary->uRamEnd >= pSummary->uDataEnd) ? pSummary->uRamEnd - pSummary->uDataEnd + 1 : 0;
+  pSummary->main = CM_STACK_NONE;
+  pSummary->isr = CM_STACK_NONE;
+
+  // The startup code calls main, and an interrupt pushes the program counter.
+  for (size_t index = 0; index < pGraph->nodes.size(); ++index) {
+    const CNode &node = pGraph->nodes[index];
+    uint32_t ulDepth = node.ulDepth + pGraph->uPcSize;
+    if (node.name == "main") {
+      pSummary->main = index;
+      pSummary->ulMainDepth = ulDepth;
+    }
+    else if ((node.name.compare(0, 9, "__vector_") == 0) && (ulDepth > pSummary->ulIsrDepth)) {
+      pSummary->isr = index;
+      pSummary->ulIsrDepth = ulDepth;
+    }
+  }
+
+  pSummary->ulWorstDepth = pSummary->ulMainDepth + pSummary->ulIsrDepth;
+  if (pSummary->main != CM_STACK_NONE) {
+    pSummary->uFlags |= pGraph->nodes[pSummary->main].uFlags;
+  }
+  if (pSummary->isr != CM_STACK_NONE) {
+    pSummary->uFlags |= pGraph->nodes[pSummary->isr].uFlags;
+  }
+  return CM_OK;
+}
+
+int cmStackCheckReport(const CMStackGraph *pGraph, const struct CMStackSummary *pSummary,
+                       const struct CMReport *pReport, struct CMStackCheck *pCheck) {
+  if ((pReport->uType == CM_TYPE_FLASH_CORRUPT) || (pReport->uType == CM_TYPE_MEMORY_CORRUPT) ||
+      (pReport->uStackPointer == 0)) {
+    return CM_ERR_ARGUMENT;
+  }
+
+  memset(pCheck, 0, sizeof(*pCheck));
+  uint16_t uRamEnd = pSummary->uRamEnd;
+  uint16_t uStackPointer = pReport->uStackPointer;
+  pCheck->ulUsed = (uStackPointer <= uRamEnd) ? uRamEnd - uStackPointer : 0;
+  if ((pReport->uStackLow != 0) && (pReport->uStackLow <= uRamEnd)) {
+    pCheck->ulHighWater = uRamEnd - pReport->uStackLow + 1;
+  }
+
+  // What the function can still call, on top of what it already uses.
+  pCheck->function = pGraph->find(pReport->ulAddress * 2);
+  uint32_t ulRemaining = 0;
+  if (pCheck->function != CM_STACK_NONE) {
+    const CNode &node = pGraph->nodes[pCheck->function];
+    ulRemaining = node.ulDepth - node.ulFrame;
+    pCheck->uFlags = node.uFlags;
+  }
+  else {
+    pCheck->uFlags = CM_STACK_NO_USAGE;
+  }
+  pCheck->ulWorst = pCheck->ulUsed + ulRemaining + pSummary->ulIsrDepth;
+
+  // The stack writes from sp + 1 up. When the high-water mark reaches _end,
+  // all of the paint is gone, so it went at least that far.
+  if ((uStackPointer + 1 < pSummary->uDataEnd) ||
+      ((pReport->uStackLow != 0) && (pReport->uStackLow <= pSummary->uDataEnd))) {
+    pCheck->uVerdict = CM_STACK_OVERFLOWED;
+  }
+  else if (pCheck->ulWorst > pSummary->ulBudget) {
+    pCheck->uVerdict = CM_STACK_MAY_OVERFLOW;
+  }
+  else {
+    pCheck->uVerdict = CM_STACK_OK;
+  }
+  return CM_OK;
+}
@@ -0,0 +1,281 @@
+/**
+ * CrashMonitorStack.h
+ * Version 1.4
+ * Author
+ *  Cyrus Brunner
+ *
+ * Static worst case stack depth, checked against the stack pointer and the
+ * high-water mark (stack-low) of crash reports. The frame size of each
+ * function comes from the .su files written by -fstack-usage, and the call
+ * graph from the call and rcall instructions in the ELF. The depth of a
+ * function is its frame plus the deepest of its callees (plus the return
+ * address the call pushes). Interrupts can land on top of any of it, so the
+ * worst case of the firmware is main plus the deepest ISR (__vector_N).
+ *
+ * The bound is only as good as the call graph: recursion, icall (function
+ * pointers, virtual functions), dynamic allocas and functions without a .su
+ * entry (ie. assembly in libgcc and avr-libc) are flagged rather than
+ * guessed.
+ */
+
+#ifndef CrashMonitorStack_h
+#define CrashMonitorStack_h
+
+#include <stddef.h>
+#include <stdint.h>
+#include "CrashMonitorDisasm.h"
+#include "CrashMonitorElf.h"
+#include "CrashMonitorHost.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Why a depth is not a proven bound. A function has the flags of
+ * everything it calls.
+ */
+enum ECMStackFlags
+{
+  /**
+   * @brief No .su entry, so the frame counts as 0.
+   */
+  CM_STACK_NO_USAGE = 0x01,
+
+  /**
+   * @brief An unbounded dynamic frame (alloca or a variable length array).
+   */
+  CM_STACK_DYNAMIC = 0x02,
+
+  /**
+   * @brief An indirect call (icall or eicall).
+   */
+  CM_STACK_INDIRECT = 0x04,
+
+  /**
+   * @brief Part of a call cycle.
+   */
+  CM_STACK_RECURSIVE = 0x08,
+
+  /**
+   * @brief A call to an address outside any function symbol.
+   */
+  CM_STACK_UNKNOWN_CALL = 0x10
+};
+
+/**
+ * @brief What a report's stack says.
+ */
+enum ECMStackVerdict
+{
+  CM_STACK_OK = 0,
+
+  /**
+   * @brief The stack at the crash, plus the worst the crashed function could
+   * still call, plus the deepest ISR, is more than the RAM left for it.
+   */
+  CM_STACK_MAY_OVERFLOW = 1,
+
+  /**
+   * @brief The stack pointer or the high-water mark is in the static data.
+   */
+  CM_STACK_OVERFLOWED = 2
+};
+
+#define CM_STACK_NONE ((size_t)-1)
+
+/**
+ * @brief A function of the call graph.
+ */
+struct CMStackFunction
+{
+  /**
+   * @brief The name (demangled), valid until the graph is freed.
+   */
+  const char *pName;
+  uint32_t ulAddress;
+  uint32_t ulSize;
+
+  /**
+   * @brief The frame size from the .su files.
+   */
+  uint32_t ulFrame;
+
+  /**
+   * @brief The worst case depth, from the function's first instruction (not
+   * counting the return address pushed by its caller).
+   */
+  uint32_t ulDepth;
+
+  /**
+   * @brief See ECMStackFlags.
+   */
+  uint8_t uFlags;
+
+  /**
+   * @brief The callee on the worst case path, or CM_STACK_NONE.
+   */
+  size_t worstCallee;
+};
+
+/**
+ * @brief The worst case of the firmware.
+ */
+struct CMStackSummary
+{
+  uint16_t uRamEnd;
+
+  /**
+   * @brief The end of the static data (_end), where the stack must stop.
+   */
+  uint16_t uDataEnd;
+
+  /**
+   * @brief The bytes between the two.
+   */
+  uint32_t ulBudget;
+
+  /**
+   * @brief main (or CM_STACK_NONE) and its depth, with the return address
+   * pushed by the startup code.
+   */
+  size_t main;
+  uint32_t ulMainDepth;
+
+  /**
+   * @brief The deepest ISR (or CM_STACK_NONE) and its depth, with the return
+   * address pushed by the interrupt.
+   */
+  size_t isr;
+  uint32_t ulIsrDepth;
+
+  /**
+   * @brief main plus the deepest ISR, and the flags of both.
+   */
+  uint32_t ulWorstDepth;
+  uint8_t uFlags;
+};
+
+/**
+ * @brief The stack of a report.
+ */
+struct CMStackCheck
+{
+  /**
+   * @brief The function the report is in (or CM_STACK_NONE).
+   */
+  size_t function;
+
+  /**
+   * @brief RAMEND - sp.
+   */
+  uint32_t ulUsed;
+
+  /**
+   * @brief The deepest the stack has been (from stack-low), or 0 if the
+   * report has no high-water mark.
+   */
+  uint32_t ulHighWater;
+
+  /**
+   * @brief ulUsed plus the worst the function could still call, plus the
+   * deepest ISR.
+   */
+  uint32_t ulWorst;
+
+  /**
+   * @brief See ECMStackVerdict.
+   */
+  uint8_t uVerdict;
+
+  /**
+   * @brief The flags of the function (see ECMStackFlags).
+   */
+  uint8_t uFlags;
+};
+
+/**
+ * @brief A call graph (opaque).
+ */
+typedef struct CMStackGraph CMStackGraph;
+
+/**
+ * @brief Builds the call graph of a firmware. The frames are all 0 (and
+ * flagged CM_STACK_NO_USAGE) until .su files are added.
+ * @param  pElf    The firmware.
+ * @param  uPcSize The program counter size (2, or 3 on the Mega).
+ * @param  ppGraph Receives the graph.
+ * @return         CM_OK, CM_ERR_ARGUMENT or CM_ERR_MEMORY.
+ */
+int cmStackGraphBuild(const CMElf *pElf, uint8_t uPcSize, CMStackGraph **ppGraph);
+
+/**
+ * @brief Adds the frame sizes in the contents of a .su file.
+ * @param  pGraph The graph.
+ * @param  pText  The file.
+ * @param  size   The size of the file.
+ * @return        The number of functions of the graph it matched, or
+ *                CM_ERR_FORMAT if a line isn't "file:line:column:name<TAB>
+ *                size<TAB>qualifier".
+ */
+long cmStackGraphAddUsage(CMStackGraph *pGraph, const char *pText, size_t size);
+
+/**
+ * @brief Frees a graph.
+ * @param pGraph The graph (may be NULL).
+ */
+void cmStackGraphFree(CMStackGraph *pGraph);
+
+/**
+ * @brief Gets the number of functions.
+ * @param  pGraph The graph.
+ * @return        The number of functions.
+ */
+size_t cmStackGraphCount(const CMStackGraph *pGraph);
+
+/**
+ * @brief Gets a function.
+ * @param  pGraph    The graph.
+ * @param  index     The function.
+ * @param  pFunction Receives the function.
+ * @return           CM_OK or CM_ERR_ARGUMENT if it does not exist.
+ */
+int cmStackGraphGet(const CMStackGraph *pGraph, size_t index, struct CMStackFunction *pFunction);
+
+/**
+ * @brief Finds the function containing an address.
+ * @param  pGraph        The graph.
+ * @param  ulByteAddress The byte address.
+ * @param  pIndex        Receives the function.
+ * @return               CM_OK or CM_ERR_ARGUMENT if no function contains it.
+ */
+int cmStackGraphFind(const CMStackGraph *pGraph, uint32_t ulByteAddress, size_t *pIndex);
+
+/**
+ * @brief Works out the worst case of the firmware.
+ * @param  pGraph   The graph.
+ * @param  pElf     The firmware (for _end).
+ * @param  pTarget  The MCU (for RAMEND).
+ * @param  pSummary Receives the worst case.
+ * @return          CM_OK or CM_ERR_ARGUMENT if there is no _end symbol.
+ */
+int cmStackSummarize(const CMStackGraph *pGraph, const CMElf *pElf, const struct CMTarget *pTarget,
+                     struct CMStackSummary *pSummary);
+
+/**
+ * @brief Checks the stack of a report.
+ * @param  pGraph   The graph.
+ * @param  pSummary The worst case of the firmware.
+ * @param  pReport  The report.
+ * @param  pCheck   Receives the check.
+ * @return          CM_OK or CM_ERR_ARGUMENT if the report has no stack
+ *                  pointer (ie. flash corruption).
+ */
+int cmStackCheckReport(const CMStackGraph *pGraph, const struct CMStackSummary *pSummary,
+                       const struct CMReport *pReport, struct CMStackCheck *pCheck);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
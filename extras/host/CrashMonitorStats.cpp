@@ -0,0 +1,253 @@
+/**
+ * CrashMonitorStats.cpp
+ * Version 1.4
+ * Author
+ *  Cyrus Brunner
+ *
+ * Compares the crashes of two firmware builds.
+ */
+
+#include "CrashMonitorStats.h"
+#include <math.h>
+#include <algorithm>
+#include <new>
+#include <unordered_map>
+#include <vector>
+
+#define MS_PER_HOUR 3600000.0
+
+// Summing binomial terms stops once they no longer change the sum.
+#define TAIL_EPSILON 1e-17
+
+struct CMComparison
+{
+  CMComparisonSummary summary;
+  std::vector<CMSiteComparison> sites;
+};
+
+namespace
+{
+  struct CCounts
+  {
+    unsigned long aulCount[2];
+  };
+
+  double logBinomialTerm(unsigned long n, unsigned long k, double dLogP, double dLogQ) {
+    return lgamma(n + 1.0) - lgamma(k + 1.0) - lgamma(n - k + 1.0) + (k * dLogP) + ((n - k) * dLogQ);
+  }
+
+  // P(X >= k) for X ~ Bin(n, p). The terms fall off on both sides of the mode,
+  // so the shorter tail is summed from k outwards until they stop counting.
+  double binomialUpperTail(unsigned long n, unsigned long k, double p) {
+    if (k == 0) {
+      return 1.0;
+    }
+    if ((k > n) || (p <= 0.0)) {
+      return 0.0;
+    }
+    if (p >= 1.0) {
+      return 1.0;
+    }
+
+    double dLogP = log(p);
+    double dLogQ = log1p(-p);
+    double dMode = floor((n + 1.0) * p);
+    double dSum = 0.0;
+    if (k > dMode) {
+      for (unsigned long j = k; j <= n; ++j) {
+        double dTerm = exp(logBinomialTerm(n, j, dLogP, dLogQ));
+        dSum += dTerm;
+        if (dTerm <= dSum * TAIL_EPSILON) {
+          break;
+        }
+      }
+      return std::min(dSum, 1.0);
+    }
+
+    for (unsigned long j = k; j-- > 0;) {
+      double dTerm = exp(logBinomialTerm(n, j, dLogP, dLogQ));
+      dSum += dTerm;
+      if (dTerm <= dSum * TAIL_EPSILON) {
+        break;
+      }
+    }
+    return std::max(1.0 - dSum, 0.0);
+  }
+
+  double minP(const CMSiteComparison &site) {
+    return std::min(site.dShareP, site.dRateP);
+  }
+
+  bool isBefore(const CMSiteComparison &a, const CMSiteComparison &b) {
+    bool bA = (a.uFlags & (CM_REGRESSION_SHARE | CM_REGRESSION_RATE)) != 0;
+    bool bB = (b.uFlags & (CM_REGRESSION_SHARE | CM_REGRESSION_RATE)) != 0;
+    if (bA != bB) {
+      return bA;
+    }
+    if (minP(a) != minP(b)) {
+      return minP(a) < minP(b);
+    }
+    if (a.site.uType != b.site.uType) {
+      return a.site.uType < b.site.uType;
+    }
+    return a.site.ulAddress < b.site.ulAddress;
+  }
+
+  CMSite getSite(const CMColumns &columns, size_t row) {
+    CMSite site;
+    site.uType = columns.puType[row];
+    switch (site.uType) {
+      case CM_TYPE_FLASH_CORRUPT:
+        site.ulAddress = 0;
+        break;
+      case CM_TYPE_MEMORY_CORRUPT:
+        site.ulAddress = columns.pulAddress[row];
+        break;
+      default:
+        site.ulAddress = columns.pulAddress[row] * 2;
+        break;
+    }
+    return site;
+  }
+
+  void compare(const CMTable *pTable, uint16_t uBase, uint16_t uNew, double dAlpha, CMComparison *pComparison) {
+    CMColumns columns;
+    cmTableColumns(pTable, &columns);
+
+    // One pass over the two columns that decide the build and the site.
+    std::unordered_map<uint64_t, CCounts> counts;
+    unsigned long aulReports[2] = { 0, 0 };
+    double adUptime[2] = { 0.0, 0.0 };
+    for (size_t row = 0; row < columns.count; ++row) {
+      int build;
+      if (columns.puBuild[row] == uBase) {
+        build = 0;
+      }
+      else if (columns.puBuild[row] == uNew) {
+        build = 1;
+      }
+      else {
+        continue;
+      }
+
+      CMSite site = getSite(columns, row);
+      CCounts &siteCounts = counts[((uint64_t)site.uType << 32) | site.ulAddress];
+      ++siteCounts.aulCount[build];
+      ++aulReports[build];
+      adUptime[build] += columns.pulUptime[row];
+    }
+
+    CMComparisonSummary &summary = pComparison->summary;
+    for (int build = 0; build < 2; ++build) {
+      summary.aBuilds[build].uBuild = build ? uNew : uBase;
+      summary.aBuilds[build].ulReports = aulReports[build];
+      summary.aBuilds[build].dDeviceHours = adUptime[build] / MS_PER_HOUR;
+      summary.aBuilds[build].dRate = (adUptime[build] > 0.0) ?
+        aulReports[build] / summary.aBuilds[build].dDeviceHours : 0.0;
+    }
+    double dBaseHours = summary.aBuilds[0].dDeviceHours;
+    double dNewHours = summary.aBuilds[1].dDeviceHours;
+    summary.dRateRatio = (summary.aBuilds[0].dRate > 0.0) ? summary.aBuilds[1].dRate / summary.aBuilds[0].dRate : 0.0;
+    summary.dRateP = cmPoissonRateTest(aulReports[0], dBaseHours, aulReports[1], dNewHours);
+    summary.uFlags = (summary.dRateP < dAlpha) ? CM_REGRESSION_RATE : 0;
+    summary.siteCount = counts.size();
+
+    // Two tests per site.
+    summary.dSiteAlpha = dAlpha / (2.0 * counts.size());
+    pComparison->sites.reserve(counts.size());
+    for (std::unordered_map<uint64_t, CCounts>::const_iterator entry = counts.begin(); entry != counts.end();
+         ++entry) {
+      CMSiteComparison site;
+      site.site.uType = (uint8_t)(entry->first >> 32);
+      site.site.ulAddress = (uint32_t)entry->first;
+      for (int build = 0; build < 2; ++build) {
+        site.aulCount[build] = entry->second.aulCount[build];
+        site.adShare[build] = aulReports[build] ? (double)site.aulCount[build] / aulReports[build] : 0.0;
+        site.adRate[build] = (summary.aBuilds[build].dDeviceHours > 0.0) ?
+          site.aulCount[build] / summary.aBuilds[build].dDeviceHours : 0.0;
+      }
+      site.dShareP = cmTwoProportionTest(site.aulCount[0], aulReports[0], site.aulCount[1], aulReports[1],
+                                         &site.dShareZ);
+      site.dRateP = cmPoissonRateTest(site.aulCount[0], dBaseHours, site.aulCount[1], dNewHours);
+      site.uFlags = 0;
+      if (site.dShareP < summary.dSiteAlpha) {
+        site.uFlags |= CM_REGRESSION_SHARE;
+      }
+      if (site.dRateP < summary.dSiteAlpha) {
+        site.uFlags |= CM_REGRESSION_RATE;
+      }
+      if ((site.aulCount[0] == 0) && (site.aulCount[1] != 0)) {
+        site.uFlags |= CM_REGRESSION_NEW_SITE;
+      }
+      pComparison->sites.push_back(site);
+    }
+    std::sort(pComparison->sites.begin(), pComparison->sites.end(), isBefore);
+  }
+}
+
+double cmTwoProportionTest(unsigned long x1, unsigned long n1, unsigned long x2, unsigned long n2, double *pZ) {
+  double dZ = 0.0;
+  double dP = 1.0;
+  if ((n1 != 0) && (n2 != 0) && (x1 <= n1) && (x2 <= n2)) {
+    double dPooled = (double)(x1 + x2) / ((double)n1 + n2);
+    double dError = sqrt(dPooled * (1.0 - dPooled) * ((1.0 / n1) + (1.0 / n2)));
+    if (dError > 0.0) {
+      dZ = (((double)x2 / n2) - ((double)x1 / n1)) / dError;
+      dP = 0.5 * erfc(dZ / sqrt(2.0));
+    }
+  }
+  if (pZ != NULL) {
+    *pZ = dZ;
+  }
+  return dP;
+}
+
+double cmPoissonRateTest(unsigned long x1, double t1, unsigned long x2, double t2) {
+  if ((t1 <= 0.0) || (t2 <= 0.0)) {
+    return 1.0;
+  }
+  return binomialUpperTail(x1 + x2, x2, t2 / (t1 + t2));
+}
+
+int cmCompareBuilds(const CMTable *pTable, uint16_t uBase, uint16_t uNew, double dAlpha,
+                    CMComparison **ppComparison) {
+  *ppComparison = NULL;
+  if (!(dAlpha > 0.0) || !(dAlpha < 1.0)) {
+    return CM_ERR_ARGUMENT;
+  }
+
+  CMComparison *pComparison = new (std::nothrow) CMComparison;
+  if (pComparison == NULL) {
+    return CM_ERR_MEMORY;
+  }
+  try {
+    compare(pTable, uBase, uNew, dAlpha, pComparison);
+  }
+  catch (const std::bad_alloc &) {
+    delete pComparison;
+    return CM_ERR_MEMORY;
+  }
+
+  if ((pComparison->summary.aBuilds[0].ulReports == 0) || (pComparison->summary.aBuilds[1].ulReports == 0)) {
+    delete pComparison;
+    return CM_ERR_ARGUMENT;
+  }
+  *ppComparison = pComparison;
+  return CM_OK;
+}
+
+void cmComparisonFree(CMComparison *pComparison) {
+  delete pComparison;
+}
+
+void cmComparisonSummary(const CMComparison *pComparison, struct CMComparisonSummary *pSummary) {
+  *pSummary = pComparison->summary;
+}
+
+int cmComparisonGetSite(const CMComparison *pComparison, size_t index, struct CMSiteComparison *pSite) {
+  if (index >= pComparison->sites.size()) {
+    return CM_ERR_ARGUMENT;
+  }
+  *pSite = pComparison->sites[index];
+  return CM_OK;
+}
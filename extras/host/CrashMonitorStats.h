@@ -0,0 +1,192 @@
+/**
+ * CrashMonitorStats.h
+ * Version 1.4
+ * Author
+ *  Cyrus Brunner
+ *
+ * Compares the crashes of two firmware builds (see setBuildId()). For each
+ * build, the rate is the number of reports per device-hour, with the summed
+ * uptime of the reports as the exposure: the watchdog resets the device, so
+ * each report's uptime is the run time since the previous one (a lower bound
+ * when devices also power cycle). For each crash site, the share of the
+ * build's reports and the rate are compared. A site is flagged as a regression
+ * when its share went up by more than a one-sided two-proportion z-test, or
+ * its rate by more than a one-sided exact Poisson rate test, would explain by
+ * chance, with the significance level split over all the tests (Bonferroni).
+ */
+
+#ifndef CrashMonitorStats_h
+#define CrashMonitorStats_h
+
+#include <stddef.h>
+#include <stdint.h>
+#include "CrashMonitorHost.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief What got worse.
+ */
+enum ECMRegression
+{
+  CM_REGRESSION_SHARE = 0x01,
+  CM_REGRESSION_RATE = 0x02,
+  CM_REGRESSION_NEW_SITE = 0x04
+};
+
+/**
+ * @brief The totals of a build.
+ */
+struct CMBuildSummary
+{
+  uint16_t uBuild;
+  unsigned long ulReports;
+
+  /**
+   * @brief The summed uptime of the reports, in hours.
+   */
+  double dDeviceHours;
+
+  /**
+   * @brief Reports per device-hour (0 if there is no exposure).
+   */
+  double dRate;
+};
+
+/**
+ * @brief A crash site: the byte address a hang (or a user report) was at, the
+ * address of a corrupt canary, or just the type for flash corruption.
+ */
+struct CMSite
+{
+  uint8_t uType;
+  uint32_t ulAddress;
+};
+
+/**
+ * @brief A site in both builds. Index 0 is the base build, 1 the new one.
+ */
+struct CMSiteComparison
+{
+  struct CMSite site;
+  unsigned long aulCount[2];
+  double adShare[2];
+  double adRate[2];
+
+  /**
+   * @brief The z statistic of the share difference, and its one-sided
+   * p-value (share went up).
+   */
+  double dShareZ;
+  double dShareP;
+
+  /**
+   * @brief The one-sided p-value of the rate going up.
+   */
+  double dRateP;
+
+  /**
+   * @brief See ECMRegression.
+   */
+  uint8_t uFlags;
+};
+
+/**
+ * @brief The whole comparison.
+ */
+struct CMComparisonSummary
+{
+  struct CMBuildSummary aBuilds[2];
+
+  /**
+   * @brief The new rate over the base rate, and the one-sided p-value of the
+   * overall rate going up.
+   */
+  double dRateRatio;
+  double dRateP;
+
+  /**
+   * @brief CM_REGRESSION_RATE if the overall rate went up significantly.
+   */
+  uint8_t uFlags;
+
+  /**
+   * @brief The per-site significance level (alpha over the number of tests).
+   */
+  double dSiteAlpha;
+
+  size_t siteCount;
+};
+
+/**
+ * @brief A comparison (opaque).
+ */
+typedef struct CMComparison CMComparison;
+
+/**
+ * @brief Compares two builds. Reports from other builds are ignored, so a
+ * whole fleet's history can be passed in one table.
+ * @param  pTable        The reports.
+ * @param  uBase         The build to compare against.
+ * @param  uNew          The build to check.
+ * @param  dAlpha        The significance level (ie. 0.05).
+ * @param  ppComparison  Receives the comparison.
+ * @return               CM_OK, CM_ERR_ARGUMENT if either build has no reports
+ *                       or alpha is not in (0, 1), or CM_ERR_MEMORY.
+ */
+int cmCompareBuilds(const CMTable *pTable, uint16_t uBase, uint16_t uNew, double dAlpha,
+                    CMComparison **ppComparison);
+
+/**
+ * @brief Frees a comparison.
+ * @param pComparison The comparison (may be NULL).
+ */
+void cmComparisonFree(CMComparison *pComparison);
+
+/**
+ * @brief Gets the totals.
+ * @param pComparison The comparison.
+ * @param pSummary    Receives the totals.
+ */
+void cmComparisonSummary(const CMComparison *pComparison, struct CMComparisonSummary *pSummary);
+
+/**
+ * @brief Gets a site. Regressions come first, then the rest by p-value.
+ * @param  pComparison The comparison.
+ * @param  index       The site.
+ * @param  pSite       Receives the site.
+ * @return             CM_OK or CM_ERR_ARGUMENT if the site does not exist.
+ */
+int cmComparisonGetSite(const CMComparison *pComparison, size_t index, struct CMSiteComparison *pSite);
+
+/**
+ * @brief The one-sided two-proportion z-test: whether x2 / n2 is bigger than
+ * x1 / n1.
+ * @param  x1 The base count.
+ * @param  n1 The base total.
+ * @param  x2 The new count.
+ * @param  n2 The new total.
+ * @param  pZ Receives the z statistic (may be NULL).
+ * @return    The p-value (1 if it can't be tested).
+ */
+double cmTwoProportionTest(unsigned long x1, unsigned long n1, unsigned long x2, unsigned long n2, double *pZ);
+
+/**
+ * @brief The one-sided exact Poisson rate test: whether x2 events in t2 is a
+ * higher rate than x1 events in t1. Given x1 + x2 events, x2 is binomial with
+ * p = t2 / (t1 + t2) if the rates are the same.
+ * @param  x1 The base count.
+ * @param  t1 The base exposure.
+ * @param  x2 The new count.
+ * @param  t2 The new exposure.
+ * @return    The p-value (1 if it can't be tested).
+ */
+double cmPoissonRateTest(unsigned long x1, double t1, unsigned long x2, double t2);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
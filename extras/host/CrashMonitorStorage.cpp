@@ -0,0 +1,461 @@
+/**
+ * CrashMonitorStorage.cpp
+ * Version 1.4
+ * Author
+ *  Cyrus Brunner
+ *
+ * Simulated storage for comparing backends on the host.
+ */
+
+#include "CrashMonitorStorage.h"
+#include <string.h>
+#include <algorithm>
+#include <new>
+#include <vector>
+#include "SdRawLayout.h"
+
+// An SPI byte at F_CPU / 2 on a 16MHz AVR, and the chip select (plus the
+// call) around each transaction.
+#define SPI_BYTE_US 1.0
+#define SPI_SELECT_US 1.0
+
+// ATmega328P: eeprom_read_byte() halts the CPU for 4 cycles, and with the call
+// takes about 8. A write (erase and write) takes 3.3ms, timed by the internal
+// RC oscillator, which is only calibrated to 10% at the factory.
+#define EEPROM_READ_US 0.5
+#define EEPROM_WRITE_US 3300.0
+#define EEPROM_WRITE_MAX_US 3630.0
+#define EEPROM_ENDURANCE 1e5
+
+// MB85RS64V: READ/WRITE opcode plus a 2 byte address, WREN before each write.
+// There is no write cycle time.
+#define FRAM_ADDRESS_BYTES 2
+#define FRAM_ENDURANCE 1e12
+
+// W25Q32JV: 3 byte addresses, 256 byte pages, 4KB sectors.
+#define NOR_ADDRESS_BYTES 3
+#define NOR_PAGE_SIZE 256
+#define NOR_SECTOR_SIZE 4096
+#define NOR_PROGRAM_US 400.0
+#define NOR_PROGRAM_MAX_US 3000.0
+#define NOR_ERASE_US 45000.0
+#define NOR_ERASE_MAX_US 400000.0
+#define NOR_ENDURANCE 1e5
+
+// SD in SPI mode: a 6 byte command and its response, then the data token, 512
+// bytes and the CRC. The read access and write busy times vary from card to
+// card; the maximums are the timeouts of the SD specification (SDHC).
+#define SD_BLOCK_SIZE 512
+#define SD_COMMAND_BYTES 7
+#define SD_READ_US 100.0
+#define SD_READ_MAX_US 100000.0
+#define SD_BUSY_US 1000.0
+#define SD_BUSY_MAX_US 250000.0
+
+struct CMStorage
+{
+  uint8_t uKind;
+  uint8_t uRecordSize;
+  std::vector<uint8_t> memory;
+  std::vector<uint32_t> cycles;
+  uint32_t ulUnitSize;
+  double dEndurance;
+  CMStorageTime time;
+  uint64_t ullBytesWritten;
+};
+
+namespace
+{
+  const char *const apNames[CM_STORAGE_KIND_COUNT] = { "EEPROM", "FRAM", "NOR", "SD" };
+
+  bool validLayout(const CMStorageLayout *pLayout) {
+    return (pLayout != NULL) && (pLayout->uMaxEntries != 0) && (pLayout->uRecordSize != 0);
+  }
+
+  size_t storeSize(const CMStorageLayout *pLayout) {
+    return CM_HEADER_SIZE + ((size_t)pLayout->uMaxEntries * pLayout->uRecordSize) + pLayout->uTraceSize;
+  }
+
+  void spend(CMStorage *pStorage, double dTypicalUs, double dMaxUs) {
+    pStorage->time.dTypicalUs += dTypicalUs;
+    pStorage->time.dMaxUs += dMaxUs;
+  }
+
+  void spendSpi(CMStorage *pStorage, size_t bytes) {
+    double dUs = SPI_SELECT_US + (bytes * SPI_BYTE_US);
+    spend(pStorage, dUs, dUs);
+  }
+
+  // NOR flash.
+
+  void norProgram(CMStorage *pStorage, size_t address, const uint8_t *puData, size_t size) {
+    // One page program (and WREN) per page touched.
+    while (size > 0) {
+      size_t chunk = std::min(size, NOR_PAGE_SIZE - (address % NOR_PAGE_SIZE));
+      for (size_t index = 0; index < chunk; ++index) {
+        pStorage->memory[address + index] &= puData[index];
+      }
+      spendSpi(pStorage, 1);
+      spendSpi(pStorage, 1 + NOR_ADDRESS_BYTES + chunk);
+      spend(pStorage, NOR_PROGRAM_US, NOR_PROGRAM_MAX_US);
+      pStorage->ullBytesWritten += chunk;
+      address += chunk;
+      puData += chunk;
+      size -= chunk;
+    }
+  }
+
+  void norWrite(CMStorage *pStorage, size_t address, const uint8_t *puData, size_t size) {
+    // Programming can only clear bits.
+    bool bProgram = true;
+    for (size_t index = 0; bProgram && (index < size); ++index) {
+      bProgram = (pStorage->memory[address + index] & puData[index]) == puData[index];
+    }
+    if (bProgram) {
+      norProgram(pStorage, address, puData, size);
+      return;
+    }
+
+    // Read the sector, erase it and program it back with the new data.
+    size_t sector = address / NOR_SECTOR_SIZE;
+    size_t sectorAddress = sector * NOR_SECTOR_SIZE;
+    spendSpi(pStorage, 1 + NOR_ADDRESS_BYTES + NOR_SECTOR_SIZE);
+    uint8_t auSector[NOR_SECTOR_SIZE];
+    memcpy(auSector, &pStorage->memory[sectorAddress], NOR_SECTOR_SIZE);
+    memcpy(auSector + (address - sectorAddress), puData, size);
+
+    spendSpi(pStorage, 1);
+    spendSpi(pStorage, 1 + NOR_ADDRESS_BYTES);
+    spend(pStorage, NOR_ERASE_US, NOR_ERASE_MAX_US);
+    memset(&pStorage->memory[sectorAddress], 0xff, NOR_SECTOR_SIZE);
+    ++pStorage->cycles[sector];
+
+    for (size_t page = 0; page < NOR_SECTOR_SIZE; page += NOR_PAGE_SIZE) {
+      const uint8_t *puPage = auSector + page;
+      bool bErased = true;
+      for (size_t index = 0; bErased && (index < NOR_PAGE_SIZE); ++index) {
+        bErased = puPage[index] == 0xff;
+      }
+      if (!bErased) {
+        norProgram(pStorage, sectorAddress + page, puPage, NOR_PAGE_SIZE);
+      }
+    }
+  }
+
+  // SD card, block by block as SdRawStorage does.
+
+  void sdReadBlock(CMStorage *pStorage, uint16_t uBlock, uint8_t uOffset, uint8_t *puData, uint8_t uSize) {
+    spendSpi(pStorage, SD_COMMAND_BYTES + 1 + SD_BLOCK_SIZE + 2);
+    spend(pStorage, SD_READ_US, SD_READ_MAX_US);
+    memcpy(puData, &pStorage->memory[((size_t)uBlock * SD_BLOCK_SIZE) + uOffset], uSize);
+  }
+
+  void sdWriteBlock(CMStorage *pStorage, uint16_t uBlock, const uint8_t *puData, uint8_t uSize) {
+    // The rest of the block is padded with zeros.
+    spendSpi(pStorage, SD_COMMAND_BYTES + 2 + SD_BLOCK_SIZE + 3);
+    spend(pStorage, SD_BUSY_US, SD_BUSY_MAX_US);
+    uint8_t *puBlock = &pStorage->memory[(size_t)uBlock * SD_BLOCK_SIZE];
+    memset(puBlock, 0, SD_BLOCK_SIZE);
+    memcpy(puBlock, puData, uSize);
+    ++pStorage->cycles[uBlock];
+    pStorage->ullBytesWritten += SD_BLOCK_SIZE;
+  }
+
+  // The device readSdRaw() and writeSdRaw() go through, so the simulator
+  // reads and writes slots with the same code as SdRawStorage.
+  struct CSdCard
+  {
+    CMStorage *pStorage;
+
+    void readBlock(uint16_t uBlock, uint8_t uOffset, uint8_t *puData, uint8_t uSize) {
+      sdReadBlock(pStorage, uBlock, uOffset, puData, uSize);
+    }
+
+    void writeBlock(uint16_t uBlock, const uint8_t *puData, uint8_t uSize) {
+      sdWriteBlock(pStorage, uBlock, puData, uSize);
+    }
+  };
+
+  uint16_t sdBlockCount(const CMStorage *pStorage) {
+    return (uint16_t)(pStorage->memory.size() / SD_BLOCK_SIZE);
+  }
+
+  // CrashMonitor::loadHeader().
+  void loadHeader(CMStorage *pStorage, const CMStorageLayout *pLayout, uint8_t auHeader[CM_HEADER_SIZE]) {
+    cmStorageRead(pStorage, 0, auHeader, CM_HEADER_SIZE);
+    if ((auHeader[2] != CM_REPORT_LAYOUT_VERSION) || (auHeader[3] != pLayout->uRecordSize)) {
+      auHeader[0] = 0;
+      auHeader[1] = 0;
+      auHeader[2] = CM_REPORT_LAYOUT_VERSION;
+      auHeader[3] = pLayout->uRecordSize;
+    }
+    else if (auHeader[0] > pLayout->uMaxEntries) {
+      auHeader[0] = pLayout->uMaxEntries;
+    }
+    if (auHeader[1] >= pLayout->uMaxEntries) {
+      auHeader[1] = 0;
+    }
+  }
+
+  int recordAddress(const CMStorageLayout *pLayout, uint8_t uSlot) {
+    return CM_HEADER_SIZE + (uSlot * pLayout->uRecordSize);
+  }
+
+  int traceAddress(const CMStorageLayout *pLayout) {
+    return recordAddress(pLayout, pLayout->uMaxEntries);
+  }
+}
+
+const char *cmStorageName(uint8_t uKind) {
+  return (uKind < CM_STORAGE_KIND_COUNT) ? apNames[uKind] : NULL;
+}
+
+int cmStorageCreate(uint8_t uKind, const struct CMStorageLayout *pLayout, CMStorage **ppStorage) {
+  *ppStorage = NULL;
+  if ((uKind >= CM_STORAGE_KIND_COUNT) || !validLayout(pLayout)) {
+    return CM_ERR_ARGUMENT;
+  }
+
+  CMStorage *pStorage = new (std::nothrow) CMStorage();
+  if (pStorage == NULL) {
+    return CM_ERR_MEMORY;
+  }
+  pStorage->uKind = uKind;
+  pStorage->uRecordSize = pLayout->uRecordSize;
+  size_t size = storeSize(pLayout);
+  uint8_t uErased = 0xff;
+  switch (uKind) {
+    case CM_STORAGE_EEPROM:
+      pStorage->ulUnitSize = 1;
+      pStorage->dEndurance = EEPROM_ENDURANCE;
+      break;
+    case CM_STORAGE_FRAM:
+      pStorage->ulUnitSize = 1;
+      pStorage->dEndurance = FRAM_ENDURANCE;
+      break;
+    case CM_STORAGE_NOR:
+      pStorage->ulUnitSize = NOR_SECTOR_SIZE;
+      pStorage->dEndurance = NOR_ENDURANCE;
+      size = ((size + NOR_SECTOR_SIZE - 1) / NOR_SECTOR_SIZE) * NOR_SECTOR_SIZE;
+      break;
+    default:
+      // The header, each record and the trace get a block.
+      pStorage->ulUnitSize = SD_BLOCK_SIZE;
+      pStorage->dEndurance = 0.0;
+      size = (size_t)(2 + pLayout->uMaxEntries) * SD_BLOCK_SIZE;
+      uErased = 0;
+      break;
+  }
+
+  try {
+    pStorage->memory.assign(size, uErased);
+    pStorage->cycles.assign(size / pStorage->ulUnitSize, 0);
+  }
+  catch (const std::bad_alloc &) {
+    delete pStorage;
+    return CM_ERR_MEMORY;
+  }
+  *ppStorage = pStorage;
+  return CM_OK;
+}
+
+void cmStorageFree(CMStorage *pStorage) {
+  delete pStorage;
+}
+
+void cmStorageRead(CMStorage *pStorage, int address, void *pData, uint8_t uSize) {
+  uint8_t *puData = (uint8_t *)pData;
+  memset(puData, 0xff, uSize);
+  if (address < 0) {
+    return;
+  }
+
+  switch (pStorage->uKind) {
+    case CM_STORAGE_EEPROM:
+      spend(pStorage, uSize * EEPROM_READ_US, uSize * EEPROM_READ_US);
+      break;
+    case CM_STORAGE_FRAM:
+      spendSpi(pStorage, 1 + FRAM_ADDRESS_BYTES + uSize);
+      break;
+    case CM_STORAGE_NOR:
+      spendSpi(pStorage, 1 + NOR_ADDRESS_BYTES + uSize);
+      break;
+    default: {
+      CSdCard card = { pStorage };
+      Watchdog::readSdRaw(card, sdBlockCount(pStorage), CM_HEADER_SIZE, pStorage->uRecordSize, address, puData,
+                          uSize);
+      return;
+    }
+  }
+  if ((size_t)address + uSize <= pStorage->memory.size()) {
+    memcpy(puData, &pStorage->memory[address], uSize);
+  }
+}
+
+void cmStorageWrite(CMStorage *pStorage, int address, const void *pData, uint8_t uSize) {
+  const uint8_t *puData = (const uint8_t *)pData;
+  if (address < 0) {
+    return;
+  }
+  if (pStorage->uKind == CM_STORAGE_SD) {
+    CSdCard card = { pStorage };
+    uint8_t auSlot[255];
+    Watchdog::writeSdRaw(card, sdBlockCount(pStorage), CM_HEADER_SIZE, pStorage->uRecordSize, address, puData, uSize,
+                         auSlot);
+    return;
+  }
+  if ((size_t)address + uSize > pStorage->memory.size()) {
+    return;
+  }
+
+  switch (pStorage->uKind) {
+    case CM_STORAGE_EEPROM:
+      // eeprom_write_byte() erases and writes every byte, changed or not.
+      spend(pStorage, uSize * EEPROM_WRITE_US, uSize * EEPROM_WRITE_MAX_US);
+      memcpy(&pStorage->memory[address], puData, uSize);
+      for (uint8_t uByte = 0; uByte < uSize; ++uByte) {
+        ++pStorage->cycles[address + uByte];
+      }
+      pStorage->ullBytesWritten += uSize;
+      break;
+    case CM_STORAGE_FRAM:
+      spendSpi(pStorage, 1);
+      spendSpi(pStorage, 1 + FRAM_ADDRESS_BYTES + uSize);
+      memcpy(&pStorage->memory[address], puData, uSize);
+      for (uint8_t uByte = 0; uByte < uSize; ++uByte) {
+        ++pStorage->cycles[address + uByte];
+      }
+      pStorage->ullBytesWritten += uSize;
+      break;
+    default:
+      // The crash monitor never writes across a sector (its store is smaller
+      // than one unless there are a lot of big records); split if it does.
+      while (uSize > 0) {
+        size_t sectorEnd = (((size_t)address / NOR_SECTOR_SIZE) + 1) * NOR_SECTOR_SIZE;
+        uint8_t uChunk = (uint8_t)std::min((size_t)uSize, sectorEnd - address);
+        norWrite(pStorage, address, puData, uChunk);
+        address += uChunk;
+        puData += uChunk;
+        uSize -= uChunk;
+      }
+      break;
+  }
+}
+
+void cmStorageTime(const CMStorage *pStorage, struct CMStorageTime *pTime) {
+  *pTime = pStorage->time;
+}
+
+void cmStorageResetTime(CMStorage *pStorage) {
+  pStorage->time.dTypicalUs = 0.0;
+  pStorage->time.dMaxUs = 0.0;
+}
+
+void cmStorageGetWear(const CMStorage *pStorage, struct CMStorageWear *pWear) {
+  pWear->ulUnitSize = pStorage->ulUnitSize;
+  pWear->dEndurance = pStorage->dEndurance;
+  pWear->ulMaxCycles = pStorage->cycles.empty() ? 0 :
+    *std::max_element(pStorage->cycles.begin(), pStorage->cycles.end());
+  pWear->ullBytesWritten = pStorage->ullBytesWritten;
+}
+
+void cmStorageCrash(CMStorage *pStorage, const struct CMStorageLayout *pLayout, const uint8_t *puRecord,
+                    const uint8_t *puTrace) {
+  uint8_t auHeader[CM_HEADER_SIZE];
+  loadHeader(pStorage, pLayout, auHeader);
+  cmStorageWrite(pStorage, recordAddress(pLayout, auHeader[1]), puRecord, pLayout->uRecordSize);
+  if (++auHeader[1] >= pLayout->uMaxEntries) {
+    auHeader[1] = 0;
+  }
+  else {
+    ++auHeader[0];
+  }
+  cmStorageWrite(pStorage, 0, auHeader, CM_HEADER_SIZE);
+  if (pLayout->uTraceSize != 0) {
+    cmStorageWrite(pStorage, traceAddress(pLayout), puTrace, pLayout->uTraceSize);
+  }
+}
+
+uint32_t cmStorageDump(CMStorage *pStorage, const struct CMStorageLayout *pLayout) {
+  uint8_t auHeader[CM_HEADER_SIZE];
+  uint8_t auData[255];
+  loadHeader(pStorage, pLayout, auHeader);
+  uint32_t ulBytes = CM_HEADER_SIZE;
+  for (uint8_t uSlot = 0; uSlot < auHeader[0]; ++uSlot) {
+    cmStorageRead(pStorage, recordAddress(pLayout, uSlot), auData, pLayout->uRecordSize);
+    ulBytes += pLayout->uRecordSize;
+  }
+  if (pLayout->uTraceSize != 0) {
+    cmStorageRead(pStorage, traceAddress(pLayout), auData, pLayout->uTraceSize);
+    ulBytes += pLayout->uTraceSize;
+  }
+  return ulBytes;
+}
+
+void cmStorageClear(CMStorage *pStorage, const struct CMStorageLayout *pLayout) {
+  uint8_t auHeader[CM_HEADER_SIZE];
+  uint8_t auZero[255];
+  memset(auZero, 0, sizeof(auZero));
+  loadHeader(pStorage, pLayout, auHeader);
+  for (uint8_t uSlot = 0; uSlot < auHeader[0]; ++uSlot) {
+    cmStorageWrite(pStorage, recordAddress(pLayout, uSlot), auZero, pLayout->uRecordSize);
+  }
+  if (pLayout->uTraceSize != 0) {
+    cmStorageWrite(pStorage, traceAddress(pLayout), auZero, pLayout->uTraceSize);
+  }
+  auHeader[0] = 0;
+  auHeader[1] = 0;
+  cmStorageWrite(pStorage, 0, auHeader, CM_HEADER_SIZE);
+}
+
+int cmStorageBench(uint8_t uKind, const struct CMStorageLayout *pLayout, uint32_t ulCrashes,
+                   struct CMStorageResult *pResult) {
+  if (ulCrashes == 0) {
+    return CM_ERR_ARGUMENT;
+  }
+  CMStorage *pStorage;
+  int result = cmStorageCreate(uKind, pLayout, &pStorage);
+  if (result != CM_OK) {
+    return result;
+  }
+
+  // Records and traces that change from crash to crash (the address, the
+  // uptime, ...), so flash has bits to set as well as clear.
+  uint8_t auRecord[255];
+  uint8_t auTrace[255];
+  uint32_t ulState = 1;
+  CMStorageTime time;
+  double dTotalUs = 0.0;
+  pResult->dPersistMaxUs = 0.0;
+  for (uint32_t ulCrash = 0; ulCrash < ulCrashes; ++ulCrash) {
+    for (uint8_t uByte = 0; uByte < pLayout->uRecordSize; ++uByte) {
+      ulState = (ulState * 1103515245UL) + 12345UL;
+      auRecord[uByte] = (uint8_t)(ulState >> 16);
+    }
+    for (uint8_t uByte = 0; uByte < pLayout->uTraceSize; ++uByte) {
+      ulState = (ulState * 1103515245UL) + 12345UL;
+      auTrace[uByte] = (uint8_t)(ulState >> 16);
+    }
+    cmStorageResetTime(pStorage);
+    cmStorageCrash(pStorage, pLayout, auRecord, auTrace);
+    cmStorageTime(pStorage, &time);
+    dTotalUs += time.dTypicalUs;
+    pResult->dPersistMaxUs = std::max(pResult->dPersistMaxUs, time.dMaxUs);
+  }
+  pResult->dPersistUs = dTotalUs / ulCrashes;
+  pResult->ulCrashes = ulCrashes;
+  cmStorageGetWear(pStorage, &pResult->wear);
+
+  cmStorageResetTime(pStorage);
+  pResult->ulDumpBytes = cmStorageDump(pStorage, pLayout);
+  cmStorageTime(pStorage, &time);
+  pResult->dDumpUs = time.dTypicalUs;
+
+  cmStorageResetTime(pStorage);
+  cmStorageClear(pStorage, pLayout);
+  cmStorageTime(pStorage, &time);
+  pResult->dClearUs = time.dTypicalUs;
+
+  cmStorageFree(pStorage);
+  return CM_OK;
+}
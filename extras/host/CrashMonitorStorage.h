@@ -0,0 +1,242 @@
+/**
+ * CrashMonitorStorage.h
+ * Version 1.4
+ * Author
+ *  Cyrus Brunner
+ *
+ * Simulated storage for comparing backends on the host. Each simulator keeps
+ * the contents of the part, the time each access takes (typical and worst
+ * case, from the datasheet, at the SPI clock of a 16MHz AVR) and how many
+ * times each wear unit (a byte, a flash sector or a card block) has been
+ * written or erased. The reads and writes are the ones CrashMonitor makes
+ * through READFUNC and WRITEFUNC: cmStorageCrash(), cmStorageDump() and
+ * cmStorageClear() make the same calls as captureCrash(), dump() and clear().
+ *
+ * | Backend | Part                    | Access                               | Endurance |
+ * |---------|-------------------------|--------------------------------------|-----------|
+ * | EEPROM  | ATmega328P internal     | 3.3ms per byte written               | 100k      |
+ * | FRAM    | MB85RS64V (SPI)         | 1us per byte (8MHz SPI), no wait     | 10^12     |
+ * | NOR     | W25Q32JV (SPI)          | program 0.4ms (3ms max) per page,    | 100k      |
+ * |         |                         | erase 45ms (400ms max) per 4KB       |           |
+ * | SD      | SDHC card (SPI)         | 512 byte blocks, busy 1ms (250ms max)| managed   |
+ *
+ * NOR flash can only clear bits, so the simulated driver programs in place
+ * when it can and otherwise erases the sector and programs it back (keeping a
+ * copy of the sector in RAM). The SD simulator maps addresses to blocks the
+ * way SdRawStorage does.
+ */
+
+#ifndef CrashMonitorStorage_h
+#define CrashMonitorStorage_h
+
+#include <stddef.h>
+#include <stdint.h>
+#include "CrashMonitorHost.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief The simulated backends.
+ */
+enum ECMStorageKind
+{
+  CM_STORAGE_EEPROM = 0,
+  CM_STORAGE_FRAM = 1,
+  CM_STORAGE_NOR = 2,
+  CM_STORAGE_SD = 3,
+  CM_STORAGE_KIND_COUNT = 4
+};
+
+/**
+ * @brief What CrashMonitor stores: begin(0, uMaxEntries) with
+ * sizeof(CCrashReport) == uRecordSize and CRASH_MONITOR_TRACE_ENTRIES *
+ * sizeof(CTraceEntry) == uTraceSize.
+ */
+struct CMStorageLayout
+{
+  uint8_t uRecordSize;
+  uint8_t uMaxEntries;
+  uint8_t uTraceSize;
+};
+
+/**
+ * @brief Simulated time, in microseconds.
+ */
+struct CMStorageTime
+{
+  double dTypicalUs;
+  double dMaxUs;
+};
+
+/**
+ * @brief The wear of a simulated part.
+ */
+struct CMStorageWear
+{
+  /**
+   * @brief The bytes of a wear unit (1 for EEPROM and FRAM, the sector for
+   * NOR, the block for SD).
+   */
+  uint32_t ulUnitSize;
+
+  /**
+   * @brief The write (or erase) cycles a unit is rated for, or 0 if the part
+   * manages its own wear (SD).
+   */
+  double dEndurance;
+
+  /**
+   * @brief The cycles of the most worn unit.
+   */
+  uint32_t ulMaxCycles;
+
+  /**
+   * @brief The bytes written to the part (whole pages or blocks where the
+   * part writes those).
+   */
+  uint64_t ullBytesWritten;
+};
+
+/**
+ * @brief A simulated part (opaque).
+ */
+typedef struct CMStorage CMStorage;
+
+/**
+ * @brief The results of cmStorageBench().
+ */
+struct CMStorageResult
+{
+  /**
+   * @brief Persisting a report in the watchdog interrupt: the mean with
+   * typical timings, and the worst crash with the datasheet maximums.
+   */
+  double dPersistUs;
+  double dPersistMaxUs;
+
+  /**
+   * @brief Reading a full store as dump() does, and the bytes it read.
+   */
+  double dDumpUs;
+  uint32_t ulDumpBytes;
+
+  /**
+   * @brief clear() of a full store (typical).
+   */
+  double dClearUs;
+
+  /**
+   * @brief The wear after the crashes (before the dump and clear).
+   */
+  struct CMStorageWear wear;
+  uint32_t ulCrashes;
+};
+
+/**
+ * @brief Gets the name of a backend.
+ * @param  uKind See ECMStorageKind.
+ * @return       The name (ie. "EEPROM"), or NULL.
+ */
+const char *cmStorageName(uint8_t uKind);
+
+/**
+ * @brief Creates a simulated part big enough for a layout, erased.
+ * @param  uKind     See ECMStorageKind.
+ * @param  pLayout   The layout.
+ * @param  ppStorage Receives the part.
+ * @return           CM_OK, CM_ERR_ARGUMENT or CM_ERR_MEMORY.
+ */
+int cmStorageCreate(uint8_t uKind, const struct CMStorageLayout *pLayout, CMStorage **ppStorage);
+
+/**
+ * @brief Frees a part.
+ * @param pStorage The part (may be NULL).
+ */
+void cmStorageFree(CMStorage *pStorage);
+
+/**
+ * @brief Reads as a READFUNC would (addresses past the end read 0xff).
+ * @param pStorage The part.
+ * @param address  The logical address.
+ * @param pData    Receives the data.
+ * @param uSize    The number of bytes.
+ */
+void cmStorageRead(CMStorage *pStorage, int address, void *pData, uint8_t uSize);
+
+/**
+ * @brief Writes as a WRITEFUNC would (addresses past the end are ignored).
+ * @param pStorage The part.
+ * @param address  The logical address.
+ * @param pData    The data.
+ * @param uSize    The number of bytes.
+ */
+void cmStorageWrite(CMStorage *pStorage, int address, const void *pData, uint8_t uSize);
+
+/**
+ * @brief Gets the time spent since the part was created or the time reset.
+ * @param pStorage The part.
+ * @param pTime    Receives the time.
+ */
+void cmStorageTime(const CMStorage *pStorage, struct CMStorageTime *pTime);
+
+/**
+ * @brief Resets the time to 0 (the wear is kept).
+ * @param pStorage The part.
+ */
+void cmStorageResetTime(CMStorage *pStorage);
+
+/**
+ * @brief Gets the wear of a part.
+ * @param pStorage The part.
+ * @param pWear    Receives the wear.
+ */
+void cmStorageGetWear(const CMStorage *pStorage, struct CMStorageWear *pWear);
+
+/**
+ * @brief Stores a report as captureCrash() does: CrashMonitor::storeReport()
+ * (load the header, write the record into the next slot, write the header)
+ * then the trace, if any.
+ * @param pStorage The part.
+ * @param pLayout  The layout.
+ * @param puRecord The record (uRecordSize bytes).
+ * @param puTrace  The trace (uTraceSize bytes).
+ */
+void cmStorageCrash(CMStorage *pStorage, const struct CMStorageLayout *pLayout, const uint8_t *puRecord,
+                    const uint8_t *puTrace);
+
+/**
+ * @brief Reads the store as dump() does: the header, each saved record and
+ * the trace.
+ * @param  pStorage The part.
+ * @param  pLayout  The layout.
+ * @return          The bytes read.
+ */
+uint32_t cmStorageDump(CMStorage *pStorage, const struct CMStorageLayout *pLayout);
+
+/**
+ * @brief Clears the store as clear() does: zeros each saved record and the
+ * trace, then the header.
+ * @param pStorage The part.
+ * @param pLayout  The layout.
+ */
+void cmStorageClear(CMStorage *pStorage, const struct CMStorageLayout *pLayout);
+
+/**
+ * @brief Benchmarks a backend: ulCrashes crashes (with changing records, so
+ * the slots wrap), then a dump and a clear of the full store.
+ * @param  uKind     See ECMStorageKind.
+ * @param  pLayout   The layout.
+ * @param  ulCrashes The number of crashes (at least 1).
+ * @param  pResult   Receives the results.
+ * @return           CM_OK, CM_ERR_ARGUMENT or CM_ERR_MEMORY.
+ */
+int cmStorageBench(uint8_t uKind, const struct CMStorageLayout *pLayout, uint32_t ulCrashes,
+                   struct CMStorageResult *pResult);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
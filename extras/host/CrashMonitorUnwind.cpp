@@ -0,0 +1,721 @@
+/**
+ * CrashMonitorUnwind.cpp
+ * Version 1.4
+ * Author
+ *  Cyrus Brunner
+ *
+ * Unwinds report stack snapshots with the call frame information of the
+ * firmware.
+ */
+
+#include "CrashMonitorUnwind.h"
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <map>
+#include <new>
+#include <vector>
+
+// DWARF call frame instructions (DWARF 4, section 7.23).
+#define DW_CFA_advance_loc 0x40
+#define DW_CFA_offset 0x80
+#define DW_CFA_restore 0xc0
+#define DW_CFA_nop 0x00
+#define DW_CFA_set_loc 0x01
+#define DW_CFA_advance_loc1 0x02
+#define DW_CFA_advance_loc2 0x03
+#define DW_CFA_advance_loc4 0x04
+#define DW_CFA_offset_extended 0x05
+#define DW_CFA_restore_extended 0x06
+#define DW_CFA_undefined 0x07
+#define DW_CFA_same_value 0x08
+#define DW_CFA_register 0x09
+#define DW_CFA_remember_state 0x0a
+#define DW_CFA_restore_state 0x0b
+#define DW_CFA_def_cfa 0x0c
+#define DW_CFA_def_cfa_register 0x0d
+#define DW_CFA_def_cfa_offset 0x0e
+#define DW_CFA_def_cfa_expression 0x0f
+#define DW_CFA_expression 0x10
+#define DW_CFA_offset_extended_sf 0x11
+#define DW_CFA_def_cfa_sf 0x12
+#define DW_CFA_def_cfa_offset_sf 0x13
+#define DW_CFA_val_offset 0x14
+#define DW_CFA_val_offset_sf 0x15
+#define DW_CFA_val_expression 0x16
+#define DW_CFA_GNU_args_size 0x2e
+#define DW_CFA_GNU_negative_offset_extended 0x2f
+
+#define CIE_ID 0xffffffff
+#define NO_REGISTER 0xff
+
+// The unwind table file: "CMUT", the version, 3 reserved bytes, the row count
+// and the rows, all little-endian.
+#define TABLE_MAGIC "CMUT"
+#define TABLE_VERSION 1
+#define TABLE_HEADER_SIZE 12
+#define TABLE_ROW_SIZE 18
+
+struct CMUnwindTable
+{
+  std::vector<CMUnwindRow> rows;
+};
+
+namespace
+{
+  struct CReader
+  {
+    const uint8_t *p;
+    const uint8_t *pEnd;
+    bool bOk;
+
+    uint8_t u8() {
+      if (p >= pEnd) {
+        bOk = false;
+        return 0;
+      }
+      return *p++;
+    }
+
+    uint32_t le(uint8_t uSize) {
+      uint32_t ulValue = 0;
+      for (uint8_t uByte = 0; uByte < uSize; ++uByte) {
+        ulValue |= (uint32_t)u8() << (uByte * 8);
+      }
+      return ulValue;
+    }
+
+    uint32_t uleb() {
+      uint32_t ulValue = 0;
+      uint8_t uShift = 0;
+      uint8_t uByte;
+      do {
+        uByte = u8();
+        if (uShift < 32) {
+          ulValue |= (uint32_t)(uByte & 0x7f) << uShift;
+        }
+        uShift += 7;
+      } while (bOk && (uByte & 0x80));
+      return ulValue;
+    }
+
+    int32_t sleb() {
+      int32_t nValue = 0;
+      uint8_t uShift = 0;
+      uint8_t uByte;
+      do {
+        uByte = u8();
+        if (uShift < 32) {
+          nValue |= (int32_t)((uint32_t)(uByte & 0x7f) << uShift);
+        }
+        uShift += 7;
+      } while (bOk && (uByte & 0x80));
+      if ((uShift < 32) && (uByte & 0x40)) {
+        nValue |= -(int32_t)(1u << uShift);
+      }
+      return nValue;
+    }
+
+    void skip(uint32_t ulSize) {
+      if ((uint32_t)(pEnd - p) < ulSize) {
+        bOk = false;
+        p = pEnd;
+      }
+      else {
+        p += ulSize;
+      }
+    }
+  };
+
+  struct CCie
+  {
+    uint32_t ulCodeAlign;
+    int32_t nDataAlign;
+    uint32_t ulReturnRegister;
+    uint8_t uAddressSize;
+    const uint8_t *puInstructions;
+    const uint8_t *puEnd;
+  };
+
+  // Where a register was saved, relative to the CFA.
+  struct CRule
+  {
+    bool bSaved;
+    int32_t nOffset;
+  };
+
+  struct CState
+  {
+    uint32_t ulCfaRegister;
+    int32_t nCfaOffset;
+    bool bCfaValid;
+    CRule returnRule;
+    CRule yLowRule;
+    CRule yHighRule;
+  };
+
+  // The rules this unwinder cares about: the return address and Y.
+  CRule *getRule(CState &state, const CCie &cie, uint32_t ulRegister) {
+    if (ulRegister == cie.ulReturnRegister) {
+      return &state.returnRule;
+    }
+    if (ulRegister == CM_DWARF_Y_LOW) {
+      return &state.yLowRule;
+    }
+    if (ulRegister == CM_DWARF_Y_HIGH) {
+      return &state.yHighRule;
+    }
+    return NULL;
+  }
+
+  void setRule(CState &state, const CCie &cie, uint32_t ulRegister, bool bSaved, int32_t nOffset) {
+    CRule *pRule = getRule(state, cie, ulRegister);
+    if (pRule != NULL) {
+      pRule->bSaved = bSaved;
+      pRule->nOffset = nOffset;
+    }
+  }
+
+  void restoreRule(CState &state, const CState &initial, const CCie &cie, uint32_t ulRegister) {
+    CRule *pRule = getRule(state, cie, ulRegister);
+    if (pRule != NULL) {
+      CState copy = initial;
+      *pRule = *getRule(copy, cie, ulRegister);
+    }
+  }
+
+  bool fits16(int32_t nValue) {
+    return (nValue >= -32768) && (nValue <= 32767);
+  }
+
+  void emitRow(std::vector<CMUnwindRow> &rows, uint32_t ulStart, uint32_t ulEnd, const CState &state) {
+    if ((ulEnd <= ulStart) || !state.bCfaValid || !fits16(state.nCfaOffset) ||
+        !fits16(state.returnRule.nOffset) || !fits16(state.yLowRule.nOffset) || !fits16(state.yHighRule.nOffset)) {
+      return;
+    }
+
+    CMUnwindRow row;
+    row.ulStart = ulStart;
+    row.ulEnd = ulEnd;
+    row.uCfaRegister = (state.ulCfaRegister <= 0xff) ? (uint8_t)state.ulCfaRegister : NO_REGISTER;
+    row.uFlags = 0;
+    row.nCfaOffset = (int16_t)state.nCfaOffset;
+    row.nReturnOffset = (int16_t)state.returnRule.nOffset;
+    row.nYLowOffset = (int16_t)state.yLowRule.nOffset;
+    row.nYHighOffset = (int16_t)state.yHighRule.nOffset;
+    if (state.returnRule.bSaved) {
+      row.uFlags |= CM_UNWIND_RETURN_SAVED;
+    }
+    if (state.yLowRule.bSaved) {
+      row.uFlags |= CM_UNWIND_Y_LOW_SAVED;
+    }
+    if (state.yHighRule.bSaved) {
+      row.uFlags |= CM_UNWIND_Y_HIGH_SAVED;
+    }
+    rows.push_back(row);
+  }
+
+  // Runs call frame instructions. With pRows NULL (the CIE's initial
+  // instructions) no rows are emitted.
+  bool execute(const CCie &cie, const uint8_t *puStart, const uint8_t *puEnd, CState &state, const CState &initial,
+               uint32_t &ulLocation, std::vector<CMUnwindRow> *pRows) {
+    CReader reader = { puStart, puEnd, true };
+    std::vector<CState> remembered;
+    while (reader.bOk && (reader.p < reader.pEnd)) {
+      uint8_t uOpcode = reader.u8();
+      uint32_t ulAdvance = 0;
+      bool bAdvance = false;
+      uint32_t ulRegister;
+      switch (uOpcode & 0xc0) {
+        case DW_CFA_advance_loc:
+          ulAdvance = (uOpcode & 0x3f) * cie.ulCodeAlign;
+          bAdvance = true;
+          break;
+        case DW_CFA_offset:
+          setRule(state, cie, uOpcode & 0x3f, true, (int32_t)reader.uleb() * cie.nDataAlign);
+          break;
+        case DW_CFA_restore:
+          restoreRule(state, initial, cie, uOpcode & 0x3f);
+          break;
+        default:
+          switch (uOpcode) {
+            case DW_CFA_nop:
+              break;
+            case DW_CFA_set_loc: {
+              uint32_t ulNew = reader.le(cie.uAddressSize);
+              if (pRows != NULL) {
+                emitRow(*pRows, ulLocation, ulNew, state);
+              }
+              ulLocation = ulNew;
+              break;
+            }
+            case DW_CFA_advance_loc1:
+              ulAdvance = reader.u8() * cie.ulCodeAlign;
+              bAdvance = true;
+              break;
+            case DW_CFA_advance_loc2:
+              ulAdvance = reader.le(2) * cie.ulCodeAlign;
+              bAdvance = true;
+              break;
+            case DW_CFA_advance_loc4:
+              ulAdvance = reader.le(4) * cie.ulCodeAlign;
+              bAdvance = true;
+              break;
+            case DW_CFA_offset_extended:
+              ulRegister = reader.uleb();
+              setRule(state, cie, ulRegister, true, (int32_t)reader.uleb() * cie.nDataAlign);
+              break;
+            case DW_CFA_offset_extended_sf:
+              ulRegister = reader.uleb();
+              setRule(state, cie, ulRegister, true, reader.sleb() * cie.nDataAlign);
+              break;
+            case DW_CFA_GNU_negative_offset_extended:
+              ulRegister = reader.uleb();
+              setRule(state, cie, ulRegister, true, -(int32_t)reader.uleb() * cie.nDataAlign);
+              break;
+            case DW_CFA_restore_extended:
+              restoreRule(state, initial, cie, reader.uleb());
+              break;
+            case DW_CFA_undefined:
+            case DW_CFA_same_value:
+              setRule(state, cie, reader.uleb(), false, 0);
+              break;
+            case DW_CFA_register:
+              // Kept in another register, which a stack snapshot can't tell.
+              setRule(state, cie, reader.uleb(), false, 0);
+              reader.uleb();
+              break;
+            case DW_CFA_remember_state:
+              remembered.push_back(state);
+              break;
+            case DW_CFA_restore_state:
+              if (remembered.empty()) {
+                return false;
+              }
+              state = remembered.back();
+              remembered.pop_back();
+              break;
+            case DW_CFA_def_cfa:
+              state.ulCfaRegister = reader.uleb();
+              state.nCfaOffset = (int32_t)reader.uleb();
+              state.bCfaValid = true;
+              break;
+            case DW_CFA_def_cfa_sf:
+              state.ulCfaRegister = reader.uleb();
+              state.nCfaOffset = reader.sleb() * cie.nDataAlign;
+              state.bCfaValid = true;
+              break;
+            case DW_CFA_def_cfa_register:
+              state.ulCfaRegister = reader.uleb();
+              break;
+            case DW_CFA_def_cfa_offset:
+              state.nCfaOffset = (int32_t)reader.uleb();
+              break;
+            case DW_CFA_def_cfa_offset_sf:
+              state.nCfaOffset = reader.sleb() * cie.nDataAlign;
+              break;
+            case DW_CFA_def_cfa_expression:
+              // Not something a table row can hold.
+              state.bCfaValid = false;
+              reader.skip(reader.uleb());
+              break;
+            case DW_CFA_expression:
+            case DW_CFA_val_expression:
+              setRule(state, cie, reader.uleb(), false, 0);
+              reader.skip(reader.uleb());
+              break;
+            case DW_CFA_val_offset:
+            case DW_CFA_val_offset_sf:
+              setRule(state, cie, reader.uleb(), false, 0);
+              reader.uleb();
+              break;
+            case DW_CFA_GNU_args_size:
+              reader.uleb();
+              break;
+            default:
+              return false;
+          }
+      }
+
+      if (bAdvance) {
+        if (pRows != NULL) {
+          emitRow(*pRows, ulLocation, ulLocation + ulAdvance, state);
+        }
+        ulLocation += ulAdvance;
+      }
+    }
+    return reader.bOk;
+  }
+
+  bool parseCie(const uint8_t *puEntry, const uint8_t *puEnd, CCie &cie) {
+    CReader reader = { puEntry, puEnd, true };
+    uint8_t uVersion = reader.u8();
+    if ((uVersion != 1) && (uVersion != 3) && (uVersion != 4)) {
+      return false;
+    }
+
+    // Augmentations (ie. "eh") only show up in .eh_frame, which avr-gcc
+    // doesn't emit.
+    if (reader.u8() != 0) {
+      return false;
+    }
+    cie.uAddressSize = 4;
+    if (uVersion == 4) {
+      cie.uAddressSize = reader.u8();
+      reader.u8();
+      if ((cie.uAddressSize != 2) && (cie.uAddressSize != 4)) {
+        return false;
+      }
+    }
+    cie.ulCodeAlign = reader.uleb();
+    cie.nDataAlign = reader.sleb();
+    cie.ulReturnRegister = (uVersion == 1) ? reader.u8() : reader.uleb();
+    cie.puInstructions = reader.p;
+    cie.puEnd = puEnd;
+    return reader.bOk;
+  }
+
+  bool isBefore(const CMUnwindRow &a, const CMUnwindRow &b) {
+    return a.ulStart < b.ulStart;
+  }
+
+  int16_t readLe16s(const uint8_t *puData) {
+    return (int16_t)(uint16_t)(puData[0] | (puData[1] << 8));
+  }
+
+  uint32_t readLe32(const uint8_t *puData) {
+    return (uint32_t)puData[0] | ((uint32_t)puData[1] << 8) |
+      ((uint32_t)puData[2] << 16) | ((uint32_t)puData[3] << 24);
+  }
+
+  void writeLe16(uint8_t *puData, uint16_t uValue) {
+    puData[0] = (uint8_t)uValue;
+    puData[1] = (uint8_t)(uValue >> 8);
+  }
+
+  void writeLe32(uint8_t *puData, uint32_t ulValue) {
+    writeLe16(puData, (uint16_t)ulValue);
+    writeLe16(puData + 2, (uint16_t)(ulValue >> 16));
+  }
+
+  int parseFrames(const uint8_t *puData, size_t size, CMUnwindTable *pTable) {
+    // CIEs first, since FDEs refer to them by offset.
+    std::map<uint32_t, CCie> cies;
+    size_t offset = 0;
+    while (size - offset >= 4) {
+      uint32_t ulLength = readLe32(puData + offset);
+      if (ulLength == 0xffffffff) {
+        // 64-bit DWARF.
+        return CM_ERR_FORMAT;
+      }
+      if ((ulLength < 4) || (ulLength > size - offset - 4)) {
+        if (ulLength == 0) {
+          offset += 4;
+          continue;
+        }
+        return CM_ERR_FORMAT;
+      }
+
+      const uint8_t *puEntry = puData + offset + 8;
+      const uint8_t *puEnd = puData + offset + 4 + ulLength;
+      uint32_t ulId = readLe32(puData + offset + 4);
+      if (ulId == CIE_ID) {
+        CCie cie;
+        if (parseCie(puEntry, puEnd, cie)) {
+          cies[(uint32_t)offset] = cie;
+        }
+      }
+      offset += 4 + ulLength;
+    }
+
+    offset = 0;
+    while (size - offset >= 4) {
+      uint32_t ulLength = readLe32(puData + offset);
+      if (ulLength == 0) {
+        offset += 4;
+        continue;
+      }
+
+      const uint8_t *puEntry = puData + offset + 8;
+      const uint8_t *puEnd = puData + offset + 4 + ulLength;
+      uint32_t ulId = readLe32(puData + offset + 4);
+      offset += 4 + ulLength;
+      std::map<uint32_t, CCie>::const_iterator cie = cies.find(ulId);
+      if ((ulId == CIE_ID) || (cie == cies.end())) {
+        // A CIE, or an FDE whose CIE couldn't be used.
+        continue;
+      }
+
+      CReader reader = { puEntry, puEnd, true };
+      uint32_t ulLocation = reader.le(cie->second.uAddressSize);
+      uint32_t ulRange = reader.le(cie->second.uAddressSize);
+      if (!reader.bOk) {
+        return CM_ERR_FORMAT;
+      }
+      if (ulLocation == 0) {
+        // A function dropped by --gc-sections keeps its FDE, relocated to 0.
+        continue;
+      }
+
+      // The CIE's initial instructions give the state at the function entry
+      // (CFA = SP + the size of the return address).
+      uint32_t ulEnd = ulLocation + ulRange;
+      uint32_t ulIgnored = ulLocation;
+      CState initial;
+      memset(&initial, 0, sizeof(initial));
+      initial.ulCfaRegister = NO_REGISTER;
+      if (!execute(cie->second, cie->second.puInstructions, cie->second.puEnd, initial, initial, ulIgnored, NULL)) {
+        return CM_ERR_FORMAT;
+      }
+
+      CState state = initial;
+      if (!execute(cie->second, reader.p, puEnd, state, initial, ulLocation, &pTable->rows)) {
+        return CM_ERR_FORMAT;
+      }
+      emitRow(pTable->rows, ulLocation, ulEnd, state);
+    }
+
+    std::stable_sort(pTable->rows.begin(), pTable->rows.end(), isBefore);
+    return CM_OK;
+  }
+
+  // Reads bytes from the snapshot, which starts at uBase.
+  bool readSnapshot(const CMReport &report, uint32_t ulAddress, uint8_t uSize, uint32_t &ulValue, bool bBigEndian) {
+    uint32_t ulBase = (uint32_t)report.uStackPointer + 1;
+    if ((ulAddress < ulBase) || (ulAddress + uSize > ulBase + report.uStackBytes)) {
+      return false;
+    }
+
+    ulValue = 0;
+    for (uint8_t uByte = 0; uByte < uSize; ++uByte) {
+      uint8_t uValue = report.auStack[ulAddress - ulBase + uByte];
+      if (bBigEndian) {
+        ulValue = (ulValue << 8) | uValue;
+      }
+      else {
+        ulValue |= (uint32_t)uValue << (uByte * 8);
+      }
+    }
+    return true;
+  }
+}
+
+int cmUnwindTableParse(const uint8_t *puData, size_t size, CMUnwindTable **ppTable) {
+  *ppTable = NULL;
+  CMUnwindTable *pTable = new (std::nothrow) CMUnwindTable;
+  if (pTable == NULL) {
+    return CM_ERR_MEMORY;
+  }
+
+  int result;
+  try {
+    result = parseFrames(puData, size, pTable);
+  }
+  catch (const std::bad_alloc &) {
+    result = CM_ERR_MEMORY;
+  }
+  if (result != CM_OK) {
+    delete pTable;
+    return result;
+  }
+  *ppTable = pTable;
+  return CM_OK;
+}
+
+int cmUnwindTableBuild(const CMElf *pElf, CMUnwindTable **ppTable) {
+  CMElfSection section;
+  if ((cmElfFindSection(pElf, ".debug_frame", &section) != CM_OK) || (section.puData == NULL)) {
+    *ppTable = NULL;
+    return CM_ERR_ARGUMENT;
+  }
+  return cmUnwindTableParse(section.puData, section.ulSize, ppTable);
+}
+
+int cmUnwindTableSave(const CMUnwindTable *pTable, const char *pPath) {
+  FILE *pFile = fopen(pPath, "wb");
+  if (pFile == NULL) {
+    return CM_ERR_IO;
+  }
+
+  uint8_t auHeader[TABLE_HEADER_SIZE] = { 'C', 'M', 'U', 'T', TABLE_VERSION };
+  writeLe32(auHeader + 8, (uint32_t)pTable->rows.size());
+  bool bOk = (fwrite(auHeader, sizeof(auHeader), 1, pFile) == 1);
+  for (size_t index = 0; bOk && (index < pTable->rows.size()); ++index) {
+    const CMUnwindRow &row = pTable->rows[index];
+    uint8_t auRow[TABLE_ROW_SIZE];
+    writeLe32(auRow, row.ulStart);
+    writeLe32(auRow + 4, row.ulEnd);
+    auRow[8] = row.uCfaRegister;
+    auRow[9] = row.uFlags;
+    writeLe16(auRow + 10, (uint16_t)row.nCfaOffset);
+    writeLe16(auRow + 12, (uint16_t)row.nReturnOffset);
+    writeLe16(auRow + 14, (uint16_t)row.nYLowOffset);
+    writeLe16(auRow + 16, (uint16_t)row.nYHighOffset);
+    bOk = (fwrite(auRow, sizeof(auRow), 1, pFile) == 1);
+  }
+  if (fclose(pFile) != 0) {
+    bOk = false;
+  }
+  return bOk ? CM_OK : CM_ERR_IO;
+}
+
+int cmUnwindTableLoad(const char *pPath, CMUnwindTable **ppTable) {
+  *ppTable = NULL;
+  struct CMMappedFile file;
+  int result = cmMapFile(pPath, &file);
+  if (result != CM_OK) {
+    return result;
+  }
+
+  if ((file.size < TABLE_HEADER_SIZE) || (memcmp(file.puData, TABLE_MAGIC, 4) != 0)) {
+    result = (file.size < TABLE_HEADER_SIZE) ? CM_ERR_TRUNCATED : CM_ERR_FORMAT;
+  }
+  else if (file.puData[4] != TABLE_VERSION) {
+    result = CM_ERR_VERSION;
+  }
+  else {
+    uint32_t ulCount = readLe32(file.puData + 8);
+    if ((file.size - TABLE_HEADER_SIZE) / TABLE_ROW_SIZE < ulCount) {
+      result = CM_ERR_TRUNCATED;
+    }
+    else {
+      CMUnwindTable *pTable = new (std::nothrow) CMUnwindTable;
+      try {
+        if (pTable == NULL) {
+          throw std::bad_alloc();
+        }
+        pTable->rows.resize(ulCount);
+        for (uint32_t ulRow = 0; ulRow < ulCount; ++ulRow) {
+          const uint8_t *puRow = file.puData + TABLE_HEADER_SIZE + ((size_t)ulRow * TABLE_ROW_SIZE);
+          CMUnwindRow &row = pTable->rows[ulRow];
+          row.ulStart = readLe32(puRow);
+          row.ulEnd = readLe32(puRow + 4);
+          row.uCfaRegister = puRow[8];
+          row.uFlags = puRow[9];
+          row.nCfaOffset = readLe16s(puRow + 10);
+          row.nReturnOffset = readLe16s(puRow + 12);
+          row.nYLowOffset = readLe16s(puRow + 14);
+          row.nYHighOffset = readLe16s(puRow + 16);
+        }
+        std::stable_sort(pTable->rows.begin(), pTable->rows.end(), isBefore);
+        *ppTable = pTable;
+      }
+      catch (const std::bad_alloc &) {
+        delete pTable;
+        result = CM_ERR_MEMORY;
+      }
+    }
+  }
+  cmUnmapFile(&file);
+  return result;
+}
+
+void cmUnwindTableFree(CMUnwindTable *pTable) {
+  delete pTable;
+}
+
+size_t cmUnwindTableCount(const CMUnwindTable *pTable) {
+  return pTable->rows.size();
+}
+
+int cmUnwindTableFind(const CMUnwindTable *pTable, uint32_t ulByteAddress, struct CMUnwindRow *pRow) {
+  // The last row starting at or below the address.
+  CMUnwindRow key;
+  key.ulStart = ulByteAddress;
+  std::vector<CMUnwindRow>::const_iterator row =
+    std::upper_bound(pTable->rows.begin(), pTable->rows.end(), key, isBefore);
+  if (row == pTable->rows.begin()) {
+    return CM_ERR_ARGUMENT;
+  }
+  --row;
+  if (ulByteAddress >= row->ulEnd) {
+    return CM_ERR_ARGUMENT;
+  }
+  *pRow = *row;
+  return CM_OK;
+}
+
+size_t cmUnwind(const CMUnwindTable *pTable, const struct CMReport *pReport, uint8_t uPcSize,
+                struct CMFrame *pFrames, size_t maxFrames, int *pStop) {
+  int stop = CM_UNWIND_STOP_MAX_FRAMES;
+  size_t count = 0;
+  if (maxFrames == 0) {
+    if (pStop != NULL) {
+      *pStop = stop;
+    }
+    return 0;
+  }
+
+  uint32_t ulAddress = pReport->ulAddress * 2;
+  uint32_t ulStackPointer = pReport->uStackPointer;
+  uint32_t ulY = 0;
+  bool bYKnown = false;
+  pFrames[count].ulAddress = ulAddress;
+  pFrames[count].uStackPointer = (uint16_t)ulStackPointer;
+  ++count;
+
+  while (count < maxFrames) {
+    // Frame 0 was interrupted at ulAddress. The others are at a return
+    // address, just after the call, which may be the last instruction of the
+    // function.
+    CMUnwindRow row;
+    uint32_t ulLookup = (count == 1) ? ulAddress : ulAddress - 1;
+    if (cmUnwindTableFind(pTable, ulLookup, &row) != CM_OK) {
+      stop = CM_UNWIND_STOP_NO_RULE;
+      break;
+    }
+
+    uint32_t ulCfa;
+    if (row.uCfaRegister == CM_DWARF_SP) {
+      ulCfa = ulStackPointer + row.nCfaOffset;
+    }
+    else if (row.uCfaRegister == CM_DWARF_Y_LOW) {
+      ulCfa = (bYKnown ? ulY : ulStackPointer) + row.nCfaOffset;
+    }
+    else {
+      stop = CM_UNWIND_STOP_NO_RULE;
+      break;
+    }
+
+    if (!(row.uFlags & CM_UNWIND_RETURN_SAVED)) {
+      stop = CM_UNWIND_STOP_NO_RETURN;
+      break;
+    }
+
+    uint32_t ulReturn;
+    if (!readSnapshot(*pReport, ulCfa + row.nReturnOffset, uPcSize, ulReturn, true)) {
+      stop = CM_UNWIND_STOP_OUTSIDE_SNAPSHOT;
+      break;
+    }
+    // The CFA only grows, so unwinding always ends.
+    if ((ulCfa <= ulStackPointer) || (ulReturn == 0)) {
+      stop = CM_UNWIND_STOP_BAD_FRAME;
+      break;
+    }
+
+    // The caller's Y is whatever this function saved, or else the same.
+    if ((row.uFlags & (CM_UNWIND_Y_LOW_SAVED | CM_UNWIND_Y_HIGH_SAVED)) != 0) {
+      uint32_t ulLow;
+      uint32_t ulHigh;
+      bYKnown = (row.uFlags & CM_UNWIND_Y_LOW_SAVED) && (row.uFlags & CM_UNWIND_Y_HIGH_SAVED) &&
+        readSnapshot(*pReport, ulCfa + row.nYLowOffset, 1, ulLow, false) &&
+        readSnapshot(*pReport, ulCfa + row.nYHighOffset, 1, ulHigh, false);
+      ulY = bYKnown ? (ulLow | (ulHigh << 8)) : 0;
+    }
+    else if (!bYKnown && (row.uCfaRegister == CM_DWARF_Y_LOW)) {
+      ulY = ulStackPointer;
+      bYKnown = true;
+    }
+
+    ulAddress = ulReturn * 2;
+    ulStackPointer = ulCfa;
+    pFrames[count].ulAddress = ulAddress;
+    pFrames[count].uStackPointer = (uint16_t)ulStackPointer;
+    ++count;
+  }
+
+  if (pStop != NULL) {
+    *pStop = stop;
+  }
+  return count;
+}
@@ -0,0 +1,204 @@
+/**
+ * CrashMonitorUnwind.h
+ * Version 1.4
+ * Author
+ *  Cyrus Brunner
+ *
+ * Unwinds the stack snapshot of a report (CRASH_MONITOR_STACK_BYTES) into a
+ * call chain. The call frame information (CFI) in the .debug_frame section of
+ * the ELF is turned into an unwind table once per build: for each range of
+ * code, how to find the canonical frame address (CFA, the caller's stack
+ * pointer) and where the return address and frame pointer (r28:r29) were
+ * saved. The table can be saved to a file, so a fleet's reports can be
+ * unwound without keeping (or parsing) every ELF.
+ */
+
+#ifndef CrashMonitorUnwind_h
+#define CrashMonitorUnwind_h
+
+#include <stddef.h>
+#include <stdint.h>
+#include "CrashMonitorElf.h"
+#include "CrashMonitorHost.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief The DWARF register numbers avr-gcc uses.
+ */
+enum ECMDwarfRegister
+{
+  CM_DWARF_Y_LOW = 28,
+  CM_DWARF_Y_HIGH = 29,
+  CM_DWARF_SP = 32,
+  CM_DWARF_RETURN = 36
+};
+
+/**
+ * @brief Flags of an unwind row.
+ */
+enum ECMUnwindFlags
+{
+  CM_UNWIND_RETURN_SAVED = 0x01,
+  CM_UNWIND_Y_LOW_SAVED = 0x02,
+  CM_UNWIND_Y_HIGH_SAVED = 0x04
+};
+
+/**
+ * @brief The unwind rule for a range of code. Offsets are in bytes from the
+ * CFA.
+ */
+struct CMUnwindRow
+{
+  /**
+   * @brief The first byte address the row applies to.
+   */
+  uint32_t ulStart;
+
+  /**
+   * @brief The byte address after the last one the row applies to.
+   */
+  uint32_t ulEnd;
+
+  /**
+   * @brief The register the CFA is based on (CM_DWARF_SP or CM_DWARF_Y_LOW).
+   */
+  uint8_t uCfaRegister;
+
+  /**
+   * @brief See ECMUnwindFlags.
+   */
+  uint8_t uFlags;
+
+  /**
+   * @brief CFA = register + nCfaOffset.
+   */
+  int16_t nCfaOffset;
+
+  /**
+   * @brief Where the return address (big-endian, in words) starts.
+   */
+  int16_t nReturnOffset;
+
+  /**
+   * @brief Where r28 and r29 were saved.
+   */
+  int16_t nYLowOffset;
+  int16_t nYHighOffset;
+};
+
+/**
+ * @brief A frame of an unwound call chain.
+ */
+struct CMFrame
+{
+  /**
+   * @brief The byte address (the crash address for frame 0, the return
+   * address after that).
+   */
+  uint32_t ulAddress;
+
+  /**
+   * @brief The stack pointer in the frame.
+   */
+  uint16_t uStackPointer;
+};
+
+/**
+ * @brief Why unwinding stopped.
+ */
+enum ECMUnwindStop
+{
+  CM_UNWIND_STOP_NO_RULE = 0,
+  CM_UNWIND_STOP_OUTSIDE_SNAPSHOT = 1,
+  CM_UNWIND_STOP_NO_RETURN = 2,
+  CM_UNWIND_STOP_BAD_FRAME = 3,
+  CM_UNWIND_STOP_MAX_FRAMES = 4
+};
+
+/**
+ * @brief An unwind table (opaque).
+ */
+typedef struct CMUnwindTable CMUnwindTable;
+
+/**
+ * @brief Builds the unwind table for a firmware from its .debug_frame.
+ * @param  pElf    The firmware (built with -g).
+ * @param  ppTable Receives the table.
+ * @return         CM_OK, CM_ERR_ARGUMENT if there is no .debug_frame,
+ *                 CM_ERR_FORMAT if it can't be parsed or CM_ERR_MEMORY.
+ */
+int cmUnwindTableBuild(const CMElf *pElf, CMUnwindTable **ppTable);
+
+/**
+ * @brief Builds an unwind table from the contents of a .debug_frame section.
+ * @param  puData  The section.
+ * @param  size    The size of the section.
+ * @param  ppTable Receives the table.
+ * @return         As cmUnwindTableBuild().
+ */
+int cmUnwindTableParse(const uint8_t *puData, size_t size, CMUnwindTable **ppTable);
+
+/**
+ * @brief Saves a table to a file.
+ * @param  pTable The table.
+ * @param  pPath  The path.
+ * @return        CM_OK or CM_ERR_IO.
+ */
+int cmUnwindTableSave(const CMUnwindTable *pTable, const char *pPath);
+
+/**
+ * @brief Loads a table saved by cmUnwindTableSave().
+ * @param  pPath   The path.
+ * @param  ppTable Receives the table.
+ * @return         CM_OK, CM_ERR_IO, CM_ERR_FORMAT, CM_ERR_VERSION or
+ *                 CM_ERR_TRUNCATED.
+ */
+int cmUnwindTableLoad(const char *pPath, CMUnwindTable **ppTable);
+
+/**
+ * @brief Frees a table.
+ * @param pTable The table (may be NULL).
+ */
+void cmUnwindTableFree(CMUnwindTable *pTable);
+
+/**
+ * @brief Gets the number of rows.
+ * @param  pTable The table.
+ * @return        The number of rows.
+ */
+size_t cmUnwindTableCount(const CMUnwindTable *pTable);
+
+/**
+ * @brief Finds the row for an address.
+ * @param  pTable        The table.
+ * @param  ulByteAddress The byte address.
+ * @param  pRow          Receives the row.
+ * @return               CM_OK or CM_ERR_ARGUMENT if no row covers it.
+ */
+int cmUnwindTableFind(const CMUnwindTable *pTable, uint32_t ulByteAddress, struct CMUnwindRow *pRow);
+
+/**
+ * @brief Unwinds a report. Frame 0 is the crash address and the stack
+ * pointer of the report. Each following frame is read from the snapshot
+ * (which starts at sp + 1) for as far as it reaches. Inside a function that
+ * uses the frame pointer, Y is taken to be equal to SP (avr-gcc sets it up
+ * that way after the prologue) until a callee's saved copy is found.
+ * @param  pTable    The unwind table of the build the report came from.
+ * @param  pReport   The report.
+ * @param  uPcSize   The program counter size (2, or 3 on the Mega).
+ * @param  pFrames   Receives the frames.
+ * @param  maxFrames The size of pFrames.
+ * @param  pStop     Receives why unwinding stopped (may be NULL).
+ * @return           The number of frames.
+ */
+size_t cmUnwind(const CMUnwindTable *pTable, const struct CMReport *pReport, uint8_t uPcSize,
+                struct CMFrame *pFrames, size_t maxFrames, int *pStop);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,202 @@
+/**
+ * CrashCompare.cpp
+ * Version 1.4
+ * Author
+ *  Cyrus Brunner
+ *
+ * Compares the crashes of two firmware builds and flags the sites (and the
+ * overall rate) that got significantly worse. Usage:
+ *
+ *   CrashCompare [options] BASE_BUILD NEW_BUILD reports...
+ *
+ * Each reports file can be a text dump, a binary dump (or a stream of them)
+ * or an EEPROM image (with --eeprom). Reports from other builds are ignored.
+ * The exit status is 3 if there is a regression.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "CrashMonitorDisasm.h"
+#include "CrashMonitorElf.h"
+#include "CrashMonitorHost.h"
+#include "CrashMonitorStats.h"
+
+#define DEFAULT_ALPHA 0.05
+#define DEFAULT_TOP 20
+
+static void usage() {
+  fprintf(stderr,
+          "Usage: CrashCompare [options] BASE_BUILD NEW_BUILD reports...\n"
+          "  --alpha A     The significance level (%g)\n"
+          "  --top N       Sites to show besides the regressions (%d)\n"
+          "  --elf FILE    The new build's ELF, to name the sites\n"
+          "  --pc-size N   The program counter size (2, or 3 on the Mega)\n"
+          "  --eeprom BASE Read EEPROM images with the reports at BASE\n",
+          DEFAULT_ALPHA, DEFAULT_TOP);
+}
+
+static const char *typeText(uint8_t uType) {
+  switch (uType) {
+    case CM_TYPE_WATCHDOG:
+      return "hang";
+    case CM_TYPE_FLASH_CORRUPT:
+      return "flash-corrupt";
+    case CM_TYPE_STALL:
+      return "stall";
+    case CM_TYPE_USER:
+      return "user";
+    case CM_TYPE_MEMORY_CORRUPT:
+      return "memory-corrupt";
+    default:
+      return "?";
+  }
+}
+
+static void formatSite(const CMSite &site, const CMElf *pElf, const CMTarget *pTarget, char *pBuffer,
+                       size_t size) {
+  if (site.uType == CM_TYPE_FLASH_CORRUPT) {
+    snprintf(pBuffer, size, "%s", typeText(site.uType));
+    return;
+  }
+
+  int length = snprintf(pBuffer, size, "%s 0x%05lx", typeText(site.uType), (unsigned long)site.ulAddress);
+  CMElfSymbol symbol;
+  if ((pElf == NULL) || (site.uType == CM_TYPE_MEMORY_CORRUPT) ||
+      (cmElfFindCode(pElf, site.ulAddress, &symbol) != CM_OK)) {
+    return;
+  }
+  length += snprintf(pBuffer + length, size - length, " %s+0x%lx", symbol.pName,
+                     (unsigned long)(site.ulAddress - symbol.ulAddress));
+  const char *pHang = (pTarget != NULL) ? cmClassifyHang(pElf, pTarget, site.ulAddress) : NULL;
+  if ((pHang != NULL) && ((size_t)length < size)) {
+    snprintf(pBuffer + length, size - length, " (%s)", pHang);
+  }
+}
+
+int main(int argc, char **argv) {
+  double dAlpha = DEFAULT_ALPHA;
+  unsigned long top = DEFAULT_TOP;
+  const char *pElfPath = NULL;
+  long base = -1;
+  unsigned pcSize = 0;
+  int arg = 1;
+  for (; (arg < argc) && (strncmp(argv[arg], "--", 2) == 0); arg += 2) {
+    if (arg + 1 >= argc) {
+      usage();
+      return 2;
+    }
+    if (strcmp(argv[arg], "--alpha") == 0) {
+      dAlpha = strtod(argv[arg + 1], NULL);
+    }
+    else if (strcmp(argv[arg], "--top") == 0) {
+      top = strtoul(argv[arg + 1], NULL, 0);
+    }
+    else if (strcmp(argv[arg], "--elf") == 0) {
+      pElfPath = argv[arg + 1];
+    }
+    else if (strcmp(argv[arg], "--pc-size") == 0) {
+      pcSize = (unsigned)strtoul(argv[arg + 1], NULL, 0);
+    }
+    else if (strcmp(argv[arg], "--eeprom") == 0) {
+      base = strtol(argv[arg + 1], NULL, 0);
+    }
+    else {
+      usage();
+      return 2;
+    }
+  }
+  if (argc - arg < 3) {
+    usage();
+    return 2;
+  }
+  uint16_t uBase = (uint16_t)strtoul(argv[arg], NULL, 0);
+  uint16_t uNew = (uint16_t)strtoul(argv[arg + 1], NULL, 0);
+
+  CMElf *pElf = NULL;
+  const CMTarget *pTarget = NULL;
+  if (pElfPath != NULL) {
+    int result = cmElfOpen(pElfPath, &pElf);
+    if (result != CM_OK) {
+      fprintf(stderr, "%s: %s\n", pElfPath, cmResultText(result));
+      return 1;
+    }
+    uint32_t ulArch = cmElfFlags(pElf) & 0x7f;
+    pTarget = cmFindTarget(NULL, ulArch);
+    if (pcSize == 0) {
+      // Only the 256KB parts (avr6) push 3 byte return addresses.
+      pcSize = (ulArch == 6) ? 3 : 2;
+    }
+  }
+  if (pcSize == 0) {
+    pcSize = 2;
+  }
+
+  CMTable *pTable = cmTableCreate();
+  for (int file = arg + 2; file < argc; ++file) {
+    long added = cmParseFile(pTable, argv[file], (uint8_t)pcSize, base);
+    if (added < 0) {
+      fprintf(stderr, "%s: %s\n", argv[file], cmResultText(added));
+      cmTableFree(pTable);
+      cmElfFree(pElf);
+      return 1;
+    }
+  }
+
+  CMComparison *pComparison;
+  int result = cmCompareBuilds(pTable, uBase, uNew, dAlpha, &pComparison);
+  if (result != CM_OK) {
+    if (result == CM_ERR_ARGUMENT) {
+      fprintf(stderr, "Both builds need reports, and alpha must be between 0 and 1\n");
+    }
+    else {
+      fprintf(stderr, "%s\n", cmResultText(result));
+    }
+    cmTableFree(pTable);
+    cmElfFree(pElf);
+    return 1;
+  }
+
+  CMComparisonSummary summary;
+  cmComparisonSummary(pComparison, &summary);
+  for (int build = 0; build < 2; ++build) {
+    printf("build %u: %lu reports, %.1f device-hours, %.4f per device-hour\n", summary.aBuilds[build].uBuild,
+           summary.aBuilds[build].ulReports, summary.aBuilds[build].dDeviceHours, summary.aBuilds[build].dRate);
+  }
+  printf("rate ratio %.2f, p=%.3g%s\n\n", summary.dRateRatio, summary.dRateP,
+         (summary.uFlags & CM_REGRESSION_RATE) ? "  REGRESSION" : "");
+  printf("%zu sites, per-site alpha %.3g\n", summary.siteCount, summary.dSiteAlpha);
+  printf("%-40s %16s %16s %7s %9s %9s\n", "site", "base", "new", "z", "p(share)", "p(rate)");
+
+  bool bRegression = (summary.uFlags & CM_REGRESSION_RATE) != 0;
+  unsigned long shown = 0;
+  CMSiteComparison site;
+  for (size_t index = 0; cmComparisonGetSite(pComparison, index, &site) == CM_OK; ++index) {
+    bool bSiteRegression = (site.uFlags & (CM_REGRESSION_SHARE | CM_REGRESSION_RATE)) != 0;
+    if (!bSiteRegression) {
+      if (shown >= top) {
+        break;
+      }
+      ++shown;
+    }
+    bRegression = bRegression || bSiteRegression;
+
+    char acSite[128];
+    char acBase[32];
+    char acNew[32];
+    formatSite(site.site, pElf, pTarget, acSite, sizeof(acSite));
+    snprintf(acBase, sizeof(acBase), "%lu (%.1f%%)", site.aulCount[0], site.adShare[0] * 100);
+    snprintf(acNew, sizeof(acNew), "%lu (%.1f%%)", site.aulCount[1], site.adShare[1] * 100);
+    printf("%-40s %16s %16s %7.2f %9.3g %9.3g", acSite, acBase, acNew, site.dShareZ, site.dShareP, site.dRateP);
+    if (bSiteRegression) {
+      printf("  REGRESSION%s%s%s", (site.uFlags & CM_REGRESSION_SHARE) ? " share" : "",
+             (site.uFlags & CM_REGRESSION_RATE) ? " rate" : "", (site.uFlags & CM_REGRESSION_NEW_SITE) ? " new" : "");
+    }
+    printf("\n");
+  }
+
+  cmComparisonFree(pComparison);
+  cmTableFree(pTable);
+  cmElfFree(pElf);
+  return bRegression ? 3 : 0;
+}
@@ -0,0 +1,196 @@
+/**
+ * CrashDecode.cpp
+ * Version 1.4
+ * Author
+ *  Cyrus Brunner
+ *
+ * Decodes crash reports against the ELF of the build that generated them:
+ * the function each crash address is in, the instructions around it and the
+ * hang classification. Usage:
+ *
+ *   CrashDecode [options] firmware.elf reports
+ *
+ * The reports can be a text dump, a binary dump (or a stream of them) or an
+ * EEPROM image (with --eeprom).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "CrashMonitorDisasm.h"
+#include "CrashMonitorElf.h"
+#include "CrashMonitorHost.h"
+
+#define DEFAULT_WINDOW 4
+#define MAX_WINDOW 32
+
+// How far before the crash address to start decoding when the function start
+// is unknown or far away.
+#define MAX_LEAD_BYTES 512
+
+static void usage() {
+  fprintf(stderr,
+          "Usage: CrashDecode [options] firmware.elf reports\n"
+          "  --window N    Instructions to show before and after the crash address (%d)\n"
+          "  --build N     Only decode reports from this build ID\n"
+          "  --mcu NAME    The MCU (ie. atmega328p), if not the default for the ELF\n"
+          "  --pc-size N   The program counter size (2, or 3 on the Mega)\n"
+          "  --eeprom BASE Read an EEPROM image with the reports at BASE\n",
+          DEFAULT_WINDOW);
+}
+
+static void printInstruction(const CMInstruction &instruction, bool bCrash) {
+  char acBytes[16];
+  if (instruction.uWords == 2) {
+    snprintf(acBytes, sizeof(acBytes), "%02x %02x %02x %02x", instruction.auOpcode[0] & 0xff,
+             instruction.auOpcode[0] >> 8, instruction.auOpcode[1] & 0xff, instruction.auOpcode[1] >> 8);
+  }
+  else {
+    snprintf(acBytes, sizeof(acBytes), "%02x %02x", instruction.auOpcode[0] & 0xff, instruction.auOpcode[0] >> 8);
+  }
+  printf("  %s %6lx:  %-12s  %s\n", bCrash ? "=>" : "  ", (unsigned long)instruction.ulAddress, acBytes,
+         instruction.acText);
+}
+
+// Shows window instructions before and after the crash address. AVR
+// instructions are one or two words, so decoding starts at the function (or a
+// little before the crash address) to stay in step with the code.
+static void printWindow(const CMElf *pElf, uint32_t ulCrash, unsigned window) {
+  CMElfSymbol symbol;
+  uint32_t ulStart = (ulCrash > MAX_LEAD_BYTES) ? ulCrash - MAX_LEAD_BYTES : 0;
+  if ((cmElfFindCode(pElf, ulCrash, &symbol) == CM_OK) && (ulCrash - symbol.ulAddress <= MAX_LEAD_BYTES)) {
+    ulStart = symbol.ulAddress;
+  }
+
+  CMInstruction aBefore[MAX_WINDOW];
+  unsigned count = 0;
+  CMInstruction instruction;
+  uint32_t ulAddress = ulStart;
+  while ((ulAddress < ulCrash) && (cmDisassemble(pElf, ulAddress, &instruction) == CM_OK)) {
+    aBefore[count % window] = instruction;
+    ++count;
+    ulAddress += instruction.uWords * 2;
+  }
+  if (ulAddress != ulCrash) {
+    // The crash address is in the middle of an instruction (ie. a bad
+    // address), or decoding went out of step. Show from the address itself.
+    count = 0;
+    ulAddress = ulCrash;
+  }
+
+  unsigned first = (count > window) ? count - window : 0;
+  for (unsigned index = first; index < count; ++index) {
+    printInstruction(aBefore[index % window], false);
+  }
+  for (unsigned index = 0; index <= window; ++index) {
+    if (cmDisassemble(pElf, ulAddress, &instruction) != CM_OK) {
+      break;
+    }
+    printInstruction(instruction, index == 0);
+    ulAddress += instruction.uWords * 2;
+  }
+}
+
+int main(int argc, char **argv) {
+  unsigned window = DEFAULT_WINDOW;
+  long build = -1;
+  long base = -1;
+  const char *pMcu = NULL;
+  unsigned pcSize = 0;
+  int arg = 1;
+  for (; (arg < argc) && (strncmp(argv[arg], "--", 2) == 0); arg += 2) {
+    if (arg + 1 >= argc) {
+      usage();
+      return 2;
+    }
+    if (strcmp(argv[arg], "--window") == 0) {
+      window = (unsigned)strtoul(argv[arg + 1], NULL, 0);
+    }
+    else if (strcmp(argv[arg], "--build") == 0) {
+      build = strtol(argv[arg + 1], NULL, 0);
+    }
+    else if (strcmp(argv[arg], "--mcu") == 0) {
+      pMcu = argv[arg + 1];
+    }
+    else if (strcmp(argv[arg], "--pc-size") == 0) {
+      pcSize = (unsigned)strtoul(argv[arg + 1], NULL, 0);
+    }
+    else if (strcmp(argv[arg], "--eeprom") == 0) {
+      base = strtol(argv[arg + 1], NULL, 0);
+    }
+    else {
+      usage();
+      return 2;
+    }
+  }
+  if ((argc - arg != 2) || (window == 0) || (window > MAX_WINDOW)) {
+    usage();
+    return 2;
+  }
+
+  CMElf *pElf;
+  int result = cmElfOpen(argv[arg], &pElf);
+  if (result != CM_OK) {
+    fprintf(stderr, "%s: %s\n", argv[arg], cmResultText(result));
+    return 1;
+  }
+
+  uint32_t ulArch = cmElfFlags(pElf) & 0x7f;
+  const CMTarget *pTarget = cmFindTarget(pMcu, ulArch);
+  if (pTarget == NULL) {
+    fprintf(stderr, "Unknown MCU; use --mcu\n");
+    cmElfFree(pElf);
+    return 1;
+  }
+  if (pcSize == 0) {
+    // Only the 256KB parts (avr6) push 3 byte return addresses.
+    pcSize = (ulArch == 6) ? 3 : 2;
+  }
+
+  CMTable *pTable = cmTableCreate();
+  long added = cmParseFile(pTable, argv[arg + 1], (uint8_t)pcSize, base);
+  if (added < 0) {
+    fprintf(stderr, "%s: %s\n", argv[arg + 1], cmResultText(added));
+    cmTableFree(pTable);
+    cmElfFree(pElf);
+    return 1;
+  }
+
+  char acLine[256];
+  CMReport report;
+  for (size_t row = 0; row < cmTableCount(pTable); ++row) {
+    cmTableGet(pTable, row, &report);
+    cmFormatReport(&report, acLine, sizeof(acLine));
+    if (report.ulDevice != CM_NO_DEVICE) {
+      printf("device %lu, ", (unsigned long)report.ulDevice);
+    }
+    printf("%s\n", acLine);
+
+    if ((report.uType == CM_TYPE_FLASH_CORRUPT) || (report.uType == CM_TYPE_MEMORY_CORRUPT)) {
+      continue;
+    }
+    if ((build >= 0) && (report.uBuild != build)) {
+      printf("  not decoded: from build %u\n", report.uBuild);
+      continue;
+    }
+
+    uint32_t ulCrash = report.ulAddress * 2;
+    CMElfSymbol symbol;
+    if (cmElfFindCode(pElf, ulCrash, &symbol) == CM_OK) {
+      printf("  in %s + 0x%lx", symbol.pName, (unsigned long)(ulCrash - symbol.ulAddress));
+    }
+    else {
+      printf("  in ?");
+    }
+    const char *pHang = cmClassifyHang(pElf, pTarget, ulCrash);
+    if (pHang != NULL) {
+      printf(", hang=%s", pHang);
+    }
+    printf("\n");
+    printWindow(pElf, ulCrash, window);
+  }
+
+  cmTableFree(pTable);
+  cmElfFree(pElf);
+  return 0;
+}
@@ -0,0 +1,278 @@
+/**
+ * CrashFleet.cpp
+ * Version 1.4
+ * Author
+ *  Cyrus Brunner
+ *
+ * Generates the crash dumps of a simulated fleet, for load testing host
+ * tooling. Usage:
+ *
+ *   CrashFleet [options]
+ *
+ * The dumps are generated on all cores and written in device order, so the
+ * output is the same for the same seed, whatever the number of threads. With
+ * --bench nothing is written; instead the dumps are generated in memory,
+ * parsed back with the host library and compared build to build, and the
+ * throughput of each step is printed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include "CrashMonitorFleet.h"
+#include "CrashMonitorHost.h"
+#include "CrashMonitorStats.h"
+
+#define DEFAULT_DEVICES 50000UL
+
+// Devices per job: big enough that starting threads doesn't show, small
+// enough that the output keeps flowing.
+#define CHUNK_DEVICES 1024
+
+struct COptions
+{
+  CMFleetConfig config;
+  uint32_t ulDevices;
+  unsigned threads;
+  double dRate;
+  bool bLoop;
+  bool bBench;
+  const char *pOutput;
+};
+
+// The dumps of a run of devices, one after another.
+struct CChunk
+{
+  std::vector<uint8_t> data;
+  std::vector<size_t> ends;
+};
+
+typedef std::chrono::steady_clock Clock;
+
+static void usage() {
+  fprintf(stderr,
+          "Usage: CrashFleet [options]\n"
+          "  --devices N   The number of devices (%lu)\n"
+          "  --seed N      The fleet seed (1)\n"
+          "  --entries N   The report slots of each device (10)\n"
+          "  --pc-size N   The program counter size (2, or 3 on the Mega)\n"
+          "  --binary      Write dumpBinary() output instead of dump() text\n"
+          "  --rate N      Dumps per second (0, as fast as possible)\n"
+          "  --loop        Start over after the last device, forever\n"
+          "  --threads N   Generator threads (one per core)\n"
+          "  --output FILE Write to FILE instead of the standard output\n"
+          "  --bench       Measure generating, parsing and comparing instead\n",
+          DEFAULT_DEVICES);
+}
+
+static void generate(const COptions &options, uint32_t ulFirst, uint32_t ulCount, CChunk &chunk) {
+  size_t maxSize = cmFleetMaxDumpSize(&options.config);
+  chunk.data.resize((size_t)ulCount * maxSize);
+  chunk.ends.resize(ulCount);
+  size_t used = 0;
+  for (uint32_t ulDevice = 0; ulDevice < ulCount; ++ulDevice) {
+    used += (size_t)cmFleetDump(&options.config, ulFirst + ulDevice, &chunk.data[used], maxSize);
+    chunk.ends[ulDevice] = used;
+  }
+  chunk.data.resize(used);
+}
+
+// Generates the devices from ulFirst on, a chunk per thread. The chunks past
+// the last device are left empty.
+static uint32_t generateBatch(const COptions &options, uint32_t ulFirst, std::vector<CChunk> &chunks) {
+  std::vector<std::thread> threads;
+  uint32_t ulDevice = ulFirst;
+  for (size_t index = 0; index < chunks.size(); ++index) {
+    chunks[index].data.clear();
+    chunks[index].ends.clear();
+    uint32_t ulCount = options.ulDevices - ulDevice;
+    if (ulCount == 0) {
+      continue;
+    }
+    if (ulCount > CHUNK_DEVICES) {
+      ulCount = CHUNK_DEVICES;
+    }
+    threads.push_back(std::thread(generate, std::cref(options), ulDevice, ulCount, std::ref(chunks[index])));
+    ulDevice += ulCount;
+  }
+  for (size_t index = 0; index < threads.size(); ++index) {
+    threads[index].join();
+  }
+  return ulDevice - ulFirst;
+}
+
+static int stream(const COptions &options) {
+  FILE *pFile = stdout;
+  if ((options.pOutput != NULL) && ((pFile = fopen(options.pOutput, "wb")) == NULL)) {
+    fprintf(stderr, "%s: %s\n", options.pOutput, cmResultText(CM_ERR_IO));
+    return 1;
+  }
+
+  std::vector<CChunk> chunks(options.threads);
+  Clock::time_point start = Clock::now();
+  unsigned long long ullWritten = 0;
+  bool bOk = true;
+  do {
+    for (uint32_t ulFirst = 0; bOk && (ulFirst < options.ulDevices);) {
+      ulFirst += generateBatch(options, ulFirst, chunks);
+      for (size_t index = 0; bOk && (index < chunks.size()); ++index) {
+        const CChunk &chunk = chunks[index];
+        if (options.dRate <= 0.0) {
+          bOk = fwrite(chunk.data.data(), 1, chunk.data.size(), pFile) == chunk.data.size();
+          continue;
+        }
+        size_t begin = 0;
+        for (size_t device = 0; bOk && (device < chunk.ends.size()); ++device) {
+          std::this_thread::sleep_until(start + std::chrono::duration_cast<Clock::duration>(
+                                                  std::chrono::duration<double>(ullWritten++ / options.dRate)));
+          size_t size = chunk.ends[device] - begin;
+          bOk = (fwrite(&chunk.data[begin], 1, size, pFile) == size) && (fflush(pFile) == 0);
+          begin = chunk.ends[device];
+        }
+      }
+    }
+  } while (bOk && options.bLoop);
+
+  if (pFile != stdout) {
+    bOk = (fclose(pFile) == 0) && bOk;
+  }
+  else {
+    bOk = (fflush(pFile) == 0) && bOk;
+  }
+  return bOk ? 0 : 1;
+}
+
+static double secondsSince(Clock::time_point start) {
+  return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+static int bench(const COptions &options) {
+  // Generate.
+  std::vector<CChunk> chunks(options.threads);
+  std::vector<uint8_t> data;
+  Clock::time_point start = Clock::now();
+  for (uint32_t ulFirst = 0; ulFirst < options.ulDevices;) {
+    ulFirst += generateBatch(options, ulFirst, chunks);
+    for (size_t index = 0; index < chunks.size(); ++index) {
+      data.insert(data.end(), chunks[index].data.begin(), chunks[index].data.end());
+    }
+  }
+  double dSeconds = secondsSince(start);
+  printf("generate: %lu devices, %.1f MB in %.3fs (%u threads): %.0f devices/s, %.1f MB/s\n",
+         (unsigned long)options.ulDevices, data.size() / 1e6, dSeconds, options.threads,
+         options.ulDevices / dSeconds, data.size() / 1e6 / dSeconds);
+
+  // Parse.
+  CMTable *pTable = cmTableCreate();
+  if (pTable == NULL) {
+    fprintf(stderr, "%s\n", cmResultText(CM_ERR_MEMORY));
+    return 1;
+  }
+  start = Clock::now();
+  long added = (options.config.uFormat == CM_FLEET_BINARY) ?
+    cmParseBinaryStream(pTable, data.data(), data.size(), options.config.uPcSize) :
+    cmParseText(pTable, (const char *)data.data(), data.size());
+  dSeconds = secondsSince(start);
+  if (added < 0) {
+    fprintf(stderr, "parse: %s\n", cmResultText(added));
+    cmTableFree(pTable);
+    return 1;
+  }
+  printf("parse: %ld reports in %.3fs: %.0f reports/s, %.1f MB/s\n", added, dSeconds, added / dSeconds,
+         data.size() / 1e6 / dSeconds);
+
+  // Compare the newest build against the one before it.
+  const CMFleetBuild *pBuilds;
+  size_t buildCount = cmFleetBuilds(&pBuilds);
+  CMComparison *pComparison = NULL;
+  start = Clock::now();
+  int result = cmCompareBuilds(pTable, pBuilds[buildCount - 2].uBuild, pBuilds[buildCount - 1].uBuild, 0.05,
+                               &pComparison);
+  dSeconds = secondsSince(start);
+  if (result != CM_OK) {
+    fprintf(stderr, "compare: %s\n", cmResultText(result));
+    cmTableFree(pTable);
+    return 1;
+  }
+  CMComparisonSummary summary;
+  cmComparisonSummary(pComparison, &summary);
+  size_t regressions = 0;
+  CMSiteComparison site;
+  while ((cmComparisonGetSite(pComparison, regressions, &site) == CM_OK) && (site.uFlags != 0)) {
+    ++regressions;
+  }
+  printf("compare: builds %u and %u, %lu sites in %.3fs: %.0f reports/s, rate x%.2f, %lu site regression(s)\n",
+         pBuilds[buildCount - 2].uBuild, pBuilds[buildCount - 1].uBuild, (unsigned long)summary.siteCount, dSeconds,
+         added / dSeconds, summary.dRateRatio, (unsigned long)regressions);
+  cmComparisonFree(pComparison);
+  cmTableFree(pTable);
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  COptions options;
+  cmFleetDefaults(&options.config);
+  options.ulDevices = DEFAULT_DEVICES;
+  options.threads = std::thread::hardware_concurrency();
+  options.dRate = 0.0;
+  options.bLoop = false;
+  options.bBench = false;
+  options.pOutput = NULL;
+  for (int arg = 1; arg < argc; ++arg) {
+    if (strcmp(argv[arg], "--binary") == 0) {
+      options.config.uFormat = CM_FLEET_BINARY;
+      continue;
+    }
+    if (strcmp(argv[arg], "--loop") == 0) {
+      options.bLoop = true;
+      continue;
+    }
+    if (strcmp(argv[arg], "--bench") == 0) {
+      options.bBench = true;
+      continue;
+    }
+    if (arg + 1 >= argc) {
+      usage();
+      return 2;
+    }
+    const char *pValue = argv[++arg];
+    if (strcmp(argv[arg - 1], "--devices") == 0) {
+      options.ulDevices = (uint32_t)strtoul(pValue, NULL, 0);
+    }
+    else if (strcmp(argv[arg - 1], "--seed") == 0) {
+      options.config.ulSeed = (uint32_t)strtoul(pValue, NULL, 0);
+    }
+    else if (strcmp(argv[arg - 1], "--entries") == 0) {
+      options.config.uMaxEntries = (uint8_t)strtoul(pValue, NULL, 0);
+    }
+    else if (strcmp(argv[arg - 1], "--pc-size") == 0) {
+      options.config.uPcSize = (uint8_t)strtoul(pValue, NULL, 0);
+    }
+    else if (strcmp(argv[arg - 1], "--rate") == 0) {
+      options.dRate = strtod(pValue, NULL);
+    }
+    else if (strcmp(argv[arg - 1], "--threads") == 0) {
+      options.threads = (unsigned)strtoul(pValue, NULL, 0);
+    }
+    else if (strcmp(argv[arg - 1], "--output") == 0) {
+      options.pOutput = pValue;
+    }
+    else {
+      usage();
+      return 2;
+    }
+  }
+  if (options.threads == 0) {
+    options.threads = 1;
+  }
+
+  if ((options.ulDevices == 0) || (options.config.uMaxEntries == 0) ||
+      ((options.config.uPcSize != 2) && (options.config.uPcSize != 3))) {
+    usage();
+    return 2;
+  }
+  return options.bBench ? bench(options) : stream(options);
+}
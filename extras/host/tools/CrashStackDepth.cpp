@@ -0,0 +1,236 @@
+/**
+ * CrashStackDepth.cpp
+ * Version 1.4
+ * Author
+ *  Cyrus Brunner
+ *
+ * Computes the worst case stack depth of a firmware from its ELF and the .su
+ * files written by -fstack-usage, and checks crash reports against it.
+ * Usage:
+ *
+ *   CrashStackDepth [options] firmware.elf file.su...
+ *
+ * With --reports, each report's stack pointer and high-water mark (stack-low)
+ * are checked, and the reports that overflowed, or could have, are flagged.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "CrashMonitorDisasm.h"
+#include "CrashMonitorElf.h"
+#include "CrashMonitorHost.h"
+#include "CrashMonitorStack.h"
+
+// How many calls of a worst case path to print.
+#define MAX_PATH 16
+
+static void usage() {
+  fprintf(stderr,
+          "Usage: CrashStackDepth [options] firmware.elf file.su...\n"
+          "  --reports FILE Check the reports in FILE\n"
+          "  --mcu NAME     The MCU (ie. atmega328p), if not the default for the ELF\n"
+          "  --pc-size N    The program counter size (2, or 3 on the Mega)\n"
+          "  --eeprom BASE  Read an EEPROM image with the reports at BASE\n");
+}
+
+static void printFlags(uint8_t uFlags) {
+  if (uFlags & CM_STACK_NO_USAGE) {
+    printf(" [no .su]");
+  }
+  if (uFlags & CM_STACK_DYNAMIC) {
+    printf(" [dynamic]");
+  }
+  if (uFlags & CM_STACK_INDIRECT) {
+    printf(" [icall]");
+  }
+  if (uFlags & CM_STACK_RECURSIVE) {
+    printf(" [recursion]");
+  }
+  if (uFlags & CM_STACK_UNKNOWN_CALL) {
+    printf(" [unknown call]");
+  }
+}
+
+static void printPath(const CMStackGraph *pGraph, size_t index, uint32_t ulDepth) {
+  CMStackFunction function;
+  cmStackGraphGet(pGraph, index, &function);
+  printf("%s: %lu bytes", function.pName, (unsigned long)ulDepth);
+  printFlags(function.uFlags);
+  printf("\n   ");
+  for (unsigned count = 0; count < MAX_PATH; ++count) {
+    printf(" %s (%lu)", function.pName, (unsigned long)function.ulFrame);
+    if ((function.worstCallee == CM_STACK_NONE) ||
+        (cmStackGraphGet(pGraph, function.worstCallee, &function) != CM_OK)) {
+      break;
+    }
+    printf(" >");
+  }
+  printf("\n");
+}
+
+// Lists the functions on worst case paths that have no .su entry.
+static void printMissing(const CMStackGraph *pGraph) {
+  unsigned count = 0;
+  CMStackFunction function;
+  for (size_t index = 0; cmStackGraphGet(pGraph, index, &function) == CM_OK; ++index) {
+    if ((function.uFlags & CM_STACK_NO_USAGE) && (function.worstCallee == CM_STACK_NONE)) {
+      printf("%s%s", (count == 0) ? "no .su entry (counted as 0): " : ", ", function.pName);
+      ++count;
+    }
+  }
+  if (count != 0) {
+    printf("\n");
+  }
+}
+
+static const char *verdictText(uint8_t uVerdict) {
+  switch (uVerdict) {
+    case CM_STACK_OVERFLOWED:
+      return "OVERFLOWED";
+    case CM_STACK_MAY_OVERFLOW:
+      return "MAY OVERFLOW";
+    default:
+      return "ok";
+  }
+}
+
+static int checkReports(const CMStackGraph *pGraph, const CMStackSummary &summary, const char *pPath,
+                        uint8_t uPcSize, long base) {
+  CMTable *pTable = cmTableCreate();
+  long added = cmParseFile(pTable, pPath, uPcSize, base);
+  if (added < 0) {
+    fprintf(stderr, "%s: %s\n", pPath, cmResultText(added));
+    cmTableFree(pTable);
+    return 1;
+  }
+
+  char acLine[256];
+  CMReport report;
+  CMStackCheck check;
+  printf("\n");
+  for (size_t row = 0; row < cmTableCount(pTable); ++row) {
+    cmTableGet(pTable, row, &report);
+    if (cmStackCheckReport(pGraph, &summary, &report, &check) != CM_OK) {
+      continue;
+    }
+    cmFormatReport(&report, acLine, sizeof(acLine));
+    if (report.ulDevice != CM_NO_DEVICE) {
+      printf("device %lu, ", (unsigned long)report.ulDevice);
+    }
+    printf("%s\n  used %lu", acLine, (unsigned long)check.ulUsed);
+    if (check.ulHighWater != 0) {
+      printf(", high-water %lu", (unsigned long)check.ulHighWater);
+    }
+    CMStackFunction function;
+    if (cmStackGraphGet(pGraph, check.function, &function) == CM_OK) {
+      printf(", in %s", function.pName);
+    }
+    printf(", worst %lu of %lu: %s", (unsigned long)check.ulWorst, (unsigned long)summary.ulBudget,
+           verdictText(check.uVerdict));
+    printFlags(check.uFlags);
+    printf("\n");
+  }
+  cmTableFree(pTable);
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  const char *pReports = NULL;
+  const char *pMcu = NULL;
+  long base = -1;
+  unsigned pcSize = 0;
+  int arg = 1;
+  for (; (arg < argc) && (strncmp(argv[arg], "--", 2) == 0); arg += 2) {
+    if (arg + 1 >= argc) {
+      usage();
+      return 2;
+    }
+    if (strcmp(argv[arg], "--reports") == 0) {
+      pReports = argv[arg + 1];
+    }
+    else if (strcmp(argv[arg], "--mcu") == 0) {
+      pMcu = argv[arg + 1];
+    }
+    else if (strcmp(argv[arg], "--pc-size") == 0) {
+      pcSize = (unsigned)strtoul(argv[arg + 1], NULL, 0);
+    }
+    else if (strcmp(argv[arg], "--eeprom") == 0) {
+      base = strtol(argv[arg + 1], NULL, 0);
+    }
+    else {
+      usage();
+      return 2;
+    }
+  }
+  if (argc - arg < 2) {
+    usage();
+    return 2;
+  }
+
+  CMElf *pElf;
+  int result = cmElfOpen(argv[arg], &pElf);
+  if (result != CM_OK) {
+    fprintf(stderr, "%s: %s\n", argv[arg], cmResultText(result));
+    return 1;
+  }
+  uint32_t ulArch = cmElfFlags(pElf) & 0x7f;
+  const CMTarget *pTarget = cmFindTarget(pMcu, ulArch);
+  if (pTarget == NULL) {
+    fprintf(stderr, "Unknown MCU; use --mcu\n");
+    cmElfFree(pElf);
+    return 1;
+  }
+  if (pcSize == 0) {
+    // Only the 256KB parts (avr6) push 3 byte return addresses.
+    pcSize = (ulArch == 6) ? 3 : 2;
+  }
+
+  CMStackGraph *pGraph;
+  result = cmStackGraphBuild(pElf, (uint8_t)pcSize, &pGraph);
+  for (int file = arg + 1; (result == CM_OK) && (file < argc); ++file) {
+    CMMappedFile usage;
+    result = cmMapFile(argv[file], &usage);
+    if (result == CM_OK) {
+      long matched = cmStackGraphAddUsage(pGraph, (const char *)usage.puData, usage.size);
+      result = (matched < 0) ? (int)matched : CM_OK;
+      cmUnmapFile(&usage);
+    }
+    if (result != CM_OK) {
+      fprintf(stderr, "%s: %s\n", argv[file], cmResultText(result));
+    }
+  }
+
+  CMStackSummary summary;
+  if ((result == CM_OK) && (cmStackSummarize(pGraph, pElf, pTarget, &summary) != CM_OK)) {
+    fprintf(stderr, "%s: no _end symbol\n", argv[arg]);
+    result = CM_ERR_ARGUMENT;
+  }
+  if (result != CM_OK) {
+    cmStackGraphFree(pGraph);
+    cmElfFree(pElf);
+    return 1;
+  }
+
+  printf("%s: static data ends at 0x%x, RAMEND 0x%x, %lu bytes for the stack\n", pTarget->pName, summary.uDataEnd,
+         summary.uRamEnd, (unsigned long)summary.ulBudget);
+  if (summary.main != CM_STACK_NONE) {
+    printPath(pGraph, summary.main, summary.ulMainDepth);
+  }
+  if (summary.isr != CM_STACK_NONE) {
+    printPath(pGraph, summary.isr, summary.ulIsrDepth);
+  }
+  printf("worst case (main + deepest ISR): %lu bytes%s", (unsigned long)summary.ulWorstDepth,
+         (summary.ulWorstDepth > summary.ulBudget) ? ", MAY OVERFLOW" : "");
+  printFlags(summary.uFlags);
+  printf("\n");
+  printMissing(pGraph);
+
+  int status = 0;
+  if (pReports != NULL) {
+    status = checkReports(pGraph, summary, pReports, (uint8_t)pcSize, base);
+  }
+  cmStackGraphFree(pGraph);
+  cmElfFree(pElf);
+  return status;
+}
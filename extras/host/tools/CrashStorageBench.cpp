@@ -0,0 +1,116 @@
+/**
+ * CrashStorageBench.cpp
+ * Version 1.4
+ * Author
+ *  Cyrus Brunner
+ *
+ * Compares the storage backends on simulated parts: the time to persist a
+ * report in the watchdog interrupt, dump throughput, the cost of clear() and
+ * the wear per 1000 crashes, counted per wear unit. Usage:
+ *
+ *   CrashStorageBench [options]
+ *
+ * See CrashMonitorStorage.h for the parts and their timings.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "CrashMonitorHost.h"
+#include "CrashMonitorStorage.h"
+
+// sizeof(CCrashReport) on the 328 without a stack snapshot.
+#define DEFAULT_RECORD_SIZE 20
+#define DEFAULT_ENTRIES 10
+#define DEFAULT_CRASHES 1000UL
+
+// sizeof(CTraceEntry).
+#define TRACE_ENTRY_SIZE 3
+
+static void usage() {
+  fprintf(stderr,
+          "Usage: CrashStorageBench [options]\n"
+          "  --record-size N   sizeof(CCrashReport) (%d)\n"
+          "  --entries N       The maxEntries passed to begin() (%d)\n"
+          "  --trace-entries N CRASH_MONITOR_TRACE_ENTRIES (0)\n"
+          "  --crashes N       The crashes to run (%lu)\n",
+          DEFAULT_RECORD_SIZE, DEFAULT_ENTRIES, DEFAULT_CRASHES);
+}
+
+static void printMs(double dUs) {
+  printf(" %10.2f", dUs / 1000.0);
+}
+
+int main(int argc, char **argv) {
+  unsigned long recordSize = DEFAULT_RECORD_SIZE;
+  unsigned long entries = DEFAULT_ENTRIES;
+  unsigned long traceEntries = 0;
+  unsigned long crashes = DEFAULT_CRASHES;
+  for (int arg = 1; arg < argc; arg += 2) {
+    if (arg + 1 >= argc) {
+      usage();
+      return 2;
+    }
+    unsigned long value = strtoul(argv[arg + 1], NULL, 0);
+    if (strcmp(argv[arg], "--record-size") == 0) {
+      recordSize = value;
+    }
+    else if (strcmp(argv[arg], "--entries") == 0) {
+      entries = value;
+    }
+    else if (strcmp(argv[arg], "--trace-entries") == 0) {
+      traceEntries = value;
+    }
+    else if (strcmp(argv[arg], "--crashes") == 0) {
+      crashes = value;
+    }
+    else {
+      usage();
+      return 2;
+    }
+  }
+  if ((recordSize == 0) || (recordSize > 255) || (entries == 0) || (entries > 255) ||
+      (traceEntries * TRACE_ENTRY_SIZE > 255) || (crashes == 0)) {
+    usage();
+    return 2;
+  }
+
+  CMStorageLayout layout;
+  layout.uRecordSize = (uint8_t)recordSize;
+  layout.uMaxEntries = (uint8_t)entries;
+  layout.uTraceSize = (uint8_t)(traceEntries * TRACE_ENTRY_SIZE);
+  printf("record %lu bytes, %lu entries, trace %u bytes, %lu crashes\n\n", recordSize, entries, layout.uTraceSize,
+         crashes);
+  printf("%-8s %10s %10s %10s %10s %12s %12s %14s\n", "backend", "persist", "persist", "dump", "clear", "written",
+         "unit cycles", "crashes to");
+  printf("%-8s %10s %10s %10s %10s %12s %12s %14s\n", "", "(ms)", "max (ms)", "(KB/s)", "(ms)", "/1000", "/1000",
+         "wear out");
+
+  for (uint8_t uKind = 0; uKind < CM_STORAGE_KIND_COUNT; ++uKind) {
+    CMStorageResult result;
+    int status = cmStorageBench(uKind, &layout, (uint32_t)crashes, &result);
+    if (status != CM_OK) {
+      fprintf(stderr, "%s: %s\n", cmStorageName(uKind), cmResultText(status));
+      return 1;
+    }
+
+    printf("%-8s", cmStorageName(uKind));
+    printMs(result.dPersistUs);
+    printMs(result.dPersistMaxUs);
+    printf(" %10.1f", (result.ulDumpBytes * 1000.0) / result.dDumpUs);
+    printMs(result.dClearUs);
+    printf(" %12.0f", (result.wear.ullBytesWritten * 1000.0) / crashes);
+    printf(" %12.0f", (result.wear.ulMaxCycles * 1000.0) / crashes);
+    if ((result.wear.dEndurance == 0.0) || (result.wear.ulMaxCycles == 0)) {
+      printf(" %14s\n", "managed");
+    }
+    else {
+      printf(" %14.3g\n", (result.wear.dEndurance * crashes) / result.wear.ulMaxCycles);
+    }
+  }
+
+  printf("\npersist: the mean (typical timings) and the worst crash (datasheet maximums).\n"
+         "unit cycles: write or erase cycles of the most worn byte (EEPROM, FRAM), 4KB sector (NOR)\n"
+         "or block (SD); crashes to wear out from its rated endurance.\n");
+  return 0;
+}
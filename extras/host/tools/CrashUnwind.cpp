@@ -0,0 +1,229 @@
+/**
+ * CrashUnwind.cpp
+ * Version 1.4
+ * Author
+ *  Cyrus Brunner
+ *
+ * Unwinds the stack snapshots of crash reports into call chains. Usage:
+ *
+ *   CrashUnwind --save table.cmut firmware.elf
+ *   CrashUnwind [options] --elf firmware.elf reports
+ *   CrashUnwind [options] --table table.cmut reports
+ *   CrashUnwind [options] --tables DIR reports
+ *
+ * The first form saves the unwind table of a build, so its ELF doesn't need to
+ * be kept. With --tables, each report is unwound with DIR/<build>.cmut, the
+ * table of the build the report came from.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <map>
+#include "CrashMonitorElf.h"
+#include "CrashMonitorHost.h"
+#include "CrashMonitorUnwind.h"
+
+#define MAX_FRAMES 32
+
+static void usage() {
+  fprintf(stderr,
+          "Usage: CrashUnwind --save table.cmut firmware.elf\n"
+          "       CrashUnwind [options] (--elf firmware.elf | --table table.cmut | --tables DIR) reports\n"
+          "  --pc-size N   The program counter size (2, or 3 on the Mega)\n"
+          "  --eeprom BASE Read an EEPROM image with the reports at BASE\n");
+}
+
+static const char *stopText(int stop) {
+  switch (stop) {
+    case CM_UNWIND_STOP_NO_RULE:
+      return "no unwind rule";
+    case CM_UNWIND_STOP_OUTSIDE_SNAPSHOT:
+      return "end of snapshot";
+    case CM_UNWIND_STOP_NO_RETURN:
+      return "no return address";
+    case CM_UNWIND_STOP_BAD_FRAME:
+      return "bad frame";
+    default:
+      return "too many frames";
+  }
+}
+
+static int saveTable(const char *pTablePath, const char *pElfPath) {
+  CMElf *pElf;
+  int result = cmElfOpen(pElfPath, &pElf);
+  if (result != CM_OK) {
+    fprintf(stderr, "%s: %s\n", pElfPath, cmResultText(result));
+    return 1;
+  }
+
+  CMUnwindTable *pTable;
+  result = cmUnwindTableBuild(pElf, &pTable);
+  cmElfFree(pElf);
+  if (result == CM_ERR_ARGUMENT) {
+    fprintf(stderr, "%s: no .debug_frame (build with -g)\n", pElfPath);
+    return 1;
+  }
+  if (result == CM_OK) {
+    result = cmUnwindTableSave(pTable, pTablePath);
+    printf("%lu rows\n", (unsigned long)cmUnwindTableCount(pTable));
+    cmUnwindTableFree(pTable);
+  }
+  if (result != CM_OK) {
+    fprintf(stderr, "%s: %s\n", pTablePath, cmResultText(result));
+    return 1;
+  }
+  return 0;
+}
+
+// Gets the table of a build from the directory, loading it the first time.
+static const CMUnwindTable *findTable(std::map<uint16_t, CMUnwindTable *> &tables, const char *pDirectory,
+                                      uint16_t uBuild) {
+  std::map<uint16_t, CMUnwindTable *>::iterator table = tables.find(uBuild);
+  if (table != tables.end()) {
+    return table->second;
+  }
+
+  char acPath[1024];
+  snprintf(acPath, sizeof(acPath), "%s/%u.cmut", pDirectory, uBuild);
+  CMUnwindTable *pTable = NULL;
+  int result = cmUnwindTableLoad(acPath, &pTable);
+  if (result != CM_OK) {
+    fprintf(stderr, "%s: %s\n", acPath, cmResultText(result));
+  }
+  tables[uBuild] = pTable;
+  return pTable;
+}
+
+static void printFrames(const CMUnwindTable *pTable, const CMElf *pElf, const CMReport &report, uint8_t uPcSize) {
+  CMFrame aFrames[MAX_FRAMES];
+  int stop;
+  size_t count = cmUnwind(pTable, &report, uPcSize, aFrames, MAX_FRAMES, &stop);
+  for (size_t frame = 0; frame < count; ++frame) {
+    printf("  #%-2lu 0x%05lx sp=0x%04x", (unsigned long)frame, (unsigned long)aFrames[frame].ulAddress,
+           aFrames[frame].uStackPointer);
+    CMElfSymbol symbol;
+    if ((pElf != NULL) && (cmElfFindCode(pElf, aFrames[frame].ulAddress, &symbol) == CM_OK)) {
+      printf(" in %s + 0x%lx", symbol.pName, (unsigned long)(aFrames[frame].ulAddress - symbol.ulAddress));
+    }
+    printf("\n");
+  }
+  printf("  (%s)\n", stopText(stop));
+}
+
+int main(int argc, char **argv) {
+  const char *pSave = NULL;
+  const char *pElfPath = NULL;
+  const char *pTablePath = NULL;
+  const char *pDirectory = NULL;
+  long base = -1;
+  unsigned pcSize = 0;
+  int arg = 1;
+  for (; (arg < argc) && (strncmp(argv[arg], "--", 2) == 0); arg += 2) {
+    if (arg + 1 >= argc) {
+      usage();
+      return 2;
+    }
+    if (strcmp(argv[arg], "--save") == 0) {
+      pSave = argv[arg + 1];
+    }
+    else if (strcmp(argv[arg], "--elf") == 0) {
+      pElfPath = argv[arg + 1];
+    }
+    else if (strcmp(argv[arg], "--table") == 0) {
+      pTablePath = argv[arg + 1];
+    }
+    else if (strcmp(argv[arg], "--tables") == 0) {
+      pDirectory = argv[arg + 1];
+    }
+    else if (strcmp(argv[arg], "--pc-size") == 0) {
+      pcSize = (unsigned)strtoul(argv[arg + 1], NULL, 0);
+    }
+    else if (strcmp(argv[arg], "--eeprom") == 0) {
+      base = strtol(argv[arg + 1], NULL, 0);
+    }
+    else {
+      usage();
+      return 2;
+    }
+  }
+  if (argc - arg != 1) {
+    usage();
+    return 2;
+  }
+  if (pSave != NULL) {
+    return saveTable(pSave, argv[arg]);
+  }
+  if ((pElfPath != NULL) + (pTablePath != NULL) + (pDirectory != NULL) != 1) {
+    usage();
+    return 2;
+  }
+
+  CMElf *pElf = NULL;
+  CMUnwindTable *pTable = NULL;
+  int result = CM_OK;
+  if (pElfPath != NULL) {
+    result = cmElfOpen(pElfPath, &pElf);
+    if (result == CM_OK) {
+      result = cmUnwindTableBuild(pElf, &pTable);
+      if (pcSize == 0) {
+        // Only the 256KB parts (avr6) push 3 byte return addresses.
+        pcSize = ((cmElfFlags(pElf) & 0x7f) == 6) ? 3 : 2;
+      }
+    }
+  }
+  else if (pTablePath != NULL) {
+    result = cmUnwindTableLoad(pTablePath, &pTable);
+  }
+  if (result != CM_OK) {
+    fprintf(stderr, "%s: %s\n", pElfPath ? pElfPath : pTablePath, cmResultText(result));
+    cmElfFree(pElf);
+    return 1;
+  }
+  if (pcSize == 0) {
+    pcSize = 2;
+  }
+
+  CMTable *pReports = cmTableCreate();
+  long added = cmParseFile(pReports, argv[arg], (uint8_t)pcSize, base);
+  if (added < 0) {
+    fprintf(stderr, "%s: %s\n", argv[arg], cmResultText(added));
+    cmTableFree(pReports);
+    cmUnwindTableFree(pTable);
+    cmElfFree(pElf);
+    return 1;
+  }
+
+  std::map<uint16_t, CMUnwindTable *> tables;
+  char acLine[256];
+  CMReport report;
+  for (size_t row = 0; row < cmTableCount(pReports); ++row) {
+    cmTableGet(pReports, row, &report);
+    cmFormatReport(&report, acLine, sizeof(acLine));
+    if (report.ulDevice != CM_NO_DEVICE) {
+      printf("device %lu, ", (unsigned long)report.ulDevice);
+    }
+    printf("%s\n", acLine);
+
+    if ((report.uType == CM_TYPE_FLASH_CORRUPT) || (report.uType == CM_TYPE_MEMORY_CORRUPT)) {
+      continue;
+    }
+    const CMUnwindTable *pReportTable = pTable;
+    if (pDirectory != NULL) {
+      pReportTable = findTable(tables, pDirectory, report.uBuild);
+      if (pReportTable == NULL) {
+        printf("  not unwound: no table for build %u\n", report.uBuild);
+        continue;
+      }
+    }
+    printFrames(pReportTable, pElf, report, (uint8_t)pcSize);
+  }
+
+  for (std::map<uint16_t, CMUnwindTable *>::iterator table = tables.begin(); table != tables.end(); ++table) {
+    cmUnwindTableFree(table->second);
+  }
+  cmTableFree(pReports);
+  cmUnwindTableFree(pTable);
+  cmElfFree(pElf);
+  return 0;
+}
@@ -0,0 +1,209 @@
+/**
+ * CrashMonitorDisasmTest.cpp
+ * Version 1.4
+ * Author
+ *  Cyrus Brunner
+ *
+ * Host test for the ELF reader, the AVR disassembler and the host side hang
+ * classification. Build and run it with "make test".
+ *
+ * The code is assembled by hand from the AVR instruction set manual into a
+ * synthetic ELF with a symbol table, so avr-gcc isn't needed.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "CrashMonitorDisasm.h"
+#include "CrashMonitorElf.h"
+#include "CrashMonitorHost.h"
+#include "TestElf.h"
+
+static int failures = 0;
+
+#define CHECK(condition) \
+  do { \
+    if (!(condition)) { \
+      printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+      ++failures; \
+    } \
+  } while (0)
+
+// Addresses of the test functions (bytes).
+#define MAIN_ADDRESS 0x100
+#define SPIN_ADDRESS 0x108
+#define SPI_ADDRESS 0x10a
+#define TWI_ADDRESS 0x110
+#define IO_ADDRESS 0x118
+#define CALLER_ADDRESS 0x11c
+#define STRAIGHT_ADDRESS 0x13a
+
+static CMElf *buildFirmware(std::vector<uint8_t> &image) {
+  std::vector<uint16_t> words(MAIN_ADDRESS / 2, 0xffff);
+  // Vector 0: jmp 0x100
+  words[0] = 0x940c;
+  words[1] = 0x0080;
+
+  const uint16_t auCode[] = {
+    // main: while (!flag); (lds r24, 0x0123; and r24, r24; breq .-8)
+    0x9180, 0x0123, 0x2388, 0xf3e1,
+    // spin: rjmp .-2
+    0xcfff,
+    // spi: in r0, 0x2d; sbrs r0, 7; rjmp .-6
+    0xb40d, 0xfe07, 0xcffd,
+    // twi: lds r24, 0x00bc; sbrs r24, 7; rjmp .-8
+    0x9180, 0x00bc, 0xff87, 0xcffc,
+    // io: sbis 0x0b, 2; rjmp .-4
+    0x9b5a, 0xcffe,
+    // caller: push r28; ldd r24, Y+1; sbiw r24, 0x01; movw r30, r24;
+    // call 0x100; rcall .-54; icall; out 0x3f, r0; cli; sei; std Z+2, r24;
+    // ld r24, -X; pop r28; ret
+    0x93cf, 0x8189, 0x9701, 0x01fc, 0x940e, 0x0080, 0xdfe5, 0x9509, 0xbe0f, 0x94f8, 0x9478,
+    0x8382, 0x918e, 0x91cf, 0x9508,
+    // straight: nop; eor r1, r1; ldi r26, 0x00; (nothing loops)
+    0x0000, 0x2411, 0xe0a0, 0x9508
+  };
+  words.insert(words.end(), auCode, auCode + (sizeof(auCode) / sizeof(auCode[0])));
+
+  std::vector<CTestSection> sections;
+  sections.push_back(makeText(0, words));
+  std::vector<CTestSymbol> symbols;
+  CTestSymbol aSymbols[] = {
+    { "__vectors", 0, 0, CM_SYMBOL_NOTYPE },
+    { "main", MAIN_ADDRESS, 8, CM_SYMBOL_FUNC },
+    { "spin", SPIN_ADDRESS, 2, CM_SYMBOL_FUNC },
+    { "spi", SPI_ADDRESS, 6, CM_SYMBOL_FUNC },
+    { "twi", TWI_ADDRESS, 8, CM_SYMBOL_FUNC },
+    { "io", IO_ADDRESS, 4, CM_SYMBOL_FUNC },
+    { "caller", CALLER_ADDRESS, 30, CM_SYMBOL_FUNC },
+    { "straight", STRAIGHT_ADDRESS, 8, CM_SYMBOL_FUNC },
+    { "flag", 0x800123, 1, CM_SYMBOL_OBJECT }
+  };
+  symbols.assign(aSymbols, aSymbols + (sizeof(aSymbols) / sizeof(aSymbols[0])));
+  image = buildElf(5, sections, symbols);
+
+  CMElf *pElf = NULL;
+  CHECK(cmElfParse(&image[0], image.size(), &pElf) == CM_OK);
+  return pElf;
+}
+
+static void testElf(const CMElf *pElf, std::vector<uint8_t> &image) {
+  CMElfSymbol symbol;
+  CMElfSection section;
+  uint16_t uWord;
+  CHECK((cmElfFlags(pElf) & 0x7f) == 5);
+  CHECK(cmElfSymbolCount(pElf) == 9);
+  CHECK(cmElfFindSection(pElf, ".text", &section) == CM_OK);
+  CHECK(section.ulSize == 0x142);
+  CHECK(cmElfFindSection(pElf, ".debug_frame", &section) == CM_ERR_ARGUMENT);
+  CHECK((cmElfReadWord(pElf, SPIN_ADDRESS, &uWord) == CM_OK) && (uWord == 0xcfff));
+  CHECK(cmElfReadWord(pElf, 0x142, &uWord) == CM_ERR_ARGUMENT);
+
+  CHECK((cmElfFindCode(pElf, MAIN_ADDRESS + 4, &symbol) == CM_OK) && (strcmp(symbol.pName, "main") == 0));
+  CHECK((cmElfFindCode(pElf, 0x20, &symbol) == CM_OK) && (strcmp(symbol.pName, "__vectors") == 0));
+  CHECK((cmElfFindSymbol(pElf, "flag", &symbol) == CM_OK) && (symbol.ulAddress == 0x800123));
+
+  // Not an ELF, and cut off before the section headers.
+  CMElf *pBad = NULL;
+  uint8_t auText[64] = "hello";
+  CHECK(cmElfParse(auText, sizeof(auText), &pBad) == CM_ERR_FORMAT);
+  CHECK(cmElfParse(&image[0], image.size() - 8, &pBad) == CM_ERR_TRUNCATED);
+  CHECK(pBad == NULL);
+}
+
+static void checkText(const CMElf *pElf, uint32_t ulAddress, const char *pText, uint8_t uFlow) {
+  CMInstruction instruction;
+  CHECK(cmDisassemble(pElf, ulAddress, &instruction) == CM_OK);
+  if (strcmp(instruction.acText, pText) != 0) {
+    printf("0x%lx: \"%s\", expected \"%s\"\n", (unsigned long)ulAddress, instruction.acText, pText);
+    ++failures;
+  }
+  CHECK(instruction.uFlow == uFlow);
+}
+
+static void testDisassemble(const CMElf *pElf) {
+  CMInstruction instruction;
+  CHECK(cmDisassemble(pElf, 0, &instruction) == CM_OK);
+  CHECK((instruction.uWords == 2) && (instruction.ulTarget == MAIN_ADDRESS));
+  checkText(pElf, 0, "jmp 0x100", CM_FLOW_JUMP);
+  checkText(pElf, MAIN_ADDRESS, "lds r24, 0x0123", CM_FLOW_NONE);
+  checkText(pElf, MAIN_ADDRESS + 4, "and r24, r24", CM_FLOW_NONE);
+  checkText(pElf, MAIN_ADDRESS + 6, "breq .-8 ; 0x100", CM_FLOW_BRANCH);
+  checkText(pElf, SPIN_ADDRESS, "rjmp .-2 ; 0x108", CM_FLOW_JUMP);
+  checkText(pElf, SPI_ADDRESS, "in r0, 0x2d", CM_FLOW_NONE);
+  checkText(pElf, SPI_ADDRESS + 2, "sbrs r0, 7", CM_FLOW_SKIP);
+  checkText(pElf, IO_ADDRESS, "sbis 0x0b, 2", CM_FLOW_SKIP);
+
+  const char *apCaller[] = {
+    "push r28", "ldd r24, Y+1", "sbiw r24, 0x01", "movw r30, r24", "call 0x100", "rcall .-54 ; 0xf4", "icall",
+    "out 0x3f, r0", "cli", "sei", "std Z+2, r24", "ld r24, -X", "pop r28", "ret"
+  };
+  const uint8_t auFlow[] = {
+    CM_FLOW_NONE, CM_FLOW_NONE, CM_FLOW_NONE, CM_FLOW_NONE, CM_FLOW_CALL, CM_FLOW_CALL, CM_FLOW_INDIRECT_CALL,
+    CM_FLOW_NONE, CM_FLOW_NONE, CM_FLOW_NONE, CM_FLOW_NONE, CM_FLOW_NONE, CM_FLOW_NONE, CM_FLOW_RETURN
+  };
+  uint32_t ulAddress = CALLER_ADDRESS;
+  for (size_t index = 0; index < sizeof(apCaller) / sizeof(apCaller[0]); ++index) {
+    checkText(pElf, ulAddress, apCaller[index], auFlow[index]);
+    cmDisassemble(pElf, ulAddress, &instruction);
+    ulAddress += instruction.uWords * 2;
+  }
+  CHECK(ulAddress == STRAIGHT_ADDRESS);
+  checkText(pElf, STRAIGHT_ADDRESS, "nop", CM_FLOW_NONE);
+  checkText(pElf, STRAIGHT_ADDRESS + 2, "eor r1, r1", CM_FLOW_NONE);
+  checkText(pElf, STRAIGHT_ADDRESS + 4, "ldi r26, 0x00", CM_FLOW_NONE);
+
+  // Erased flash isn't an instruction.
+  checkText(pElf, 0x20, ".word 0xffff", CM_FLOW_NONE);
+  CHECK(cmDisassemble(pElf, 0x1000, &instruction) == CM_ERR_ARGUMENT);
+}
+
+static void checkHang(const CMElf *pElf, const CMTarget *pTarget, uint32_t ulAddress, const char *pExpected) {
+  const char *pHang = cmClassifyHang(pElf, pTarget, ulAddress);
+  if ((pHang == NULL) != (pExpected == NULL) || ((pHang != NULL) && (strcmp(pHang, pExpected) != 0))) {
+    printf("0x%lx: hang=%s, expected %s\n", (unsigned long)ulAddress, pHang ? pHang : "(none)",
+           pExpected ? pExpected : "(none)");
+    ++failures;
+  }
+}
+
+static void testClassifyHang(const CMElf *pElf) {
+  const CMTarget *pTarget = cmFindTarget(NULL, cmElfFlags(pElf) & 0x7f);
+  CHECK((pTarget != NULL) && (strcmp(pTarget->pName, "atmega328p") == 0));
+  CHECK(cmFindTarget("atmega2560", 0)->uRamStart == 0x200);
+  CHECK(cmFindTarget("attiny85", 0) == NULL);
+
+  // The watchdog can fire anywhere in the loop.
+  checkHang(pElf, pTarget, MAIN_ADDRESS, "volatile-wait");
+  checkHang(pElf, pTarget, MAIN_ADDRESS + 4, "volatile-wait");
+  checkHang(pElf, pTarget, SPIN_ADDRESS, "spin");
+  checkHang(pElf, pTarget, SPI_ADDRESS + 2, "spi-poll");
+  checkHang(pElf, pTarget, TWI_ADDRESS + 4, "twi-poll");
+  checkHang(pElf, pTarget, IO_ADDRESS, "io-poll");
+  checkHang(pElf, pTarget, STRAIGHT_ADDRESS, NULL);
+  checkHang(pElf, pTarget, 0x1000, NULL);
+
+  // On a part where 0x123 is an I/O register, the main loop polls I/O.
+  CMTarget ioTarget = *pTarget;
+  ioTarget.uRamStart = 0x200;
+  checkHang(pElf, &ioTarget, MAIN_ADDRESS, "io-poll");
+}
+
+int main() {
+  std::vector<uint8_t> image;
+  CMElf *pElf = buildFirmware(image);
+  if (pElf == NULL) {
+    return 1;
+  }
+
+  testElf(pElf, image);
+  testDisassemble(pElf);
+  testClassifyHang(pElf);
+  cmElfFree(pElf);
+
+  if (failures != 0) {
+    printf("%d check(s) failed\n", failures);
+    return 1;
+  }
+  printf("All checks passed\n");
+  return 0;
+}
@@ -0,0 +1,221 @@
+/**
+ * CrashMonitorFleetTest.cpp
+ * Version 1.4
+ * Author
+ *  Cyrus Brunner
+ *
+ * Host test for the fleet simulator. Build and run it with "make test".
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include "CrashMonitorFleet.h"
+#include "CrashMonitorHost.h"
+
+static int failures = 0;
+
+#define CHECK(condition) \
+  do { \
+    if (!(condition)) { \
+      printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+      ++failures; \
+    } \
+  } while (0)
+
+#define DEVICE_COUNT 500
+
+static std::vector<uint8_t> dumpDevice(const CMFleetConfig &config, uint32_t ulDevice) {
+  std::vector<uint8_t> dump(cmFleetMaxDumpSize(&config));
+  long size = cmFleetDump(&config, ulDevice, &dump[0], dump.size());
+  CHECK(size > 0);
+  dump.resize((size > 0) ? (size_t)size : 0);
+  return dump;
+}
+
+static std::vector<uint8_t> dumpFleet(const CMFleetConfig &config, uint32_t ulFirst, uint32_t ulCount) {
+  std::vector<uint8_t> fleet;
+  for (uint32_t ulDevice = ulFirst; ulDevice < ulFirst + ulCount; ++ulDevice) {
+    std::vector<uint8_t> dump = dumpDevice(config, ulDevice);
+    fleet.insert(fleet.end(), dump.begin(), dump.end());
+  }
+  return fleet;
+}
+
+static bool sameReport(const CMReport &a, const CMReport &b) {
+  if ((a.uType == CM_TYPE_FLASH_CORRUPT) || (a.uType == CM_TYPE_MEMORY_CORRUPT)) {
+    // dump() only prints the address and data of these.
+    return (a.ulAddress == b.ulAddress) && (a.ulData == b.ulData) && (a.uType == b.uType) && (a.uSlot == b.uSlot) &&
+      (a.ulDevice == b.ulDevice);
+  }
+  return (a.ulAddress == b.ulAddress) && (a.ulData == b.ulData) && (a.uType == b.uType) &&
+    (a.uStackPointer == b.uStackPointer) && (a.uRegion == b.uRegion) && (a.uBuild == b.uBuild) &&
+    (a.ulUptime == b.ulUptime) && (a.uStackLow == b.uStackLow) && (a.uIrqLatencyUs == b.uIrqLatencyUs) &&
+    (a.uSlot == b.uSlot) && (a.ulDevice == b.ulDevice);
+}
+
+static bool sameTable(const CMTable *pA, const CMTable *pB) {
+  if (cmTableCount(pA) != cmTableCount(pB)) {
+    return false;
+  }
+  CMReport a;
+  CMReport b;
+  for (size_t row = 0; row < cmTableCount(pA); ++row) {
+    cmTableGet(pA, row, &a);
+    cmTableGet(pB, row, &b);
+    if (!sameReport(a, b)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static void testDeterminism() {
+  CMFleetConfig config;
+  cmFleetDefaults(&config);
+
+  // The same device comes out the same, in any order.
+  std::vector<uint8_t> first = dumpDevice(config, 7);
+  dumpDevice(config, 8);
+  CHECK(dumpDevice(config, 7) == first);
+
+  // Another seed gives another fleet.
+  std::vector<uint8_t> fleet = dumpFleet(config, 0, 16);
+  config.ulSeed = 2;
+  CHECK(dumpFleet(config, 0, 16) != fleet);
+}
+
+static void testFormats(uint8_t uPcSize) {
+  CMFleetConfig config;
+  cmFleetDefaults(&config);
+  config.uPcSize = uPcSize;
+
+  // The text and the binary stream parse to the same reports.
+  CMTable *pText = cmTableCreate();
+  std::vector<uint8_t> text = dumpFleet(config, 0, DEVICE_COUNT);
+  long textCount = cmParseText(pText, (const char *)&text[0], text.size());
+  config.uFormat = CM_FLEET_BINARY;
+  CMTable *pBinary = cmTableCreate();
+  std::vector<uint8_t> binary = dumpFleet(config, 0, DEVICE_COUNT);
+  long binaryCount = cmParseBinaryStream(pBinary, &binary[0], binary.size(), uPcSize);
+  CHECK(textCount > DEVICE_COUNT);
+  CHECK(binaryCount == textCount);
+  CHECK(sameTable(pText, pBinary));
+
+  // Every build shows up, and so does every report type.
+  const CMFleetBuild *pBuilds;
+  size_t buildCount = cmFleetBuilds(&pBuilds);
+  CHECK(buildCount >= 2);
+  unsigned share = 0;
+  for (size_t build = 0; build < buildCount; ++build) {
+    share += pBuilds[build].uShare;
+  }
+  CHECK(share == 100);
+  unsigned auTypes[CM_TYPE_MEMORY_CORRUPT + 1] = { 0 };
+  std::vector<unsigned> builds(buildCount, 0);
+  CMReport report;
+  uint32_t ulLastDevice = 0;
+  bool bOrdered = true;
+  for (size_t row = 0; row < cmTableCount(pBinary); ++row) {
+    cmTableGet(pBinary, row, &report);
+    CHECK(report.uType <= CM_TYPE_MEMORY_CORRUPT);
+    ++auTypes[report.uType];
+    bOrdered = bOrdered && (report.ulDevice >= ulLastDevice) && (report.ulDevice < DEVICE_COUNT);
+    ulLastDevice = report.ulDevice;
+    if (report.uType == CM_TYPE_FLASH_CORRUPT) {
+      continue;
+    }
+    for (size_t build = 0; build < buildCount; ++build) {
+      builds[build] += (report.uBuild == pBuilds[build].uBuild);
+    }
+    if (report.uType != CM_TYPE_MEMORY_CORRUPT) {
+      CHECK((report.uStackPointer > 0x700) && (report.ulUptime >= 1000));
+    }
+  }
+  CHECK(bOrdered);
+  for (unsigned uType = 0; uType <= CM_TYPE_MEMORY_CORRUPT; ++uType) {
+    CHECK(auTypes[uType] != 0);
+  }
+  for (size_t build = 0; build < buildCount; ++build) {
+    CHECK(builds[build] != 0);
+  }
+  cmTableFree(pText);
+  cmTableFree(pBinary);
+}
+
+static void testStore() {
+  CMFleetConfig config;
+  cmFleetDefaults(&config);
+  config.uMaxEntries = 3;
+  config.uFormat = CM_FLEET_BINARY;
+  const size_t storeSize = CM_HEADER_SIZE + (3 * (2 + CM_RECORD_FIXED_SIZE));
+
+  // Each device's EEPROM holds what its binary dump does. The slots wrap the
+  // way the device's do: once wrapped, the store stays full (the header can
+  // count one past the slots, which the device caps when it loads it).
+  bool bWrapped = false;
+  bool bEmpty = false;
+  for (uint32_t ulDevice = 0; ulDevice < 50; ++ulDevice) {
+    uint8_t auStore[storeSize];
+    CHECK(cmFleetStore(&config, ulDevice, auStore, sizeof(auStore)) == (long)storeSize);
+    std::vector<uint8_t> dump = dumpDevice(config, ulDevice);
+    CHECK(dump.size() >= 4 + CM_DESCRIPTOR_SIZE + CM_HEADER_SIZE);
+    const uint8_t *puHeader = &dump[4 + CM_DESCRIPTOR_SIZE];
+    uint8_t uSaved = puHeader[0];
+    CHECK(uSaved <= 3);
+    CHECK(dump.size() == 4 + CM_DESCRIPTOR_SIZE + CM_HEADER_SIZE + ((size_t)uSaved * (2 + CM_RECORD_FIXED_SIZE)));
+    CHECK(memcmp(puHeader + CM_HEADER_SIZE, auStore + CM_HEADER_SIZE, uSaved * (2 + CM_RECORD_FIXED_SIZE)) == 0);
+
+    CMTable *pEeprom = cmTableCreate();
+    long count = cmParseEeprom(pEeprom, auStore, sizeof(auStore), 0, 2, ulDevice);
+    if (auStore[2] == 0xff) {
+      // No crashes: the header was never written, and the device ignores it.
+      bEmpty = true;
+      CHECK(count == CM_ERR_LAYOUT);
+      CHECK(uSaved == 0);
+    }
+    else {
+      CHECK(puHeader[1] == auStore[1]);
+      if ((auStore[0] >= 3) || (auStore[1] != auStore[0])) {
+        bWrapped = true;
+        CHECK(uSaved >= 2);
+      }
+      if (auStore[0] <= 3) {
+        CMTable *pBinary = cmTableCreate();
+        CHECK(cmParseBinaryStream(pBinary, &dump[0], dump.size(), 2) == count);
+        CHECK(sameTable(pEeprom, pBinary));
+        cmTableFree(pBinary);
+      }
+    }
+    cmTableFree(pEeprom);
+  }
+  CHECK(bWrapped && bEmpty);
+}
+
+static void testArguments() {
+  CMFleetConfig config;
+  cmFleetDefaults(&config);
+  uint8_t auBuffer[64];
+  CHECK(cmFleetDump(&config, 0, auBuffer, sizeof(auBuffer)) == CM_ERR_ARGUMENT);
+  CHECK(cmFleetStore(&config, 0, auBuffer, sizeof(auBuffer)) == CM_ERR_ARGUMENT);
+  config.uPcSize = 4;
+  CHECK(cmFleetStore(&config, 0, auBuffer, 0) == CM_ERR_ARGUMENT);
+  config.uPcSize = 2;
+  config.uMaxEntries = 0;
+  CHECK(cmFleetStore(&config, 0, auBuffer, sizeof(auBuffer)) == CM_ERR_ARGUMENT);
+}
+
+int main() {
+  testDeterminism();
+  testFormats(2);
+  testFormats(3);
+  testStore();
+  testArguments();
+
+  if (failures != 0) {
+    printf("%d check(s) failed\n", failures);
+    return 1;
+  }
+  printf("All checks passed\n");
+  return 0;
+}
@@ -0,0 +1,366 @@
+/**
+ * CrashMonitorHostTest.c
+ * Version 1.4
+ * Author
+ *  Cyrus Brunner
+ *
+ * Host test for the report parsers in libcrashmonitor. It is written in C to
+ * make sure the library can be used through its C ABI. Build and run it with
+ * "make test".
+ *
+ * The test encodes reports the way the device stores them, writes them out as
+ * a binary dump, an EEPROM image, serialize() packets and a text dump, and
+ * checks that every parser gives back the same table.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "CrashMonitorHost.h"
+
+#define PC_SIZE 2
+#define STACK_BYTES 16
+#define RECORD_SIZE (PC_SIZE + CM_RECORD_FIXED_SIZE + STACK_BYTES)
+#define REPORT_COUNT 5
+#define EEPROM_BASE 500
+
+static int failures = 0;
+
+#define CHECK(condition) \
+  do { \
+    if (!(condition)) { \
+      printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+      ++failures; \
+    } \
+  } while (0)
+
+static void makeReports(struct CMReport *pReports, uint8_t uStackBytes) {
+  uint8_t uReport;
+  uint8_t uByte;
+  for (uReport = 0; uReport < REPORT_COUNT; ++uReport) {
+    struct CMReport *pReport = &pReports[uReport];
+    memset(pReport, 0, sizeof(*pReport));
+    pReport->ulAddress = 0x3ae + (uReport * 0x101);
+    pReport->ulData = 0x12345678 + uReport;
+    pReport->uType = (uReport == 1) ? CM_TYPE_STALL : ((uReport == 2) ? CM_TYPE_USER : CM_TYPE_WATCHDOG);
+    pReport->uStackPointer = 0x8f2 - uReport;
+    pReport->uRegion = (uReport == 3) ? 7 : 0;
+    pReport->uBuild = 42;
+    pReport->ulUptime = 81234 * (uReport + 1);
+    pReport->uStackLow = (uReport == 0) ? 0 : 0x7a0;
+    pReport->uIrqLatencyUs = (uReport == 4) ? 412 : 0;
+    pReport->uSlot = uReport;
+    pReport->ulDevice = CM_NO_DEVICE;
+    pReport->uStackBytes = uStackBytes;
+    for (uByte = 0; uByte < uStackBytes; ++uByte) {
+      pReport->auStack[uByte] = (uint8_t)((uReport * 16) + uByte);
+    }
+  }
+
+  // A flash and a memory corruption report as well, which only carry an
+  // address and the data.
+  memset(&pReports[REPORT_COUNT - 2], 0, sizeof(struct CMReport) * 2);
+  pReports[REPORT_COUNT - 2].uType = CM_TYPE_FLASH_CORRUPT;
+  pReports[REPORT_COUNT - 2].ulAddress = 0xd20;
+  pReports[REPORT_COUNT - 2].ulData = 0x3c1f9b02;
+  pReports[REPORT_COUNT - 1].uType = CM_TYPE_MEMORY_CORRUPT;
+  pReports[REPORT_COUNT - 1].ulAddress = 0x1f0;
+  pReports[REPORT_COUNT - 1].ulData = 0xbeef;
+  for (uReport = REPORT_COUNT - 2; uReport < REPORT_COUNT; ++uReport) {
+    pReports[uReport].uSlot = uReport;
+    pReports[uReport].ulDevice = CM_NO_DEVICE;
+    pReports[uReport].uStackBytes = uStackBytes;
+  }
+}
+
+static int sameReport(const struct CMReport *pA, const struct CMReport *pB) {
+  return (pA->ulAddress == pB->ulAddress) && (pA->ulData == pB->ulData) && (pA->uType == pB->uType) &&
+    (pA->uStackPointer == pB->uStackPointer) && (pA->uRegion == pB->uRegion) && (pA->uBuild == pB->uBuild) &&
+    (pA->ulUptime == pB->ulUptime) && (pA->uStackLow == pB->uStackLow) &&
+    (pA->uIrqLatencyUs == pB->uIrqLatencyUs) && (pA->uSlot == pB->uSlot) && (pA->ulDevice == pB->ulDevice) &&
+    (pA->uStackBytes == pB->uStackBytes) && (memcmp(pA->auStack, pB->auStack, pA->uStackBytes) == 0);
+}
+
+static void checkTable(const CMTable *pTable, const struct CMReport *pReports, size_t count) {
+  size_t row;
+  struct CMReport report;
+  CHECK(cmTableCount(pTable) == count);
+  for (row = 0; row < count; ++row) {
+    CHECK(cmTableGet(pTable, row, &report) == CM_OK);
+    CHECK(sameReport(&report, &pReports[row]));
+  }
+}
+
+// Builds what dumpBinary() writes.
+static size_t makeBinaryDump(uint8_t *puDump, const struct CMReport *pReports, uint8_t uRecordSize) {
+  uint8_t uReport;
+  size_t size = 0;
+  puDump[size++] = 'C';
+  puDump[size++] = 'M';
+  puDump[size++] = CM_BINARY_FORMAT_VERSION;
+  puDump[size++] = uRecordSize;
+  puDump[size++] = REPORT_COUNT;
+  puDump[size++] = REPORT_COUNT;
+  puDump[size++] = CM_REPORT_LAYOUT_VERSION;
+  puDump[size++] = uRecordSize;
+  for (uReport = 0; uReport < REPORT_COUNT; ++uReport) {
+    size += cmEncodeRecord(&pReports[uReport], PC_SIZE, puDump + size);
+  }
+  return size;
+}
+
+static void testBinary(void) {
+  struct CMReport aReports[REPORT_COUNT];
+  uint8_t auDump[8 + (REPORT_COUNT * RECORD_SIZE)];
+  CMTable *pTable = cmTableCreate();
+  struct CMColumns columns;
+  size_t used = 0;
+
+  makeReports(aReports, STACK_BYTES);
+  size_t size = makeBinaryDump(auDump, aReports, RECORD_SIZE);
+  CHECK(cmParseBinary(pTable, auDump, size, PC_SIZE, CM_NO_DEVICE, &used) == REPORT_COUNT);
+  CHECK(used == size);
+  checkTable(pTable, aReports, REPORT_COUNT);
+
+  // The columns hold the same values.
+  cmTableColumns(pTable, &columns);
+  CHECK(columns.count == REPORT_COUNT);
+  CHECK(columns.uStackBytes == STACK_BYTES);
+  CHECK(columns.pulAddress[0] == 0x3ae);
+  CHECK(columns.puType[1] == CM_TYPE_STALL);
+  CHECK(columns.puBuild[2] == 42);
+  CHECK(columns.puStack[(2 * STACK_BYTES) + 1] == 33);
+
+  // Truncated, bad magic, other version and a record size mismatch leave the
+  // table alone.
+  cmTableClear(pTable);
+  CHECK(cmParseBinary(pTable, auDump, size - 1, PC_SIZE, CM_NO_DEVICE, NULL) == CM_ERR_TRUNCATED);
+  auDump[2] = 1;
+  CHECK(cmParseBinary(pTable, auDump, size, PC_SIZE, CM_NO_DEVICE, NULL) == CM_ERR_VERSION);
+  auDump[2] = CM_BINARY_FORMAT_VERSION;
+  auDump[7] = RECORD_SIZE - 1;
+  CHECK(cmParseBinary(pTable, auDump, size, PC_SIZE, CM_NO_DEVICE, NULL) == CM_ERR_LAYOUT);
+  auDump[0] = 'X';
+  CHECK(cmParseBinary(pTable, auDump, size, PC_SIZE, CM_NO_DEVICE, NULL) == CM_ERR_FORMAT);
+  CHECK(cmTableCount(pTable) == 0);
+  cmTableFree(pTable);
+}
+
+static void testBinaryStream(void) {
+  struct CMReport aReports[3][REPORT_COUNT];
+  uint8_t auStream[3 * (4 + 8 + (REPORT_COUNT * RECORD_SIZE))];
+  struct CMReport aExpected[3 * REPORT_COUNT];
+  CMTable *pTable = cmTableCreate();
+  size_t size = 0;
+  uint32_t ulDevice;
+  uint8_t uReport;
+
+  for (ulDevice = 0; ulDevice < 3; ++ulDevice) {
+    makeReports(aReports[ulDevice], STACK_BYTES);
+    auStream[size++] = (uint8_t)(ulDevice + 1000);
+    auStream[size++] = (uint8_t)((ulDevice + 1000) >> 8);
+    auStream[size++] = 0;
+    auStream[size++] = 0;
+    size += makeBinaryDump(auStream + size, aReports[ulDevice], RECORD_SIZE);
+    for (uReport = 0; uReport < REPORT_COUNT; ++uReport) {
+      aExpected[(ulDevice * REPORT_COUNT) + uReport] = aReports[ulDevice][uReport];
+      aExpected[(ulDevice * REPORT_COUNT) + uReport].ulDevice = ulDevice + 1000;
+    }
+  }
+  CHECK(cmParseBinaryStream(pTable, auStream, size, PC_SIZE) == 3 * REPORT_COUNT);
+  checkTable(pTable, aExpected, 3 * REPORT_COUNT);
+
+  // A stream cut off in the last dump adds nothing.
+  cmTableClear(pTable);
+  CHECK(cmParseBinaryStream(pTable, auStream, size - 3, PC_SIZE) == CM_ERR_TRUNCATED);
+  CHECK(cmTableCount(pTable) == 0);
+  cmTableFree(pTable);
+}
+
+static void testEeprom(void) {
+  struct CMReport aReports[REPORT_COUNT];
+  uint8_t auImage[1024];
+  CMTable *pTable = cmTableCreate();
+  uint8_t uReport;
+
+  // No stack snapshot this time, and unused slots after the saved reports.
+  makeReports(aReports, 0);
+  memset(auImage, 0xff, sizeof(auImage));
+  auImage[EEPROM_BASE] = REPORT_COUNT;
+  auImage[EEPROM_BASE + 1] = REPORT_COUNT;
+  auImage[EEPROM_BASE + 2] = CM_REPORT_LAYOUT_VERSION;
+  auImage[EEPROM_BASE + 3] = PC_SIZE + CM_RECORD_FIXED_SIZE;
+  for (uReport = 0; uReport < REPORT_COUNT; ++uReport) {
+    cmEncodeRecord(&aReports[uReport], PC_SIZE,
+                   auImage + EEPROM_BASE + 4 + (uReport * (PC_SIZE + CM_RECORD_FIXED_SIZE)));
+    aReports[uReport].ulDevice = 7;
+  }
+  CHECK(cmParseEeprom(pTable, auImage, sizeof(auImage), EEPROM_BASE, PC_SIZE, 7) == REPORT_COUNT);
+  checkTable(pTable, aReports, REPORT_COUNT);
+
+  // Erased EEPROM (or an older layout) is not read, just like on the device.
+  cmTableClear(pTable);
+  auImage[EEPROM_BASE + 2] = 0xff;
+  CHECK(cmParseEeprom(pTable, auImage, sizeof(auImage), EEPROM_BASE, PC_SIZE, 7) == CM_ERR_LAYOUT);
+  CHECK(cmParseEeprom(pTable, auImage, sizeof(auImage), sizeof(auImage) - 2, PC_SIZE, 7) == CM_ERR_TRUNCATED);
+  CHECK(cmTableCount(pTable) == 0);
+  cmTableFree(pTable);
+}
+
+// The same as CrashMonitor::serialize().
+static uint8_t serialize(const uint8_t *puRecords, uint8_t uSaved, uint8_t *puBuffer, uint8_t uLen,
+                         uint16_t *puCursor) {
+  uint8_t uUsed = 0;
+  while ((uint8_t)(*puCursor >> 8) < uSaved) {
+    uint8_t uSlot = (uint8_t)(*puCursor >> 8);
+    uint8_t uOffset = (uint8_t)*puCursor;
+    uint8_t uSize = RECORD_SIZE - uOffset;
+    if ((uint8_t)(uLen - uUsed) < 3) {
+      break;
+    }
+    puBuffer[uUsed++] = uSlot;
+    puBuffer[uUsed++] = uOffset;
+    if (uSize > (uint8_t)(uLen - uUsed)) {
+      uSize = uLen - uUsed;
+    }
+    memcpy(puBuffer + uUsed, puRecords + (uSlot * RECORD_SIZE) + uOffset, uSize);
+    uUsed += uSize;
+    uOffset += uSize;
+    *puCursor = (uOffset >= RECORD_SIZE) ? (uint16_t)((uSlot + 1) << 8) : (uint16_t)((uSlot << 8) | uOffset);
+  }
+  return uUsed;
+}
+
+static void testPackets(void) {
+  struct CMReport aReports[REPORT_COUNT];
+  uint8_t auRecords[REPORT_COUNT * RECORD_SIZE];
+  uint8_t auPacket[32];
+  uint8_t uLen;
+  uint8_t uReport;
+  uint8_t uPacket = 0;
+  uint16_t uCursor = 0;
+  struct CMPacketReader reader;
+  CMTable *pTable = cmTableCreate();
+  long added = 0;
+
+  makeReports(aReports, STACK_BYTES);
+  for (uReport = 0; uReport < REPORT_COUNT; ++uReport) {
+    cmEncodeRecord(&aReports[uReport], PC_SIZE, auRecords + (uReport * RECORD_SIZE));
+  }
+
+  // A record (36 bytes) does not fit in a 32 byte packet, so every record is
+  // split.
+  CHECK(cmPacketReaderInit(&reader, RECORD_SIZE, PC_SIZE, CM_NO_DEVICE) == CM_OK);
+  while ((uLen = serialize(auRecords, REPORT_COUNT, auPacket, sizeof(auPacket), &uCursor)) != 0) {
+    added += cmParsePacket(&reader, pTable, auPacket, uLen);
+    ++uPacket;
+  }
+  CHECK(added == REPORT_COUNT);
+  CHECK(uPacket > REPORT_COUNT);
+  checkTable(pTable, aReports, REPORT_COUNT);
+
+  // Lose the second packet, which holds the end of the first record and the
+  // start of the second. Both are dropped and the rest still come through.
+  cmTableClear(pTable);
+  cmPacketReaderInit(&reader, RECORD_SIZE, PC_SIZE, CM_NO_DEVICE);
+  uCursor = 0;
+  uPacket = 0;
+  while ((uLen = serialize(auRecords, REPORT_COUNT, auPacket, sizeof(auPacket), &uCursor)) != 0) {
+    if (uPacket++ != 1) {
+      cmParsePacket(&reader, pTable, auPacket, uLen);
+    }
+  }
+  CHECK(cmTableCount(pTable) == REPORT_COUNT - 2);
+  CHECK((cmTableGet(pTable, 0, &aReports[0]) == CM_OK) && (aReports[0].uSlot == 2));
+  cmTableFree(pTable);
+}
+
+static void testText(void) {
+  struct CMReport aReports[2 * REPORT_COUNT];
+  char acText[4096];
+  char acLine[512];
+  size_t size = 0;
+  uint8_t uReport;
+  CMTable *pTable = cmTableCreate();
+
+  // Two devices' dumps, with other serial output, \r\n line endings and the
+  // fields only the device can decode (insn and hang) mixed in.
+  makeReports(aReports, STACK_BYTES);
+  makeReports(aReports + REPORT_COUNT, STACK_BYTES);
+  size += sprintf(acText + size, "booting...\r\nDevice: 12\r\nCrash Monitor\r\n-------------\r\n");
+  size += sprintf(acText + size, "Saved reports: %d\r\nNext report: %d\r\n", REPORT_COUNT, REPORT_COUNT);
+  for (uReport = 0; uReport < 2 * REPORT_COUNT; ++uReport) {
+    if (uReport == REPORT_COUNT) {
+      size += sprintf(acText + size, "Device: 13\r\n");
+    }
+    aReports[uReport].ulDevice = (uReport < REPORT_COUNT) ? 12 : 13;
+    if ((aReports[uReport].uType == CM_TYPE_FLASH_CORRUPT) || (aReports[uReport].uType == CM_TYPE_MEMORY_CORRUPT)) {
+      // These lines have no stack snapshot.
+      aReports[uReport].uStackBytes = 0;
+    }
+    cmFormatReport(&aReports[uReport], acLine, sizeof(acLine));
+    if (uReport == 0) {
+      char *pStack = strstr(acLine, ", stack=");
+      char acStack[256];
+      strcpy(acStack, pStack);
+      sprintf(pStack, ", insn=0xCFFF, hang=spin%s", acStack);
+    }
+    size += sprintf(acText + size, "%s\r\n", acLine);
+  }
+  size += sprintf(acText + size, "Trace:\r\nfmt=3, arg=0x10\r\n0: word-address=0x3AE: byte-ad");
+
+  CHECK(strstr(acText, "0: word-address=0x3AE: byte-address=0x75C, data=0x12345678, sp=0x8F2, build=42, "
+                "uptime=81234, insn=0xCFFF, hang=spin, stack=000102030405060708090A0B0C0D0E0F\r\n") != NULL);
+  CHECK(strstr(acText, "3: flash-corrupt length=0x1A40, crc=0x3C1F, expected=0x9B02\r\n") != NULL);
+  CHECK(cmParseText(pTable, acText, size) == 2 * REPORT_COUNT);
+
+  // The flash and memory corruption rows take the width of the table's stack
+  // column, with the snapshot zeroed.
+  for (uReport = 0; uReport < 2 * REPORT_COUNT; ++uReport) {
+    aReports[uReport].uStackBytes = STACK_BYTES;
+  }
+  checkTable(pTable, aReports, 2 * REPORT_COUNT);
+  cmTableFree(pTable);
+}
+
+static void testMappedFile(void) {
+  struct CMReport aReports[REPORT_COUNT];
+  uint8_t auDump[8 + (REPORT_COUNT * RECORD_SIZE)];
+  char acPath[] = "/tmp/CrashMonitorHostTestXXXXXX";
+  struct CMMappedFile file;
+  CMTable *pTable = cmTableCreate();
+  int fd = mkstemp(acPath);
+
+  makeReports(aReports, STACK_BYTES);
+  size_t size = makeBinaryDump(auDump, aReports, RECORD_SIZE);
+  CHECK(fd >= 0);
+  CHECK(write(fd, auDump, size) == (ssize_t)size);
+  close(fd);
+
+  CHECK(cmMapFile(acPath, &file) == CM_OK);
+  CHECK(file.size == size);
+  CHECK(cmParseBinary(pTable, file.puData, file.size, PC_SIZE, CM_NO_DEVICE, NULL) == REPORT_COUNT);
+  checkTable(pTable, aReports, REPORT_COUNT);
+  cmUnmapFile(&file);
+  unlink(acPath);
+  CHECK(cmMapFile(acPath, &file) == CM_ERR_IO);
+  cmTableFree(pTable);
+}
+
+int main(void) {
+  testBinary();
+  testBinaryStream();
+  testEeprom();
+  testPackets();
+  testText();
+  testMappedFile();
+
+  if (failures != 0) {
+    printf("%d check(s) failed\n", failures);
+    return 1;
+  }
+  printf("All checks passed\n");
+  return 0;
+}
@@ -0,0 +1,238 @@
+/**
+ * CrashMonitorStackTest.cpp
+ * Version 1.4
+ * Author
+ *  Cyrus Brunner
+ *
+ * Host test for the stack depth analysis. Build and run it with "make test".
+ *
+ * The call graph is assembled by hand into a synthetic ELF:
+ *
+ *   main        0x100  call helper, rcall leaf, jmp tail (a tail call)
+ *   helper      0x120  call leaf, icall
+ *   leaf        0x140
+ *   tail        0x160  rcall recurse, call 0x1000 (not a function)
+ *   recurse     0x180  rcall recurse
+ *   __vector_11 0x1a0  call leaf
+ *   __vector_5  0x1c0
+ *   Sensor::read(int) 0x1e0
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "CrashMonitorElf.h"
+#include "CrashMonitorHost.h"
+#include "CrashMonitorStack.h"
+#include "TestElf.h"
+
+static int failures = 0;
+
+#define CHECK(condition) \
+  do { \
+    if (!(condition)) { \
+      printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+      ++failures; \
+    } \
+  } while (0)
+
+#define MAIN_ADDRESS 0x100
+#define HELPER_ADDRESS 0x120
+#define LEAF_ADDRESS 0x140
+#define TAIL_ADDRESS 0x160
+#define RECURSE_ADDRESS 0x180
+#define VECTOR_11_ADDRESS 0x1a0
+#define VECTOR_5_ADDRESS 0x1c0
+#define SENSOR_ADDRESS 0x1e0
+#define DATA_END 0x700
+
+static const char acUsage[] =
+  "main.cpp:10:5:int main()\t6\tstatic\n"
+  "main.cpp:20:13:helper\t10\tstatic\n"
+  "other.c:5:13:helper\t4\tstatic\n"
+  "leaf.c:1:6:leaf\t2\tstatic\r\n"
+  "tail.c:3:6:tail\t8\tdynamic\n"
+  "rec.c:3:6:recurse\t3\tdynamic,bounded\n"
+  "isr.cpp:9:1:void __vector_11()\t17\tstatic\n"
+  "sensor.cpp:12:6:int Sensor::read(int)\t5\tstatic\n"
+  "unknown.c:1:1:nothere\t9\tstatic\n"
+  "\n"
+  "C:\\proj\\win.c:4:2:__vector_5\t20\tstatic\n";
+
+static CMElf *buildFirmware(std::vector<uint8_t> &image) {
+  std::vector<uint16_t> words(0x78, 0);
+  const uint16_t auMain[] = { 0x940e, 0x0090, 0xd01d, 0x940c, 0x00b0, 0x9508 };
+  const uint16_t auHelper[] = { 0x940e, 0x00a0, 0x9509, 0x9508 };
+  const uint16_t auLeaf[] = { 0x0000, 0x9508 };
+  const uint16_t auTail[] = { 0xd00f, 0x940e, 0x0800, 0x9508 };
+  const uint16_t auRecurse[] = { 0xdfff, 0x9508 };
+  const uint16_t auVector11[] = { 0x940e, 0x00a0, 0x9518 };
+  const uint16_t auVector5[] = { 0x9518 };
+  const uint16_t auSensor[] = { 0x9508 };
+  memcpy(&words[(MAIN_ADDRESS - 0x100) / 2], auMain, sizeof(auMain));
+  memcpy(&words[(HELPER_ADDRESS - 0x100) / 2], auHelper, sizeof(auHelper));
+  memcpy(&words[(LEAF_ADDRESS - 0x100) / 2], auLeaf, sizeof(auLeaf));
+  memcpy(&words[(TAIL_ADDRESS - 0x100) / 2], auTail, sizeof(auTail));
+  memcpy(&words[(RECURSE_ADDRESS - 0x100) / 2], auRecurse, sizeof(auRecurse));
+  memcpy(&words[(VECTOR_11_ADDRESS - 0x100) / 2], auVector11, sizeof(auVector11));
+  memcpy(&words[(VECTOR_5_ADDRESS - 0x100) / 2], auVector5, sizeof(auVector5));
+  memcpy(&words[(SENSOR_ADDRESS - 0x100) / 2], auSensor, sizeof(auSensor));
+
+  std::vector<CTestSection> sections;
+  sections.push_back(makeText(0x100, words));
+  CTestSymbol aSymbols[] = {
+    { "main", MAIN_ADDRESS, sizeof(auMain), CM_SYMBOL_FUNC },
+    { "helper", HELPER_ADDRESS, sizeof(auHelper), CM_SYMBOL_FUNC },
+    { "leaf", LEAF_ADDRESS, sizeof(auLeaf), CM_SYMBOL_FUNC },
+    { "tail", TAIL_ADDRESS, sizeof(auTail), CM_SYMBOL_FUNC },
+    { "recurse", RECURSE_ADDRESS, sizeof(auRecurse), CM_SYMBOL_FUNC },
+    { "__vector_11", VECTOR_11_ADDRESS, sizeof(auVector11), CM_SYMBOL_FUNC },
+    { "__vector_5", VECTOR_5_ADDRESS, sizeof(auVector5), CM_SYMBOL_FUNC },
+    { "_ZN6Sensor4readEi", SENSOR_ADDRESS, sizeof(auSensor), CM_SYMBOL_FUNC },
+    { "_end", 0x800000 + DATA_END, 0, CM_SYMBOL_NOTYPE }
+  };
+  std::vector<CTestSymbol> symbols(aSymbols, aSymbols + (sizeof(aSymbols) / sizeof(aSymbols[0])));
+  image = buildElf(5, sections, symbols);
+
+  CMElf *pElf = NULL;
+  CHECK(cmElfParse(&image[0], image.size(), &pElf) == CM_OK);
+  return pElf;
+}
+
+static CMStackFunction getFunction(const CMStackGraph *pGraph, uint32_t ulAddress) {
+  CMStackFunction function;
+  size_t index = CM_STACK_NONE;
+  memset(&function, 0, sizeof(function));
+  CHECK(cmStackGraphFind(pGraph, ulAddress, &index) == CM_OK);
+  CHECK(cmStackGraphGet(pGraph, index, &function) == CM_OK);
+  return function;
+}
+
+static void testGraph(CMStackGraph *pGraph) {
+  CHECK(cmStackGraphCount(pGraph) == 8);
+  CMStackFunction function = getFunction(pGraph, SENSOR_ADDRESS);
+  CHECK(strcmp(function.pName, "Sensor::read(int)") == 0);
+
+  // Nothing is known before the .su files are added.
+  function = getFunction(pGraph, HELPER_ADDRESS);
+  CHECK((function.ulFrame == 0) && (function.ulDepth == 2) &&
+        (function.uFlags == (CM_STACK_NO_USAGE | CM_STACK_INDIRECT)));
+
+  // A bad file changes nothing.
+  const char acBad[] = "leaf.c:1:6:leaf\t2\tstatic\nnot a .su line\n";
+  CHECK(cmStackGraphAddUsage(pGraph, acBad, sizeof(acBad) - 1) == CM_ERR_FORMAT);
+  CHECK(getFunction(pGraph, LEAF_ADDRESS).ulFrame == 0);
+
+  CHECK(cmStackGraphAddUsage(pGraph, acUsage, sizeof(acUsage) - 1) == 9);
+
+  function = getFunction(pGraph, LEAF_ADDRESS);
+  CHECK((function.ulFrame == 2) && (function.ulDepth == 2) && (function.uFlags == 0) &&
+        (function.worstCallee == CM_STACK_NONE));
+
+  // The bigger of the two static helpers, plus the call to leaf.
+  function = getFunction(pGraph, HELPER_ADDRESS);
+  CHECK((function.ulFrame == 10) && (function.ulDepth == 14) && (function.uFlags == CM_STACK_INDIRECT));
+
+  function = getFunction(pGraph, RECURSE_ADDRESS);
+  CHECK((function.ulDepth == 3) && (function.uFlags == CM_STACK_RECURSIVE));
+
+  function = getFunction(pGraph, TAIL_ADDRESS);
+  CHECK((function.ulDepth == 13) &&
+        (function.uFlags == (CM_STACK_DYNAMIC | CM_STACK_RECURSIVE | CM_STACK_UNKNOWN_CALL)));
+
+  // helper (2 + 14) beats the tail call (13, no return address) and leaf.
+  function = getFunction(pGraph, MAIN_ADDRESS);
+  CHECK((function.ulFrame == 6) && (function.ulDepth == 22));
+  CHECK(function.uFlags == (CM_STACK_INDIRECT | CM_STACK_DYNAMIC | CM_STACK_RECURSIVE | CM_STACK_UNKNOWN_CALL));
+  size_t helper;
+  CHECK((cmStackGraphFind(pGraph, HELPER_ADDRESS + 4, &helper) == CM_OK) && (function.worstCallee == helper));
+
+  CHECK(getFunction(pGraph, VECTOR_11_ADDRESS).ulDepth == 21);
+  CHECK(getFunction(pGraph, VECTOR_5_ADDRESS).ulDepth == 20);
+  CHECK(getFunction(pGraph, SENSOR_ADDRESS).ulFrame == 5);
+
+  size_t index;
+  CHECK(cmStackGraphFind(pGraph, 0x1000, &index) == CM_ERR_ARGUMENT);
+  CHECK(cmStackGraphFind(pGraph, MAIN_ADDRESS + 0x0c, &index) == CM_ERR_ARGUMENT);
+}
+
+static CMReport makeReport(uint32_t ulByteAddress, uint16_t uStackPointer, uint16_t uStackLow) {
+  CMReport report;
+  memset(&report, 0, sizeof(report));
+  report.uType = CM_TYPE_WATCHDOG;
+  report.ulAddress = ulByteAddress / 2;
+  report.uStackPointer = uStackPointer;
+  report.uStackLow = uStackLow;
+  report.ulDevice = CM_NO_DEVICE;
+  return report;
+}
+
+static void testReports(const CMStackGraph *pGraph, const CMElf *pElf) {
+  CMStackSummary summary;
+  const CMTarget *pTarget = cmFindTarget("atmega328p", 0);
+  CHECK(cmStackSummarize(pGraph, pElf, pTarget, &summary) == CM_OK);
+  CHECK((summary.uRamEnd == 0x8ff) && (summary.uDataEnd == DATA_END) && (summary.ulBudget == 0x200));
+  CHECK(summary.ulMainDepth == 24);
+  CHECK(summary.ulIsrDepth == 23);
+  CHECK(summary.ulWorstDepth == 47);
+  CHECK(summary.uFlags == (CM_STACK_INDIRECT | CM_STACK_DYNAMIC | CM_STACK_RECURSIVE | CM_STACK_UNKNOWN_CALL));
+  size_t index;
+  CHECK((cmStackGraphFind(pGraph, VECTOR_11_ADDRESS, &index) == CM_OK) && (summary.isr == index));
+
+  // Hung in helper with plenty of room: 15 used, helper can still call leaf
+  // (4), and an ISR can land on top (23).
+  CMStackCheck check;
+  CMReport report = makeReport(HELPER_ADDRESS + 4, 0x8f0, 0);
+  CHECK(cmStackCheckReport(pGraph, &summary, &report, &check) == CM_OK);
+  CHECK((check.ulUsed == 15) && (check.ulHighWater == 0) && (check.ulWorst == 42));
+  CHECK((check.uVerdict == CM_STACK_OK) && (check.uFlags == CM_STACK_INDIRECT));
+  CHECK((cmStackGraphFind(pGraph, HELPER_ADDRESS, &index) == CM_OK) && (check.function == index));
+
+  // Close enough to _end that the worst case doesn't fit.
+  report = makeReport(HELPER_ADDRESS + 4, 0x710, 0);
+  CHECK(cmStackCheckReport(pGraph, &summary, &report, &check) == CM_OK);
+  CHECK((check.ulWorst == 0x1ef + 27) && (check.uVerdict == CM_STACK_MAY_OVERFLOW));
+
+  // The stack is in the static data, or the paint ran out.
+  report = makeReport(LEAF_ADDRESS, 0x6f0, 0);
+  CHECK(cmStackCheckReport(pGraph, &summary, &report, &check) == CM_OK);
+  CHECK(check.uVerdict == CM_STACK_OVERFLOWED);
+  report = makeReport(LEAF_ADDRESS, 0x8f0, DATA_END);
+  CHECK(cmStackCheckReport(pGraph, &summary, &report, &check) == CM_OK);
+  CHECK((check.ulHighWater == 0x200) && (check.uVerdict == CM_STACK_OVERFLOWED));
+  report = makeReport(LEAF_ADDRESS, 0x8f0, 0x800);
+  CHECK(cmStackCheckReport(pGraph, &summary, &report, &check) == CM_OK);
+  CHECK((check.ulHighWater == 0x100) && (check.uVerdict == CM_STACK_OK));
+
+  // Outside any function.
+  report = makeReport(0x1000, 0x8f0, 0);
+  CHECK(cmStackCheckReport(pGraph, &summary, &report, &check) == CM_OK);
+  CHECK((check.function == CM_STACK_NONE) && (check.uFlags == CM_STACK_NO_USAGE));
+
+  report.uType = CM_TYPE_FLASH_CORRUPT;
+  CHECK(cmStackCheckReport(pGraph, &summary, &report, &check) == CM_ERR_ARGUMENT);
+}
+
+int main() {
+  std::vector<uint8_t> image;
+  CMElf *pElf = buildFirmware(image);
+  if (pElf == NULL) {
+    return 1;
+  }
+
+  CMStackGraph *pGraph = NULL;
+  CHECK(cmStackGraphBuild(pElf, 4, &pGraph) == CM_ERR_ARGUMENT);
+  CHECK(cmStackGraphBuild(pElf, 2, &pGraph) == CM_OK);
+  if (pGraph != NULL) {
+    testGraph(pGraph);
+    testReports(pGraph, pElf);
+    cmStackGraphFree(pGraph);
+  }
+  cmElfFree(pElf);
+
+  if (failures != 0) {
+    printf("%d check(s) failed\n", failures);
+    return 1;
+  }
+  printf("All checks passed\n");
+  return 0;
+}
@@ -0,0 +1,169 @@
+/**
+ * CrashMonitorStatsTest.cpp
+ * Version 1.4
+ * Author
+ *  Cyrus Brunner
+ *
+ * Host test for the build comparison. Build and run it with "make test".
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include "CrashMonitorHost.h"
+#include "CrashMonitorStats.h"
+
+static int failures = 0;
+
+#define CHECK(condition) \
+  do { \
+    if (!(condition)) { \
+      printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+      ++failures; \
+    } \
+  } while (0)
+
+#define CHECK_NEAR(value, expected, tolerance) \
+  do { \
+    double dValue = (value); \
+    if (!(fabs(dValue - (expected)) <= (tolerance))) { \
+      printf("%s:%d: %s = %.10g, expected %.10g\n", __FILE__, __LINE__, #value, dValue, (double)(expected)); \
+      ++failures; \
+    } \
+  } while (0)
+
+#define BASE_BUILD 41
+#define NEW_BUILD 42
+#define MS_PER_HOUR 3600000UL
+
+static void testTests() {
+  double dZ;
+
+  // Pooled p = 0.175: z = 0.15 / sqrt(0.175 * 0.825 * 0.02).
+  CHECK_NEAR(cmTwoProportionTest(10, 100, 25, 100, &dZ), 0.002624, 0.000005);
+  CHECK_NEAR(dZ, 2.7914, 0.0001);
+  CHECK_NEAR(cmTwoProportionTest(25, 100, 10, 100, &dZ), 0.997376, 0.000005);
+  CHECK(cmTwoProportionTest(0, 100, 0, 100, &dZ) == 1.0);
+  CHECK(dZ == 0.0);
+  CHECK(cmTwoProportionTest(1, 0, 1, 10, NULL) == 1.0);
+
+  // Bin(5, 0.5) >= 5 is 1/32, Bin(10, 0.5) >= 5 is 638/1024.
+  CHECK_NEAR(cmPoissonRateTest(0, 1.0, 5, 1.0), 1.0 / 32, 1e-12);
+  CHECK_NEAR(cmPoissonRateTest(5, 1.0, 5, 1.0), 638.0 / 1024, 1e-12);
+  // Twice the exposure: Bin(3, 2/3) >= 3 = 8/27.
+  CHECK_NEAR(cmPoissonRateTest(0, 1.0, 3, 2.0), 8.0 / 27, 1e-12);
+  CHECK(cmPoissonRateTest(0, 1.0, 0, 1.0) == 1.0);
+  CHECK(cmPoissonRateTest(5, 0.0, 5, 1.0) == 1.0);
+  // Bin(200, 0.5) >= 100 = (1 + P(X = 100)) / 2, summed down the lower tail.
+  CHECK_NEAR(cmPoissonRateTest(100, 1000.0, 100, 1000.0), 0.5281742, 0.0000005);
+  CHECK(cmPoissonRateTest(1000000, 1.0, 1000000, 1.0) > 0.5);
+  CHECK(cmPoissonRateTest(1000, 1.0, 2000, 1.0) < 1e-30);
+}
+
+static void addReports(CMTable *pTable, uint16_t uBuild, uint8_t uType, uint32_t ulAddress, unsigned count,
+                       uint32_t ulUptime) {
+  CMReport report;
+  memset(&report, 0, sizeof(report));
+  report.uType = uType;
+  report.ulAddress = ulAddress;
+  report.uBuild = uBuild;
+  report.ulUptime = ulUptime;
+  report.ulDevice = CM_NO_DEVICE;
+  for (unsigned index = 0; index < count; ++index) {
+    report.ulData = index;
+    CHECK(cmTableAppend(pTable, &report) == CM_OK);
+  }
+}
+
+static void testCompare() {
+  CMTable *pTable = cmTableCreate();
+
+  // The base build hangs at two sites, an hour of uptime each time. The new
+  // one hangs as often, but 30 of its 100 hangs are at a new site. Flash
+  // corruption (whatever the length) is one site.
+  addReports(pTable, BASE_BUILD, CM_TYPE_WATCHDOG, 0x100, 50, MS_PER_HOUR);
+  addReports(pTable, BASE_BUILD, CM_TYPE_WATCHDOG, 0x200, 48, MS_PER_HOUR);
+  addReports(pTable, BASE_BUILD, CM_TYPE_FLASH_CORRUPT, 0x800, 1, MS_PER_HOUR);
+  addReports(pTable, BASE_BUILD, CM_TYPE_FLASH_CORRUPT, 0x900, 1, MS_PER_HOUR);
+  addReports(pTable, NEW_BUILD, CM_TYPE_WATCHDOG, 0x100, 50, MS_PER_HOUR);
+  addReports(pTable, NEW_BUILD, CM_TYPE_WATCHDOG, 0x200, 18, MS_PER_HOUR);
+  addReports(pTable, NEW_BUILD, CM_TYPE_FLASH_CORRUPT, 0x800, 2, MS_PER_HOUR);
+  addReports(pTable, NEW_BUILD, CM_TYPE_STALL, 0x300, 30, MS_PER_HOUR);
+  // Other builds are ignored.
+  addReports(pTable, 7, CM_TYPE_STALL, 0x300, 500, 1000);
+
+  CMComparison *pComparison = NULL;
+  CHECK(cmCompareBuilds(pTable, BASE_BUILD, NEW_BUILD, 0.05, &pComparison) == CM_OK);
+  if (pComparison == NULL) {
+    cmTableFree(pTable);
+    return;
+  }
+
+  CMComparisonSummary summary;
+  cmComparisonSummary(pComparison, &summary);
+  CHECK((summary.aBuilds[0].uBuild == BASE_BUILD) && (summary.aBuilds[1].uBuild == NEW_BUILD));
+  CHECK((summary.aBuilds[0].ulReports == 100) && (summary.aBuilds[1].ulReports == 100));
+  CHECK_NEAR(summary.aBuilds[0].dDeviceHours, 100.0, 1e-9);
+  CHECK_NEAR(summary.aBuilds[1].dRate, 1.0, 1e-9);
+  CHECK_NEAR(summary.dRateRatio, 1.0, 1e-9);
+  CHECK(summary.uFlags == 0);
+  CHECK(summary.siteCount == 4);
+  CHECK_NEAR(summary.dSiteAlpha, 0.05 / 8, 1e-12);
+
+  // The new site comes first, as a regression.
+  CMSiteComparison site;
+  CHECK(cmComparisonGetSite(pComparison, 0, &site) == CM_OK);
+  CHECK((site.site.uType == CM_TYPE_STALL) && (site.site.ulAddress == 0x600));
+  CHECK((site.aulCount[0] == 0) && (site.aulCount[1] == 30));
+  CHECK_NEAR(site.adShare[1], 0.3, 1e-12);
+  CHECK_NEAR(site.adRate[1], 0.3, 1e-12);
+  CHECK(site.uFlags == (CM_REGRESSION_SHARE | CM_REGRESSION_RATE | CM_REGRESSION_NEW_SITE));
+
+  // Nothing else got significantly worse. The flash corruptions of both
+  // lengths are one site.
+  size_t index;
+  for (index = 1; cmComparisonGetSite(pComparison, index, &site) == CM_OK; ++index) {
+    CHECK((site.uFlags & (CM_REGRESSION_SHARE | CM_REGRESSION_RATE)) == 0);
+    if (site.site.uType == CM_TYPE_FLASH_CORRUPT) {
+      CHECK((site.site.ulAddress == 0) && (site.aulCount[0] == 2) && (site.aulCount[1] == 2));
+    }
+    if (site.site.ulAddress == 0x400) {
+      // Fewer hangs here: z is negative.
+      CHECK((site.dShareZ < 0) && (site.dShareP > 0.99));
+    }
+  }
+  CHECK(index == 4);
+  CHECK(cmComparisonGetSite(pComparison, 4, &site) == CM_ERR_ARGUMENT);
+  cmComparisonFree(pComparison);
+
+  // Twice the hangs in the same uptime is a rate regression, and here all of
+  // them are at one site.
+  addReports(pTable, 43, CM_TYPE_WATCHDOG, 0x100, 100, MS_PER_HOUR / 2);
+  CHECK(cmCompareBuilds(pTable, NEW_BUILD, 43, 0.05, &pComparison) == CM_OK);
+  cmComparisonSummary(pComparison, &summary);
+  CHECK_NEAR(summary.aBuilds[1].dDeviceHours, 50.0, 1e-9);
+  CHECK_NEAR(summary.dRateRatio, 2.0, 1e-9);
+  CHECK(summary.uFlags == CM_REGRESSION_RATE);
+  CHECK(cmComparisonGetSite(pComparison, 0, &site) == CM_OK);
+  CHECK((site.site.ulAddress == 0x200) && (site.uFlags == (CM_REGRESSION_SHARE | CM_REGRESSION_RATE)));
+  cmComparisonFree(pComparison);
+
+  // A build without reports, or a bad alpha.
+  CHECK(cmCompareBuilds(pTable, BASE_BUILD, 99, 0.05, &pComparison) == CM_ERR_ARGUMENT);
+  CHECK(pComparison == NULL);
+  CHECK(cmCompareBuilds(pTable, BASE_BUILD, NEW_BUILD, 0.0, &pComparison) == CM_ERR_ARGUMENT);
+  CHECK(cmCompareBuilds(pTable, BASE_BUILD, NEW_BUILD, 1.0, &pComparison) == CM_ERR_ARGUMENT);
+  cmTableFree(pTable);
+}
+
+int main() {
+  testTests();
+  testCompare();
+
+  if (failures != 0) {
+    printf("%d check(s) failed\n", failures);
+    return 1;
+  }
+  printf("All checks passed\n");
+  return 0;
+}
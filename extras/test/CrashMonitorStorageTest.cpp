@@ -0,0 +1,230 @@
+/**
+ * CrashMonitorStorageTest.cpp
+ * Version 1.4
+ * Author
+ *  Cyrus Brunner
+ *
+ * Host test for the storage simulators. Build and run it with "make test".
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include "CrashMonitorHost.h"
+#include "CrashMonitorStorage.h"
+
+static int failures = 0;
+
+#define CHECK(condition) \
+  do { \
+    if (!(condition)) { \
+      printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+      ++failures; \
+    } \
+  } while (0)
+
+#define CHECK_NEAR(value, expected, tolerance) \
+  do { \
+    double dValue = (value); \
+    if (!(fabs(dValue - (expected)) <= (tolerance))) { \
+      printf("%s:%d: %s = %.10g, expected %.10g\n", __FILE__, __LINE__, #value, dValue, (double)(expected)); \
+      ++failures; \
+    } \
+  } while (0)
+
+#define RECORD_SIZE 20
+#define MAX_ENTRIES 3
+#define TRACE_SIZE 6
+
+static const CMStorageLayout layout = { RECORD_SIZE, MAX_ENTRIES, 0 };
+static const CMStorageLayout traceLayout = { RECORD_SIZE, MAX_ENTRIES, TRACE_SIZE };
+
+static void makeRecord(uint8_t uSeed, uint8_t *puRecord) {
+  for (uint8_t uByte = 0; uByte < RECORD_SIZE; ++uByte) {
+    puRecord[uByte] = (uint8_t)((uSeed * 37) + (uByte * 11));
+  }
+}
+
+static double crashTime(CMStorage *pStorage, const CMStorageLayout &storeLayout, uint8_t uSeed, double *pMaxUs) {
+  uint8_t auRecord[RECORD_SIZE];
+  uint8_t auTrace[TRACE_SIZE];
+  makeRecord(uSeed, auRecord);
+  memset(auTrace, uSeed, sizeof(auTrace));
+  CMStorageTime time;
+  cmStorageResetTime(pStorage);
+  cmStorageCrash(pStorage, &storeLayout, auRecord, auTrace);
+  cmStorageTime(pStorage, &time);
+  if (pMaxUs != NULL) {
+    *pMaxUs = time.dMaxUs;
+  }
+  return time.dTypicalUs;
+}
+
+static void checkHeader(CMStorage *pStorage, uint8_t uSaved, uint8_t uNext) {
+  uint8_t auHeader[CM_HEADER_SIZE];
+  cmStorageRead(pStorage, 0, auHeader, sizeof(auHeader));
+  CHECK((auHeader[0] == uSaved) && (auHeader[1] == uNext));
+  CHECK((auHeader[2] == CM_REPORT_LAYOUT_VERSION) && (auHeader[3] == RECORD_SIZE));
+}
+
+static void checkRecord(CMStorage *pStorage, uint8_t uSlot, uint8_t uSeed) {
+  uint8_t auExpected[RECORD_SIZE];
+  uint8_t auRecord[RECORD_SIZE];
+  makeRecord(uSeed, auExpected);
+  cmStorageRead(pStorage, CM_HEADER_SIZE + (uSlot * RECORD_SIZE), auRecord, RECORD_SIZE);
+  CHECK(memcmp(auRecord, auExpected, RECORD_SIZE) == 0);
+}
+
+static void testEeprom() {
+  CMStorage *pStorage = NULL;
+  CHECK(cmStorageCreate(CM_STORAGE_EEPROM, &layout, &pStorage) == CM_OK);
+
+  // Reading the header, then 3.3ms per byte of the record and the header.
+  double dMaxUs;
+  CHECK_NEAR(crashTime(pStorage, layout, 1, &dMaxUs), (4 * 0.5) + (24 * 3300.0), 1e-6);
+  CHECK_NEAR(dMaxUs, (4 * 0.5) + (24 * 3630.0), 1e-6);
+  checkHeader(pStorage, 1, 1);
+
+  // The slots wrap the way they do on the device: the header is one short of
+  // full after the first wrap.
+  crashTime(pStorage, layout, 2, NULL);
+  crashTime(pStorage, layout, 3, NULL);
+  checkHeader(pStorage, 2, 0);
+  crashTime(pStorage, layout, 4, NULL);
+  checkHeader(pStorage, 3, 1);
+  checkRecord(pStorage, 0, 4);
+  checkRecord(pStorage, 1, 2);
+  checkRecord(pStorage, 2, 3);
+
+  // Every crash rewrites the header, the record cells wear by the slot.
+  CMStorageWear wear;
+  cmStorageGetWear(pStorage, &wear);
+  CHECK((wear.ulUnitSize == 1) && (wear.ulMaxCycles == 4) && (wear.dEndurance == 1e5));
+  CHECK(wear.ullBytesWritten == 4 * 24);
+
+  // dump() reads the header and the saved records; clear() zeros them.
+  CHECK(cmStorageDump(pStorage, &layout) == CM_HEADER_SIZE + (3 * RECORD_SIZE));
+  cmStorageResetTime(pStorage);
+  cmStorageClear(pStorage, &layout);
+  CMStorageTime time;
+  cmStorageTime(pStorage, &time);
+  CHECK_NEAR(time.dTypicalUs, (4 * 0.5) + (64 * 3300.0), 1e-6);
+  checkHeader(pStorage, 0, 0);
+  CHECK(cmStorageDump(pStorage, &layout) == CM_HEADER_SIZE);
+  cmStorageFree(pStorage);
+}
+
+static void testFram() {
+  CMStorage *pStorage = NULL;
+  CHECK(cmStorageCreate(CM_STORAGE_FRAM, &layout, &pStorage) == CM_OK);
+
+  // 1us per SPI byte and per select: READ + address + header, then WREN and
+  // WRITE + address + data for the record and the header. No waiting.
+  double dMaxUs;
+  CHECK_NEAR(crashTime(pStorage, layout, 1, &dMaxUs), (1 + 7) + (2 + 24) + (2 + 8), 1e-6);
+  CHECK_NEAR(dMaxUs, 44.0, 1e-6);
+  checkRecord(pStorage, 0, 1);
+  cmStorageFree(pStorage);
+}
+
+static void testNor() {
+  CMStorage *pStorage = NULL;
+  CHECK(cmStorageCreate(CM_STORAGE_NOR, &layout, &pStorage) == CM_OK);
+
+  // The first crash programs erased flash.
+  CMStorageWear wear;
+  double dMaxUs;
+  double dUs = crashTime(pStorage, layout, 1, &dMaxUs);
+  CHECK_NEAR(dUs, (1 + 8) + (2 + 25 + 400) + (2 + 9 + 400), 1e-6);
+  CHECK_NEAR(dMaxUs, (1 + 8) + (2 + 25 + 3000) + (2 + 9 + 3000), 1e-6);
+  cmStorageGetWear(pStorage, &wear);
+  CHECK((wear.ulUnitSize == 4096) && (wear.ulMaxCycles == 0));
+
+  // The second record goes into erased flash too, but the header sets bits
+  // (1 -> 2), which takes an erase of the sector. Everything else survives.
+  dUs = crashTime(pStorage, layout, 2, &dMaxUs);
+  CHECK(dUs > 45000.0);
+  CHECK(dMaxUs > 400000.0);
+  cmStorageGetWear(pStorage, &wear);
+  CHECK(wear.ulMaxCycles == 1);
+  checkHeader(pStorage, 2, 2);
+  checkRecord(pStorage, 0, 1);
+  checkRecord(pStorage, 1, 2);
+
+  // Clearing only clears bits.
+  cmStorageClear(pStorage, &layout);
+  cmStorageGetWear(pStorage, &wear);
+  CHECK(wear.ulMaxCycles == 1);
+  checkHeader(pStorage, 0, 0);
+  cmStorageFree(pStorage);
+}
+
+static void testSd() {
+  CMStorage *pStorage = NULL;
+  CHECK(cmStorageCreate(CM_STORAGE_SD, &traceLayout, &pStorage) == CM_OK);
+
+  // A block read for the header, block writes for the record and the header,
+  // and a read-modify-write of the trace block (the trace is smaller than a
+  // record, so it is a partial slot).
+  const double dRead = (1 + 7 + 1 + 512 + 2) + 100.0;
+  const double dWrite = (1 + 7 + 2 + 512 + 3) + 1000.0;
+  CHECK_NEAR(crashTime(pStorage, traceLayout, 1, NULL), dRead + dWrite + dWrite + dRead + dWrite, 1e-6);
+  checkHeader(pStorage, 1, 1);
+  checkRecord(pStorage, 0, 1);
+  uint8_t auTrace[TRACE_SIZE];
+  cmStorageRead(pStorage, CM_HEADER_SIZE + (MAX_ENTRIES * RECORD_SIZE), auTrace, TRACE_SIZE);
+  CHECK((auTrace[0] == 1) && (auTrace[TRACE_SIZE - 1] == 1));
+
+  // A whole block per write, and the header block is written every crash.
+  CMStorageWear wear;
+  cmStorageGetWear(pStorage, &wear);
+  CHECK((wear.ulUnitSize == 512) && (wear.dEndurance == 0.0) && (wear.ulMaxCycles == 1));
+  CHECK(wear.ullBytesWritten == 3 * 512);
+
+  // Addresses past the blocks read 0xff and aren't written.
+  uint8_t auData[4] = { 1, 2, 3, 4 };
+  cmStorageWrite(pStorage, 10000, auData, sizeof(auData));
+  cmStorageRead(pStorage, 10000, auData, sizeof(auData));
+  CHECK((auData[0] == 0xff) && (auData[3] == 0xff));
+  cmStorageFree(pStorage);
+}
+
+static void testBench() {
+  CMStorageResult result;
+  CHECK(cmStorageBench(CM_STORAGE_EEPROM, &layout, 1000, &result) == CM_OK);
+  CHECK(result.ulCrashes == 1000);
+  CHECK_NEAR(result.dPersistUs, (4 * 0.5) + (24 * 3300.0), 1e-6);
+  CHECK(result.wear.ulMaxCycles == 1000);
+  CHECK(result.wear.ullBytesWritten == 1000 * 24);
+  CHECK(result.ulDumpBytes == CM_HEADER_SIZE + (MAX_ENTRIES * RECORD_SIZE));
+  CHECK_NEAR(result.dDumpUs, (CM_HEADER_SIZE + (MAX_ENTRIES * RECORD_SIZE)) * 0.5, 1e-6);
+
+  // Random records set bits in most of the slots, so NOR erases about once
+  // or twice per crash, far more than the header alone would.
+  CHECK(cmStorageBench(CM_STORAGE_NOR, &layout, 1000, &result) == CM_OK);
+  CHECK((result.wear.ulMaxCycles > 900) && (result.wear.ulMaxCycles <= 2000));
+  CHECK(result.dPersistMaxUs >= 400000.0);
+
+  CMStorage *pStorage = NULL;
+  CMStorageLayout empty = { RECORD_SIZE, 0, 0 };
+  CHECK(cmStorageBench(CM_STORAGE_FRAM, &layout, 0, &result) == CM_ERR_ARGUMENT);
+  CHECK(cmStorageBench(CM_STORAGE_KIND_COUNT, &layout, 10, &result) == CM_ERR_ARGUMENT);
+  CHECK(cmStorageCreate(CM_STORAGE_FRAM, &empty, &pStorage) == CM_ERR_ARGUMENT);
+  CHECK(pStorage == NULL);
+  CHECK(cmStorageName(CM_STORAGE_KIND_COUNT) == NULL);
+}
+
+int main() {
+  testEeprom();
+  testFram();
+  testNor();
+  testSd();
+  testBench();
+
+  if (failures != 0) {
+    printf("%d check(s) failed\n", failures);
+    return 1;
+  }
+  printf("All checks passed\n");
+  return 0;
+}
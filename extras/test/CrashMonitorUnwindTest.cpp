@@ -0,0 +1,263 @@
+/**
+ * CrashMonitorUnwindTest.cpp
+ * Version 1.4
+ * Author
+ *  Cyrus Brunner
+ *
+ * Host test for the stack unwinder. Build and run it with "make test".
+ *
+ * The .debug_frame is written by hand the way avr-gcc lays it out (CFA =
+ * SP + 2 at entry, the return address at CFA - 1), for three nested functions:
+ *
+ *   main   0x280  push r28, push r29, 2 locals, Y = SP, push 2 arguments,
+ *                 call middle at 0x290
+ *   middle 0x240  push r16, call inner at 0x24a
+ *   inner  0x200  push r28, push r29, 4 locals, Y = SP, hangs at 0x210
+ *
+ * main was called from 0xc8, which has no call frame information.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "CrashMonitorElf.h"
+#include "CrashMonitorHost.h"
+#include "CrashMonitorUnwind.h"
+#include "TestElf.h"
+
+static int failures = 0;
+
+#define CHECK(condition) \
+  do { \
+    if (!(condition)) { \
+      printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+      ++failures; \
+    } \
+  } while (0)
+
+#define INNER_ADDRESS 0x200
+#define MIDDLE_ADDRESS 0x240
+#define MAIN_ADDRESS 0x280
+#define FUNCTION_SIZE 0x20
+#define CRASH_ADDRESS 0x210
+#define STACK_POINTER 0x8ec
+
+// Pads an entry with DW_CFA_nop and fills in its length.
+static void appendEntry(std::vector<uint8_t> &frames, uint32_t ulId, const std::vector<uint8_t> &body) {
+  std::vector<uint8_t> entry;
+  appendLe32(entry, 0);
+  appendLe32(entry, ulId);
+  entry.insert(entry.end(), body.begin(), body.end());
+  while (entry.size() % 4 != 0) {
+    entry.push_back(0);
+  }
+  uint32_t ulLength = (uint32_t)entry.size() - 4;
+  memcpy(&entry[0], &ulLength, 4);
+  frames.insert(frames.end(), entry.begin(), entry.end());
+}
+
+static void appendFde(std::vector<uint8_t> &frames, uint32_t ulAddress, const uint8_t *puCode, size_t size) {
+  std::vector<uint8_t> body;
+  appendLe32(body, ulAddress);
+  appendLe32(body, FUNCTION_SIZE);
+  body.insert(body.end(), puCode, puCode + size);
+  // The CIE is at offset 0.
+  appendEntry(frames, 0, body);
+}
+
+static std::vector<uint8_t> buildFrames() {
+  std::vector<uint8_t> frames;
+
+  // Version 1, no augmentation, code alignment 2, data alignment -1, return
+  // address column 36; def_cfa r32 ofs 2, r36 at cfa-1.
+  const uint8_t auCie[] = { 1, 0, 2, 0x7f, 36, 0x0c, 32, 2, 0x80 | 36, 1 };
+  appendEntry(frames, 0xffffffff, std::vector<uint8_t>(auCie, auCie + sizeof(auCie)));
+
+  // advance 2: cfa+3, r28 at cfa-2; advance 2: cfa+4, r29 at cfa-3;
+  // advance 6: cfa+8; advance 4: cfa = r28+8; advance 10: remember,
+  // (epilogue) def_cfa r32 ofs 2, restore r28, r29; advance 2: restore state.
+  const uint8_t auInner[] = {
+    0x41, 0x0e, 3, 0x80 | 28, 2, 0x41, 0x0e, 4, 0x80 | 29, 3, 0x43, 0x0e, 8, 0x42, 0x0d, 28,
+    0x45, 0x0a, 0x0c, 32, 2, 0xc0 | 28, 0xc0 | 29, 0x41, 0x0b
+  };
+  appendFde(frames, INNER_ADDRESS, auInner, sizeof(auInner));
+
+  // advance 2: cfa+3.
+  const uint8_t auMiddle[] = { 0x41, 0x0e, 3 };
+  appendFde(frames, MIDDLE_ADDRESS, auMiddle, sizeof(auMiddle));
+
+  // As inner, with 2 locals (using the _sf forms).
+  const uint8_t auMain[] = {
+    0x41, 0x0e, 3, 0x11, 28, 2, 0x41, 0x13, 0x7c, 0x80 | 29, 3, 0x43, 0x0e, 6, 0x42, 0x0d, 28
+  };
+  appendFde(frames, MAIN_ADDRESS, auMain, sizeof(auMain));
+
+  // A function dropped by --gc-sections.
+  appendFde(frames, 0, auMiddle, sizeof(auMiddle));
+  return frames;
+}
+
+static CMReport buildReport(uint8_t uStackBytes) {
+  const uint8_t auStack[] = {
+    // inner: 4 locals, r29, r28 (main's Y, 0x08f9), return to 0x24e
+    0xaa, 0xaa, 0xaa, 0xaa, 0x08, 0xf9, 0x01, 0x27,
+    // middle: r16, return to 0x294
+    0x55, 0x01, 0x4a,
+    // main: 2 arguments, 2 locals, r29, r28, return to 0xc8
+    0x22, 0x11, 0xbb, 0xbb, 0x00, 0x00, 0x00, 0x64
+  };
+
+  CMReport report;
+  memset(&report, 0, sizeof(report));
+  report.ulAddress = CRASH_ADDRESS / 2;
+  report.uStackPointer = STACK_POINTER;
+  report.uStackBytes = uStackBytes;
+  report.ulDevice = CM_NO_DEVICE;
+  memcpy(report.auStack, auStack, (uStackBytes < sizeof(auStack)) ? uStackBytes : sizeof(auStack));
+  return report;
+}
+
+static void testTable(const CMUnwindTable *pTable) {
+  CMUnwindRow row;
+  CHECK((cmUnwindTableFind(pTable, INNER_ADDRESS, &row) == CM_OK) && (row.uCfaRegister == CM_DWARF_SP) &&
+        (row.nCfaOffset == 2) && (row.nReturnOffset == -1) && (row.uFlags == CM_UNWIND_RETURN_SAVED));
+  CHECK((cmUnwindTableFind(pTable, INNER_ADDRESS + 6, &row) == CM_OK) && (row.nCfaOffset == 4) &&
+        (row.nYLowOffset == -2) && (row.nYHighOffset == -3) &&
+        (row.uFlags == (CM_UNWIND_RETURN_SAVED | CM_UNWIND_Y_LOW_SAVED | CM_UNWIND_Y_HIGH_SAVED)));
+  CHECK((cmUnwindTableFind(pTable, CRASH_ADDRESS, &row) == CM_OK) && (row.uCfaRegister == CM_DWARF_Y_LOW) &&
+        (row.nCfaOffset == 8));
+
+  // The epilogue, then the state remembered before it.
+  CHECK((cmUnwindTableFind(pTable, 0x218, &row) == CM_OK) && (row.uCfaRegister == CM_DWARF_SP) &&
+        (row.nCfaOffset == 2) && (row.uFlags == CM_UNWIND_RETURN_SAVED));
+  CHECK((cmUnwindTableFind(pTable, 0x21c, &row) == CM_OK) && (row.uCfaRegister == CM_DWARF_Y_LOW) &&
+        (row.nCfaOffset == 8));
+
+  // The _sf forms scale by the data alignment.
+  CHECK((cmUnwindTableFind(pTable, MAIN_ADDRESS + 4, &row) == CM_OK) && (row.nCfaOffset == 4) &&
+        (row.nYLowOffset == -2));
+
+  CHECK(cmUnwindTableFind(pTable, 0x10, &row) == CM_ERR_ARGUMENT);
+  CHECK(cmUnwindTableFind(pTable, MAIN_ADDRESS + FUNCTION_SIZE, &row) == CM_ERR_ARGUMENT);
+  CHECK(cmUnwindTableFind(pTable, 0x230, &row) == CM_ERR_ARGUMENT);
+}
+
+static void testUnwind(const CMUnwindTable *pTable) {
+  CMFrame aFrames[8];
+  int stop;
+  CMReport report = buildReport(19);
+  size_t count = cmUnwind(pTable, &report, 2, aFrames, 8, &stop);
+  CHECK(count == 4);
+  CHECK(stop == CM_UNWIND_STOP_NO_RULE);
+  CHECK((aFrames[0].ulAddress == CRASH_ADDRESS) && (aFrames[0].uStackPointer == STACK_POINTER));
+  CHECK((aFrames[1].ulAddress == 0x24e) && (aFrames[1].uStackPointer == 0x8f4));
+  // main's Y (from inner's saved copy) isn't its SP, as it pushed arguments.
+  CHECK((aFrames[2].ulAddress == 0x294) && (aFrames[2].uStackPointer == 0x8f7));
+  CHECK((aFrames[3].ulAddress == 0xc8) && (aFrames[3].uStackPointer == 0x8ff));
+
+  // Only as far as the snapshot reaches.
+  report = buildReport(10);
+  CHECK(cmUnwind(pTable, &report, 2, aFrames, 8, &stop) == 2);
+  CHECK(stop == CM_UNWIND_STOP_OUTSIDE_SNAPSHOT);
+  report = buildReport(0);
+  CHECK(cmUnwind(pTable, &report, 2, aFrames, 8, &stop) == 1);
+  CHECK(stop == CM_UNWIND_STOP_OUTSIDE_SNAPSHOT);
+
+  report = buildReport(19);
+  CHECK(cmUnwind(pTable, &report, 2, aFrames, 3, &stop) == 3);
+  CHECK(stop == CM_UNWIND_STOP_MAX_FRAMES);
+
+  // A return address of 0 is a corrupt stack, not a frame.
+  report.auStack[6] = 0;
+  report.auStack[7] = 0;
+  CHECK(cmUnwind(pTable, &report, 2, aFrames, 8, &stop) == 1);
+  CHECK(stop == CM_UNWIND_STOP_BAD_FRAME);
+}
+
+static void testElf(const std::vector<uint8_t> &frames) {
+  std::vector<CTestSection> sections;
+  sections.push_back(makeText(INNER_ADDRESS, std::vector<uint16_t>(0x60, 0)));
+  CTestSection debugFrame;
+  debugFrame.name = ".debug_frame";
+  debugFrame.ulType = 1;
+  debugFrame.ulFlags = 0;
+  debugFrame.ulAddress = 0;
+  debugFrame.data = frames;
+  sections.push_back(debugFrame);
+  std::vector<uint8_t> image = buildElf(5, sections, std::vector<CTestSymbol>());
+
+  CMElf *pElf = NULL;
+  CMUnwindTable *pTable = NULL;
+  CHECK(cmElfParse(&image[0], image.size(), &pElf) == CM_OK);
+  CHECK(cmUnwindTableBuild(pElf, &pTable) == CM_OK);
+  CHECK(cmUnwindTableCount(pTable) == 14);
+  cmUnwindTableFree(pTable);
+  cmElfFree(pElf);
+
+  // Without -g there's nothing to build from.
+  sections.pop_back();
+  image = buildElf(5, sections, std::vector<CTestSymbol>());
+  CHECK(cmElfParse(&image[0], image.size(), &pElf) == CM_OK);
+  CHECK(cmUnwindTableBuild(pElf, &pTable) == CM_ERR_ARGUMENT);
+  CHECK(pTable == NULL);
+  cmElfFree(pElf);
+}
+
+static void testSaveLoad(const CMUnwindTable *pTable) {
+  char acPath[] = "/tmp/CrashMonitorUnwindTestXXXXXX";
+  int fd = mkstemp(acPath);
+  CHECK(fd >= 0);
+  close(fd);
+
+  CMUnwindTable *pLoaded = NULL;
+  CHECK(cmUnwindTableSave(pTable, acPath) == CM_OK);
+  CHECK(cmUnwindTableLoad(acPath, &pLoaded) == CM_OK);
+  CHECK(cmUnwindTableCount(pLoaded) == cmUnwindTableCount(pTable));
+  testTable(pLoaded);
+  testUnwind(pLoaded);
+  cmUnwindTableFree(pLoaded);
+
+  // Cut off in the middle of a row.
+  CHECK(truncate(acPath, 12 + 18 + 5) == 0);
+  CHECK(cmUnwindTableLoad(acPath, &pLoaded) == CM_ERR_TRUNCATED);
+  CHECK(pLoaded == NULL);
+  unlink(acPath);
+  CHECK(cmUnwindTableLoad(acPath, &pLoaded) == CM_ERR_IO);
+}
+
+static void testBadFrames(std::vector<uint8_t> frames) {
+  CMUnwindTable *pTable = NULL;
+
+  // An entry longer than the section.
+  std::vector<uint8_t> truncated(frames.begin(), frames.end() - 4);
+  CHECK(cmUnwindTableParse(&truncated[0], truncated.size(), &pTable) == CM_ERR_FORMAT);
+  CHECK(pTable == NULL);
+
+  // An unknown instruction in the first FDE (after the 20 byte CIE).
+  frames[20 + 16] = 0x3f;
+  CHECK(cmUnwindTableParse(&frames[0], frames.size(), &pTable) == CM_ERR_FORMAT);
+  CHECK(pTable == NULL);
+}
+
+int main() {
+  std::vector<uint8_t> frames = buildFrames();
+  CMUnwindTable *pTable = NULL;
+  CHECK(cmUnwindTableParse(&frames[0], frames.size(), &pTable) == CM_OK);
+  if (pTable == NULL) {
+    return 1;
+  }
+
+  testTable(pTable);
+  testUnwind(pTable);
+  testSaveLoad(pTable);
+  cmUnwindTableFree(pTable);
+  testElf(frames);
+  testBadFrames(frames);
+
+  if (failures != 0) {
+    printf("%d check(s) failed\n", failures);
+    return 1;
+  }
+  printf("All checks passed\n");
+  return 0;
+}
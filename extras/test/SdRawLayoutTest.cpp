@@ -0,0 +1,212 @@
+/**
+ * SdRawLayoutTest.cpp
+ * Version 1.4
+ * Author
+ *  Cyrus Brunner
+ *
+ * Host test for the SdRawStorage address to block mapping. Build and run it
+ * on a PC with "make test", or:
+ *
+ *   g++ -Isrc extras/test/SdRawLayoutTest.cpp -o SdRawLayoutTest && ./SdRawLayoutTest
+ *
+ * The test writes a report store to a simulated 64 block card through
+ * writeSdRaw() and readSdRaw(), the code SdRawStorage reads and writes with
+ * (the way CrashMonitor::begin(0, 20) lays it out), and reads it back.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "SdRawLayout.h"
+
+using namespace Watchdog;
+
+#define BLOCK_SIZE 512
+#define BLOCK_COUNT 64
+#define HEADER_SIZE 4
+#define MAX_ENTRIES 20
+#define HEATMAP_SIZE 64
+
+// sizeof(CTraceEntry) times CRASH_MONITOR_TRACE_ENTRIES: one smaller and one
+// bigger than a report.
+#define SMALL_TRACE_SIZE (3 * 4)
+#define LARGE_TRACE_SIZE (3 * 64)
+
+// A card as SdRawStorage drives it: a block write fills the rest of the block
+// with zeros.
+struct CCard
+{
+  uint8_t auBlocks[BLOCK_COUNT][BLOCK_SIZE];
+  unsigned int uReads;
+  unsigned int uWrites;
+
+  void readBlock(uint16_t uBlock, uint8_t uOffset, uint8_t *puData, uint8_t uSize) {
+    ++uReads;
+    memcpy(puData, &auBlocks[uBlock][uOffset], uSize);
+  }
+
+  void writeBlock(uint16_t uBlock, const uint8_t *puData, uint8_t uSize) {
+    ++uWrites;
+    memset(auBlocks[uBlock], 0, BLOCK_SIZE);
+    memcpy(auBlocks[uBlock], puData, uSize);
+  }
+};
+
+static CCard card;
+static int failures = 0;
+
+#define CHECK(condition) \
+  do { \
+    if (!(condition)) { \
+      printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+      ++failures; \
+    } \
+  } while (0)
+
+static void cardWrite(int address, const uint8_t *puData, uint8_t uSize, uint8_t uRecordSize) {
+  uint8_t auSlot[255];
+  writeSdRaw(card, BLOCK_COUNT, HEADER_SIZE, uRecordSize, address, puData, uSize, auSlot);
+}
+
+static void cardRead(int address, uint8_t *puData, uint8_t uSize, uint8_t uRecordSize) {
+  readSdRaw(card, BLOCK_COUNT, HEADER_SIZE, uRecordSize, address, puData, uSize);
+}
+
+static void resetCard() {
+  memset(card.auBlocks, 0, sizeof(card.auBlocks));
+  card.uReads = 0;
+  card.uWrites = 0;
+}
+
+static void testFixedLocations(uint8_t uRecordSize) {
+  CSdRawLocation location = getSdRawLocation(0, HEADER_SIZE, uRecordSize);
+  CHECK((location.uBlock == 0) && (location.uOffset == 0));
+  location = getSdRawLocation(1, HEADER_SIZE, uRecordSize);
+  CHECK((location.uBlock == 0) && (location.uOffset == 1));
+
+  // Report i starts its own block.
+  for (int nReport = 0; nReport < MAX_ENTRIES; ++nReport) {
+    location = getSdRawLocation(HEADER_SIZE + (nReport * uRecordSize), HEADER_SIZE, uRecordSize);
+    CHECK((location.uBlock == 1 + nReport) && (location.uOffset == 0));
+    location = getSdRawLocation(HEADER_SIZE + (nReport * uRecordSize) + uRecordSize - 1, HEADER_SIZE, uRecordSize);
+    CHECK((location.uBlock == 1 + nReport) && (location.uOffset == uRecordSize - 1));
+  }
+
+  // So does the trace that follows them.
+  location = getSdRawLocation(HEADER_SIZE + (MAX_ENTRIES * uRecordSize), HEADER_SIZE, uRecordSize);
+  CHECK((location.uBlock == 1 + MAX_ENTRIES) && (location.uOffset == 0));
+}
+
+static void testWritePaths(uint8_t uRecordSize) {
+  resetCard();
+  uint8_t auData[255];
+  int reportAddress = HEADER_SIZE + uRecordSize;
+
+  // A whole report is one block write, without reading the block first.
+  memset(auData, 0x11, uRecordSize);
+  cardWrite(reportAddress, auData, uRecordSize, uRecordSize);
+  CHECK((card.uReads == 0) && (card.uWrites == 1));
+  CHECK((card.auBlocks[2][0] == 0x11) && (card.auBlocks[2][uRecordSize - 1] == 0x11));
+  CHECK(card.auBlocks[2][uRecordSize] == 0);
+
+  // A byte of it reads the slot, changes the byte and writes the whole slot
+  // back.
+  uint8_t uByte = 0x22;
+  cardWrite(reportAddress + 5, &uByte, 1, uRecordSize);
+  CHECK((card.uReads == 1) && (card.uWrites == 2));
+  uint8_t auRead[255];
+  cardRead(reportAddress, auRead, uRecordSize, uRecordSize);
+  memset(auData, 0x11, uRecordSize);
+  auData[5] = 0x22;
+  CHECK(memcmp(auRead, auData, uRecordSize) == 0);
+
+  // So does part of the header.
+  memset(auData, 0x33, HEADER_SIZE);
+  cardWrite(0, auData, HEADER_SIZE, uRecordSize);
+  uByte = 0x44;
+  cardWrite(1, &uByte, 1, uRecordSize);
+  cardRead(0, auRead, HEADER_SIZE, uRecordSize);
+  CHECK((auRead[0] == 0x33) && (auRead[1] == 0x44) && (auRead[2] == 0x33) && (auRead[3] == 0x33));
+
+  // A partial write stops at the end of its slot.
+  memset(auData, 0x55, 4);
+  cardWrite(reportAddress + uRecordSize - 2, auData, 4, uRecordSize);
+  CHECK((card.auBlocks[2][uRecordSize - 1] == 0x55) && (card.auBlocks[2][uRecordSize] == 0));
+  CHECK(card.auBlocks[3][0] == 0);
+
+  // Nothing happens outside the area.
+  unsigned int uWrites = card.uWrites;
+  cardWrite(-1, auData, 1, uRecordSize);
+  cardWrite(HEADER_SIZE + (BLOCK_COUNT * uRecordSize), auData, 1, uRecordSize);
+  CHECK(card.uWrites == uWrites);
+  cardRead(HEADER_SIZE + (BLOCK_COUNT * uRecordSize), auRead, 2, uRecordSize);
+  CHECK((auRead[0] == 0xff) && (auRead[1] == 0xff));
+}
+
+static void testRoundTrip(uint8_t uRecordSize, uint8_t uTraceSize) {
+  resetCard();
+
+  // Header, reports, trace and the heatmap right after the trace, as on
+  // EEPROM. A trace smaller than a report shares its block with the start of
+  // the heatmap.
+  uint8_t auData[255];
+  int traceAddress = HEADER_SIZE + (MAX_ENTRIES * uRecordSize);
+  int heatmapAddress = traceAddress + uTraceSize;
+
+  memset(auData, 0xa0, HEADER_SIZE);
+  cardWrite(0, auData, HEADER_SIZE, uRecordSize);
+  for (int nReport = 0; nReport < MAX_ENTRIES; ++nReport) {
+    memset(auData, nReport + 1, uRecordSize);
+    cardWrite(HEADER_SIZE + (nReport * uRecordSize), auData, uRecordSize, uRecordSize);
+  }
+  memset(auData, 0xb0, uTraceSize);
+  cardWrite(traceAddress, auData, uTraceSize, uRecordSize);
+  for (int nByte = 0; nByte < HEATMAP_SIZE; ++nByte) {
+    uint8_t uByte = (uint8_t)(0xc0 + nByte);
+    cardWrite(heatmapAddress + nByte, &uByte, 1, uRecordSize);
+  }
+
+  // The next crash rewrites a report, the header and the trace.
+  memset(auData, 0xd0, uRecordSize);
+  cardWrite(HEADER_SIZE, auData, uRecordSize, uRecordSize);
+  memset(auData, 0xa1, HEADER_SIZE);
+  cardWrite(0, auData, HEADER_SIZE, uRecordSize);
+  memset(auData, 0xb1, uTraceSize);
+  cardWrite(traceAddress, auData, uTraceSize, uRecordSize);
+
+  // Nothing may have overwritten anything else.
+  uint8_t auRead[255];
+  cardRead(0, auRead, HEADER_SIZE, uRecordSize);
+  CHECK((auRead[0] == 0xa1) && (auRead[HEADER_SIZE - 1] == 0xa1));
+  for (int nReport = 0; nReport < MAX_ENTRIES; ++nReport) {
+    cardRead(HEADER_SIZE + (nReport * uRecordSize), auRead, uRecordSize, uRecordSize);
+    memset(auData, (nReport == 0) ? 0xd0 : nReport + 1, uRecordSize);
+    CHECK(memcmp(auRead, auData, uRecordSize) == 0);
+  }
+  cardRead(traceAddress, auRead, uTraceSize, uRecordSize);
+  memset(auData, 0xb1, uTraceSize);
+  CHECK(memcmp(auRead, auData, uTraceSize) == 0);
+  for (int nByte = 0; nByte < HEATMAP_SIZE; ++nByte) {
+    uint8_t uByte = 0;
+    cardRead(heatmapAddress + nByte, &uByte, 1, uRecordSize);
+    CHECK(uByte == (uint8_t)(0xc0 + nByte));
+  }
+}
+
+int main() {
+  // sizeof(CCrashReport) on the 328 and the Mega, and on the 328 with a 16
+  // byte stack snapshot.
+  static const uint8_t auRecordSizes[] = { 20, 21, 36 };
+  for (unsigned int uSize = 0; uSize < sizeof(auRecordSizes); ++uSize) {
+    testFixedLocations(auRecordSizes[uSize]);
+    testWritePaths(auRecordSizes[uSize]);
+    testRoundTrip(auRecordSizes[uSize], SMALL_TRACE_SIZE);
+    testRoundTrip(auRecordSizes[uSize], LARGE_TRACE_SIZE);
+  }
+
+  if (failures != 0) {
+    printf("%d check(s) failed\n", failures);
+    return 1;
+  }
+  printf("OK\n");
+  return 0;
+}
@@ -0,0 +1,156 @@
+/**
+ * TestElf.h
+ * Version 1.4
+ * Author
+ *  Cyrus Brunner
+ *
+ * Builds small AVR ELF images in memory for the host tests, so they don't
+ * need avr-gcc: sections with the given contents plus a symbol table.
+ */
+
+#ifndef TestElf_h
+#define TestElf_h
+
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+struct CTestSection
+{
+  std::string name;
+  uint32_t ulType;
+  uint32_t ulFlags;
+  uint32_t ulAddress;
+  std::vector<uint8_t> data;
+};
+
+struct CTestSymbol
+{
+  std::string name;
+  uint32_t ulAddress;
+  uint32_t ulSize;
+  uint8_t uType;
+};
+
+static inline void appendLe16(std::vector<uint8_t> &data, uint16_t uValue) {
+  data.push_back((uint8_t)uValue);
+  data.push_back((uint8_t)(uValue >> 8));
+}
+
+static inline void appendLe32(std::vector<uint8_t> &data, uint32_t ulValue) {
+  appendLe16(data, (uint16_t)ulValue);
+  appendLe16(data, (uint16_t)(ulValue >> 16));
+}
+
+/**
+ * @brief Builds a .text section from opcode words.
+ */
+static inline CTestSection makeText(uint32_t ulAddress, const std::vector<uint16_t> &words) {
+  CTestSection section;
+  section.name = ".text";
+  section.ulType = 1;
+  section.ulFlags = 0x6;
+  section.ulAddress = ulAddress;
+  for (size_t index = 0; index < words.size(); ++index) {
+    appendLe16(section.data, words[index]);
+  }
+  return section;
+}
+
+/**
+ * @brief Builds an ELF image with the sections (after the null section) and
+ * symbols, followed by .symtab, .strtab and .shstrtab.
+ */
+static inline std::vector<uint8_t> buildElf(uint32_t ulFlags, std::vector<CTestSection> sections,
+                                            const std::vector<CTestSymbol> &symbols) {
+  uint16_t uFirstExtra = (uint16_t)(sections.size() + 1);
+
+  CTestSection strtab;
+  strtab.name = ".strtab";
+  strtab.ulType = 3;
+  strtab.ulFlags = 0;
+  strtab.ulAddress = 0;
+  strtab.data.push_back(0);
+
+  CTestSection symtab;
+  symtab.name = ".symtab";
+  symtab.ulType = 2;
+  symtab.ulFlags = 0;
+  symtab.ulAddress = 0;
+  symtab.data.resize(16, 0);
+  for (size_t index = 0; index < symbols.size(); ++index) {
+    appendLe32(symtab.data, (uint32_t)strtab.data.size());
+    strtab.data.insert(strtab.data.end(), symbols[index].name.begin(), symbols[index].name.end());
+    strtab.data.push_back(0);
+    appendLe32(symtab.data, symbols[index].ulAddress);
+    appendLe32(symtab.data, symbols[index].ulSize);
+    symtab.data.push_back((uint8_t)(0x10 | symbols[index].uType));
+    symtab.data.push_back(0);
+    // Defined in the first section.
+    appendLe16(symtab.data, 1);
+  }
+
+  CTestSection shstrtab;
+  shstrtab.name = ".shstrtab";
+  shstrtab.ulType = 3;
+  shstrtab.ulFlags = 0;
+  shstrtab.ulAddress = 0;
+  sections.push_back(symtab);
+  sections.push_back(strtab);
+  sections.push_back(shstrtab);
+
+  std::vector<uint32_t> names;
+  std::vector<uint8_t> &shstrings = sections.back().data;
+  shstrings.push_back(0);
+  for (size_t index = 0; index < sections.size(); ++index) {
+    names.push_back((uint32_t)shstrings.size());
+    shstrings.insert(shstrings.end(), sections[index].name.begin(), sections[index].name.end());
+    shstrings.push_back(0);
+  }
+
+  std::vector<uint8_t> image(52, 0);
+  std::vector<uint32_t> offsets;
+  for (size_t index = 0; index < sections.size(); ++index) {
+    offsets.push_back((uint32_t)image.size());
+    image.insert(image.end(), sections[index].data.begin(), sections[index].data.end());
+  }
+  uint32_t ulShOff = (uint32_t)image.size();
+
+  // The null section, then the rest.
+  image.resize(image.size() + 40, 0);
+  for (size_t index = 0; index < sections.size(); ++index) {
+    appendLe32(image, names[index]);
+    appendLe32(image, sections[index].ulType);
+    appendLe32(image, sections[index].ulFlags);
+    appendLe32(image, sections[index].ulAddress);
+    appendLe32(image, offsets[index]);
+    appendLe32(image, (uint32_t)sections[index].data.size());
+    // .symtab links to .strtab.
+    appendLe32(image, (index + 1 == uFirstExtra) ? uFirstExtra + 1u : 0u);
+    appendLe32(image, 0);
+    appendLe32(image, 1);
+    appendLe32(image, (index + 1 == uFirstExtra) ? 16u : 0u);
+  }
+
+  uint8_t auIdent[16] = { 0x7f, 'E', 'L', 'F', 1, 1, 1 };
+  memcpy(&image[0], auIdent, sizeof(auIdent));
+  std::vector<uint8_t> header;
+  appendLe16(header, 2);      // e_type (ET_EXEC)
+  appendLe16(header, 83);     // e_machine (EM_AVR)
+  appendLe32(header, 1);      // e_version
+  appendLe32(header, 0);      // e_entry
+  appendLe32(header, 0);      // e_phoff
+  appendLe32(header, ulShOff);
+  appendLe32(header, ulFlags);
+  appendLe16(header, 52);     // e_ehsize
+  appendLe16(header, 0);      // e_phentsize
+  appendLe16(header, 0);      // e_phnum
+  appendLe16(header, 40);     // e_shentsize
+  appendLe16(header, (uint16_t)(sections.size() + 1));
+  appendLe16(header, (uint16_t)sections.size());
+  memcpy(&image[16], &header[0], header.size());
+  return image;
+}
+
+#endif
@@ -10,35 +10,494 @@
 
 #include "ArduinoCrashMonitor.h"
 #include <avr/eeprom.h>
+#include <avr/pgmspace.h>
+#include <util/crc16.h>
 
 using namespace Watchdog;
 
+// End of the .text section, provided by the avr-libc linker scripts.
+extern "C" char _etext;
+
+#if CRASH_MONITOR_STACK_PAINT
+// The pattern free RAM is painted with.
+#define STACK_PAINT 0xc5
+
+// The end of .noinit (the start of the heap), and the top of the heap, from
+// the avr-libc linker scripts and malloc. __brkval is weak so that malloc is
+// not linked in just for this.
+extern "C" uint8_t _end;
+extern "C" char *__brkval __attribute__((weak));
+
+/**
+ * @brief Runs in .init1, before the stack is used. Paints everything between
+ * the end of the static data and the top of RAM. This has to be assembly since
+ * r1 is not cleared yet.
+ */
+void crashMonitorPaintStack() __attribute__((naked, used, section(".init1")));
+void crashMonitorPaintStack() {
+  asm volatile (
+    "ldi r30, lo8(_end)" "\n\t"
+    "ldi r31, hi8(_end)" "\n\t"
+    "ldi r24, %[paint]" "\n\t"
+    "ldi r25, hi8(%[top])" "\n\t"
+    "rjmp 2f" "\n"
+    "1:" "\n\t"
+    "st Z+, r24" "\n"
+    "2:" "\n\t"
+    "cpi r30, lo8(%[top])" "\n\t"
+    "cpc r31, r25" "\n\t"
+    "brlo 1b" "\n\t"
+    "breq 1b"
+    :: [paint] "M" (STACK_PAINT), [top] "i" (RAMEND));
+}
+#endif
+
 // Init static vars
 int CrashMonitor::_nBaseAddress = 500;
 int CrashMonitor::_nMaxEntries = DEFAULT_ENTRIES;
+#if CRASH_MONITOR_EARLY_BOOT
+CCrashReport CrashMonitor::_crashReport __attribute__((section(".noinit")));
+uint16_t CrashMonitor::_uPendingCheck __attribute__((section(".noinit")));
+bool CrashMonitor::_bHeatmapPending = false;
+
+// The reset cause captured in .init3.
+static uint8_t resetCause __attribute__((section(".noinit")));
+
+/**
+ * @brief Runs in .init3, before the C runtime initializes anything. Captures the
+ * reset cause before anyone clears it and disables the watchdog, which stays
+ * enabled after a watchdog reset and would otherwise keep resetting the MCU
+ * with the shortest timeout during startup.
+ */
+void crashMonitorEarlyBoot() __attribute__((naked, used, section(".init3")));
+void crashMonitorEarlyBoot() {
+  uint8_t uCause = MCUSR;
+#if CRASH_MONITOR_OPTIBOOT_R2
+  if (uCause == 0) {
+    // Optiboot clears MCUSR and passes the original value in r2.
+    asm volatile ("mov %0, r2" : "=r" (uCause));
+  }
+#endif
+  resetCause = uCause;
+  MCUSR = 0;
+  wdt_disable();
+}
+#else
 CCrashReport CrashMonitor::_crashReport;
+#endif
 STATICFUNC CrashMonitor::userCrashHandler = NULL;
+STATICFUNC CrashMonitor::failSafeHandler = NULL;
+const CFailSafeOutput *CrashMonitor::_pFailSafeOutputs = NULL;
+uint8_t CrashMonitor::_uFailSafeCount = 0;
+READFUNC CrashMonitor::storageRead = NULL;
+WRITEFUNC CrashMonitor::storageWrite = NULL;
+uint32_t CrashMonitor::_ulFlashLength = 0;
+uint32_t CrashMonitor::_ulFlashOffset = 0;
+uint16_t CrashMonitor::_uFlashCrc = 0xffff;
+uint16_t CrashMonitor::_uFlashExpected = 0;
+uint8_t CrashMonitor::_uFlashChunk = DEFAULT_FLASH_CHUNK;
+uint8_t CrashMonitor::_uTimeout = WDTO_2S;
+uint8_t CrashMonitor::_uCurrentTimeout = WDTO_2S;
+bool CrashMonitor::_bWatchdogEnabled = false;
+volatile uint8_t CrashMonitor::_uRegion = 0;
+uint16_t CrashMonitor::_uBuild = 0;
+int CrashMonitor::_nHeatmapAddress = -1;
+uint8_t CrashMonitor::_uHeatmapShift = DEFAULT_HEATMAP_SHIFT;
+#if CRASH_MONITOR_MAX_WATCHES > 0
+CMemoryWatch CrashMonitor::_watches[CRASH_MONITOR_MAX_WATCHES];
+uint8_t CrashMonitor::_uNextWatch = 0;
+#endif
+#if CRASH_MONITOR_MAX_HANDLERS > 0
+CCrashHandler CrashMonitor::_handlers[CRASH_MONITOR_MAX_HANDLERS];
+uint8_t CrashMonitor::_uHandlerCount = 0;
+CHandlerResults CrashMonitor::_handlerResults;
+CHandlerResults CrashMonitor::_pendingResults __attribute__((section(".noinit")));
+uint16_t CrashMonitor::_uPendingResultsMagic __attribute__((section(".noinit")));
+#endif
+#if CRASH_MONITOR_LIVENESS
+bool CrashMonitor::_bLiveness = false;
+volatile uint8_t CrashMonitor::_uLivenessToken = 0;
+uint8_t CrashMonitor::_uLastToken = 0;
+uint16_t CrashMonitor::_uStallTicks = 0;
+uint16_t CrashMonitor::_uStallLimit = 0;
+#endif
+#if CRASH_MONITOR_LATENCY
+bool CrashMonitor::_bLatency = false;
+uint8_t CrashMonitor::_uMaxLateTicks = 0;
+uint8_t CrashMonitor::_auMaxLateAddress[PROGRAM_COUNTER_SIZE];
+uint16_t CrashMonitor::_auLatencyHistogram[8];
+#endif
+#if CRASH_MONITOR_TRACE_ENTRIES > 0
+CTraceEntry CrashMonitor::_traceRing[CRASH_MONITOR_TRACE_ENTRIES] __attribute__((section(".noinit")));
+uint8_t CrashMonitor::_uTraceHead __attribute__((section(".noinit")));
+#endif
 
 void CrashMonitor::begin(int baseAddress, int maxEntries) {
   CrashMonitor::_nBaseAddress = baseAddress;
   CrashMonitor::_nMaxEntries = maxEntries;
+#if CRASH_MONITOR_EARLY_BOOT
+  if ((resetCause & _BV(WDRF)) &&
+      (CrashMonitor::_uPendingCheck == CrashMonitor::getPendingCheck(CrashMonitor::_crashReport))) {
+    // The reset happened while the capture was being stored. Store it now.
+    // The heatmap is usually enabled after begin(), so its update waits for
+    // enableHeatmap() if need be.
+    CrashMonitor::storeReport(CrashMonitor::_crashReport);
+  #if CRASH_MONITOR_TRACE_ENTRIES > 0
+    CrashMonitor::saveTrace();
+  #endif
+    CrashMonitor::_bHeatmapPending = true;
+    if (CrashMonitor::_nHeatmapAddress >= 0) {
+      CrashMonitor::updateCaptureHeatmap();
+      CrashMonitor::_bHeatmapPending = false;
+    }
+  }
+  CrashMonitor::_uPendingCheck = 0;
+#endif
+#if CRASH_MONITOR_MAX_HANDLERS > 0
+  if (CrashMonitor::_uPendingResultsMagic == PENDING_RESULTS_MAGIC) {
+    CrashMonitor::_handlerResults = CrashMonitor::_pendingResults;
+  }
+  CrashMonitor::_uPendingResultsMagic = 0;
+#endif
   CrashMonitor::_crashReport.uData = 0;
+  CrashMonitor::_crashReport.uType = ReportType_Watchdog;
+#if CRASH_MONITOR_TRACE_ENTRIES > 0
+  memset(CrashMonitor::_traceRing, 0, sizeof(CrashMonitor::_traceRing));
+  CrashMonitor::_uTraceHead = 0;
+#endif
 }
 
-void CrashMonitor::enableWatchdog(CrashMonitor::ETimeout timeout) {
+#if CRASH_MONITOR_EARLY_BOOT
+uint8_t CrashMonitor::getResetCause() {
+  return resetCause;
+}
+
+uint16_t CrashMonitor::getPendingCheck(const CCrashReport &report) {
+  uint16_t uCheck = 0xffff;
+  const uint8_t *puData = (const uint8_t *)&report;
+  for (uint8_t uByte = 0; uByte < sizeof(report); ++uByte) {
+    uCheck = _crc16_update(uCheck, puData[uByte]);
+  }
+  return uCheck ^ 0xc0de;
+}
+#endif
+
+void CrashMonitor::setTimeout(uint8_t timeout) {
   wdt_enable(timeout);
   WDTCSR |= _BV(WDIE);
 }
 
+void CrashMonitor::enableWatchdog(CrashMonitor::ETimeout timeout) {
+  CrashMonitor::_uTimeout = timeout;
+  CrashMonitor::_uCurrentTimeout = timeout;
+  CrashMonitor::_bWatchdogEnabled = true;
+  CrashMonitor::setTimeout(timeout);
+}
+
 void CrashMonitor::disableWatchdog() {
+  CrashMonitor::_bWatchdogEnabled = false;
   wdt_disable();
 }
 
+void CrashMonitor::extend(CrashMonitor::ETimeout timeout, uint8_t regionId) {
+  CrashMonitor::_uRegion = regionId;
+  CrashMonitor::_uCurrentTimeout = timeout;
+#if CRASH_MONITOR_LIVENESS
+  ++CrashMonitor::_uLivenessToken;
+#endif
+  if (CrashMonitor::_bWatchdogEnabled) {
+    CrashMonitor::setTimeout(timeout);
+  }
+}
+
+void CrashMonitor::restore() {
+  CrashMonitor::_uRegion = 0;
+  CrashMonitor::_uCurrentTimeout = CrashMonitor::_uTimeout;
+#if CRASH_MONITOR_LIVENESS
+  ++CrashMonitor::_uLivenessToken;
+#endif
+  if (CrashMonitor::_bWatchdogEnabled) {
+    CrashMonitor::setTimeout(CrashMonitor::_uTimeout);
+  }
+}
+
 void CrashMonitor::iAmAlive() {
+#if CRASH_MONITOR_LIVENESS
+  if (CrashMonitor::_bLiveness) {
+    ++CrashMonitor::_uLivenessToken;
+  }
+  else {
+    wdt_reset();
+  }
+#else
+  wdt_reset();
+#endif
+  CrashMonitor::poll();
+}
+
+#if CRASH_MONITOR_LIVENESS
+void CrashMonitor::enableLivenessMode(CrashMonitor::ETimeout timeout, uint16_t stallMs) {
+  CrashMonitor::enableWatchdog(timeout);
+
+  uint8_t uSreg = SREG;
+  cli();
+  CrashMonitor::_uStallLimit = (stallMs == 0) ? 1 : stallMs;
+  CrashMonitor::_uStallTicks = 0;
+  CrashMonitor::_uLastToken = CrashMonitor::_uLivenessToken;
+  CrashMonitor::_bLiveness = true;
+  CrashMonitor::startTimerTick();
+  SREG = uSreg;
+}
+
+void CrashMonitor::disableLivenessMode() {
+  CrashMonitor::_bLiveness = false;
+  CrashMonitor::stopTimerTick();
   wdt_reset();
 }
 
+void CrashMonitor::livenessInterruptHandler(uint8_t *puProgramAddress) {
+  if ((!CrashMonitor::_bLiveness) || (CrashMonitor::_uRegion != 0)) {
+    // Let the (extended) hardware timeout do the work.
+    return;
+  }
+
+  uint8_t uToken = CrashMonitor::_uLivenessToken;
+  if (uToken != CrashMonitor::_uLastToken) {
+    CrashMonitor::_uLastToken = uToken;
+    CrashMonitor::_uStallTicks = 0;
+  }
+  else if (++CrashMonitor::_uStallTicks >= CrashMonitor::_uStallLimit) {
+    // The main loop has stalled. The address stacked by this interrupt is
+    // where it is stuck.
+    CrashMonitor::failSafe();
+    CrashMonitor::captureCrash(puProgramAddress, ReportType_Stall);
+  }
+
+  wdt_reset();
+}
+#endif
+
+#if CRASH_MONITOR_LIVENESS || CRASH_MONITOR_LATENCY
+void CrashMonitor::startTimerTick() {
+  // Timer0 is already free running for millis(), so a compare match on B
+  // fires once per overflow period without disturbing it. OCR0B is left
+  // alone, since it sets the analogWrite() duty cycle on the OC0B pin, and
+  // any value fires once per period.
+  if (!(TIMSK0 & _BV(OCIE0B))) {
+    TIFR0 = _BV(OCF0B);
+    TIMSK0 |= _BV(OCIE0B);
+  }
+}
+
+void CrashMonitor::stopTimerTick() {
+#if CRASH_MONITOR_LIVENESS
+  if (CrashMonitor::_bLiveness) {
+    return;
+  }
+#endif
+#if CRASH_MONITOR_LATENCY
+  if (CrashMonitor::_bLatency) {
+    return;
+  }
+#endif
+  TIMSK0 &= ~_BV(OCIE0B);
+}
+#endif
+
+#if CRASH_MONITOR_LATENCY
+void CrashMonitor::enableLatencyMonitor() {
+  uint8_t uSreg = SREG;
+  cli();
+  CrashMonitor::_bLatency = true;
+  CrashMonitor::startTimerTick();
+  SREG = uSreg;
+}
+
+void CrashMonitor::disableLatencyMonitor() {
+  uint8_t uSreg = SREG;
+  cli();
+  CrashMonitor::_bLatency = false;
+  CrashMonitor::stopTimerTick();
+  SREG = uSreg;
+}
+
+void CrashMonitor::getLatencyStats(CLatencyStats &stats) {
+  uint8_t auAddress[PROGRAM_COUNTER_SIZE];
+  uint8_t uSreg = SREG;
+  cli();
+  uint8_t uMaxLateTicks = CrashMonitor::_uMaxLateTicks;
+  memcpy(auAddress, CrashMonitor::_auMaxLateAddress, PROGRAM_COUNTER_SIZE);
+  memcpy(stats.auHistogram, CrashMonitor::_auLatencyHistogram, sizeof(stats.auHistogram));
+  SREG = uSreg;
+
+  // The address was stacked big-endian.
+  stats.uMaxUs = CrashMonitor::latencyTicksToMicros(uMaxLateTicks);
+  stats.ulMaxAddress = 0;
+  for (uint8_t uByte = 0; uByte < PROGRAM_COUNTER_SIZE; ++uByte) {
+    stats.ulMaxAddress = (stats.ulMaxAddress << 8) | auAddress[uByte];
+  }
+}
+
+void CrashMonitor::resetLatencyStats() {
+  uint8_t uSreg = SREG;
+  cli();
+  CrashMonitor::_uMaxLateTicks = 0;
+  memset(CrashMonitor::_auMaxLateAddress, 0, PROGRAM_COUNTER_SIZE);
+  memset(CrashMonitor::_auLatencyHistogram, 0, sizeof(CrashMonitor::_auLatencyHistogram));
+  SREG = uSreg;
+}
+
+uint16_t CrashMonitor::latencyTicksToMicros(uint8_t uTicks) {
+  // Timer0 runs at F_CPU / 64 for millis().
+  return (uint16_t)(((uint32_t)uTicks * 64) / (F_CPU / 1000000UL));
+}
+
+void CrashMonitor::latencyInterruptHandler(uint8_t *puProgramAddress, uint8_t uTimerCount) {
+  if (!CrashMonitor::_bLatency) {
+    return;
+  }
+
+  // The compare flag was set when TCNT0 passed OCR0B, so the difference is how
+  // long the interrupt waited (plus the prologue, well under a tick). Windows
+  // longer than the timer period (256 ticks) wrap around.
+  uint8_t uLateTicks = uTimerCount - OCR0B;
+  uint8_t uBucket = 0;
+  for (uint8_t uTicks = uLateTicks >> 1; uTicks != 0; uTicks >>= 1) {
+    ++uBucket;
+  }
+  if (CrashMonitor::_auLatencyHistogram[uBucket] != 0xffff) {
+    ++CrashMonitor::_auLatencyHistogram[uBucket];
+  }
+
+  if (uLateTicks > CrashMonitor::_uMaxLateTicks) {
+    CrashMonitor::_uMaxLateTicks = uLateTicks;
+    memcpy(CrashMonitor::_auMaxLateAddress, puProgramAddress, PROGRAM_COUNTER_SIZE);
+  }
+}
+#endif
+
+void CrashMonitor::enableFlashCheck(uint16_t expectedCrc, uint32_t length, uint8_t chunkSize) {
+  if (length == 0) {
+  #if FLASHEND > 0xffff
+    length = pgm_get_far_address(_etext);
+  #else
+    length = (uint16_t)(uintptr_t)&_etext;
+  #endif
+  }
+
+  CrashMonitor::_uFlashExpected = expectedCrc;
+  CrashMonitor::_uFlashChunk = (chunkSize == 0) ? 1 : chunkSize;
+  CrashMonitor::_ulFlashOffset = 0;
+  CrashMonitor::_uFlashCrc = 0xffff;
+  CrashMonitor::_ulFlashLength = length;
+}
+
+void CrashMonitor::disableFlashCheck() {
+  CrashMonitor::_ulFlashLength = 0;
+}
+
+void CrashMonitor::poll() {
+  if (CrashMonitor::_ulFlashLength != 0) {
+    CrashMonitor::checkFlashChunk();
+  }
+#if CRASH_MONITOR_MAX_WATCHES > 0
+  CrashMonitor::checkWatches();
+#endif
+}
+
+#if CRASH_MONITOR_MAX_WATCHES > 0
+bool CrashMonitor::watchCanary(const volatile void *address, uint16_t value) {
+  return CrashMonitor::watchRange(address, value, value);
+}
+
+bool CrashMonitor::watchRange(const volatile void *address, uint16_t minValue, uint16_t maxValue) {
+  for (uint8_t uWatch = 0; uWatch < CRASH_MONITOR_MAX_WATCHES; ++uWatch) {
+    CMemoryWatch &watch = CrashMonitor::_watches[uWatch];
+    if (watch.puAddress == NULL) {
+      watch.uMin = minValue;
+      watch.uMax = maxValue;
+      watch.puAddress = (const volatile uint16_t *)address;
+      return true;
+    }
+  }
+  return false;
+}
+
+void CrashMonitor::clearWatches() {
+  for (uint8_t uWatch = 0; uWatch < CRASH_MONITOR_MAX_WATCHES; ++uWatch) {
+    CrashMonitor::_watches[uWatch].puAddress = NULL;
+  }
+}
+
+void CrashMonitor::checkWatches() {
+  for (uint8_t uCount = 0; uCount < CRASH_MONITOR_WATCHES_PER_KICK; ++uCount) {
+    CMemoryWatch &watch = CrashMonitor::_watches[CrashMonitor::_uNextWatch];
+    if (++CrashMonitor::_uNextWatch >= CRASH_MONITOR_MAX_WATCHES) {
+      CrashMonitor::_uNextWatch = 0;
+    }
+
+    if (watch.puAddress == NULL) {
+      continue;
+    }
+
+    // The value may be written by an interrupt, so read it atomically.
+    uint8_t uSreg = SREG;
+    cli();
+    uint16_t uValue = *watch.puAddress;
+    SREG = uSreg;
+
+    if ((uValue < watch.uMin) || (uValue > watch.uMax)) {
+      uint16_t uAddress = (uint16_t)(uintptr_t)watch.puAddress;
+      watch.puAddress = NULL;
+      CrashMonitor::record(ReportType_MemoryCorrupt, uAddress, uValue);
+      return;
+    }
+  }
+}
+#endif
+
+void CrashMonitor::checkFlashChunk() {
+  uint8_t uCount = CrashMonitor::_uFlashChunk;
+  uint32_t ulOffset = CrashMonitor::_ulFlashOffset;
+  uint16_t uCrc = CrashMonitor::_uFlashCrc;
+  while ((uCount--) && (ulOffset < CrashMonitor::_ulFlashLength)) {
+  #if FLASHEND > 0xffff
+    uCrc = _crc16_update(uCrc, pgm_read_byte_far(ulOffset));
+  #else
+    uCrc = _crc16_update(uCrc, pgm_read_byte((uint16_t)ulOffset));
+  #endif
+    ++ulOffset;
+  }
+
+  if (ulOffset < CrashMonitor::_ulFlashLength) {
+    CrashMonitor::_ulFlashOffset = ulOffset;
+    CrashMonitor::_uFlashCrc = uCrc;
+    return;
+  }
+
+  // Completed a full pass. Start over if the image is intact.
+  CrashMonitor::_ulFlashOffset = 0;
+  CrashMonitor::_uFlashCrc = 0xffff;
+  if (uCrc != CrashMonitor::_uFlashExpected) {
+    CrashMonitor::record(ReportType_FlashCorrupt, CrashMonitor::_ulFlashLength / 2,
+      ((uint32_t)uCrc << 16) | CrashMonitor::_uFlashExpected);
+
+    // Only report the corruption once.
+    CrashMonitor::_ulFlashLength = 0;
+  }
+}
+
+void CrashMonitor::setStorage(READFUNC onRead, WRITEFUNC onWrite) {
+  CrashMonitor::storageRead = onRead;
+  CrashMonitor::storageWrite = onWrite;
+}
+
 void CrashMonitor::readBlock(int baseAddress, void *pData, uint8_t uSize) {
+  if (CrashMonitor::storageRead != NULL) {
+    CrashMonitor::storageRead(baseAddress, pData, uSize);
+    return;
+  }
+
   uint8_t *puData = (uint8_t *)pData;
   while (uSize--) {
     *puData++ = eeprom_read_byte((const uint8_t *)baseAddress++);
@@ -46,6 +505,11 @@ void CrashMonitor::readBlock(int baseAddress, void *pData, uint8_t uSize) {
 }
 
 void CrashMonitor::writeBlock(int baseAddress, const void *pData, uint8_t uSize) {
+  if (CrashMonitor::storageWrite != NULL) {
+    CrashMonitor::storageWrite(baseAddress, pData, uSize);
+    return;
+  }
+
   const uint8_t *puData = (const uint8_t *)pData;
   while (uSize--) {
     eeprom_write_byte((uint8_t *)baseAddress++, *puData++);
@@ -56,9 +520,14 @@ void CrashMonitor::loadHeader(CCrashMonitorHeader &reportHeader) {
   CrashMonitor::readBlock(CrashMonitor::_nBaseAddress, &reportHeader, sizeof(reportHeader));
 
   // Ensure the report structure is valid.
-  if (reportHeader.savedReports == 0xff) {
-    // EEPROM is 0xff when unintialized.
+  if ((reportHeader.uLayout != REPORT_LAYOUT_VERSION) ||
+      (reportHeader.uRecordSize != sizeof(CCrashReport))) {
+    // Uninitialized (EEPROM is 0xff) or saved with a different report layout
+    // that we can't read. Start over.
     reportHeader.savedReports = 0;
+    reportHeader.uNextReport = 0;
+    reportHeader.uLayout = REPORT_LAYOUT_VERSION;
+    reportHeader.uRecordSize = sizeof(CCrashReport);
   }
   else if (reportHeader.savedReports > CrashMonitor::_nMaxEntries) {
     reportHeader.savedReports = CrashMonitor::_nMaxEntries;
@@ -81,9 +550,78 @@ int CrashMonitor::getAddressForReport(int report) {
   return address;
 }
 
-void CrashMonitor::saveCurrentReport(int reportSlot) {
+#if CRASH_MONITOR_TRACE_ENTRIES > 0
+int CrashMonitor::getTraceAddress() {
+  return CrashMonitor::_nBaseAddress + sizeof(CCrashMonitorHeader) +
+    (CrashMonitor::_nMaxEntries * sizeof(CCrashReport));
+}
+
+void CrashMonitor::saveTrace() {
+  // Unroll the ring oldest entry first and save it in one block so block
+  // based storage only has to do a single write.
+  CTraceEntry aTrace[CRASH_MONITOR_TRACE_ENTRIES];
+  uint8_t uHead = CrashMonitor::_uTraceHead;
+  for (uint8_t uEntry = 0; uEntry < CRASH_MONITOR_TRACE_ENTRIES; ++uEntry) {
+    aTrace[uEntry] = CrashMonitor::_traceRing[(uHead + uEntry) & (CRASH_MONITOR_TRACE_ENTRIES - 1)];
+  }
+  CrashMonitor::writeBlock(CrashMonitor::getTraceAddress(), aTrace, sizeof(aTrace));
+}
+#endif
+
+void CrashMonitor::saveReport(int reportSlot, const CCrashReport &report) {
   int addr = CrashMonitor::getAddressForReport(reportSlot);
-  CrashMonitor::writeBlock(addr, &CrashMonitor::_crashReport, sizeof(CrashMonitor::_crashReport));
+  CrashMonitor::writeBlock(addr, &report, sizeof(report));
+}
+
+void CrashMonitor::storeReport(const CCrashReport &report) {
+  CCrashMonitorHeader header;
+
+  CrashMonitor::loadHeader(header);
+  CrashMonitor::saveReport(header.uNextReport, report);
+
+  // Update header for next time.
+  ++header.uNextReport;
+  if (header.uNextReport >= CrashMonitor::_nMaxEntries) {
+    header.uNextReport = 0;
+  }
+  else {
+    ++header.savedReports;
+  }
+
+  CrashMonitor::saveHeader(header);
+}
+
+void CrashMonitor::record(EReportType type, uint32_t wordAddress, uint32_t data) {
+  CCrashReport report;
+  memset(&report, 0, sizeof(report));
+  CrashMonitor::setReportAddress(report, wordAddress);
+  report.uData = data;
+  report.uType = type;
+  report.uRegion = CrashMonitor::_uRegion;
+  report.uBuild = CrashMonitor::_uBuild;
+  report.ulUptime = millis();
+
+  // A store takes about 3.4ms per EEPROM byte, which is longer than the short
+  // watchdog timeouts. Run it under the longest timeout so the watchdog
+  // interrupt can't fire in the middle of it and store into the same slot.
+  // The region also holds off the liveness stall check.
+  uint8_t uRegion = CrashMonitor::_uRegion;
+  ETimeout timeout = CrashMonitor::getTimeout();
+  CrashMonitor::extend(CrashMonitor::getLongestTimeout(), RECORD_REGION);
+  CrashMonitor::storeReport(report);
+  if (uRegion != 0) {
+    CrashMonitor::extend(timeout, uRegion);
+  }
+  else {
+    CrashMonitor::restore();
+  }
+}
+
+void CrashMonitor::setReportAddress(CCrashReport &report, uint32_t uWordAddress) {
+  for (int8_t nByte = PROGRAM_COUNTER_SIZE - 1; nByte >= 0; --nByte) {
+    report.auAddress[nByte] = (uint8_t)uWordAddress;
+    uWordAddress >>= 8;
+  }
 }
 
 void CrashMonitor::loadReport(int report, CCrashReport &state) {
@@ -105,6 +643,100 @@ void CrashMonitor::printValue(Print &destination, const __FlashStringHelper *pLa
   }
 }
 
+uint16_t CrashMonitor::readOpcode(uint32_t uByteAddress) {
+#if FLASHEND > 0xffff
+  return pgm_read_word_far(uByteAddress);
+#else
+  return pgm_read_word((uint16_t)uByteAddress);
+#endif
+}
+
+const __FlashStringHelper *CrashMonitor::classifyHang(uint32_t uByteAddress) {
+  if (uByteAddress > FLASHEND) {
+    return NULL;
+  }
+
+  uint16_t uOpcode = CrashMonitor::readOpcode(uByteAddress);
+  if (uOpcode == 0xcfff) {
+    // rjmp .-2
+    return F("spin");
+  }
+
+  // Look for a short backwards rjmp or conditional branch at or just after the
+  // crash address that jumps back to (or before) it. That is the tail of a
+  // polling loop (ie. while (!flag); ends in a breq).
+  uint32_t uLoopStart = 0;
+  uint32_t uLoopEnd = 0;
+  for (uint8_t uWord = 0; uWord < 4; ++uWord) {
+    uint32_t uAddress = uByteAddress + (uWord * 2);
+    uOpcode = CrashMonitor::readOpcode(uAddress);
+    int16_t nOffset = 0;
+    if (((uOpcode & 0xf000) == 0xc000) && (uOpcode & 0x0800)) {
+      // rjmp .-k
+      nOffset = (int16_t)(uOpcode | 0xf000);
+    }
+    else if ((((uOpcode & 0xf800) == 0xf000) || ((uOpcode & 0xf800) == 0xf400)) &&
+             (uOpcode & 0x0200)) {
+      // brbs/brbc s,.-k (breq, brne, brcs, ...), a 7-bit signed offset.
+      nOffset = (int16_t)((uOpcode >> 3) & 0x7f) - 0x80;
+    }
+
+    if (nOffset < 0) {
+      uint32_t uTarget = uAddress + 2 + (nOffset * 2);
+      if ((uTarget <= uByteAddress) && (uAddress - uTarget <= 16)) {
+        uLoopStart = uTarget;
+        uLoopEnd = uAddress;
+        break;
+      }
+    }
+  }
+
+  if (uLoopEnd == 0) {
+    return NULL;
+  }
+
+  for (uint32_t uAddress = uLoopStart; uAddress < uLoopEnd; uAddress += 2) {
+    uOpcode = CrashMonitor::readOpcode(uAddress);
+    if ((uOpcode & 0xfd00) == 0x9900) {
+      // sbic/sbis A,b
+      return F("io-poll");
+    }
+
+    if ((uOpcode & 0xf800) == 0xb000) {
+      // in Rd,A
+    #ifdef SPSR
+      uint8_t uIoAddress = ((uOpcode >> 5) & 0x30) | (uOpcode & 0x0f);
+      if (uIoAddress == _SFR_IO_ADDR(SPSR)) {
+        return F("spi-poll");
+      }
+    #endif
+      return F("io-poll");
+    }
+
+    if ((uOpcode & 0xfe0f) == 0x9000) {
+      // lds Rd,k (two words)
+      uAddress += 2;
+      uint16_t uDataAddress = CrashMonitor::readOpcode(uAddress);
+    #ifdef TWCR
+      if (uDataAddress == _SFR_MEM_ADDR(TWCR)) {
+        return F("twi-poll");
+      }
+    #endif
+    #ifdef SPSR
+      if (uDataAddress == _SFR_MEM_ADDR(SPSR)) {
+        return F("spi-poll");
+      }
+    #endif
+      if (uDataAddress >= RAMSTART) {
+        return F("volatile-wait");
+      }
+      return F("io-poll");
+    }
+  }
+
+  return F("loop");
+}
+
 void CrashMonitor::dump(Print &destination, bool onlyIfPresent) {
   CCrashMonitorHeader header;
   CrashMonitor::loadHeader(header);
@@ -122,11 +754,146 @@ void CrashMonitor::dump(Print &destination, bool onlyIfPresent) {
       destination.print(uReport);
       uAddress = 0;
       memcpy(&uAddress, report.auAddress, PROGRAM_COUNTER_SIZE);
+      if (report.uType == ReportType_MemoryCorrupt) {
+        CrashMonitor::printValue(destination, F(": memory-corrupt address=0x"), uAddress, HEX, false);
+        CrashMonitor::printValue(destination, F(", value=0x"), report.uData, HEX, true);
+        continue;
+      }
+
+      if (report.uType == ReportType_FlashCorrupt) {
+        CrashMonitor::printValue(destination, F(": flash-corrupt length=0x"), uAddress * 2, HEX, false);
+        CrashMonitor::printValue(destination, F(", crc=0x"), report.uData >> 16, HEX, false);
+        CrashMonitor::printValue(destination, F(", expected=0x"), report.uData & 0xffff, HEX, true);
+        continue;
+      }
+
       CrashMonitor::printValue(destination, F(": word-address=0x"), uAddress, HEX, false);
       CrashMonitor::printValue(destination, F(": byte-address=0x"), uAddress * 2, HEX, false);
-      CrashMonitor::printValue(destination, F(", data=0x"), report.uData, HEX, true);
+      CrashMonitor::printValue(destination, F(", data=0x"), report.uData, HEX, false);
+      if (report.uType == ReportType_Stall) {
+        destination.print(F(", stall"));
+      }
+      else if (report.uType == ReportType_User) {
+        destination.print(F(", user"));
+      }
+      CrashMonitor::printValue(destination, F(", sp=0x"), report.uStackPointer, HEX, false);
+      if (report.uStackLow != 0) {
+        CrashMonitor::printValue(destination, F(", stack-low=0x"), report.uStackLow, HEX, false);
+      }
+      if (report.uIrqLatencyUs != 0) {
+        CrashMonitor::printValue(destination, F(", irq-latency="), report.uIrqLatencyUs, DEC, false);
+      }
+      if (report.uRegion != 0) {
+        CrashMonitor::printValue(destination, F(", region="), report.uRegion, DEC, false);
+      }
+      CrashMonitor::printValue(destination, F(", build="), report.uBuild, DEC, false);
+      CrashMonitor::printValue(destination, F(", uptime="), report.ulUptime, DEC, false);
+
+      // Decode the instruction at the crash address. This is only meaningful
+      // if the report was generated by the firmware that is now running.
+      if ((report.uBuild == CrashMonitor::_uBuild) && (uAddress * 2 <= FLASHEND)) {
+        CrashMonitor::printValue(destination, F(", insn=0x"), CrashMonitor::readOpcode(uAddress * 2), HEX, false);
+        const __FlashStringHelper *pHang = CrashMonitor::classifyHang(uAddress * 2);
+        if (pHang != NULL) {
+          destination.print(F(", hang="));
+          destination.print(pHang);
+        }
+      }
+    #if CRASH_MONITOR_STACK_BYTES > 0
+      destination.print(F(", stack="));
+      for (uint8_t uByte = 0; uByte < CRASH_MONITOR_STACK_BYTES; ++uByte) {
+        if (report.auStack[uByte] < 0x10) {
+          destination.print('0');
+        }
+        destination.print(report.auStack[uByte], HEX);
+      }
+    #endif
+      destination.println();
+    }
+
+  #if CRASH_MONITOR_TRACE_ENTRIES > 0
+    // The trace saved with the most recent watchdog report.
+    CTraceEntry aTrace[CRASH_MONITOR_TRACE_ENTRIES];
+    CrashMonitor::readBlock(CrashMonitor::getTraceAddress(), aTrace, sizeof(aTrace));
+    bool bTrace = false;
+    for (uint8_t uEntry = 0; uEntry < CRASH_MONITOR_TRACE_ENTRIES; ++uEntry) {
+      if ((aTrace[uEntry].uFormat == 0) || (aTrace[uEntry].uFormat == 0xff)) {
+        continue;
+      }
+
+      if (!bTrace) {
+        destination.println(F("Trace:"));
+        bTrace = true;
+      }
+      CrashMonitor::printValue(destination, F("fmt="), aTrace[uEntry].uFormat, DEC, false);
+      CrashMonitor::printValue(destination, F(", arg=0x"), aTrace[uEntry].uArg, HEX, true);
+    }
+  #endif
+  }
+}
+
+void CrashMonitor::dumpBinary(Print &destination, bool onlyIfPresent) {
+  CCrashMonitorHeader header;
+  CrashMonitor::loadHeader(header);
+  if ((onlyIfPresent) && (header.savedReports == 0)) {
+    return;
+  }
+
+  const uint8_t auDescriptor[] = { 'C', 'M', BINARY_FORMAT_VERSION, sizeof(CCrashReport) };
+  destination.write(auDescriptor, sizeof(auDescriptor));
+  destination.write((const uint8_t *)&header, sizeof(header));
+
+  // Records go out as stored (address bytes in stack order) so that a dump and
+  // a raw EEPROM image can be parsed the same way.
+  CCrashReport report;
+  for (uint8_t uReport = 0; uReport < header.savedReports; ++uReport) {
+    CrashMonitor::readBlock(CrashMonitor::getAddressForReport(uReport), &report, sizeof(report));
+    destination.write((const uint8_t *)&report, sizeof(report));
+  }
+}
+
+uint8_t CrashMonitor::serialize(uint8_t *buffer, uint8_t len, uint16_t &cursor) {
+  CCrashMonitorHeader header;
+  CrashMonitor::loadHeader(header);
+
+  uint8_t uUsed = 0;
+  while ((uint8_t)(cursor >> 8) < header.savedReports) {
+    uint8_t uSlot = (uint8_t)(cursor >> 8);
+    uint8_t uOffset = (uint8_t)cursor;
+    if ((uint8_t)(len - uUsed) < 3) {
+      // No room for a fragment header and at least one byte.
+      break;
+    }
+
+    buffer[uUsed++] = uSlot;
+    buffer[uUsed++] = uOffset;
+    uint8_t uSize = sizeof(CCrashReport) - uOffset;
+    int address = CrashMonitor::getAddressForReport(uSlot);
+    if ((uOffset == 0) && ((uint8_t)(len - uUsed) >= uSize)) {
+      // The whole record fits. Read it straight into the buffer.
+      CrashMonitor::readBlock(address, buffer + uUsed, uSize);
+    }
+    else {
+      // Split the record. Reads always cover a whole record, so block based
+      // storage sees the same addresses and sizes it was written with.
+      CCrashReport report;
+      CrashMonitor::readBlock(address, &report, sizeof(report));
+      if (uSize > (uint8_t)(len - uUsed)) {
+        uSize = len - uUsed;
+      }
+      memcpy(buffer + uUsed, (const uint8_t *)&report + uOffset, uSize);
+    }
+    uUsed += uSize;
+
+    uOffset += uSize;
+    if (uOffset >= sizeof(CCrashReport)) {
+      cursor = (uint16_t)(uSlot + 1) << 8;
+    }
+    else {
+      cursor = ((uint16_t)uSlot << 8) | uOffset;
     }
   }
+  return uUsed;
 }
 
 void CrashMonitor::clear() {
@@ -134,27 +901,23 @@ void CrashMonitor::clear() {
   CCrashMonitorHeader header;
   CrashMonitor::loadHeader(header);
   if (header.savedReports != 0) {
-    // We have at least one report.
-    uint32_t uAddress;
-    int sz = 0;
+    // We have at least one report. Overwrite each saved report slot with zeros.
+    // This goes through the storage backend one report at a time, so block
+    // based storage sees the same addresses it was written with.
     CCrashReport report;
-
-    // Loop through the report addresses and load each report.
+    memset(&report, 0, sizeof(report));
     for (uint8_t uReport = 0; uReport < header.savedReports; ++uReport) {
-      CrashMonitor::loadReport(uReport, report);
-
-      // Determine the size of the report (number of bytes to delete), then
-      // starting at the address of the report, write zeros for the length of
-      // the report.
-      uAddress = 0;
-      memcpy(&uAddress, report.auAddress, PROGRAM_COUNTER_SIZE);
-      sz = sizeof(report);
-      while (sz--) {
-        eeprom_write_byte((uint8_t *)uAddress++, 0);
-      }
+      CrashMonitor::saveReport(uReport, report);
     }
   }
 
+#if CRASH_MONITOR_TRACE_ENTRIES > 0
+  // And the trace saved with the last report.
+  CTraceEntry aTrace[CRASH_MONITOR_TRACE_ENTRIES];
+  memset(aTrace, 0, sizeof(aTrace));
+  CrashMonitor::writeBlock(CrashMonitor::getTraceAddress(), aTrace, sizeof(aTrace));
+#endif
+
   // Now clear out the header.
   header.savedReports = 0;
   header.uNextReport = 0;
@@ -171,35 +934,259 @@ void CrashMonitor::setUserCrashHandler(void (*onUserCrashEvent)()) {
   CrashMonitor::userCrashHandler = onUserCrashEvent;
 }
 
-void CrashMonitor::watchDogInterruptHandler(uint8_t *puProgramAddress) {
-  CCrashMonitorHeader header;
+void CrashMonitor::setFailSafeOutputs(const CFailSafeOutput *pOutputs, uint8_t uCount) {
+  uint8_t uSreg = SREG;
+  cli();
+  CrashMonitor::_pFailSafeOutputs = pOutputs;
+  CrashMonitor::_uFailSafeCount = (pOutputs == NULL) ? 0 : uCount;
+  SREG = uSreg;
+}
 
-  CrashMonitor::loadHeader(header);
-  memcpy(CrashMonitor::_crashReport.auAddress, puProgramAddress, PROGRAM_COUNTER_SIZE);
-  CrashMonitor::saveCurrentReport(header.uNextReport);
+void CrashMonitor::setFailSafeHandler(void (*onFailSafe)()) {
+  CrashMonitor::failSafeHandler = onFailSafe;
+}
 
-  // Update header for next time.
-  ++header.uNextReport;
-  if (header.uNextReport >= CrashMonitor::_nMaxEntries) {
-    header.uNextReport = 0;
+void CrashMonitor::failSafe() {
+  const CFailSafeOutput *pOutput = CrashMonitor::_pFailSafeOutputs;
+  for (uint8_t uCount = CrashMonitor::_uFailSafeCount; uCount != 0; --uCount, ++pOutput) {
+    *pOutput->puPort = (*pOutput->puPort & ~pOutput->uMask) | (pOutput->uValue & pOutput->uMask);
   }
-  else {
-    ++header.savedReports;
+
+  if (CrashMonitor::failSafeHandler != NULL) {
+    CrashMonitor::failSafeHandler();
   }
+}
 
-  CrashMonitor::saveHeader(header);
+#if CRASH_MONITOR_MAX_HANDLERS > 0
+int8_t CrashMonitor::addCrashHandler(void (*onCrash)(), uint8_t priority, uint16_t budgetMs) {
+  if ((onCrash == NULL) || (CrashMonitor::_uHandlerCount >= CRASH_MONITOR_MAX_HANDLERS)) {
+    return -1;
+  }
+
+  // Insert in priority order. Handlers with the same priority run in the
+  // order they were added.
+  uint8_t uId = CrashMonitor::_uHandlerCount;
+  uint8_t uSlot = uId;
+  uint8_t uSreg = SREG;
+  cli();
+  while ((uSlot > 0) && (CrashMonitor::_handlers[uSlot - 1].uPriority > priority)) {
+    CrashMonitor::_handlers[uSlot] = CrashMonitor::_handlers[uSlot - 1];
+    --uSlot;
+  }
+
+  CrashMonitor::_handlers[uSlot].onCrash = onCrash;
+  CrashMonitor::_handlers[uSlot].uPriority = priority;
+  CrashMonitor::_handlers[uSlot].uId = uId;
+  CrashMonitor::_handlers[uSlot].uBudgetMs = budgetMs;
+  ++CrashMonitor::_uHandlerCount;
+  SREG = uSreg;
+  return uId;
+}
+
+void CrashMonitor::runCrashHandlers() {
+  // The part of the 120ms second stage timeout we can count on. The watchdog
+  // oscillator is not very accurate, so leave some margin.
+  const uint16_t uWindowMs = 100;
+
+  // Interrupts are disabled and we are about to reset, so Timer1 can be taken
+  // over as a stopwatch. With a 1024 prescaler it covers over 4s at 16MHz.
+  TCCR1A = 0;
+  TCCR1B = _BV(CS12) | _BV(CS10);
+  TCNT1 = 0;
+  const uint32_t ulTicksPerSecond = F_CPU / 1024;
+
+  CHandlerResults &results = CrashMonitor::_pendingResults;
+  memset(&results, 0, sizeof(results));
+  CrashMonitor::_uPendingResultsMagic = PENDING_RESULTS_MAGIC;
+
+  uint16_t uStartMs = 0;
+  for (uint8_t uHandler = 0; uHandler < CrashMonitor::_uHandlerCount; ++uHandler) {
+    const CCrashHandler &handler = CrashMonitor::_handlers[uHandler];
+    uint8_t uBit = _BV(handler.uId);
+    // Compare against the time left so a large budget can't wrap around.
+    if ((uStartMs > uWindowMs) || (handler.uBudgetMs > uWindowMs - uStartMs)) {
+      results.uSkipped |= uBit;
+      continue;
+    }
+
+    results.uStarted |= uBit;
+    handler.onCrash();
+    uint16_t uEndMs = (uint16_t)((TCNT1 * 1000UL) / ulTicksPerSecond);
+    results.uCompleted |= uBit;
+    results.auTimeMs[handler.uId] = uEndMs - uStartMs;
+    if (uEndMs - uStartMs > handler.uBudgetMs) {
+      results.uOverrun |= uBit;
+    }
+    uStartMs = uEndMs;
+  }
+}
+#endif
+
+void CrashMonitor::enableHeatmap(int address, uint8_t bucketShift) {
+  CrashMonitor::_uHeatmapShift = bucketShift;
+  CrashMonitor::_nHeatmapAddress = address;
+#if CRASH_MONITOR_EARLY_BOOT
+  if (CrashMonitor::_bHeatmapPending) {
+    CrashMonitor::updateCaptureHeatmap();
+    CrashMonitor::_bHeatmapPending = false;
+  }
+#endif
+}
+
+void CrashMonitor::updateCaptureHeatmap() {
+  uint32_t uWordAddress = 0;
+  for (uint8_t uByte = 0; uByte < PROGRAM_COUNTER_SIZE; ++uByte) {
+    uWordAddress = (uWordAddress << 8) | CrashMonitor::_crashReport.auAddress[uByte];
+  }
+  CrashMonitor::updateHeatmap(uWordAddress * 2);
+}
+
+int CrashMonitor::getHeatmapSize() {
+  uint32_t ulBuckets = ((uint32_t)FLASHEND + 1) >> CrashMonitor::_uHeatmapShift;
+  return (ulBuckets + 1) / 2;
+}
+
+// The counters are stored inverted (15 - count), so that erased EEPROM (0xff)
+// reads as all zero.
+uint8_t CrashMonitor::getHeatmapCount(uint16_t uBucket) {
+  uint8_t uByte;
+  CrashMonitor::readBlock(CrashMonitor::_nHeatmapAddress + (uBucket >> 1), &uByte, 1);
+  if (uBucket & 1) {
+    uByte >>= 4;
+  }
+  return 15 - (uByte & 0x0f);
+}
+
+void CrashMonitor::updateHeatmap(uint32_t uByteAddress) {
+  if ((CrashMonitor::_nHeatmapAddress < 0) || (uByteAddress > FLASHEND)) {
+    return;
+  }
+
+  uint16_t uBucket = uByteAddress >> CrashMonitor::_uHeatmapShift;
+  int addr = CrashMonitor::_nHeatmapAddress + (uBucket >> 1);
+  uint8_t uShift = (uBucket & 1) ? 4 : 0;
+  uint8_t uByte;
+  CrashMonitor::readBlock(addr, &uByte, 1);
+
+  uint8_t uNibble = (uByte >> uShift) & 0x0f;
+  if (uNibble != 0) {
+    // Not saturated yet.
+    uByte = (uByte & ~(0x0f << uShift)) | ((uNibble - 1) << uShift);
+    CrashMonitor::writeBlock(addr, &uByte, 1);
+  }
+}
+
+void CrashMonitor::dumpHeatmap(Print &destination) {
+  if (CrashMonitor::_nHeatmapAddress < 0) {
+    return;
+  }
+
+  uint16_t uBuckets = CrashMonitor::getHeatmapSize() * 2;
+  uint32_t ulBucketSize = 1UL << CrashMonitor::_uHeatmapShift;
+  destination.println(F("Crash Heatmap"));
+  destination.println(F("-------------"));
+
+  // Print the buckets grouped by count, highest first. This avoids needing
+  // RAM to sort them.
+  for (uint8_t uCount = 15; uCount > 0; --uCount) {
+    for (uint16_t uBucket = 0; uBucket < uBuckets; ++uBucket) {
+      if (CrashMonitor::getHeatmapCount(uBucket) != uCount) {
+        continue;
+      }
+
+      CrashMonitor::printValue(destination, F("byte-address=0x"), uBucket * ulBucketSize, HEX, false);
+      CrashMonitor::printValue(destination, F("-0x"), ((uBucket + 1) * ulBucketSize) - 1, HEX, false);
+      CrashMonitor::printValue(destination, F(", count="), uCount, DEC, false);
+      destination.println((uCount == 15) ? F("+") : F(""));
+    }
+  }
+}
+
+void CrashMonitor::clearHeatmap() {
+  if (CrashMonitor::_nHeatmapAddress < 0) {
+    return;
+  }
+
+  uint8_t uByte = 0xff;
+  int nSize = CrashMonitor::getHeatmapSize();
+  for (int nOffset = 0; nOffset < nSize; ++nOffset) {
+    CrashMonitor::writeBlock(CrashMonitor::_nHeatmapAddress + nOffset, &uByte, 1);
+  }
+}
+
+void CrashMonitor::watchDogInterruptHandler(uint8_t *puProgramAddress) {
+  CrashMonitor::captureCrash(puProgramAddress, ReportType_Watchdog);
+}
+
+uint16_t CrashMonitor::getStackLow() {
+#if CRASH_MONITOR_STACK_PAINT
+  const uint8_t *puRam = &_end;
+  if ((&__brkval != NULL) && (__brkval != NULL)) {
+    puRam = (const uint8_t *)__brkval;
+  }
+  while ((puRam <= (const uint8_t *)RAMEND) && (*puRam == STACK_PAINT)) {
+    ++puRam;
+  }
+  return (uint16_t)(uintptr_t)puRam;
+#else
+  return 0;
+#endif
+}
+
+void CrashMonitor::captureCrash(uint8_t *puProgramAddress, uint8_t uType) {
+  // Storing the report (and trace) takes about 3.4ms per EEPROM byte, which is
+  // far longer than what is left of a short first stage timeout. Switch to the
+  // longest timeout (as a plain reset) until the second stage starts below.
+  wdt_enable(CrashMonitor::getLongestTimeout());
+
+  memcpy(CrashMonitor::_crashReport.auAddress, puProgramAddress, PROGRAM_COUNTER_SIZE);
+  CrashMonitor::_crashReport.uType = uType;
+  // SP points at the next free byte, so before the program counter was pushed
+  // it was just below the last program counter byte.
+  CrashMonitor::_crashReport.uStackPointer = (uint16_t)(uintptr_t)(puProgramAddress + PROGRAM_COUNTER_SIZE - 1);
+  CrashMonitor::_crashReport.uRegion = CrashMonitor::_uRegion;
+  CrashMonitor::_crashReport.uBuild = CrashMonitor::_uBuild;
+  CrashMonitor::_crashReport.ulUptime = millis();
+  CrashMonitor::_crashReport.uStackLow = CrashMonitor::getStackLow();
+#if CRASH_MONITOR_LATENCY
+  CrashMonitor::_crashReport.uIrqLatencyUs = CrashMonitor::latencyTicksToMicros(CrashMonitor::_uMaxLateTicks);
+#else
+  CrashMonitor::_crashReport.uIrqLatencyUs = 0;
+#endif
+#if CRASH_MONITOR_STACK_BYTES > 0
+  const uint8_t *puStack = puProgramAddress + PROGRAM_COUNTER_SIZE;
+  for (uint8_t uByte = 0; uByte < CRASH_MONITOR_STACK_BYTES; ++uByte) {
+    CrashMonitor::_crashReport.auStack[uByte] = (puStack <= (const uint8_t *)RAMEND) ? *puStack++ : 0;
+  }
+#endif
+
+#if CRASH_MONITOR_EARLY_BOOT
+  // If we get reset before the report is stored, begin() stores it.
+  CrashMonitor::_uPendingCheck = CrashMonitor::getPendingCheck(CrashMonitor::_crashReport);
+#endif
+  CrashMonitor::storeReport(CrashMonitor::_crashReport);
+#if CRASH_MONITOR_TRACE_ENTRIES > 0
+  CrashMonitor::saveTrace();
+#endif
+  CrashMonitor::updateCaptureHeatmap();
+#if CRASH_MONITOR_EARLY_BOOT
+  CrashMonitor::_uPendingCheck = 0;
+#endif
 
   // Wait for next watchdog timeout to reset the system. If the watchdog timeout
   // is too short, it doesn't give the program much time to reset it before the
   // next timeout. So we can be a bit generous here.
   wdt_enable(WDTO_120MS);
+#if CRASH_MONITOR_MAX_HANDLERS > 0
+  CrashMonitor::runCrashHandlers();
+#endif
   if (CrashMonitor::userCrashHandler != NULL) {
     CrashMonitor::userCrashHandler();
   }
-  else {
-    while (true) {
-      ;
-    }
+
+  // The ISR is naked, so there is nothing to return to.
+  while (true) {
+    ;
   }
 }
 
@@ -211,7 +1198,15 @@ void CrashMonitor::watchDogInterruptHandler(uint8_t *puProgramAddress) {
  * EEPROM then let the second watchdog event reset the MCU. We never return from
  * this function.
  */
-ISR(WDT_vect) {
+ISR(WDT_vect, ISR_NAKED) {
+  // The interrupted code may have been using r1 (ie. for mul) and compiled
+  // code expects it to be zero.
+  asm volatile ("clr __zero_reg__");
+
+  // Drive outputs to a safe state before anything else. This returns with the
+  // stack pointer where it was, so the program counter is still on top.
+  Watchdog::CrashMonitor::failSafe();
+
   // Setup a pointer to the program counter. It goes in a register so we don't
   // mess up the stack.
   register uint8_t *upStack;
@@ -224,3 +1219,32 @@ ISR(WDT_vect) {
   ++upStack;
   Watchdog::CrashMonitor::watchDogInterruptHandler(upStack);
 }
+
+#if CRASH_MONITOR_LIVENESS || CRASH_MONITOR_LATENCY
+/**
+ * @brief Interrupt Service Request for liveness mode and the latency monitor.
+ * Unlike the watchdog ISR, this one has to return, so it can't be naked.
+ * Instead, the prologue's stack usage (.L__stack_usage, emitted by avr-gcc for
+ * every function) is added to SP to find the program counter pushed when the
+ * interrupt fired.
+ */
+ISR(TIMER0_COMPB_vect) {
+  // Read the timer first so the latency measurement is as tight as possible.
+  uint8_t uTimerCount = TCNT0;
+  uint8_t *upStack;
+  asm volatile (
+    "in %A0, __SP_L__" "\n\t"
+    "in %B0, __SP_H__" "\n\t"
+    "subi %A0, lo8(-(.L__stack_usage + 1))" "\n\t"
+    "sbci %B0, hi8(-(.L__stack_usage + 1))"
+    : "=d" (upStack));
+#if CRASH_MONITOR_LATENCY
+  Watchdog::CrashMonitor::latencyInterruptHandler(upStack, uTimerCount);
+#else
+  (void)uTimerCount;
+#endif
+#if CRASH_MONITOR_LIVENESS
+  Watchdog::CrashMonitor::livenessInterruptHandler(upStack);
+#endif
+}
+#endif
@@ -26,7 +26,105 @@ namespace Watchdog
     #define PROGRAM_COUNTER_SIZE 2
   #endif
 
+  // The number of stack bytes (above the program counter) to capture with
+  // each crash report. Define this in your build flags to enable stack
+  // snapshots. Each byte is stored per report in EEPROM.
+  #ifndef CRASH_MONITOR_STACK_BYTES
+    #define CRASH_MONITOR_STACK_BYTES 0
+  #endif
+
+  // The number of entries in the trace ring (see CrashMonitor::trace()). Must
+  // be a power of 2 (up to 64). Define this in your build flags to enable
+  // tracing. The ring takes 3 bytes of RAM per entry and the same again in
+  // EEPROM.
+  #ifndef CRASH_MONITOR_TRACE_ENTRIES
+    #define CRASH_MONITOR_TRACE_ENTRIES 0
+  #endif
+
+  #if (CRASH_MONITOR_TRACE_ENTRIES & (CRASH_MONITOR_TRACE_ENTRIES - 1)) != 0
+    #error "CRASH_MONITOR_TRACE_ENTRIES must be a power of 2."
+  #endif
+
+  // The saved ring is written with a single 8-bit sized block write.
+  #if CRASH_MONITOR_TRACE_ENTRIES > 64
+    #error "CRASH_MONITOR_TRACE_ENTRIES must be 64 or less."
+  #endif
+
+  // Set to 1 in your build flags to enable liveness mode (see
+  // CrashMonitor::enableLivenessMode()). This takes over the Timer0 compare B
+  // interrupt, which the Arduino core does not use.
+  #ifndef CRASH_MONITOR_LIVENESS
+    #define CRASH_MONITOR_LIVENESS 0
+  #endif
+
+  // Set to 1 in your build flags to enable the interrupt latency monitor (see
+  // CrashMonitor::enableLatencyMonitor()). This shares the Timer0 compare B
+  // interrupt with liveness mode.
+  #ifndef CRASH_MONITOR_LATENCY
+    #define CRASH_MONITOR_LATENCY 0
+  #endif
+
+  // The number of memory watches (see CrashMonitor::watchCanary()). Define
+  // this in your build flags to enable memory watches. Each one takes 6 bytes
+  // of RAM.
+  #ifndef CRASH_MONITOR_MAX_WATCHES
+    #define CRASH_MONITOR_MAX_WATCHES 0
+  #endif
+
+  // The number of memory watches checked per call to iAmAlive() or poll().
+  #ifndef CRASH_MONITOR_WATCHES_PER_KICK
+    #define CRASH_MONITOR_WATCHES_PER_KICK 1
+  #endif
+
+  // Set to 1 in your build flags to enable the early boot hook. When enabled,
+  // the reset cause is captured and MCUSR cleared and the watchdog disabled in
+  // .init3 (before the C runtime starts), and a crash capture that was cut
+  // short by a reset is recovered from .noinit RAM by begin().
+  #ifndef CRASH_MONITOR_EARLY_BOOT
+    #define CRASH_MONITOR_EARLY_BOOT 0
+  #endif
+
+  // Set to 1 in your build flags (along with CRASH_MONITOR_EARLY_BOOT) if the
+  // bootloader is Optiboot, which clears MCUSR and passes the original value
+  // in r2. Other bootloaders leave r2 undefined.
+  #ifndef CRASH_MONITOR_OPTIBOOT_R2
+    #define CRASH_MONITOR_OPTIBOOT_R2 0
+  #endif
+
+  // The number of prioritized crash handlers (see
+  // CrashMonitor::addCrashHandler()), up to 8. Define this in your build flags
+  // to enable the handler chain.
+  #ifndef CRASH_MONITOR_MAX_HANDLERS
+    #define CRASH_MONITOR_MAX_HANDLERS 0
+  #endif
+
+  #if CRASH_MONITOR_MAX_HANDLERS > 8
+    #error "CRASH_MONITOR_MAX_HANDLERS must be 8 or less."
+  #endif
+
+  // Set to 1 in your build flags to enable stack painting. Free RAM is then
+  // filled with a known pattern in .init1 (which adds a little to the boot
+  // time) so the deepest the stack has ever reached can be found when a crash
+  // is captured. Otherwise stack-low is reported as 0.
+  #ifndef CRASH_MONITOR_STACK_PAINT
+    #define CRASH_MONITOR_STACK_PAINT 0
+  #endif
+
   typedef void (*STATICFUNC)();
+  typedef void (*READFUNC)(int address, void *pData, uint8_t uSize);
+  typedef void (*WRITEFUNC)(int address, const void *pData, uint8_t uSize);
+
+  /**
+   * @brief The kinds of report that can be stored.
+   */
+  enum EReportType
+  {
+    ReportType_Watchdog = 0,
+    ReportType_FlashCorrupt = 1,
+    ReportType_Stall = 2,
+    ReportType_User = 3,
+    ReportType_MemoryCorrupt = 4
+  };
 
   /**
    * @brief Crash monitor header.
@@ -42,6 +140,167 @@ namespace Watchdog
      * @brief The location for the next report to be saved.
      */
     uint8_t uNextReport;
+
+    /**
+     * @brief The version of the CCrashReport layout the reports were saved
+     * with. Reports saved with another layout (or by an older version of this
+     * library) are discarded.
+     */
+    uint8_t uLayout;
+
+    /**
+     * @brief sizeof(CCrashReport) when the reports were saved, which changes
+     * with the build flags (ie. CRASH_MONITOR_STACK_BYTES).
+     */
+    uint8_t uRecordSize;
+  } __attribute__((__packed__));
+
+  /**
+   * @brief An output to drive to a safe state as soon as a crash is detected.
+   * The bits in uMask of *puPort are set to the matching bits of uValue.
+   */
+  struct CFailSafeOutput
+  {
+    /**
+     * @brief The output register (ie. &PORTB).
+     */
+    volatile uint8_t *puPort;
+
+    /**
+     * @brief The bits to change.
+     */
+    uint8_t uMask;
+
+    /**
+     * @brief The safe values of those bits.
+     */
+    uint8_t uValue;
+  };
+
+  /**
+   * @brief A memory watch. The 16-bit value at puAddress must stay within
+   * uMin to uMax (inclusive). A canary is a watch where both are the same.
+   */
+  struct CMemoryWatch
+  {
+    /**
+     * @brief The address to watch, or NULL if the watch is unused.
+     */
+    const volatile uint16_t *puAddress;
+
+    /**
+     * @brief The minimum valid value.
+     */
+    uint16_t uMin;
+
+    /**
+     * @brief The maximum valid value.
+     */
+    uint16_t uMax;
+  };
+
+  /**
+   * @brief A prioritized crash handler.
+   */
+  struct CCrashHandler
+  {
+    /**
+     * @brief The callback.
+     */
+    STATICFUNC onCrash;
+
+    /**
+     * @brief The priority. Lower values run first.
+     */
+    uint8_t uPriority;
+
+    /**
+     * @brief The handler ID (the order it was added in).
+     */
+    uint8_t uId;
+
+    /**
+     * @brief The time the handler needs, in milliseconds.
+     */
+    uint16_t uBudgetMs;
+  };
+
+  /**
+   * @brief The outcome of the crash handler chain. Each bit in the masks is a
+   * handler ID.
+   */
+  struct CHandlerResults
+  {
+    /**
+     * @brief The handlers that were started.
+     */
+    uint8_t uStarted;
+
+    /**
+     * @brief The handlers that returned before the reset.
+     */
+    uint8_t uCompleted;
+
+    /**
+     * @brief The handlers that were skipped because their budget did not fit
+     * in the time left before the reset.
+     */
+    uint8_t uSkipped;
+
+    /**
+     * @brief The handlers that took longer than their budget.
+     */
+    uint8_t uOverrun;
+
+  #if CRASH_MONITOR_MAX_HANDLERS > 0
+    /**
+     * @brief The time each handler took, in milliseconds, by handler ID.
+     */
+    uint16_t auTimeMs[CRASH_MONITOR_MAX_HANDLERS];
+  #endif
+  };
+
+  /**
+   * @brief Interrupt latency statistics (see CrashMonitor::getLatencyStats()).
+   */
+  struct CLatencyStats
+  {
+    /**
+     * @brief The longest time the timer interrupt was held off, in
+     * microseconds.
+     */
+    uint16_t uMaxUs;
+
+    /**
+     * @brief The word address the timer interrupt returned to when uMaxUs was
+     * measured. This is just after the point where interrupts were enabled
+     * again.
+     */
+    uint32_t ulMaxAddress;
+
+    /**
+     * @brief The number of timer interrupts held off for each range of timer
+     * ticks (4us at 16MHz). Bucket 0 is 0-1 ticks and bucket n is 2^n to
+     * 2^(n+1)-1 ticks. The counts stop at 0xFFFF.
+     */
+    uint16_t auHistogram[8];
+  };
+
+  /**
+   * @brief A trace entry. The format is a user-defined ID for a format string
+   * that is expanded when the trace is read back.
+   */
+  struct CTraceEntry
+  {
+    /**
+     * @brief The format ID. 0 marks an unused entry.
+     */
+    uint8_t uFormat;
+
+    /**
+     * @brief The raw argument.
+     */
+    uint16_t uArg;
   } __attribute__((__packed__));
 
   /**
@@ -57,9 +316,60 @@ namespace Watchdog
     uint8_t auAddress[PROGRAM_COUNTER_SIZE];
 
     /**
-     * @brief User data.
+     * @brief User data. For flash corruption reports, this holds the computed
+     * CRC in the upper word and the expected CRC in the lower word.
      */
     uint32_t uData;
+
+    /**
+     * @brief The report type (see EReportType).
+     */
+    uint8_t uType;
+
+    /**
+     * @brief The stack pointer of the interrupted code when the watchdog
+     * interrupt fired (before the program counter was pushed). The stack
+     * snapshot starts at uStackPointer + 1.
+     */
+    uint16_t uStackPointer;
+
+    /**
+     * @brief The ID of the extended timeout region that was active when the
+     * report was generated, or 0 if none (see CrashMonitor::extend()).
+     */
+    uint8_t uRegion;
+
+    /**
+     * @brief The ID of the firmware build that generated the report (see
+     * CrashMonitor::setBuildId()).
+     */
+    uint16_t uBuild;
+
+    /**
+     * @brief The time since boot in milliseconds when the report was
+     * generated.
+     */
+    uint32_t ulUptime;
+
+    /**
+     * @brief The lowest address the stack has reached since boot (the stack
+     * high-water mark), or 0 if stack painting is disabled.
+     */
+    uint16_t uStackLow;
+
+    /**
+     * @brief The longest time the timer interrupt was held off since boot, in
+     * microseconds, or 0 if the latency monitor is disabled.
+     */
+    uint16_t uIrqLatencyUs;
+
+  #if CRASH_MONITOR_STACK_BYTES > 0
+    /**
+     * @brief A raw snapshot of the stack, starting just above the program
+     * counter. Unused bytes (past RAMEND) are 0.
+     */
+    uint8_t auStack[CRASH_MONITOR_STACK_BYTES];
+  #endif
   } __attribute__((__packed__));
 
   /**
@@ -80,12 +390,99 @@ namespace Watchdog
 
     // The maximum number of crash entries stored in the EEPROM.
     static int _nMaxEntries;
-    enum EConstants { DEFAULT_ENTRIES = 10 };
+    enum EConstants
+    {
+      DEFAULT_ENTRIES = 10,
+      DEFAULT_FLASH_CHUNK = 16,
+      BINARY_FORMAT_VERSION = 2,
+      DEFAULT_HEATMAP_SHIFT = 8,
+      RECORD_REGION = 255,
+      REPORT_LAYOUT_VERSION = 1,
+      PENDING_RESULTS_MAGIC = 0xc4a5
+    };
     static CCrashReport _crashReport;
 
+    // Incremental flash check state. A length of zero means the check is
+    // disabled.
+    static uint32_t _ulFlashLength;
+    static uint32_t _ulFlashOffset;
+    static uint16_t _uFlashCrc;
+    static uint16_t _uFlashExpected;
+    static uint8_t _uFlashChunk;
+
+    // The timeout set by enableWatchdog() (restored by restore()), the
+    // timeout currently in effect and the currently extended region.
+    static uint8_t _uTimeout;
+    static uint8_t _uCurrentTimeout;
+    static bool _bWatchdogEnabled;
+    static volatile uint8_t _uRegion;
+
+    // The ID of the running firmware build.
+    static uint16_t _uBuild;
+
+    // The EEPROM address of the heatmap (-1 if disabled) and the number of
+    // address bits per bucket.
+    static int _nHeatmapAddress;
+    static uint8_t _uHeatmapShift;
+
+  #if CRASH_MONITOR_EARLY_BOOT
+    // Set when _crashReport holds a capture that has not been fully stored
+    // yet. Both live in .noinit so they survive the reset.
+    static uint16_t _uPendingCheck;
+
+    // Set when begin() recovered a capture whose heatmap update still has to
+    // be applied (once the heatmap is enabled).
+    static bool _bHeatmapPending;
+  #endif
+
+  #if CRASH_MONITOR_MAX_WATCHES > 0
+    // The memory watch list and the next watch to check.
+    static CMemoryWatch _watches[CRASH_MONITOR_MAX_WATCHES];
+    static uint8_t _uNextWatch;
+  #endif
+
+  #if CRASH_MONITOR_MAX_HANDLERS > 0
+    // The handler chain, sorted by priority, and the results of running it
+    // during the last crash. The in-progress results live in .noinit so they
+    // survive the reset and are copied out by begin().
+    static CCrashHandler _handlers[CRASH_MONITOR_MAX_HANDLERS];
+    static uint8_t _uHandlerCount;
+    static CHandlerResults _handlerResults;
+    static CHandlerResults _pendingResults;
+    static uint16_t _uPendingResultsMagic;
+  #endif
+
+  #if CRASH_MONITOR_LIVENESS
+    // Liveness mode state. The main loop advances the token and the timer
+    // interrupt counts ticks since it last changed.
+    static bool _bLiveness;
+    static volatile uint8_t _uLivenessToken;
+    static uint8_t _uLastToken;
+    static uint16_t _uStallTicks;
+    static uint16_t _uStallLimit;
+  #endif
+
+  #if CRASH_MONITOR_LATENCY
+    // Latency monitor state, in Timer0 ticks. The address is stored as it was
+    // stacked by the timer interrupt.
+    static bool _bLatency;
+    static uint8_t _uMaxLateTicks;
+    static uint8_t _auMaxLateAddress[PROGRAM_COUNTER_SIZE];
+    static uint16_t _auLatencyHistogram[8];
+  #endif
+
+  #if CRASH_MONITOR_TRACE_ENTRIES > 0
+    // The trace ring and the index of the next entry to write. These live in
+    // .noinit so they are not touched by the C runtime on a reset.
+    static CTraceEntry _traceRing[CRASH_MONITOR_TRACE_ENTRIES];
+    static uint8_t _uTraceHead;
+  #endif
+
   public:
     /**
-     * @brief Initializes the crash monitor.
+     * @brief Initializes the crash monitor. With CRASH_MONITOR_EARLY_BOOT, if
+     * the last reset cut a crash capture short before it was stored, the
+     * capture is stored now.
      * @param baseAddress The address in the EEPROM where crash data should be stored.
      * @param maxEntries The maximum number of crash entries that should be stored
      * in the EEPROM. Storage of EEPROM data will take up sizeof(CCrashMonitorHeader) +
@@ -93,6 +490,16 @@ namespace Watchdog
      */
     static void begin(int baseAddress = 500, int maxEntries = DEFAULT_ENTRIES);
 
+  #if CRASH_MONITOR_EARLY_BOOT
+    /**
+     * @brief Gets the cause of the last reset. This is MCUSR as it was at boot
+     * (or as passed in r2 by Optiboot if CRASH_MONITOR_OPTIBOOT_R2 is set), so
+     * test it with the MCUSR bits (ie. _BV(WDRF) for a watchdog reset).
+     * @return The reset cause flags.
+     */
+    static uint8_t getResetCause();
+  #endif
+
     /**
      * @brief Dumps data to the specified destination.
      * @param destination   Any destination object of type Print (ie. Serial).
@@ -101,6 +508,33 @@ namespace Watchdog
      */
     static void dump(Print &destination, bool onlyIfPresent = true);
 
+    /**
+     * @brief Dumps the raw report storage to the specified destination in a
+     * compact binary format. The output is a 4 byte descriptor ('C', 'M',
+     * format version, sizeof(CCrashReport)) followed by the CCrashMonitorHeader
+     * and each saved CCrashReport exactly as they are stored in EEPROM.
+     * @param destination   Any destination object of type Print (ie. Serial).
+     * @param onlyIfPresent Only attempt to dump if there are saved reports.
+     */
+    static void dumpBinary(Print &destination, bool onlyIfPresent = true);
+
+    /**
+     * @brief Serializes as many saved reports as fit into a buffer, for links
+     * with small packets (ie. LoRa or RS-485). Each entry is the report slot
+     * number, the byte offset into the record and then the CCrashReport bytes
+     * as stored (the same layout as dumpBinary()) from that offset. An entry
+     * runs to the end of the record or the end of the buffer, whichever comes
+     * first, so records that don't fit are split across buffers. Whole records
+     * are read straight from storage into the buffer.
+     * @param buffer The buffer to fill.
+     * @param len    The size of the buffer. Must be at least 3.
+     * @param cursor The position (slot and offset) of the next byte to
+     * serialize. Start at 0 and pass the same variable back in to continue
+     * where the last call left off.
+     * @return The number of bytes written, or 0 when there is nothing left.
+     */
+    static uint8_t serialize(uint8_t *buffer, uint8_t len, uint16_t &cursor);
+
     /**
      * @brief Possible timeout values.
      */
@@ -137,43 +571,329 @@ namespace Watchdog
      */
     static void disableWatchdog();
 
+    /**
+     * @brief Temporarily changes the watchdog timeout for a known long
+     * operation (ie. a flash write or SD card sync) and resets the watchdog. If
+     * the firmware hangs before restore() is called, the report names the
+     * region. Has no effect on the timeout if the watchdog is not enabled.
+     * @param timeout  The timeout to use for the duration of the region.
+     * @param regionId A non-zero ID identifying the region in crash reports.
+     */
+    static void extend(ETimeout timeout, uint8_t regionId);
+
+    /**
+     * @brief Restores the timeout set by enableWatchdog() after a call to
+     * extend() and resets the watchdog.
+     */
+    static void restore();
+
+    /**
+     * @brief Gets the ID of the currently extended region.
+     * @return The region ID, or 0 if no region is extended.
+     */
+    static uint8_t getRegion() { return _uRegion; }
+
+    /**
+     * @brief Gets the current watchdog timeout. While a region is extended,
+     * this is the extended timeout.
+     * @return The current timeout.
+     */
+    static ETimeout getTimeout() { return (ETimeout)_uCurrentTimeout; }
+
     /**
      * @brief Lets the watchdog timer know the program is still alive. Call
      * this before the watchdog timeout elapses to prevent program being aborted.
+     * If the flash check is enabled, this also checks the next chunk of flash.
+     * In liveness mode, this advances the progress token instead of resetting
+     * the watchdog.
      */
     static void iAmAlive();
 
+  #if CRASH_MONITOR_LIVENESS
+    /**
+     * @brief Enables liveness mode. The Timer0 compare B interrupt (about every
+     * 1ms) resets the watchdog, but only while iAmAlive() keeps being called
+     * within stallMs. If the main loop stalls for longer, a ReportType_Stall
+     * report is stored with the main loop address that the timer interrupt
+     * preempted. This gives fast detection of a stuck loop while keeping a
+     * long hardware timeout for interrupt-level hangs. While a region is
+     * extended (see extend()), the timer stops resetting the watchdog and the
+     * extended hardware timeout applies.
+     * @param timeout The hardware watchdog timeout.
+     * @param stallMs The time the main loop may go without calling iAmAlive().
+     */
+    static void enableLivenessMode(ETimeout timeout, uint16_t stallMs);
+
+    /**
+     * @brief Disables liveness mode. The watchdog stays enabled with the
+     * hardware timeout and iAmAlive() resets it directly again.
+     */
+    static void disableLivenessMode();
+
+    /**
+     * @brief Called by the Timer0 compare B interrupt in liveness mode.
+     * @param puProgramAddress The program address stacked by the interrupt.
+     */
+    static void livenessInterruptHandler(uint8_t *puProgramAddress);
+  #endif
+
+  #if CRASH_MONITOR_LATENCY
+    /**
+     * @brief Enables the interrupt latency monitor. The Timer0 compare B
+     * interrupt (about every 1ms) measures how long after the compare match it
+     * got to run, which is how long interrupts were disabled (by cli() or by
+     * another interrupt) when it fired. The worst case is stored with each
+     * crash report, so long interrupts-disabled windows can be found before
+     * they get long enough to cause a hang.
+     */
+    static void enableLatencyMonitor();
+
+    /**
+     * @brief Disables the interrupt latency monitor. The statistics are kept.
+     */
+    static void disableLatencyMonitor();
+
+    /**
+     * @brief Gets the interrupt latency statistics gathered since boot or the
+     * last call to resetLatencyStats().
+     * @param stats Receives the statistics.
+     */
+    static void getLatencyStats(CLatencyStats &stats);
+
+    /**
+     * @brief Clears the interrupt latency statistics.
+     */
+    static void resetLatencyStats();
+
+    /**
+     * @brief Called by the Timer0 compare B interrupt when the latency monitor
+     * is enabled.
+     * @param puProgramAddress The program address stacked by the interrupt.
+     * @param uTimerCount The value of TCNT0 on entry to the interrupt.
+     */
+    static void latencyInterruptHandler(uint8_t *puProgramAddress, uint8_t uTimerCount);
+  #endif
+
+    /**
+     * @brief Enables the incremental flash integrity check. A CRC-16 (poly
+     * 0xA001, init 0xFFFF, as computed by _crc16_update()) is accumulated over
+     * the application flash a chunk at a time on each call to iAmAlive() or
+     * poll(). When a full pass does not match the expected value, a
+     * ReportType_FlashCorrupt report is stored and the check is disabled.
+     * @param expectedCrc The CRC computed over the image at build time. Keep
+     * this value outside of the checked range (ie. in EEPROM or a volatile
+     * global) or the CRC will depend on itself. A plain global is not enough,
+     * since link time optimization can fold it into instructions in .text.
+     * @param length The number of bytes to check starting at address 0. If 0,
+     * everything up to the end of the .text section is checked.
+     * @param chunkSize The number of bytes to check per call. Each byte costs
+     * roughly 30 cycles, so the default of 16 bytes is about 30us at 16MHz.
+     */
+    static void enableFlashCheck(uint16_t expectedCrc, uint32_t length = 0,
+      uint8_t chunkSize = DEFAULT_FLASH_CHUNK);
+
+    /**
+     * @brief Disables the incremental flash integrity check.
+     */
+    static void disableFlashCheck();
+
+    /**
+     * @brief Runs the background checks (the next chunk of the flash check and
+     * the next memory watches) without kicking the watchdog. Use this to run
+     * the checks from places other than iAmAlive().
+     */
+    static void poll();
+
+  #if CRASH_MONITOR_MAX_WATCHES > 0
+    /**
+     * @brief Watches a canary word. Watches are checked round-robin, a few per
+     * call to iAmAlive() or poll() (CRASH_MONITOR_WATCHES_PER_KICK). The first
+     * time the value changes, a ReportType_MemoryCorrupt report is stored with
+     * the address and value, and the watch is removed.
+     * @param address The address of the word to watch.
+     * @param value   The value the word must keep.
+     * @return true if the watch was added; false if the watch list is full.
+     */
+    static bool watchCanary(const volatile void *address, uint16_t value);
+
+    /**
+     * @brief Watches a critical value. Works like watchCanary(), but reports
+     * when the 16-bit value leaves the range minValue to maxValue (inclusive).
+     * @param address  The address of the word to watch.
+     * @param minValue The minimum valid value.
+     * @param maxValue The maximum valid value.
+     * @return true if the watch was added; false if the watch list is full.
+     */
+    static bool watchRange(const volatile void *address, uint16_t minValue, uint16_t maxValue);
+
+    /**
+     * @brief Removes all memory watches.
+     */
+    static void clearWatches();
+  #endif
+
+    /**
+     * @brief Adds an entry to the trace ring. Only the format ID and raw
+     * argument are stored, so this costs tens of cycles. When the watchdog
+     * fires, the ring is saved to EEPROM with the crash report and printed by
+     * dump(), oldest entry first. Does nothing unless
+     * CRASH_MONITOR_TRACE_ENTRIES is defined.
+     * @param formatId A non-zero ID for the format string of the entry.
+     * @param arg      The argument for the format string.
+     */
+  #if CRASH_MONITOR_TRACE_ENTRIES > 0
+    static inline void trace(uint8_t formatId, uint16_t arg) {
+      uint8_t uHead = _uTraceHead & (CRASH_MONITOR_TRACE_ENTRIES - 1);
+      _traceRing[uHead].uFormat = formatId;
+      _traceRing[uHead].uArg = arg;
+      _uTraceHead = uHead + 1;
+    }
+  #else
+    static inline void trace(uint8_t, uint16_t) { }
+  #endif
+
     /**
      * @brief Sets user data to be included in crash report.
      * @param data The data to include.
      */
     static void setData(uint32_t data) { _crashReport.uData = data; }
 
+    /**
+     * @brief Sets the ID of the running firmware build to include in reports,
+     * so crash distributions can be compared between builds.
+     * @param buildId The build ID (ie. a build number or part of a commit hash).
+     */
+    static void setBuildId(uint16_t buildId) { _uBuild = buildId; }
+
     /**
      * @brief Gets the user data being included in the crash report.
      * @return The user data being included in the crash report.
      */
     static uint32_t getData() { return _crashReport.uData; }
 
+    /**
+     * @brief Stores a report without resetting the MCU, ie. for a fault the
+     * firmware detected itself. The user data set with setData() is not
+     * changed. The store runs under the longest watchdog timeout (as region
+     * RECORD_REGION, 255), so the watchdog can't fire in the middle of it.
+     * @param type        The report type.
+     * @param wordAddress The word address to store with the report.
+     * @param data        The data to store with the report.
+     */
+    static void record(EReportType type, uint32_t wordAddress, uint32_t data);
+
     /**
      * @brief Set the program address for the watchdog interrupt handler.
      * @param puProgramAddress The program address.
      */
     static void watchDogInterruptHandler(uint8_t *puProgramAddress);
 
+    /**
+     * @brief Sets a table of outputs to drive to a safe state (ie. heaters and
+     * motors off). This is the first thing the watchdog interrupt does, before
+     * the crash is captured or stored. The worst case latency from the
+     * watchdog firing to the first output write is about 50 cycles (about 3us
+     * at 16MHz), plus any time interrupts were disabled when it fired, and
+     * about 20 cycles for each further table entry.
+     * @param pOutputs The table of outputs. It must stay valid (ie. be static).
+     * @param uCount   The number of entries in the table.
+     */
+    static void setFailSafeOutputs(const CFailSafeOutput *pOutputs, uint8_t uCount);
+
+    /**
+     * @brief Sets a fail-safe handler. If set, this callback is executed by the
+     * watchdog interrupt right after the fail-safe outputs are written and
+     * before the crash is captured or stored. Keep it short.
+     * @param onFailSafe A user callback to execute, or NULL.
+     */
+    static void setFailSafeHandler(void (*onFailSafe)());
+
+    /**
+     * @brief Writes the fail-safe outputs and runs the fail-safe handler.
+     * Called by the interrupt handlers; can also be called directly.
+     */
+    static void failSafe();
+
     /**
      * @brief Sets a user crash event handler. If set, this callback will be executed
      * by the interrupt handler after that crash report is generated and stored.
-     * @param onUserCrashEvent A user callback to execute. If NULL, then the
-     * firmware will simply halt until the board is power-cycled or reset.
+     * @param onUserCrashEvent A user callback to execute. If NULL (or if the
+     * callback returns), the firmware will halt until the watchdog resets the
+     * MCU.
      */
     static void setUserCrashHandler(void (*onUserCrashEvent)());
 
+  #if CRASH_MONITOR_MAX_HANDLERS > 0
+    /**
+     * @brief Adds a crash handler to the chain. After the report is stored,
+     * the handlers run in order of priority within the second stage watchdog
+     * window (about 100ms of the 120ms timeout). Each handler is timed, and a
+     * handler whose budget does not fit in the time left is skipped. A handler
+     * that overruns its budget can't be stopped, but is recorded, and the
+     * handlers after it get correspondingly less time. The handler set with
+     * setUserCrashHandler() runs after the chain.
+     * @param onCrash   The callback.
+     * @param priority  The priority. Lower values run first.
+     * @param budgetMs  The time the handler needs, in milliseconds.
+     * @return The handler ID (0-7), or -1 if the chain is full.
+     */
+    static int8_t addCrashHandler(void (*onCrash)(), uint8_t priority, uint16_t budgetMs);
+
+    /**
+     * @brief Gets the outcome of the handler chain during the crash that
+     * caused the last reset. All zero if the last reset was not a crash.
+     * @return The handler results.
+     */
+    static const CHandlerResults &getHandlerResults() { return _handlerResults; }
+  #endif
+
+    /**
+     * @brief Enables the lifetime crash heatmap. Flash is divided into buckets
+     * of 2^bucketShift bytes, each with a saturating 4-bit counter (two per
+     * byte) that is incremented with a single byte write on every watchdog or
+     * stall report. The heatmap is never overwritten by new reports, so it
+     * keeps hotspots that have rotated out of the report slots.
+     * @param address     The EEPROM address of the heatmap. It takes
+     * getHeatmapSize() bytes and must not overlap the reports.
+     * @param bucketShift The number of address bits per bucket. The default of
+     * 8 (256 byte buckets) fits a 32KB part in 64 bytes.
+     */
+    static void enableHeatmap(int address, uint8_t bucketShift = DEFAULT_HEATMAP_SHIFT);
+
+    /**
+     * @brief Gets the size of the heatmap in bytes.
+     * @return The number of bytes the heatmap takes in EEPROM.
+     */
+    static int getHeatmapSize();
+
+    /**
+     * @brief Dumps the heatmap as a list of hotspots, most frequent first.
+     * @param destination Any destination object of type Print (ie. Serial).
+     */
+    static void dumpHeatmap(Print &destination);
+
+    /**
+     * @brief Resets all heatmap counters to zero.
+     */
+    static void clearHeatmap();
+
     /**
      * @brief Deletes all saved reports from EEPROM.
      */
     static void clear();
 
+    /**
+     * @brief Replaces EEPROM with another storage backend (ie. FRAM or an SD
+     * card). The library always reads a record with the same address and size
+     * it was written with, so block based backends can store one record per
+     * block. Both callbacks may be called from the watchdog interrupt.
+     * @param onRead  Reads uSize bytes at the given address. If NULL, EEPROM
+     * is used.
+     * @param onWrite Writes uSize bytes at the given address. If NULL, EEPROM
+     * is used.
+     */
+    static void setStorage(READFUNC onRead, WRITEFUNC onWrite);
+
     /**
      * @brief Determines whether or not the maximum number of reports have been saved.
      * @return true if the EEPROM storage for crash reports is full; Otherwise;
@@ -182,6 +902,24 @@ namespace Watchdog
     static bool isFull();
 
   private:
+    /**
+     * @brief Enables the watchdog with the specified timeout and the interrupt.
+     * @param timeout The timeout value.
+     */
+    static void setTimeout(uint8_t timeout);
+
+    /**
+     * @brief Gets the longest watchdog timeout the MCU supports.
+     * @return The longest timeout.
+     */
+    static ETimeout getLongestTimeout() {
+    #ifdef WDTO_8S
+      return Timeout_8s;
+    #else
+      return Timeout_2s;
+    #endif
+    }
+
     /**
      * @brief Saves the header to EEPROM.
      * @param reportHeader The crash report header.
@@ -195,10 +933,108 @@ namespace Watchdog
     static void loadHeader(CCrashMonitorHeader &reportHeader);
 
     /**
-     * @brief Saves the current crash report to EEPROM.
+     * @brief Saves a crash report to EEPROM.
      * @param reportSlot The slot to store the report in.
+     * @param report     The report to save.
      */
-    static void saveCurrentReport(int reportSlot);
+    static void saveReport(int reportSlot, const CCrashReport &report);
+
+    /**
+     * @brief Saves a crash report in the next slot and updates the header.
+     * @param report The report to store.
+     */
+    static void storeReport(const CCrashReport &report);
+
+    /**
+     * @brief Sets the address of a report. The address is stored in the same
+     * byte order as it is found on the stack.
+     * @param report       The report to set the address of.
+     * @param uWordAddress The word address to store.
+     */
+    static void setReportAddress(CCrashReport &report, uint32_t uWordAddress);
+
+    /**
+     * @brief Checks the next chunk of flash and stores a report on mismatch.
+     */
+    static void checkFlashChunk();
+
+  #if CRASH_MONITOR_MAX_WATCHES > 0
+    /**
+     * @brief Checks the next memory watches and stores a report on violation.
+     */
+    static void checkWatches();
+  #endif
+
+    /**
+     * @brief Builds a report for the interrupted code, stores it, then waits
+     * for the second watchdog timeout to reset the MCU. Never returns.
+     * @param puProgramAddress The program address stacked by the interrupt.
+     * @param uType            The report type.
+     */
+    static void captureCrash(uint8_t *puProgramAddress, uint8_t uType);
+
+    /**
+     * @brief Finds the stack high-water mark by looking for the first byte
+     * above the heap that is no longer painted.
+     * @return The lowest address the stack has reached, or 0 if unknown.
+     */
+    static uint16_t getStackLow();
+
+  #if CRASH_MONITOR_LIVENESS || CRASH_MONITOR_LATENCY
+    /**
+     * @brief Enables the Timer0 compare B interrupt.
+     */
+    static void startTimerTick();
+
+    /**
+     * @brief Disables the Timer0 compare B interrupt once neither liveness
+     * mode nor the latency monitor needs it.
+     */
+    static void stopTimerTick();
+  #endif
+
+  #if CRASH_MONITOR_LATENCY
+    /**
+     * @brief Converts Timer0 ticks to microseconds.
+     * @param  uTicks The number of ticks.
+     * @return        The time in microseconds.
+     */
+    static uint16_t latencyTicksToMicros(uint8_t uTicks);
+  #endif
+
+    /**
+     * @brief Increments the heatmap counter for a crash address.
+     * @param uByteAddress The byte address of the crash.
+     */
+    static void updateHeatmap(uint32_t uByteAddress);
+
+    /**
+     * @brief Increments the heatmap counter for the address in _crashReport.
+     */
+    static void updateCaptureHeatmap();
+
+    /**
+     * @brief Reads the heatmap counter of a bucket.
+     * @param  uBucket The bucket.
+     * @return         The count (0-15).
+     */
+    static uint8_t getHeatmapCount(uint16_t uBucket);
+
+  #if CRASH_MONITOR_MAX_HANDLERS > 0
+    /**
+     * @brief Runs the handler chain within the second stage window.
+     */
+    static void runCrashHandlers();
+  #endif
+
+  #if CRASH_MONITOR_EARLY_BOOT
+    /**
+     * @brief Computes the check value marking a pending capture as valid.
+     * @param  report The report to check.
+     * @return        The check value.
+     */
+    static uint16_t getPendingCheck(const CCrashReport &report);
+  #endif
 
     /**
      * @brief Loads the crash report from EEPROM.
@@ -214,6 +1050,20 @@ namespace Watchdog
      */
     static int getAddressForReport(int report);
 
+  #if CRASH_MONITOR_TRACE_ENTRIES > 0
+    /**
+     * @brief Gets the EEPROM address of the saved trace. The trace is stored
+     * right after the last report slot.
+     * @return The address of the saved trace.
+     */
+    static int getTraceAddress();
+
+    /**
+     * @brief Saves the trace ring to EEPROM, oldest entry first.
+     */
+    static void saveTrace();
+  #endif
+
     /**
      * @brief Reads a block of data from EEPROM.
      * @param baseAddress The base address to start reading from.
@@ -241,7 +1091,64 @@ namespace Watchdog
     static void printValue(Print &destination, const __FlashStringHelper *pLabel,
       uint32_t uValue, uint8_t uRadix, bool newLine);
 
+    /**
+     * @brief Reads an instruction word from flash.
+     * @param  uByteAddress The byte address of the instruction.
+     * @return              The instruction word.
+     */
+    static uint16_t readOpcode(uint32_t uByteAddress);
+
+    /**
+     * @brief Classifies the code at a crash address by looking for common hang
+     * patterns: a self jump (rjmp .-2), or a short loop (ending in a backward
+     * rjmp or conditional branch) polling an I/O bit with sbis/sbic, polling
+     * the SPI or TWI status registers, or reloading a variable from RAM.
+     * @param  uByteAddress The byte address the watchdog interrupted.
+     * @return              A label for the pattern, or NULL if none matched.
+     */
+    static const __FlashStringHelper *classifyHang(uint32_t uByteAddress);
+
     static STATICFUNC userCrashHandler;
+    static STATICFUNC failSafeHandler;
+    static const CFailSafeOutput *_pFailSafeOutputs;
+    static uint8_t _uFailSafeCount;
+    static READFUNC storageRead;
+    static WRITEFUNC storageWrite;
+  };
+
+  /**
+   * @brief Scoped guard for CrashMonitor::extend(). Extends the timeout for the
+   * lifetime of the guard and puts back the previous timeout and region when
+   * it goes out of scope, so guards can be nested.
+   */
+  class TimeoutExtension
+  {
+  public:
+    /**
+     * @brief Extends the timeout until the guard is destroyed.
+     * @param timeout  The timeout to use for the duration of the region.
+     * @param regionId A non-zero ID identifying the region in crash reports.
+     */
+    TimeoutExtension(CrashMonitor::ETimeout timeout, uint8_t regionId)
+      : _prevTimeout(CrashMonitor::getTimeout()), _uPrevRegion(CrashMonitor::getRegion()) {
+      CrashMonitor::extend(timeout, regionId);
+    }
+
+    /**
+     * @brief Puts back the previous timeout and region.
+     */
+    ~TimeoutExtension() {
+      if (_uPrevRegion != 0) {
+        CrashMonitor::extend(_prevTimeout, _uPrevRegion);
+      }
+      else {
+        CrashMonitor::restore();
+      }
+    }
+
+  private:
+    CrashMonitor::ETimeout _prevTimeout;
+    uint8_t _uPrevRegion;
   };
 }
 #endif
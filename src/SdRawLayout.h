@@ -0,0 +1,133 @@
+/**
+ * SdRawLayout.h
+ * Version 1.4
+ * Author
+ *  Cyrus Brunner
+ *
+ * Maps the logical addresses used by CrashMonitor to SD card blocks for
+ * SdRawStorage, and reads and writes slots through it. This has no Arduino
+ * dependencies so it can be built and tested on a PC.
+ */
+
+#ifndef SdRawLayout_h
+#define SdRawLayout_h
+
+#include <stdint.h>
+#include <string.h>
+
+namespace Watchdog
+{
+  /**
+   * @brief The location of a logical address in the preallocated blocks.
+   */
+  struct CSdRawLocation
+  {
+    /**
+     * @brief The block, relative to the first block of the area.
+     */
+    uint16_t uBlock;
+
+    /**
+     * @brief The byte offset within the block.
+     */
+    uint8_t uOffset;
+  };
+
+  /**
+   * @brief Gets the location of a logical address. CrashMonitor::begin(0)
+   * lays out the header at address 0 followed by one record per report, so
+   * the header gets block 0 and every record-sized stride after it gets the
+   * next block. This way each report (and the trace, which follows the
+   * reports) is a single block write. Anything else (ie. the heatmap) is
+   * packed uRecordSize bytes per block.
+   * @param  address     The logical address (must not be negative).
+   * @param  uHeaderSize The size of the header (sizeof(CCrashMonitorHeader)).
+   * @param  uRecordSize The size of a report (sizeof(CCrashReport)).
+   * @return             The location.
+   */
+  inline CSdRawLocation getSdRawLocation(int address, uint8_t uHeaderSize, uint8_t uRecordSize) {
+    CSdRawLocation location;
+    if (address < uHeaderSize) {
+      location.uBlock = 0;
+      location.uOffset = (uint8_t)address;
+    }
+    else {
+      uint16_t uRecordAddress = (uint16_t)(address - uHeaderSize);
+      location.uBlock = (uint16_t)(1 + (uRecordAddress / uRecordSize));
+      location.uOffset = (uint8_t)(uRecordAddress % uRecordSize);
+    }
+    return location;
+  }
+
+  /**
+   * @brief Reads through the mapping, as SdRawStorage::read() does. TDevice
+   * has readBlock(uBlock, uOffset, puData, uSize), which reads part of a
+   * block, and writeBlock(uBlock, puData, uSize), which writes the start of a
+   * block and fills the rest with zeros.
+   * @param device      The device.
+   * @param uBlockCount The blocks of the area.
+   * @param uHeaderSize The size of the header.
+   * @param uRecordSize The size of a report.
+   * @param address     The logical address. Negative addresses and addresses
+   *                    past the area read 0xff.
+   * @param puData      Receives the data.
+   * @param uSize       The number of bytes (within one slot).
+   */
+  template <class TDevice>
+  void readSdRaw(TDevice &device, uint16_t uBlockCount, uint8_t uHeaderSize, uint8_t uRecordSize, int address,
+                 uint8_t *puData, uint8_t uSize) {
+    memset(puData, 0xff, uSize);
+    if (address < 0) {
+      return;
+    }
+
+    CSdRawLocation location = getSdRawLocation(address, uHeaderSize, uRecordSize);
+    if (location.uBlock >= uBlockCount) {
+      return;
+    }
+    device.readBlock(location.uBlock, location.uOffset, puData, uSize);
+  }
+
+  /**
+   * @brief Writes through the mapping, as SdRawStorage::write() does. A write
+   * of a whole slot (the header, a report or the trace) is a single block
+   * write. Anything smaller (ie. a heatmap byte) reads the slot, changes it
+   * and writes it back, so the rest of the slot is kept. Writes never go past
+   * the end of a slot.
+   * @param device      The device (see readSdRaw()).
+   * @param uBlockCount The blocks of the area.
+   * @param uHeaderSize The size of the header.
+   * @param uRecordSize The size of a report.
+   * @param address     The logical address. Negative addresses and addresses
+   *                    past the area are ignored.
+   * @param puData      The data.
+   * @param uSize       The number of bytes.
+   * @param puSlot      A buffer of uRecordSize (and uHeaderSize) bytes.
+   */
+  template <class TDevice>
+  void writeSdRaw(TDevice &device, uint16_t uBlockCount, uint8_t uHeaderSize, uint8_t uRecordSize, int address,
+                  const uint8_t *puData, uint8_t uSize, uint8_t *puSlot) {
+    if (address < 0) {
+      return;
+    }
+
+    CSdRawLocation location = getSdRawLocation(address, uHeaderSize, uRecordSize);
+    if (location.uBlock >= uBlockCount) {
+      return;
+    }
+
+    uint8_t uSlotSize = (location.uBlock == 0) ? uHeaderSize : uRecordSize;
+    if ((location.uOffset == 0) && (uSize >= uSlotSize)) {
+      device.writeBlock(location.uBlock, puData, uSize);
+      return;
+    }
+
+    device.readBlock(location.uBlock, 0, puSlot, uSlotSize);
+    if (uSize > uSlotSize - location.uOffset) {
+      uSize = uSlotSize - location.uOffset;
+    }
+    memcpy(puSlot + location.uOffset, puData, uSize);
+    device.writeBlock(location.uBlock, puSlot, uSlotSize);
+  }
+}
+#endif
@@ -0,0 +1,248 @@
+/**
+ * SdRawStorage.cpp
+ * Version 1.4
+ * Author
+ *  Cyrus Brunner
+ *
+ * A crash report storage backend that writes records as raw 512 byte blocks to
+ * a preallocated, contiguous file on an SD card using polled SPI.
+ */
+
+#include "SdRawStorage.h"
+#include "SdRawLayout.h"
+#include "ArduinoCrashMonitor.h"
+
+using namespace Watchdog;
+
+// Init static vars
+volatile uint8_t *SdRawStorage::_pCsPort = NULL;
+uint8_t SdRawStorage::_uCsMask = 0;
+uint32_t SdRawStorage::_ulFirstBlock = 0;
+uint16_t SdRawStorage::_uBlockCount = 0;
+bool SdRawStorage::_bBlockAddressing = false;
+bool SdRawStorage::_bReady = false;
+uint8_t SdRawStorage::_uSpcr = _BV(SPE) | _BV(MSTR);
+uint8_t SdRawStorage::_uSpsr = _BV(SPI2X);
+
+uint8_t SdRawStorage::transfer(uint8_t uData) {
+  SPDR = uData;
+  while (!(SPSR & _BV(SPIF))) {
+    ;
+  }
+  return SPDR;
+}
+
+void SdRawStorage::select() {
+  SPCR = SdRawStorage::_uSpcr;
+  SPSR = SdRawStorage::_uSpsr;
+  *SdRawStorage::_pCsPort &= ~SdRawStorage::_uCsMask;
+}
+
+void SdRawStorage::deselect() {
+  *SdRawStorage::_pCsPort |= SdRawStorage::_uCsMask;
+  SdRawStorage::transfer(0xff);
+}
+
+bool SdRawStorage::waitReady() {
+  // These loops can't use millis() since interrupts are disabled when called
+  // from the watchdog interrupt. At 8MHz SPI this is a few hundred ms, which
+  // covers the worst case write busy time of most cards.
+  uint32_t ulTries = 200000UL;
+  while (ulTries--) {
+    if (SdRawStorage::transfer(0xff) == 0xff) {
+      return true;
+    }
+  }
+  return false;
+}
+
+uint8_t SdRawStorage::command(uint8_t uCommand, uint32_t ulArg) {
+  SdRawStorage::waitReady();
+
+  SdRawStorage::transfer(0x40 | uCommand);
+  for (int8_t nShift = 24; nShift >= 0; nShift -= 8) {
+    SdRawStorage::transfer((uint8_t)(ulArg >> nShift));
+  }
+
+  // Only CMD0 and CMD8 need a valid CRC in SPI mode.
+  uint8_t uCrc = 0x01;
+  if (uCommand == CMD_GO_IDLE_STATE) {
+    uCrc = 0x95;
+  }
+  else if (uCommand == CMD_SEND_IF_COND) {
+    uCrc = 0x87;
+  }
+  SdRawStorage::transfer(uCrc);
+
+  uint8_t uResponse = 0xff;
+  for (uint8_t uTry = 0; uTry < 10; ++uTry) {
+    uResponse = SdRawStorage::transfer(0xff);
+    if (!(uResponse & 0x80)) {
+      break;
+    }
+  }
+  return uResponse;
+}
+
+uint32_t SdRawStorage::getCardAddress(uint16_t uBlock) {
+  uint32_t ulBlock = SdRawStorage::_ulFirstBlock + uBlock;
+  return SdRawStorage::_bBlockAddressing ? ulBlock : ulBlock * BLOCK_SIZE;
+}
+
+bool SdRawStorage::begin(uint8_t csPin, uint32_t firstBlock, uint16_t blockCount, bool initCard) {
+  SdRawStorage::_bReady = false;
+  SdRawStorage::_ulFirstBlock = firstBlock;
+  SdRawStorage::_uBlockCount = blockCount;
+  SdRawStorage::_pCsPort = portOutputRegister(digitalPinToPort(csPin));
+  SdRawStorage::_uCsMask = digitalPinToBitMask(csPin);
+
+  // SS must be an output for the SPI peripheral to stay in master mode.
+  pinMode(csPin, OUTPUT);
+  digitalWrite(csPin, HIGH);
+  pinMode(SS, OUTPUT);
+  pinMode(MOSI, OUTPUT);
+  pinMode(SCK, OUTPUT);
+  pinMode(MISO, INPUT);
+
+  uint8_t uResponse;
+  bool bVersion2 = false;
+  if (initCard) {
+    // The card must be initialized at 400kHz or less.
+    SdRawStorage::_uSpcr = _BV(SPE) | _BV(MSTR) | _BV(SPR1) | _BV(SPR0);
+    SdRawStorage::_uSpsr = 0;
+    SPCR = SdRawStorage::_uSpcr;
+    SPSR = SdRawStorage::_uSpsr;
+    for (uint8_t uByte = 0; uByte < 10; ++uByte) {
+      SdRawStorage::transfer(0xff);
+    }
+
+    SdRawStorage::select();
+    unsigned long ulStart = millis();
+    while (SdRawStorage::command(CMD_GO_IDLE_STATE, 0) != R1_IDLE_STATE) {
+      if (millis() - ulStart > 1000) {
+        SdRawStorage::deselect();
+        return false;
+      }
+    }
+
+    uResponse = SdRawStorage::command(CMD_SEND_IF_COND, 0x1aa);
+    if (!(uResponse & R1_ILLEGAL_COMMAND)) {
+      uint8_t uCheck = 0;
+      for (uint8_t uByte = 0; uByte < 4; ++uByte) {
+        uCheck = SdRawStorage::transfer(0xff);
+      }
+      if (uCheck != 0xaa) {
+        SdRawStorage::deselect();
+        return false;
+      }
+      bVersion2 = true;
+    }
+
+    ulStart = millis();
+    do {
+      SdRawStorage::command(CMD_APP_CMD, 0);
+      uResponse = SdRawStorage::command(ACMD_SD_SEND_OP_COND, bVersion2 ? 0x40000000UL : 0);
+      if (millis() - ulStart > 2000) {
+        SdRawStorage::deselect();
+        return false;
+      }
+    } while (uResponse != 0);
+  }
+  else {
+    SdRawStorage::select();
+    bVersion2 = true;
+  }
+
+  // High capacity cards are addressed by block, others by byte.
+  SdRawStorage::_bBlockAddressing = false;
+  if ((bVersion2) && (SdRawStorage::command(CMD_READ_OCR, 0) == 0)) {
+    uint8_t uOcr = SdRawStorage::transfer(0xff);
+    SdRawStorage::_bBlockAddressing = (uOcr & 0x40) != 0;
+    for (uint8_t uByte = 0; uByte < 3; ++uByte) {
+      SdRawStorage::transfer(0xff);
+    }
+  }
+
+  if ((!SdRawStorage::_bBlockAddressing) &&
+      (SdRawStorage::command(CMD_SET_BLOCKLEN, BLOCK_SIZE) != 0)) {
+    SdRawStorage::deselect();
+    return false;
+  }
+
+  SdRawStorage::deselect();
+
+  // Full speed from here on (F_CPU / 2).
+  SdRawStorage::_uSpcr = _BV(SPE) | _BV(MSTR);
+  SdRawStorage::_uSpsr = _BV(SPI2X);
+  SdRawStorage::_bReady = true;
+  return true;
+}
+
+void SdRawStorage::readBlock(uint16_t uBlock, uint8_t uOffset, uint8_t *puData, uint8_t uSize) {
+  SdRawStorage::select();
+  if (SdRawStorage::command(CMD_READ_SINGLE_BLOCK, SdRawStorage::getCardAddress(uBlock)) == 0) {
+    uint16_t uTries = 0xffff;
+    uint8_t uToken = 0xff;
+    while ((uTries--) && (uToken == 0xff)) {
+      uToken = SdRawStorage::transfer(0xff);
+    }
+
+    if (uToken == DATA_START_BLOCK) {
+      // The whole block (and CRC) has to be clocked out, but we only keep what
+      // was asked for.
+      for (uint16_t uByte = 0; uByte < BLOCK_SIZE + 2; ++uByte) {
+        uint8_t uData = SdRawStorage::transfer(0xff);
+        if ((uByte >= uOffset) && (uByte < uOffset + uSize)) {
+          puData[uByte - uOffset] = uData;
+        }
+      }
+    }
+  }
+  SdRawStorage::deselect();
+}
+
+void SdRawStorage::writeBlock(uint16_t uBlock, const uint8_t *puData, uint8_t uSize) {
+  SdRawStorage::select();
+  if (SdRawStorage::command(CMD_WRITE_BLOCK, SdRawStorage::getCardAddress(uBlock)) == 0) {
+    SdRawStorage::transfer(0xff);
+    SdRawStorage::transfer(DATA_START_BLOCK);
+    for (uint16_t uByte = 0; uByte < BLOCK_SIZE; ++uByte) {
+      SdRawStorage::transfer((uByte < uSize) ? puData[uByte] : 0);
+    }
+
+    // Dummy CRC.
+    SdRawStorage::transfer(0xff);
+    SdRawStorage::transfer(0xff);
+
+    if ((SdRawStorage::transfer(0xff) & DATA_RES_MASK) == DATA_RES_ACCEPTED) {
+      // Wait for the card to finish programming before letting go of it.
+      SdRawStorage::waitReady();
+    }
+  }
+  SdRawStorage::deselect();
+}
+
+void SdRawStorage::read(int address, void *pData, uint8_t uSize) {
+  uint8_t *puData = (uint8_t *)pData;
+  if (!SdRawStorage::_bReady) {
+    memset(puData, 0xff, uSize);
+    return;
+  }
+
+  CCard card;
+  readSdRaw(card, SdRawStorage::_uBlockCount, sizeof(CCrashMonitorHeader), sizeof(CCrashReport), address, puData,
+            uSize);
+}
+
+void SdRawStorage::write(int address, const void *pData, uint8_t uSize) {
+  if (!SdRawStorage::_bReady) {
+    return;
+  }
+
+  // Part of a slot (ie. a heatmap byte) is read into auSlot, changed and
+  // written back. The crash monitor never writes across a slot boundary.
+  CCard card;
+  uint8_t auSlot[sizeof(CCrashReport)];
+  writeSdRaw(card, SdRawStorage::_uBlockCount, sizeof(CCrashMonitorHeader), sizeof(CCrashReport), address,
+             (const uint8_t *)pData, uSize, auSlot);
+}
@@ -0,0 +1,165 @@
+/**
+ * SdRawStorage.h
+ * Version 1.4
+ * Author
+ *  Cyrus Brunner
+ *
+ * A crash report storage backend that writes records as raw 512 byte blocks to
+ * a preallocated, contiguous file on an SD card using polled SPI.
+ */
+
+#ifndef SdRawStorage_h
+#define SdRawStorage_h
+
+#include <Arduino.h>
+
+namespace Watchdog
+{
+  /**
+   * @brief SD card storage backend for CrashMonitor. There is no filesystem
+   * code involved, so it is safe to use from the watchdog interrupt. The
+   * header goes in the first block and each report after it in its own block
+   * (see getSdRawLocation()), written as a single raw block padded with zeros.
+   * Use CrashMonitor::begin(0) so the logical addresses start at the first
+   * block of the file, and allow one block per report plus one for the header,
+   * one for the trace and one per sizeof(CCrashReport) heatmap bytes.
+   *
+   * The blocks must be preallocated, ie. with SdFat:
+   *
+   *   file.createContiguous("CRASH.BIN", 512UL * 64);
+   *   SdRawStorage::begin(SD_CS_PIN, file.firstBlock(), 64, false);
+   *   CrashMonitor::setStorage(SdRawStorage::read, SdRawStorage::write);
+   */
+  class SdRawStorage
+  {
+  public:
+    /**
+     * @brief Initializes the backend.
+     * @param csPin      The chip select pin of the SD card.
+     * @param firstBlock The first block of the preallocated area.
+     * @param blockCount The number of blocks in the preallocated area.
+     * @param initCard   Set true to initialize the card. Set false if the card
+     * has already been initialized (ie. by SdFat).
+     * @return true if the card responded; Otherwise, false.
+     */
+    static bool begin(uint8_t csPin, uint32_t firstBlock, uint16_t blockCount, bool initCard = true);
+
+    /**
+     * @brief Reads uSize bytes at an address.
+     * @param address The logical address.
+     * @param pData   The buffer to read into.
+     * @param uSize   The number of bytes to read.
+     */
+    static void read(int address, void *pData, uint8_t uSize);
+
+    /**
+     * @brief Writes uSize bytes at an address. A whole header or report is
+     * written as a block padded with zeros. A partial write (ie. a heatmap
+     * byte) reads the block back first to keep the rest of it.
+     * @param address The logical address.
+     * @param pData   The data to write.
+     * @param uSize   The number of bytes to write.
+     */
+    static void write(int address, const void *pData, uint8_t uSize);
+
+  private:
+    enum EConstants
+    {
+      BLOCK_SIZE = 512,
+      CMD_GO_IDLE_STATE = 0,
+      CMD_SEND_IF_COND = 8,
+      CMD_SET_BLOCKLEN = 16,
+      CMD_READ_SINGLE_BLOCK = 17,
+      CMD_WRITE_BLOCK = 24,
+      CMD_APP_CMD = 55,
+      CMD_READ_OCR = 58,
+      ACMD_SD_SEND_OP_COND = 41,
+      R1_IDLE_STATE = 0x01,
+      R1_ILLEGAL_COMMAND = 0x04,
+      DATA_START_BLOCK = 0xfe,
+      DATA_RES_MASK = 0x1f,
+      DATA_RES_ACCEPTED = 0x05
+    };
+
+    static volatile uint8_t *_pCsPort;
+    static uint8_t _uCsMask;
+    static uint32_t _ulFirstBlock;
+    static uint16_t _uBlockCount;
+    static bool _bBlockAddressing;
+    static bool _bReady;
+    static uint8_t _uSpcr;
+    static uint8_t _uSpsr;
+
+    /**
+     * @brief Selects the card and applies our SPI settings, since the
+     * application may have changed them.
+     */
+    static void select();
+
+    /**
+     * @brief Deselects the card and clocks out one more byte to release MISO.
+     */
+    static void deselect();
+
+    /**
+     * @brief Transfers a byte over SPI.
+     * @param  uData The byte to send.
+     * @return       The byte received.
+     */
+    static uint8_t transfer(uint8_t uData);
+
+    /**
+     * @brief Waits for the card to stop signaling busy.
+     * @return true if the card is ready; Otherwise, false.
+     */
+    static bool waitReady();
+
+    /**
+     * @brief Sends a command to a selected card.
+     * @param  uCommand The command index.
+     * @param  ulArg    The command argument.
+     * @return          The R1 response, or 0xff on timeout.
+     */
+    static uint8_t command(uint8_t uCommand, uint32_t ulArg);
+
+    /**
+     * @brief Gets the card address for a block.
+     * @param  uBlock The block, relative to the first block.
+     * @return        The address to send with a read or write command.
+     */
+    static uint32_t getCardAddress(uint16_t uBlock);
+
+    /**
+     * @brief Reads part of a block.
+     * @param uBlock  The block, relative to the first block.
+     * @param uOffset The offset in the block to start at.
+     * @param puData  The buffer to read into.
+     * @param uSize   The number of bytes to read.
+     */
+    static void readBlock(uint16_t uBlock, uint8_t uOffset, uint8_t *puData, uint8_t uSize);
+
+    /**
+     * @brief Writes a block. The rest of the block is filled with zeros.
+     * @param uBlock The block, relative to the first block.
+     * @param puData The data to write.
+     * @param uSize  The number of bytes to write.
+     */
+    static void writeBlock(uint16_t uBlock, const uint8_t *puData, uint8_t uSize);
+
+    /**
+     * @brief The card, as the device readSdRaw() and writeSdRaw() (see
+     * SdRawLayout.h) read and write blocks through.
+     */
+    struct CCard
+    {
+      void readBlock(uint16_t uBlock, uint8_t uOffset, uint8_t *puData, uint8_t uSize) {
+        SdRawStorage::readBlock(uBlock, uOffset, puData, uSize);
+      }
+
+      void writeBlock(uint16_t uBlock, const uint8_t *puData, uint8_t uSize) {
+        SdRawStorage::writeBlock(uBlock, puData, uSize);
+      }
+    };
+  };
+}
+#endif